@@ -20,6 +20,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <unistd.h>
 #include <dirent.h>
 #include <sys/param.h>
@@ -36,6 +37,7 @@
 #include "sql.h"
 #include "utils.h"
 #include "image_utils.h"
+#include "scanner.h"
 #include "log.h"
 
 static int
@@ -51,20 +53,15 @@ art_cache_exists(const char *orig_path, char **cache_file)
 	return (!access(*cache_file, F_OK));
 }
 
+/* Resize imsrc into cache_file, which is consumed.  Returns the path
+ * written, or NULL. */
 static char *
-save_resized_album_art(image_s *imsrc, const char *path)
+save_resized_to(image_s *imsrc, char *cache_file)
 {
 	int dstw, dsth;
 	image_s *imdst;
-	char *cache_file;
 	char cache_dir[MAXPATHLEN];
 
-	if( !imsrc )
-		return NULL;
-
-	if( art_cache_exists(path, &cache_file) )
-		return cache_file;
-
 	strncpyt(cache_dir, cache_file, sizeof(cache_dir));
 	make_dir(dirname(cache_dir), S_IRWXU|S_IRGRP|S_IXGRP|S_IROTH|S_IXOTH);
 
@@ -91,6 +88,20 @@ save_resized_album_art(image_s *imsrc, const char *path)
 	return cache_file;
 }
 
+static char *
+save_resized_album_art(image_s *imsrc, const char *path)
+{
+	char *cache_file;
+
+	if( !imsrc )
+		return NULL;
+
+	if( art_cache_exists(path, &cache_file) )
+		return cache_file;
+
+	return save_resized_to(imsrc, cache_file);
+}
+
 /* And our main album art functions */
 void
 update_if_album_art(const char *path)
@@ -160,73 +171,122 @@ update_if_album_art(const char *path)
 	closedir(dh);
 }
 
-char *
-check_embedded_art(const char *path, const char *image_data, int image_size)
+/* Embedded art is stored once per distinct image: the cache file is named
+ * after a hash of the image bytes, so every track of an album shares one
+ * resized file and one ALBUM_ART row.  A small LRU of recently seen hashes
+ * resolves repeats without touching the disk or the database. */
+#define ART_LRU_SIZE 32
+
+struct art_lru_s {
+	uint64_t hash;
+	int size;
+	int64_t art_id;		/* 0 if the image couldn't be used */
+	unsigned int stamp;
+};
+
+static struct art_lru_s art_lru[ART_LRU_SIZE];
+static unsigned int art_lru_clock;
+
+static uint64_t
+art_hash(const char *data, int len)
 {
-	int width = 0, height = 0;
-	char *art_path = NULL;
-	char *cache_dir;
-	FILE *dstfile;
-	image_s *imsrc;
-	static char last_path[PATH_MAX];
-	static unsigned int last_hash = 0;
-	static int last_success = 0;
-	unsigned int hash;
+	uint64_t h = 0xcbf29ce484222325ULL ^ (uint64_t)len;
+	uint64_t w;
+	int i;
 
-	if( !image_data || !image_size || !path )
+	for( i = 0; i + 8 <= len; i += 8 )
 	{
-		return NULL;
+		memcpy(&w, data + i, 8);
+		h = (h ^ w) * 0x100000001b3ULL;
+		h ^= h >> 29;
 	}
-	/* If the embedded image matches the embedded image from the last file we
-	 * checked, just make a hard link.  Better than storing it on the disk twice. */
-	hash = DJBHash(image_data, image_size);
-	if( hash == last_hash )
+	for( ; i < len; i++ )
+		h = (h ^ (unsigned char)data[i]) * 0x100000001b3ULL;
+
+	return h ^ (h >> 32);
+}
+
+static struct art_lru_s *
+art_lru_find(uint64_t hash, int size)
+{
+	int i;
+
+	for( i = 0; i < ART_LRU_SIZE; i++ )
 	{
-		if( !last_success )
-			return NULL;
-		art_cache_exists(path, &art_path);
-		if( link(last_path, art_path) == 0 )
-		{
-			return(art_path);
-		}
-		else
+		if( art_lru[i].stamp && art_lru[i].hash == hash && art_lru[i].size == size )
 		{
-			if( errno == ENOENT )
-			{
-				cache_dir = strdup(art_path);
-				make_dir(dirname(cache_dir), S_IRWXU|S_IRGRP|S_IXGRP|S_IROTH|S_IXOTH);
-				free(cache_dir);
-				if( link(last_path, art_path) == 0 )
-					return(art_path);
-			}
-			DPRINTF(E_WARN, L_METADATA, "Linking %s to %s failed [%s]\n", art_path, last_path, strerror(errno));
-			free(art_path);
-			art_path = NULL;
+			art_lru[i].stamp = ++art_lru_clock;
+			return &art_lru[i];
 		}
 	}
-	last_hash = hash;
+
+	return NULL;
+}
+
+static void
+art_lru_add(uint64_t hash, int size, int64_t art_id)
+{
+	struct art_lru_s *victim = &art_lru[0];
+	int i;
+
+	for( i = 1; i < ART_LRU_SIZE && victim->stamp; i++ )
+	{
+		if( art_lru[i].stamp < victim->stamp )
+			victim = &art_lru[i];
+	}
+	victim->hash = hash;
+	victim->size = size;
+	victim->art_id = art_id;
+	victim->stamp = ++art_lru_clock;
+}
+
+static int64_t
+album_art_id(const char *art_path)
+{
+	char *sql;
+	char **result;
+	int cols, rows;
+	int64_t ret = 0;
+
+	sql = sqlite3_mprintf("SELECT ID from ALBUM_ART where PATH = '%q'", art_path);
+	if( (sql_get_table(db, sql, &result, &rows, &cols) == SQLITE_OK) && rows )
+	{
+		ret = strtoll(result[1], NULL, 10);
+	}
+	else
+	{
+		if( sql_exec(db, "INSERT into ALBUM_ART (PATH) VALUES ('%q')", art_path) == SQLITE_OK )
+			ret = sqlite3_last_insert_rowid(db);
+	}
+	sqlite3_free_table(result);
+	sqlite3_free(sql);
+
+	return ret;
+}
+
+/* Decode the embedded image and write it (resized if needed) to art_path,
+ * which is consumed.  Returns the cache file, or NULL if the image is bad. */
+static char *
+save_embedded_art(const char *path, const char *image_data, int image_size, char *art_path)
+{
+	image_s *imsrc;
+	FILE *dstfile;
+	size_t nwritten;
 
 	imsrc = image_new_from_jpeg(NULL, 0, image_data, image_size, 1, ROTATE_NONE);
 	if( !imsrc )
 	{
-		last_success = 0;
+		free(art_path);
 		return NULL;
 	}
-	width = imsrc->width;
-	height = imsrc->height;
+	scan_stats.art_decodes++;
 
-	if( width > 160 || height > 160 )
+	if( imsrc->width > 160 || imsrc->height > 160 )
 	{
-		art_path = save_resized_album_art(imsrc, path);
+		art_path = save_resized_to(imsrc, art_path);
 	}
-	else if( width > 0 && height > 0 )
+	else if( imsrc->width > 0 && imsrc->height > 0 )
 	{
-		size_t nwritten;
-		if( art_cache_exists(path, &art_path) )
-			goto end_art;
-		cache_dir = strdup(art_path);
-		make_dir(dirname(cache_dir), S_IRWXU|S_IRGRP|S_IXGRP|S_IROTH|S_IXOTH);
-		free(cache_dir);
 		dstfile = fopen(art_path, "w");
 		if( !dstfile )
 		{
@@ -242,22 +302,230 @@ check_embedded_art(const char *path, const char *image_data, int image_size)
 			remove(art_path);
 			free(art_path);
 			art_path = NULL;
-			goto end_art;
 		}
 	}
+	else
+	{
+		free(art_path);
+		art_path = NULL;
+	}
 end_art:
 	image_free(imsrc);
-	if( !art_path )
+	if( art_path )
+		DPRINTF(E_DEBUG, L_METADATA, "Found new embedded album art in %s\n", basename((char *)path));
+
+	return art_path;
+}
+
+static int64_t
+find_embedded_art(const char *path, const char *image_data, int image_size)
+{
+	struct art_lru_s *cached;
+	uint64_t hash;
+	char *art_path;
+	char *cache_dir;
+	int64_t ret = 0;
+
+	hash = art_hash(image_data, image_size);
+	cached = art_lru_find(hash, image_size);
+	if( cached )
+	{
+		scan_stats.art_lru_hits++;
+		return cached->art_id;
+	}
+
+	if( asprintf(&art_path, "%s/art_cache/embedded/%016llx-%x.jpg",
+	             db_path, (unsigned long long)hash, image_size) < 0 )
+		return 0;
+	if( access(art_path, F_OK) != 0 )
 	{
+		cache_dir = strdup(art_path);
+		make_dir(dirname(cache_dir), S_IRWXU|S_IRGRP|S_IXGRP|S_IROTH|S_IXOTH);
+		free(cache_dir);
+		art_path = save_embedded_art(path, image_data, image_size, art_path);
+	}
+	if( art_path )
+		ret = album_art_id(art_path);
+	else
 		DPRINTF(E_WARN, L_METADATA, "Invalid embedded album art in %s\n", basename((char *)path));
-		last_success = 0;
+	free(art_path);
+	art_lru_add(hash, image_size, ret);
+
+	return ret;
+}
+
+/* Most directories hold none of the cover art names we probe for, so each
+ * directory is listed once and the candidate names (anything ending in
+ * .jpg, plus the configured album_art_names) are kept in a small hash set.
+ * Probes for names not in the set fail without a syscall.  Names are
+ * matched ignoring case, since on vfat and friends access() finds
+ * Cover.JPG when asked for cover.jpg; a hit is still confirmed with
+ * access().  inotify calls album_art_dir_changed() to drop a snapshot
+ * when its directory changes. */
+#define ART_DIR_SLOTS 4
+
+struct art_dir_s {
+	char *path;
+	size_t path_len;
+	unsigned int stamp;
+	unsigned int mask;	/* bucket count - 1 */
+	uint32_t *buckets;	/* offset+1 into names, 0 if empty */
+	char *names;
+};
+
+static struct art_dir_s art_dirs[ART_DIR_SLOTS];
+static unsigned int art_dir_clock;
+
+static uint32_t
+art_name_hash(const char *name)
+{
+	uint32_t h = 2166136261U;
+
+	while( *name )
+		h = (h ^ (unsigned char)tolower((unsigned char)*name++)) * 16777619U;
+	return h;
+}
+
+static int
+art_name_wanted(const char *name)
+{
+	struct album_art_name_s *album_art_name;
+	size_t len = strlen(name);
+
+	if( len > 4 && strcasecmp(name + len - 4, ".jpg") == 0 )
+		return 1;
+	for( album_art_name = album_art_names; album_art_name; album_art_name = album_art_name->next )
+	{
+		if( strcasecmp(name, album_art_name->name) == 0 )
+			return 1;
+	}
+	return 0;
+}
+
+static void
+art_dir_free(struct art_dir_s *snap)
+{
+	free(snap->path);
+	free(snap->buckets);
+	free(snap->names);
+	memset(snap, 0, sizeof(*snap));
+}
+
+static int
+art_dir_build(struct art_dir_s *snap, const char *dir)
+{
+	struct dirent *e;
+	DIR *dh;
+	char *names = NULL, *p;
+	size_t len = 0, size = 0, n;
+	unsigned int count = 0, nbuckets, i;
+	uint32_t off;
+
+	if( !(dh = opendir(dir)) )
+		return -1;
+	while( (e = readdir(dh)) )
+	{
+		if( !art_name_wanted(e->d_name) )
+			continue;
+		n = strlen(e->d_name) + 1;
+		if( len + n > size )
+		{
+			size = size ? size * 2 : 256;
+			while( len + n > size )
+				size *= 2;
+			if( !(p = realloc(names, size)) )
+				goto fail;
+			names = p;
+		}
+		memcpy(names + len, e->d_name, n);
+		len += n;
+		count++;
+	}
+	closedir(dh);
+	dh = NULL;
+
+	for( nbuckets = 8; nbuckets < count * 2; nbuckets *= 2 )
+		;
+	snap->buckets = calloc(nbuckets, sizeof(uint32_t));
+	if( !snap->buckets || !(snap->path = strdup(dir)) )
+		goto fail;
+	snap->path_len = strlen(dir);
+	snap->mask = nbuckets - 1;
+	snap->names = names;
+	for( off = 0; off < len; off += strlen(names + off) + 1 )
+	{
+		i = art_name_hash(names + off) & snap->mask;
+		while( snap->buckets[i] )
+			i = (i + 1) & snap->mask;
+		snap->buckets[i] = off + 1;
+	}
+	snap->stamp = ++art_dir_clock;
+	return 0;
+fail:
+	if( dh )
+		closedir(dh);
+	free(names);
+	art_dir_free(snap);
+	return -1;
+}
+
+static struct art_dir_s *
+art_dir_get(const char *dir)
+{
+	struct art_dir_s *victim = &art_dirs[0];
+	int i;
+
+	for( i = 0; i < ART_DIR_SLOTS; i++ )
+	{
+		if( art_dirs[i].path && strcmp(art_dirs[i].path, dir) == 0 )
+		{
+			art_dirs[i].stamp = ++art_dir_clock;
+			return &art_dirs[i];
+		}
+		if( art_dirs[i].stamp < victim->stamp )
+			victim = &art_dirs[i];
+	}
+	art_dir_free(victim);
+	if( art_dir_build(victim, dir) != 0 )
 		return NULL;
+	return victim;
+}
+
+/* Like access(file, R_OK), but answers from the directory snapshot when
+ * file lives directly in it. */
+static int
+art_dir_access(struct art_dir_s *snap, const char *file)
+{
+	const char *name;
+	uint32_t i, off;
+
+	if( !snap || strncmp(file, snap->path, snap->path_len) != 0 ||
+	    file[snap->path_len] != '/' )
+		return access(file, R_OK);
+	name = file + snap->path_len + 1;
+	if( strchr(name, '/') )
+		return access(file, R_OK);
+
+	for( i = art_name_hash(name) & snap->mask; (off = snap->buckets[i]); i = (i + 1) & snap->mask )
+	{
+		if( strcasecmp(snap->names + off - 1, name) == 0 )
+			return access(file, R_OK);
 	}
-	DPRINTF(E_DEBUG, L_METADATA, "Found new embedded album art in %s\n", basename((char *)path));
-	last_success = 1;
-	strcpy(last_path, art_path);
+	return -1;
+}
+
+void
+album_art_dir_changed(const char *dir)
+{
+	int i;
 
-	return(art_path);
+	if( !dir )
+		return;
+	for( i = 0; i < ART_DIR_SLOTS; i++ )
+	{
+		if( art_dirs[i].path && strcmp(art_dirs[i].path, dir) == 0 )
+			art_dir_free(&art_dirs[i]);
+	}
 }
 
 static char *
@@ -266,6 +534,7 @@ check_for_album_file(const char *path)
 	char file[MAXPATHLEN];
 	char mypath[MAXPATHLEN];
 	struct album_art_name_s *album_art_name;
+	struct art_dir_s *snap;
 	image_s *imsrc = NULL;
 	int width=0, height=0;
 	char *art_file;
@@ -279,14 +548,16 @@ check_for_album_file(const char *path)
 	if( S_ISDIR(st.st_mode) )
 	{
 		dir = path;
+		snap = art_dir_get(dir);
 		goto check_dir;
 	}
 	strncpyt(mypath, path, sizeof(mypath));
 	dir = dirname(mypath);
+	snap = art_dir_get(dir);
 
 	/* First look for file-specific cover art */
 	snprintf(file, sizeof(file), "%s.cover.jpg", path);
-	ret = access(file, R_OK);
+	ret = art_dir_access(snap, file);
 	if( ret != 0 )
 	{
 		strncpyt(file, path, sizeof(file));
@@ -294,7 +565,7 @@ check_for_album_file(const char *path)
 		if( art_file )
 		{
 			strcpy(art_file, ".jpg");
-			ret = access(file, R_OK);
+			ret = art_dir_access(snap, file);
 		}
 		if( ret != 0 )
 		{
@@ -303,7 +574,7 @@ check_for_album_file(const char *path)
 			{
 				memmove(art_file+2, art_file+1, file+MAXPATHLEN-art_file-2);
 				art_file[1] = '.';
-				ret = access(file, R_OK);
+				ret = art_dir_access(snap, file);
 			}
 		}
 	}
@@ -321,7 +592,7 @@ check_dir:
 	for( album_art_name = album_art_names; album_art_name; album_art_name = album_art_name->next )
 	{
 		snprintf(file, sizeof(file), "%s/%s", dir, album_art_name->name);
-		if( access(file, R_OK) == 0 )
+		if( art_dir_access(snap, file) == 0 )
 		{
 			if( art_cache_exists(file, &art_file) )
 			{
@@ -349,28 +620,15 @@ found_file:
 int64_t
 find_album_art(const char *path, const char *image_data, int image_size)
 {
-	char *album_art = NULL;
-	char *sql;
-	char **result;
-	int cols, rows;
+	char *album_art;
 	int64_t ret = 0;
 
-	if( (image_size && (album_art = check_embedded_art(path, image_data, image_size))) ||
-	    (album_art = check_for_album_file(path)) )
-	{
-		sql = sqlite3_mprintf("SELECT ID from ALBUM_ART where PATH = '%q'", album_art ? album_art : path);
-		if( (sql_get_table(db, sql, &result, &rows, &cols) == SQLITE_OK) && rows )
-		{
-			ret = strtoll(result[1], NULL, 10);
-		}
-		else
-		{
-			if( sql_exec(db, "INSERT into ALBUM_ART (PATH) VALUES ('%q')", album_art) == SQLITE_OK )
-				ret = sqlite3_last_insert_rowid(db);
-		}
-		sqlite3_free_table(result);
-		sqlite3_free(sql);
-	}
+	if( image_size && image_data && path &&
+	    (ret = find_embedded_art(path, image_data, image_size)) )
+		return ret;
+
+	if( (album_art = check_for_album_file(path)) )
+		ret = album_art_id(album_art);
 	free(album_art);
 
 	return ret;
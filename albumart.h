@@ -30,4 +30,7 @@ update_if_album_art(const char *path);
 int64_t
 find_album_art(const char *path, const char *image_data, int image_size);
 
+void
+album_art_dir_changed(const char *dir);
+
 #endif
@@ -203,6 +203,9 @@
 /* Define to 1 if you have the `sendfile' function. */
 #define HAVE_SENDFILE 1
 
+/* Define to 1 if you have the `sendmmsg' function. */
+/* #undef HAVE_SENDMMSG */
+
 /* Define to 1 if you have the `setlocale' function. */
 #define HAVE_SETLOCALE 1
 
@@ -31,7 +31,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <setjmp.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include <jpeglib.h>
 #ifdef HAVE_MACHINE_ENDIAN_H
 #include <machine/endian.h>
@@ -39,16 +43,9 @@
 #include <endian.h>
 #endif
 
-#include "upnpreplyparse.h"
 #include "image_utils.h"
 #include "log.h"
 
-#if __BYTE_ORDER == __LITTLE_ENDIAN
-# define SWAP16(w) ( (((w) >> 8) & 0x00ff) | (((w) << 8) & 0xff00) )
-#else
-# define SWAP16(w) (w)
-#endif
-
 #define JPEG_QUALITY  96
 
 #define COL(red, green, blue) (((red) << 24) | ((green) << 16) | ((blue) << 8) | 0xFF)
@@ -234,171 +231,369 @@ put_pix_alpha_replace(image_s *pimage, int32_t x, int32_t y, pix col)
 		pimage->buf[(y * pimage->width) + x] = col;
 }
 
-int
-image_get_jpeg_resolution(const char * path, int * width, int * height)
-{
-	FILE *img;
-	unsigned char buf[8];
-	uint16_t offset, h, w;
-	int ret = 1;
-	size_t nread;
-	long size;
-	
-
-	img = fopen(path, "r");
-	if( !img )
+/* Single-pass header probe.
+ * The file is mapped once and only the segments that carry what the
+ * scanner stores are touched: SOF for the resolution, the EXIF APP1
+ * for orientation/date/camera/thumbnail, and XMP for a fallback date. */
+#define PROBE_READ_MAX	(256*1024)
+
+static unsigned int
+probe_get16(const unsigned char *p, int le)
+{
+	return le ? (p[0] | (p[1] << 8)) : ((p[0] << 8) | p[1]);
+}
+
+static unsigned int
+probe_get32(const unsigned char *p, int le)
+{
+	return le ? (p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned)p[3] << 24)) :
+	            (((unsigned)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]);
+}
+
+static int
+probe_is_sof(int marker)
+{
+	return (marker >= 0xC0 && marker <= 0xCF &&
+	        marker != 0xC4 && marker != 0xC8 && marker != 0xCC);
+}
+
+/* find the frame size of a JPEG held in memory (used for EXIF thumbnails) */
+static int
+probe_jpeg_sof(const unsigned char *buf, size_t len, int *width, int *height)
+{
+	size_t pos = 2;
+	unsigned int seglen;
+
+	if( len < 4 || buf[0] != 0xFF || buf[1] != 0xD8 )
 		return -1;
+	while( pos + 4 <= len )
+	{
+		if( buf[pos] != 0xFF || buf[pos+1] == 0xFF )
+		{
+			pos++;
+			continue;
+		}
+		if( buf[pos+1] == 0xD9 || buf[pos+1] == 0xDA )
+			break;
+		seglen = probe_get16(buf+pos+2, 0);
+		if( probe_is_sof(buf[pos+1]) && pos + 9 <= len )
+		{
+			*height = probe_get16(buf+pos+5, 0);
+			*width = probe_get16(buf+pos+7, 0);
+			return 0;
+		}
+		if( seglen < 2 )
+			break;
+		pos += 2 + seglen;
+	}
+	return -1;
+}
 
-	fseek(img, 0, SEEK_END);
-	size = ftell(img);
-	rewind(img);
+static void
+probe_exif_string(const unsigned char *tiff, size_t len, const unsigned char *entry,
+                  int le, char *out, size_t outlen)
+{
+	unsigned int count = probe_get32(entry+4, le);
+	const unsigned char *val;
+	size_t n;
 
-	nread = fread(&buf, 2, 1, img);
-	if( (nread < 1) || (buf[0] != 0xFF) || (buf[1] != 0xD8) )
+	if( count <= 4 )
+		val = entry + 8;
+	else
 	{
-		fclose(img);
-		return -1;
+		unsigned int off = probe_get32(entry+8, le);
+		if( off >= len || count > len - off )
+			return;
+		val = tiff + off;
 	}
-	memset(&buf, 0, sizeof(buf));
+	n = strnlen((const char *)val, count);
+	if( n >= outlen )
+		n = outlen - 1;
+	memcpy(out, val, n);
+	out[n] = '\0';
+}
 
-	while( ftell(img) < size )
+/* walk one IFD; returns the offset of the next IFD, or 0 */
+static unsigned int
+probe_exif_ifd(const unsigned char *tiff, size_t len, unsigned int off, int le,
+               int which, unsigned int *exif_ifd, struct image_header *hdr)
+{
+	const unsigned char *e;
+	unsigned int n, i, tag;
+	unsigned int thumb_off = 0, thumb_len = 0;
+
+	/* len >= 8 here; compare against len - x so a hostile off can't wrap */
+	if( off < 8 || off > len - 2 )
+		return 0;
+	n = probe_get16(tiff+off, le);
+	if( n * 12 + 4 > len - 2 - off )
+		return 0;
+	for( i = 0; i < n; i++ )
+	{
+		e = tiff + off + 2 + i * 12;
+		tag = probe_get16(e, le);
+		switch( which )
+		{
+		case 0:	/* IFD0 */
+			if( tag == 0x010F )
+				probe_exif_string(tiff, len, e, le, hdr->make, sizeof(hdr->make));
+			else if( tag == 0x0110 )
+				probe_exif_string(tiff, len, e, le, hdr->model, sizeof(hdr->model));
+			else if( tag == 0x0112 )
+			{
+				switch( probe_get16(e+8, le) )
+				{
+				case 3: hdr->rotate = 180; break;
+				case 6: hdr->rotate = 90; break;
+				case 8: hdr->rotate = 270; break;
+				}
+			}
+			else if( tag == 0x8769 )
+				*exif_ifd = probe_get32(e+8, le);
+			break;
+		case 1:	/* IFD1, the thumbnail */
+			if( tag == 0x0201 )
+				thumb_off = probe_get32(e+8, le);
+			else if( tag == 0x0202 )
+				thumb_len = probe_get32(e+8, le);
+			break;
+		default:	/* Exif sub-IFD */
+			if( tag == 0x9003 )
+				probe_exif_string(tiff, len, e, le, hdr->date, sizeof(hdr->date));
+			else if( tag == 0x9004 && !hdr->date[0] )
+				probe_exif_string(tiff, len, e, le, hdr->date, sizeof(hdr->date));
+			break;
+		}
+	}
+	if( which == 1 && thumb_off && thumb_len && thumb_off < len && thumb_len <= len - thumb_off )
 	{
-		while( nread > 0 && buf[0] != 0xFF && !feof(img) )
-			nread = fread(&buf, 1, 1, img);
+		hdr->thumb_size = thumb_len;
+		probe_jpeg_sof(tiff + thumb_off, thumb_len, &hdr->thumb_width, &hdr->thumb_height);
+	}
+
+	return probe_get32(tiff + off + 2 + n * 12, le);
+}
 
-		while( nread > 0 && buf[0] == 0xFF && !feof(img) )
-			nread = fread(&buf, 1, 1, img);
+static void
+probe_exif(const unsigned char *tiff, size_t len, struct image_header *hdr)
+{
+	unsigned int ifd1, exif_ifd = 0;
+	int le;
+
+	if( len < 8 )
+		return;
+	if( tiff[0] == 'I' && tiff[1] == 'I' )
+		le = 1;
+	else if( tiff[0] == 'M' && tiff[1] == 'M' )
+		le = 0;
+	else
+		return;
+	hdr->exif = 1;
+	ifd1 = probe_exif_ifd(tiff, len, probe_get32(tiff+4, le), le, 0, &exif_ifd, hdr);
+	if( exif_ifd )
+		probe_exif_ifd(tiff, len, exif_ifd, le, 2, NULL, hdr);
+	if( ifd1 )
+		probe_exif_ifd(tiff, len, ifd1, le, 1, NULL, hdr);
+}
+
+/* XMP stores the date either as an element or as an attribute */
+static void
+probe_xmp_date(const unsigned char *xmp, size_t len, struct image_header *hdr)
+{
+	const char *p, *end = (const char *)xmp + len;
+	size_t n = 0;
+
+	p = memmem(xmp, len, "DateTimeOriginal", 16);
+	if( !p )
+		return;
+	p += 16;
+	if( p + 2 < end && p[0] == '=' && (p[1] == '"' || p[1] == '\'') )
+		p += 2;
+	else if( p < end && *p == '>' )
+		p++;
+	else
+		return;
+	while( p + n < end && p[n] != '<' && p[n] != '"' && p[n] != '\'' && n < sizeof(hdr->date) - 1 )
+		n++;
+	memcpy(hdr->date, p, n);
+	hdr->date[n] = '\0';
+}
 
-		if( (buf[0] >= 0xc0) && (buf[0] <= 0xc3) )
+static int
+probe_jpeg(const unsigned char *buf, size_t len, struct image_header *hdr)
+{
+	const unsigned char *xmp = NULL;
+	size_t pos = 2, xmplen = 0;
+	unsigned int seglen;
+	int marker;
+
+	while( pos + 4 <= len )
+	{
+		if( buf[pos] != 0xFF )
+		{
+			pos++;
+			continue;
+		}
+		marker = buf[pos+1];
+		if( marker == 0xFF || marker == 0x01 || marker == 0xD8 ||
+		    (marker >= 0xD0 && marker <= 0xD7) )
+		{
+			pos += (marker == 0xFF) ? 1 : 2;
+			continue;
+		}
+		if( marker == 0xD9 || marker == 0xDA )
+			break;
+		seglen = probe_get16(buf+pos+2, 0);
+		if( seglen < 2 )
+			break;
+		if( probe_is_sof(marker) )
 		{
-			nread = fread(&buf, 7, 1, img);
-			*width = 0;
-			*height = 0;
-			if( nread < 1 )
-				break;
-			memcpy(&h, buf+3, 2);
-			*height = SWAP16(h);
-			memcpy(&w, buf+5, 2);
-			*width = SWAP16(w);
-			ret = 0;
+			if( pos + 9 <= len )
+			{
+				hdr->height = probe_get16(buf+pos+5, 0);
+				hdr->width = probe_get16(buf+pos+7, 0);
+			}
 			break;
 		}
-		else
+		if( marker == 0xE1 && pos + 2 + seglen <= len )
 		{
-			offset = 0;
-			nread = fread(&buf, 2, 1, img);
-			if( nread < 1 )
-				break;
-			memcpy(&offset, buf, 2);
-			offset = SWAP16(offset) - 2;
-			if( fseek(img, offset, SEEK_CUR) == -1 )
-				break;
+			const unsigned char *seg = buf + pos + 4;
+			size_t n = seglen - 2;
+			if( !hdr->exif && n > 6 && memcmp(seg, "Exif\0\0", 6) == 0 )
+				probe_exif(seg + 6, n - 6, hdr);
+			else if( n > 29 && memcmp(seg, "http://ns.adobe.com/xap/1.0/", 29) == 0 )
+			{
+				xmp = seg + 29;
+				xmplen = n - 29;
+			}
 		}
+		pos += 2 + seglen;
 	}
-	fclose(img);
-	return ret;
+	if( !hdr->date[0] && xmp )
+		probe_xmp_date(xmp, xmplen, hdr);
+
+	return (hdr->width && hdr->height) ? 0 : -1;
 }
 
-int
-image_get_jpeg_date_xmp(const char * path, char ** date)
-{
-	FILE *img;
-	unsigned char buf[8];
-	char *data = NULL, *newdata;
-	uint16_t offset;
-	struct NameValueParserData xml;
-	char * exif;
-	int ret = 1;
-	size_t nread;
-
-	img = fopen(path, "r");
-	if( !img )
-		return(-1);
-
-	nread = fread(&buf, 2, 1, img);
-	if( (nread < 1) || (buf[0] != 0xFF) || (buf[1] != 0xD8) )
-	{
-		fclose(img);
-		return(-1);
-	}
-	memset(&buf, 0, sizeof(buf));
+static int
+probe_png(const unsigned char *buf, size_t len, struct image_header *hdr)
+{
+	if( len < 24 || memcmp(buf+12, "IHDR", 4) != 0 )
+		return -1;
+	hdr->width = probe_get32(buf+16, 0);
+	hdr->height = probe_get32(buf+20, 0);
 
-	while( !feof(img) )
-	{
-		while( nread > 0 && buf[0] != 0xFF && !feof(img) )
-			nread = fread(&buf, 1, 1, img);
+	return 0;
+}
 
-		while( nread > 0 && buf[0] == 0xFF && !feof(img) )
-			nread = fread(&buf, 1, 1, img);
+/* descend meta/iprp/ipco and take the largest 'ispe' plus any 'irot' */
+static int
+probe_heif_boxes(const unsigned char *buf, size_t len, int depth, struct image_header *hdr)
+{
+	size_t pos = 0, size;
+	const unsigned char *b;
 
-		if( feof(img) )
+	if( depth > 4 )
+		return -1;
+	while( pos + 8 <= len )
+	{
+		b = buf + pos;
+		size = probe_get32(b, 0);
+		if( size == 0 )
+			size = len - pos;
+		if( size < 8 || size > len - pos )
 			break;
-
-		if( buf[0] == 0xE1 ) // APP1 marker
+		if( memcmp(b+4, "meta", 4) == 0 && size > 12 )
+			probe_heif_boxes(b + 12, size - 12, depth + 1, hdr);
+		else if( memcmp(b+4, "iprp", 4) == 0 || memcmp(b+4, "ipco", 4) == 0 )
+			probe_heif_boxes(b + 8, size - 8, depth + 1, hdr);
+		else if( memcmp(b+4, "ispe", 4) == 0 && size >= 20 )
 		{
-			offset = 0;
-			nread = fread(&buf, 2, 1, img);
-			if( nread < 1 )
-				break;
-			memcpy(&offset, buf, 2);
-			offset = SWAP16(offset) - 2;
-
-			if( offset < 30 )
+			int w = probe_get32(b+12, 0), h = probe_get32(b+16, 0);
+			if( (int64_t)w * h > (int64_t)hdr->width * hdr->height )
 			{
-				fseek(img, offset, SEEK_CUR);
-				continue;
+				hdr->width = w;
+				hdr->height = h;
 			}
+		}
+		else if( memcmp(b+4, "irot", 4) == 0 && size >= 9 )
+			hdr->rotate = (360 - (b[8] & 3) * 90) % 360;
+		pos += size;
+	}
 
-			newdata = realloc(data, 30);
-			if( !newdata )
-				break;
-			data = newdata;
+	return (hdr->width && hdr->height) ? 0 : -1;
+}
 
-			nread = fread(data, 29, 1, img);
-			if( nread < 1 )
-				break;
-			offset -= 29;
-			if( strcmp(data, "http://ns.adobe.com/xap/1.0/") != 0 )
-			{
-				fseek(img, offset, SEEK_CUR);
-				continue;
-			}
+static int
+probe_heif(const unsigned char *buf, size_t len, struct image_header *hdr)
+{
+	if( len < 16 )
+		return -1;
+	if( memcmp(buf+8, "heic", 4) != 0 && memcmp(buf+8, "heix", 4) != 0 &&
+	    memcmp(buf+8, "mif1", 4) != 0 && memcmp(buf+8, "msf1", 4) != 0 )
+		return -1;
 
-			newdata = realloc(data, offset+1);
-			if( !newdata )
-				break;
-			data = newdata;
-			nread = fread(data, offset, 1, img);
-			if( nread < 1 )
-				break;
-
-			ParseNameValue(data, offset, &xml, 0);
-			exif = GetValueFromNameValueList(&xml, "DateTimeOriginal");
-			if( !exif )
-			{
-				ClearNameValueList(&xml);
-				break;
-			}
-			*date = realloc(*date, strlen(exif)+1);
-			strcpy(*date, exif);
-			ClearNameValueList(&xml);
+	return probe_heif_boxes(buf, len, 0, hdr);
+}
 
-			ret = 0;
-			break;
-		}
-		else
+int
+image_probe_header(const char * path, struct image_header * hdr)
+{
+	struct stat st;
+	unsigned char *buf;
+	size_t len;
+	int fd, mapped = 1, ret = -1;
+	ssize_t n;
+
+	memset(hdr, 0, sizeof(*hdr));
+	fd = open(path, O_RDONLY);
+	if( fd < 0 )
+		return -1;
+	if( fstat(fd, &st) != 0 || st.st_size < 16 )
+	{
+		close(fd);
+		return -1;
+	}
+	len = st.st_size;
+	buf = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+	if( buf == MAP_FAILED )
+	{
+		/* fall back to reading just the start of the file */
+		mapped = 0;
+		if( len > PROBE_READ_MAX )
+			len = PROBE_READ_MAX;
+		buf = malloc(len);
+		if( !buf || (n = read(fd, buf, len)) < 16 )
 		{
-			offset = 0;
-			nread = fread(&buf, 2, 1, img);
-			if( nread < 1 )
-				break;
-			memcpy(&offset, buf, 2);
-			offset = SWAP16(offset) - 2;
-			fseek(img, offset, SEEK_CUR);
+			free(buf);
+			close(fd);
+			return -1;
 		}
+		len = n;
 	}
-	fclose(img);
-	free(data);
+	close(fd);
+
+	if( buf[0] == 0xFF && buf[1] == 0xD8 )
+	{
+		hdr->type = IMAGE_TYPE_JPEG;
+		ret = probe_jpeg(buf, len, hdr);
+	}
+	else if( memcmp(buf, "\x89PNG\r\n\x1a\n", 8) == 0 )
+	{
+		hdr->type = IMAGE_TYPE_PNG;
+		ret = probe_png(buf, len, hdr);
+	}
+	else if( memcmp(buf+4, "ftyp", 4) == 0 )
+	{
+		hdr->type = IMAGE_TYPE_HEIF;
+		ret = probe_heif(buf, len, hdr);
+	}
+
+	if( mapped )
+		munmap(buf, st.st_size);
+	else
+		free(buf);
+
 	return ret;
 }
 
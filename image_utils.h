@@ -36,14 +36,30 @@ typedef struct {
 	pix     *buf;
 } image_s;
 
+#define IMAGE_TYPE_JPEG 1
+#define IMAGE_TYPE_PNG  2
+#define IMAGE_TYPE_HEIF 3
+
+/* Everything the scanner needs from an image, gathered in one pass */
+struct image_header {
+	int type;		/* IMAGE_TYPE_*, or 0 if unrecognized */
+	int width;
+	int height;
+	int rotate;		/* clockwise degrees needed for display */
+	int exif;		/* an EXIF block was found */
+	int thumb_size;
+	int thumb_width;
+	int thumb_height;
+	char date[32];		/* DateTimeOriginal, EXIF or XMP form */
+	char make[32];
+	char model[64];
+};
+
 void
 image_free(image_s *pimage);
 
 int
-image_get_jpeg_date_xmp(const char * path, char ** date);
-
-int
-image_get_jpeg_resolution(const char * path, int * width, int * height);
+image_probe_header(const char * path, struct image_header * hdr);
 
 image_s *
 image_new_from_jpeg(const char * path, int is_file, const char * ptr, int size, int scale, int resize);
@@ -46,6 +46,8 @@
 #include "scanner.h"
 #include "metadata.h"
 #include "albumart.h"
+#include "upnpevents.h"
+#include "upnphttp.h"
 #include "playlist.h"
 #include "log.h"
 
@@ -622,7 +624,7 @@ nas_inotify_update_file(const char * path , const char * name,NAS_DIR dir)
 int
 inotify_remove_file(const char * path)
 {
-	char sql[128];
+	char sql[160];
 	char art_cache[PATH_MAX];
 	char *id;
 	char *ptr;
@@ -649,12 +651,14 @@ inotify_remove_file(const char * path)
 		         MUSIC_PLIST_ID, detailID);
 		sql_exec(db, "DELETE from OBJECTS where OBJECT_ID = '%s$%llX' or PARENT_ID = '%s$%llX'",
 		         MUSIC_PLIST_ID, detailID, MUSIC_PLIST_ID, detailID);
+		upnp_event_container_changed(MUSIC_PLIST_ID);
 	}
 	else
 	{
+		mark_containers_updated(detailID);
 		/* Delete the parent containers if we are about to empty them. */
 		snprintf(sql, sizeof(sql), "SELECT PARENT_ID from OBJECTS where DETAIL_ID = %lld"
-		                           " and PARENT_ID not like '64$%%'",
+		                           " and not (PARENT_ID > '" BROWSEDIR_ID "$' and PARENT_ID < '" BROWSEDIR_ID "%%')",
 		                           (long long int)detailID);
 		if( (sql_get_table(db, sql, &result, &rows, NULL) == SQLITE_OK) )
 		{
@@ -678,9 +682,16 @@ inotify_remove_file(const char * path)
 					ptr = strrchr(result[i], '$');
 					if( ptr )
 						*ptr = '\0';
+					upnp_event_container_changed(result[i]);
 					if( sql_get_int_field(db, "SELECT count(*) from OBJECTS where PARENT_ID = '%s'", result[i]) == 0 )
 					{
 						sql_exec(db, "DELETE from OBJECTS where OBJECT_ID = '%s'", result[i]);
+						ptr = strrchr(result[i], '$');
+						if( ptr )
+						{
+							*ptr = '\0';
+							upnp_event_container_changed(result[i]);
+						}
 					}
 				}
 			}
@@ -689,6 +700,7 @@ inotify_remove_file(const char * path)
 		/* Now delete the actual objects */
 		sql_exec(db, "DELETE from DETAILS where ID = %lld", detailID);
 		sql_exec(db, "DELETE from OBJECTS where DETAIL_ID = %lld", detailID);
+		media_cache_invalidate(detailID);
 	}
 	snprintf(art_cache, sizeof(art_cache), "%s/art_cache%s", db_path, path);
 	remove(art_cache);
@@ -700,30 +712,31 @@ int
 inotify_remove_directory(int fd, const char * path)
 {
 	char * sql;
+	char * subtree;
 	char **result;
-	int64_t detailID = 0;
 	int rows, i, ret = 1;
 
 	/* Invalidate the scanner cache so we don't insert files into non-existent containers */
 	valid_cache = 0;
 	remove_watch(fd, path);
-	sql = sqlite3_mprintf("SELECT ID from DETAILS where (PATH > '%q/' and PATH <= '%q/%c')"
-	                      " or PATH = '%q'", path, path, 0xFF, path);
+	/* The whole subtree goes in a few statements, each a range scan on
+	 * the PATH index joined through the DETAIL_ID index. */
+	subtree = sqlite3_mprintf("SELECT ID from DETAILS where (PATH > '%q/' and PATH <= '%q/%c')"
+	                          " or PATH = '%q'", path, path, 0xFF, path);
+	sql = sqlite3_mprintf("SELECT distinct PARENT_ID from OBJECTS where DETAIL_ID in (%s)", subtree);
 	if( (sql_get_table(db, sql, &result, &rows, NULL) == SQLITE_OK) )
 	{
-		if( rows )
-		{
-			for( i=1; i <= rows; i++ )
-			{
-				detailID = strtoll(result[i], NULL, 10);
-				sql_exec(db, "DELETE from DETAILS where ID = %lld", detailID);
-				sql_exec(db, "DELETE from OBJECTS where DETAIL_ID = %lld", detailID);
-			}
-			ret = 0;
-		}
+		for( i=1; i <= rows; i++ )
+			upnp_event_container_changed(result[i]);
 		sqlite3_free_table(result);
 	}
 	sqlite3_free(sql);
+	sql_exec(db, "DELETE from OBJECTS where DETAIL_ID in (%s)", subtree);
+	if( sql_exec(db, "DELETE from DETAILS where ID in (%s)", subtree) == SQLITE_OK &&
+	    sqlite3_changes(db) > 0 )
+		ret = 0;
+	sqlite3_free(subtree);
+	media_cache_flush();
 	/* Clean up any album art entries in the deleted directory */
 	sql_exec(db, "DELETE from ALBUM_ART where (PATH > '%q/' and PATH <= '%q/%c')", path, path, 0xFF);
 
@@ -777,7 +790,7 @@ nas_inotify_remove_directory(int fd, const char * path)
 }
 #endif
 void *
-start_inotify()
+start_inotify(void *main_db)
 {
 	struct pollfd pollfds[1];
 	int timeout = 1000;
@@ -793,12 +806,17 @@ start_inotify()
 	if ( pollfds[0].fd < 0 )
 		DPRINTF(E_ERROR, L_INOTIFY, "inotify_init() failed!\n");
 
+	/* In WAL mode this thread writes through its own connection, so its
+	 * transactions never hold up Browse on the main one. */
+	db = main_db;
 	while( scanning )
 	{
 		if( quitting )
 			goto quitting;
 		sleep(1);
 	}
+	if( GETFLAG(DB_WAL_MASK) )
+		open_db(NULL);
 	inotify_create_watches(pollfds[0].fd);
 	if (setpriority(PRIO_PROCESS, 0, 19) == -1)
 		DPRINTF(E_WARN, L_INOTIFY,  "Failed to reduce inotify thread priority\n");
@@ -835,12 +853,13 @@ start_inotify()
 			struct inotify_event * event = (struct inotify_event *) &buffer[i];
 			if( event->len )
 			{
+				album_art_dir_changed(get_path_from_wd(event->wd));
 				if( *(event->name) == '.' )
 				{
 					i += EVENT_SIZE + event->len;
 					continue;
 				}
-				esc_name = modifyString(strdup(event->name), "&", "&amp;amp;");
+				esc_name = escape_tag(event->name, 1);
 				sprintf(path_buf, "%s/%s", get_path_from_wd(event->wd), event->name);
 				if ( event->mask & IN_ISDIR && (event->mask & (IN_CREATE|IN_MOVED_TO)) )
 				{
@@ -922,6 +941,8 @@ start_inotify()
 	inotify_remove_watches(pollfds[0].fd);
 quitting:
 	close(pollfds[0].fd);
+	if( db != main_db )
+		sqlite3_close(db);
 
 	return 0;
 }
@@ -10,5 +10,5 @@ void
 scan_add_dir(path);
 #endif
 void *
-start_inotify();
+start_inotify(void *main_db);
 #endif
@@ -18,6 +18,7 @@
 #include "config.h"
 
 #include <stdio.h>
+#include <stdarg.h>
 #include <ctype.h>
 #include <string.h>
 #include <stdlib.h>
@@ -27,6 +28,7 @@
 #include <sys/types.h>
 #include <sys/param.h>
 #include <fcntl.h>
+#include <sys/time.h>
 
 #include <libexif/exif-loader.h>
 #include <jpeglib.h>
@@ -39,27 +41,12 @@
 #include "upnpreplyparse.h"
 #include "tivo_utils.h"
 #include "metadata.h"
+#include "scanner.h"
 #include "albumart.h"
 #include "utils.h"
 #include "sql.h"
 #include "log.h"
 
-#define FLAG_TITLE	0x00000001
-#define FLAG_ARTIST	0x00000002
-#define FLAG_ALBUM	0x00000004
-#define FLAG_GENRE	0x00000008
-#define FLAG_COMMENT	0x00000010
-#define FLAG_CREATOR	0x00000020
-#define FLAG_DATE	0x00000040
-#define FLAG_DLNA_PN	0x00000080
-#define FLAG_MIME	0x00000100
-#define FLAG_DURATION	0x00000200
-#define FLAG_RESOLUTION	0x00000400
-#define FLAG_BITRATE	0x00000800
-#define FLAG_FREQUENCY	0x00001000
-#define FLAG_BPS	0x00002000
-#define FLAG_CHANNELS	0x00004000
-#define FLAG_ROTATION	0x00008000
 
 /* Audio profile flags */
 enum audio_profiles {
@@ -76,19 +63,119 @@ enum audio_profiles {
 	PROFILE_AUDIO_AMR
 };
 
-static inline int
+/* Probe limits, smallest first.  Most containers describe their streams in
+ * the first few hundred KB; only fall back to a deeper (and on MKV/TS much
+ * seekier) probe when the codec parameters dlna_pn selection needs are
+ * still missing.  The last tier leaves libav's own defaults in place. */
+static const struct {
+	const char *probesize;
+	const char *analyzeduration;
+} lav_probe_tiers[] = {
+	{ "262144",  "1000000" },
+	{ "4194304", "5000000" },
+	{ NULL,      NULL }
+};
+
+/* Bytes read by this process so far, as accounted by the kernel.  This
+ * covers every read libav issues without needing a custom AVIOContext. */
+static long long
+lav_read_bytes(void)
+{
+	char buf[256], *p;
+	long long rchar = -1;
+	int fd, n;
+
+	fd = open("/proc/self/io", O_RDONLY);
+	if( fd < 0 )
+		return -1;
+	n = read(fd, buf, sizeof(buf)-1);
+	close(fd);
+	if( n <= 0 )
+		return -1;
+	buf[n] = '\0';
+	if( (p = strstr(buf, "rchar:")) )
+		rchar = strtoll(p+6, NULL, 10);
+	return rchar;
+}
+
+#if LIBAVFORMAT_VERSION_INT >= ((53<<16)+(17<<8)+0)
+static int
+lav_probe_complete(AVFormatContext *ctx)
+{
+	int i, have_stream = 0;
+
+	for( i=0; i<ctx->nb_streams; i++ )
+	{
+		AVCodecContext *cc = ctx->streams[i]->codec;
+		switch( cc->codec_type )
+		{
+			case AVMEDIA_TYPE_VIDEO:
+				if( cc->codec_id == CODEC_ID_NONE || !cc->width || !cc->height )
+					return 0;
+				have_stream = 1;
+				break;
+			case AVMEDIA_TYPE_AUDIO:
+				if( cc->codec_id == CODEC_ID_NONE || !cc->sample_rate || !cc->channels )
+					return 0;
+				have_stream = 1;
+				break;
+			default:
+				break;
+		}
+	}
+	/* audio-only files are done once their streams are described too */
+	return have_stream;
+}
+#endif
+
+static int
 lav_open(AVFormatContext **ctx, const char *filename)
 {
 	int ret;
+	struct timeval start, end;
+	long long bytes = lav_read_bytes();
 #if LIBAVFORMAT_VERSION_INT >= ((53<<16)+(17<<8)+0)
-	ret = avformat_open_input(ctx, filename, NULL, NULL);
-	if (ret == 0)
+	AVDictionary *opts;
+	int tier;
+#endif
+
+	gettimeofday(&start, NULL);
+#if LIBAVFORMAT_VERSION_INT >= ((53<<16)+(17<<8)+0)
+	for( tier = 0; ; tier++ )
+	{
+		opts = NULL;
+		if( lav_probe_tiers[tier].probesize )
+		{
+			av_dict_set(&opts, "probesize", lav_probe_tiers[tier].probesize, 0);
+			av_dict_set(&opts, "analyzeduration", lav_probe_tiers[tier].analyzeduration, 0);
+		}
+		ret = avformat_open_input(ctx, filename, NULL, &opts);
+		av_dict_free(&opts);
+		if( ret != 0 )
+			break;
 		avformat_find_stream_info(*ctx, NULL);
+		if( !lav_probe_tiers[tier].probesize || lav_probe_complete(*ctx) )
+			break;
+		avformat_close_input(ctx);
+		scan_stats.probe_retries++;
+	}
 #else
 	ret = av_open_input_file(ctx, filename, NULL, 0, NULL);
 	if (ret == 0)
 		av_find_stream_info(*ctx);
 #endif
+	gettimeofday(&end, NULL);
+
+	if( bytes >= 0 )
+		bytes = lav_read_bytes() - bytes;
+	scan_stats.probe_files++;
+	scan_stats.probe_usec += (end.tv_sec - start.tv_sec) * 1000000LL +
+	                         (end.tv_usec - start.tv_usec);
+	if( bytes > 0 )
+		scan_stats.probe_bytes += bytes;
+	DPRINTF(E_DEBUG, L_METADATA, "Probed %s: %lld bytes in %ld ms\n", filename, bytes,
+	        (long)((end.tv_sec - start.tv_sec) * 1000 + (end.tv_usec - start.tv_usec) / 1000));
+
 	return ret;
 }
 
@@ -194,6 +281,139 @@ no_source_video:
 	free(file);
 }
 
+/* Every string an extractor hangs off metadata_t comes from this bump
+ * arena and is released in one go by meta_reset() once the DETAILS row is
+ * written.  Only one file is extracted at a time per process, so a single
+ * static arena is enough.  The first chunk is kept across resets; anything
+ * larger than a chunk gets its own block. */
+#define META_CHUNK_SIZE 8192
+
+struct meta_chunk {
+	struct meta_chunk *next;
+	size_t size;
+	size_t used;
+	char data[];
+};
+
+static struct {
+	struct meta_chunk *head;	/* current chunk; the tail of the list is the kept one */
+	size_t bytes;			/* bytes handed out since the last reset */
+	unsigned int allocs;
+} meta_arena;
+
+static struct meta_chunk *
+meta_chunk_new(size_t size, struct meta_chunk *next)
+{
+	struct meta_chunk *c;
+
+	c = malloc(sizeof(struct meta_chunk) + size);
+	if( !c )
+	{
+		DPRINTF(E_FATAL, L_METADATA, "Out of memory for metadata arena\n");
+		exit(EXIT_FAILURE);
+	}
+	c->next = next;
+	c->size = size;
+	c->used = 0;
+
+	return c;
+}
+
+static void *
+meta_alloc(size_t len)
+{
+	struct meta_chunk *c = meta_arena.head;
+	void *ret;
+
+	len = (len + 7) & ~(size_t)7;
+	if( !c )
+		c = meta_arena.head = meta_chunk_new(META_CHUNK_SIZE, NULL);
+	if( c->used + len > c->size )
+	{
+		c = meta_chunk_new(len > META_CHUNK_SIZE ? len : META_CHUNK_SIZE, c);
+		meta_arena.head = c;
+	}
+	ret = c->data + c->used;
+	c->used += len;
+	meta_arena.bytes += len;
+	meta_arena.allocs++;
+
+	return ret;
+}
+
+static char *
+meta_strdup(const char *s)
+{
+	size_t len = strlen(s) + 1;
+
+	return memcpy(meta_alloc(len), s, len);
+}
+
+static char *
+meta_asprintf(const char *fmt, ...)
+{
+	char buf[128];
+	va_list ap;
+	int len;
+	char *ret;
+
+	va_start(ap, fmt);
+	len = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	if( len < 0 )
+		return NULL;
+	ret = meta_alloc(len + 1);
+	if( len < (int)sizeof(buf) )
+		return memcpy(ret, buf, len + 1);
+	va_start(ap, fmt);
+	vsnprintf(ret, len + 1, fmt, ap);
+	va_end(ap);
+
+	return ret;
+}
+
+/* Same contract as escape_tag(): NULL if nothing needs escaping and
+ * force_alloc is unset, otherwise an escaped copy in the arena. */
+static char *
+meta_escape(const char *tag, int force_alloc)
+{
+	size_t len, esc_len;
+	char *ret;
+
+	len = strlen(tag);
+	esc_len = xml_escaped_len(tag, len, 1);
+	if( esc_len == len )
+		return force_alloc ? meta_strdup(tag) : NULL;
+
+	ret = meta_alloc(esc_len + 1);
+	xml_escape(ret, tag, len, 1);
+
+	return ret;
+}
+
+static void
+meta_reset(void)
+{
+	struct meta_chunk *c = meta_arena.head;
+
+	if( !c )
+		return;
+	while( c->next )
+	{
+		struct meta_chunk *next = c->next;
+		free(c);
+		c = next;
+	}
+	c->used = 0;
+	meta_arena.head = c;
+
+	scan_stats.meta_allocs += meta_arena.allocs;
+	if( meta_arena.bytes > scan_stats.meta_arena_peak )
+		scan_stats.meta_arena_peak = meta_arena.bytes;
+	meta_arena.bytes = 0;
+	meta_arena.allocs = 0;
+}
+
 void
 parse_nfo(const char *path, metadata_t *m)
 {
@@ -226,10 +446,10 @@ parse_nfo(const char *path, metadata_t *m)
 		val2 = GetValueFromNameValueList(&xml, "episodetitle");
 		if( val2 ) {
 			char *esc_tag2 = unescape_tag(val2, 1);
-			xasprintf(&m->title, "%s - %s", esc_tag, esc_tag2);
+			m->title = meta_asprintf("%s - %s", esc_tag, esc_tag2);
 			free(esc_tag2);
 		} else {
-			m->title = escape_tag(esc_tag, 1);
+			m->title = meta_escape(esc_tag, 1);
 		}
 		free(esc_tag);
 	}
@@ -237,32 +457,30 @@ parse_nfo(const char *path, metadata_t *m)
 	val = GetValueFromNameValueList(&xml, "plot");
 	if( val ) {
 		char *esc_tag = unescape_tag(val, 1);
-		m->comment = escape_tag(esc_tag, 1);
+		m->comment = meta_escape(esc_tag, 1);
 		free(esc_tag);
 	}
 
 	val = GetValueFromNameValueList(&xml, "capturedate");
 	if( val ) {
 		char *esc_tag = unescape_tag(val, 1);
-		m->date = escape_tag(esc_tag, 1);
+		m->date = meta_escape(esc_tag, 1);
 		free(esc_tag);
 	}
 
 	val = GetValueFromNameValueList(&xml, "genre");
 	if( val )
 	{
-		free(m->genre);
 		char *esc_tag = unescape_tag(val, 1);
-		m->genre = escape_tag(esc_tag, 1);
+		m->genre = meta_escape(esc_tag, 1);
 		free(esc_tag);
 	}
 
 	val = GetValueFromNameValueList(&xml, "mime");
 	if( val )
 	{
-		free(m->mime);
 		char *esc_tag = unescape_tag(val, 1);
-		m->mime = escape_tag(esc_tag, 1);
+		m->mime = meta_escape(esc_tag, 1);
 		free(esc_tag);
 	}
 
@@ -270,41 +488,131 @@ parse_nfo(const char *path, metadata_t *m)
 	fclose(nfo);
 }
 
+/* Extracted DETAILS columns are kept in a side database keyed by file
+ * identity, so rebuilding files.db doesn't have to reopen every file.
+ * Bump META_CACHE_VERSION whenever the extraction code changes its output. */
+#define META_CACHE_VERSION 4
+#define META_CACHE_COLS "SIZE, TIMESTAMP, TITLE, DURATION, BITRATE, SAMPLERATE, CREATOR, ARTIST," \
+                        " ALBUM, GENRE, COMMENT, CHANNELS, DISC, TRACK, DATE, RESOLUTION, THUMBNAIL," \
+                        " ROTATION, DLNA_PN, MIME"
+static int meta_cache_ok = 0;
+
+static int
+meta_cache_create(sqlite3 *handle)
+{
+	int ret;
+
+	if( sql_get_int_field(handle, "pragma MC.user_version") == META_CACHE_VERSION )
+		return SQLITE_OK;
+	sql_exec(handle, "DROP TABLE if exists MC.META_CACHE");
+	ret = sql_exec(handle, "CREATE TABLE MC.META_CACHE ("
+	                       "DEV INTEGER, "
+	                       "INODE INTEGER, "
+	                       "PATH TEXT, "
+	                       "EMBEDDED_ART BOOL DEFAULT 0, "
+	                       "SIZE INTEGER, "
+	                       "TIMESTAMP INTEGER, "
+	                       "TITLE TEXT, "
+	                       "DURATION TEXT, "
+	                       "BITRATE INTEGER, "
+	                       "SAMPLERATE INTEGER, "
+	                       "CREATOR TEXT, "
+	                       "ARTIST TEXT, "
+	                       "ALBUM TEXT, "
+	                       "GENRE TEXT, "
+	                       "COMMENT TEXT, "
+	                       "CHANNELS INTEGER, "
+	                       "DISC INTEGER, "
+	                       "TRACK INTEGER, "
+	                       "DATE DATE, "
+	                       "RESOLUTION TEXT, "
+	                       "THUMBNAIL BOOL DEFAULT 0, "
+	                       "ROTATION INTEGER, "
+	                       "DLNA_PN TEXT, "
+	                       "MIME TEXT, "
+	                       "PRIMARY KEY (DEV, INODE))");
+	if( ret == SQLITE_OK )
+		ret = sql_exec(handle, "pragma MC.user_version = %d", META_CACHE_VERSION);
+	return ret;
+}
+
+void
+open_meta_cache(sqlite3 *handle)
+{
+	char path[PATH_MAX];
+
+	meta_cache_ok = 0;
+	snprintf(path, sizeof(path), "%s/meta_cache.db", db_path);
+	if( sql_exec(handle, "ATTACH DATABASE %Q AS MC", path) != SQLITE_OK )
+		return;
+	sql_exec(handle, "pragma MC.journal_mode = OFF");
+	sql_exec(handle, "pragma MC.synchronous = OFF");
+	if( meta_cache_create(handle) != SQLITE_OK )
+	{
+		/* Most likely a torn write; it's only a cache, so start over. */
+		DPRINTF(E_WARN, L_METADATA, "Discarding unusable metadata cache %s\n", path);
+		sql_exec(handle, "DETACH DATABASE MC");
+		unlink(path);
+		if( sql_exec(handle, "ATTACH DATABASE %Q AS MC", path) != SQLITE_OK ||
+		    meta_cache_create(handle) != SQLITE_OK )
+			return;
+	}
+	meta_cache_ok = 1;
+}
+
+/* Drop cache entries for files that didn't turn up in a full scan. */
 void
-free_metadata(metadata_t *m, uint32_t flags)
+prune_meta_cache(void)
+{
+	if( !meta_cache_ok )
+		return;
+	sql_exec(db, "DELETE from MC.META_CACHE where PATH not in"
+	             " (SELECT PATH from DETAILS where PATH not null)");
+}
+
+/* Returns 1 on a usable hit, 2 if the cached entry relied on embedded
+ * album art (which lived in the discarded art_cache), and 0 on a miss. */
+static int
+meta_cache_check(const char *path, const struct stat *st)
+{
+	int ret;
+
+	if( !meta_cache_ok )
+		return 0;
+	ret = sql_get_int_field(db, "SELECT 1+EMBEDDED_ART from MC.META_CACHE"
+	                            " where DEV = %lld and INODE = %lld and SIZE = %lld"
+	                            " and TIMESTAMP = %lld and PATH = %Q",
+	                            (long long)st->st_dev, (long long)st->st_ino,
+	                            (long long)st->st_size, (long long)st->st_mtime, path);
+	if( ret == 1 )
+		scan_stats.meta_cache_hits++;
+	else
+		scan_stats.meta_cache_misses++;
+	return ret;
+}
+
+static int64_t
+meta_cache_fetch(const char *path, const struct stat *st, int64_t album_art)
+{
+	if( sql_exec(db, "INSERT into DETAILS (PATH, ALBUM_ART, " META_CACHE_COLS ")"
+	                 " SELECT PATH, %lld, " META_CACHE_COLS " from MC.META_CACHE"
+	                 " where DEV = %lld and INODE = %lld",
+	                 (long long)album_art, (long long)st->st_dev, (long long)st->st_ino) != SQLITE_OK ||
+	    sqlite3_changes(db) != 1 )
+		return 0;
+	DPRINTF(E_MAXDEBUG, L_METADATA, "Metadata cache hit for %s\n", path);
+	return sqlite3_last_insert_rowid(db);
+}
+
+static void
+meta_cache_store(int64_t detailID, const struct stat *st, int embedded_art)
 {
-	if( flags & FLAG_TITLE )
-		free(m->title);
-	if( flags & FLAG_ARTIST )
-		free(m->artist);
-	if( flags & FLAG_ALBUM )
-		free(m->album);
-	if( flags & FLAG_GENRE )
-		free(m->genre);
-	if( flags & FLAG_CREATOR )
-		free(m->creator);
-	if( flags & FLAG_DATE )
-		free(m->date);
-	if( flags & FLAG_COMMENT )
-		free(m->comment);
-	if( flags & FLAG_DLNA_PN )
-		free(m->dlna_pn);
-	if( flags & FLAG_MIME )
-		free(m->mime);
-	if( flags & FLAG_DURATION )
-		free(m->duration);
-	if( flags & FLAG_RESOLUTION )
-		free(m->resolution);
-	if( flags & FLAG_BITRATE )
-		free(m->bitrate);
-	if( flags & FLAG_FREQUENCY )
-		free(m->frequency);
-	if( flags & FLAG_BPS )
-		free(m->bps);
-	if( flags & FLAG_CHANNELS )
-		free(m->channels);
-	if( flags & FLAG_ROTATION )
-		free(m->rotation);
+	if( !meta_cache_ok || !detailID )
+		return;
+	sql_exec(db, "INSERT OR REPLACE into MC.META_CACHE (DEV, INODE, PATH, EMBEDDED_ART, " META_CACHE_COLS ")"
+	             " SELECT %lld, %lld, PATH, %d, " META_CACHE_COLS " from DETAILS where ID = %lld",
+	             (long long)st->st_dev, (long long)st->st_ino, embedded_art ? 1 : 0,
+	             (long long)detailID);
 }
 
 int64_t
@@ -341,13 +649,15 @@ GetAudioMetadata(const char *path, char *name)
 	int64_t album_art = 0;
 	struct song_metadata song;
 	metadata_t m;
-	uint32_t free_flags = FLAG_MIME|FLAG_DURATION|FLAG_DLNA_PN|FLAG_DATE;
 	memset(&m, '\0', sizeof(metadata_t));
 
 	if ( stat(path, &file) != 0 )
 		return 0;
 
 	strip_ext(name);
+	if( meta_cache_check(path, &file) == 1 &&
+	    (ret = meta_cache_fetch(path, &file, find_album_art(path, NULL, 0))) )
+		return ret;
 #ifdef BAIDU_DMS_OPT
 	if( ends_with(path, ".mp3") || ends_with(path, ".flac") ||
 		ends_with(path, ".wma") || ends_with(path, ".asf")  ||
@@ -360,34 +670,34 @@ GetAudioMetadata(const char *path, char *name)
 	if( ends_with(path, ".mp3") )
 	{
 		strcpy(type, "mp3");
-		m.mime = strdup("audio/mpeg");
+		m.mime = meta_strdup("audio/mpeg");
 	}
 	else if( ends_with(path, ".m4a") || ends_with(path, ".mp4") ||
 	         ends_with(path, ".aac") || ends_with(path, ".m4p") )
 	{
 		strcpy(type, "aac");
-		m.mime = strdup("audio/mp4");
+		m.mime = meta_strdup("audio/mp4");
 	}
 	else if( ends_with(path, ".3gp") )
 	{
 		strcpy(type, "aac");
-		m.mime = strdup("audio/3gpp");
+		m.mime = meta_strdup("audio/3gpp");
 	}
 	else if( ends_with(path, ".wma") || ends_with(path, ".asf") )
 	{
 		strcpy(type, "asf");
-		m.mime = strdup("audio/x-ms-wma");
+		m.mime = meta_strdup("audio/x-ms-wma");
 	}
 	else if( ends_with(path, ".flac") || ends_with(path, ".fla") || ends_with(path, ".flc") )
 	{
 		strcpy(type, "flc");
-		m.mime = strdup("audio/x-flac");
+		m.mime = meta_strdup("audio/x-flac");
 	}
 
 	else if( ends_with(path, ".pcm") )
 	{
 		strcpy(type, "pcm");
-		m.mime = strdup("audio/L16");
+		m.mime = meta_strdup("audio/L16");
 	}
 
 
@@ -403,15 +713,15 @@ GetAudioMetadata(const char *path, char *name)
 	{
 		DPRINTF(E_WARN, L_GENERAL, "Cannot extract tags from %s!\n", path);
         	freetags(&song);
-		free_metadata(&m, free_flags);
+		meta_reset();
 		return 0;
 	}
 
 	if( song.dlna_pn )
-		m.dlna_pn = strdup(song.dlna_pn);
+		m.dlna_pn = meta_strdup(song.dlna_pn);
 	if( song.year )
-		xasprintf(&m.date, "%04d-01-01", song.year);
-	xasprintf(&m.duration, "%d:%02d:%02d.%03d",
+		m.date = meta_asprintf("%04d-01-01", song.year);
+	m.duration = meta_asprintf("%d:%02d:%02d.%03d",
 	                      (song.song_length/3600000),
 	                      (song.song_length/60000%60),
 	                      (song.song_length/1000%60),
@@ -419,9 +729,8 @@ GetAudioMetadata(const char *path, char *name)
 	if( song.title && *song.title )
 	{
 		m.title = trim(song.title);
-		if( (esc_tag = escape_tag(m.title, 0)) )
+		if( (esc_tag = meta_escape(m.title, 0)) )
 		{
-			free_flags |= FLAG_TITLE;
 			m.title = esc_tag;
 		}
 	}
@@ -436,13 +745,11 @@ GetAudioMetadata(const char *path, char *name)
 			m.creator = trim(song.contributor[i]);
 			if( strlen(m.creator) > 48 )
 			{
-				m.creator = strdup("Various Artists");
-				free_flags |= FLAG_CREATOR;
+				m.creator = meta_strdup("Various Artists");
 			}
-			else if( (esc_tag = escape_tag(m.creator, 0)) )
+			else if( (esc_tag = meta_escape(m.creator, 0)) )
 			{
 				m.creator = esc_tag;
-				free_flags |= FLAG_CREATOR;
 			}
 			m.artist = m.creator;
 			break;
@@ -457,40 +764,35 @@ GetAudioMetadata(const char *path, char *name)
 			m.artist = trim(song.contributor[i]);
 			if( strlen(m.artist) > 48 )
 			{
-				m.artist = strdup("Various Artists");
-				free_flags |= FLAG_ARTIST;
+				m.artist = meta_strdup("Various Artists");
 			}
-			else if( (esc_tag = escape_tag(m.artist, 0)) )
+			else if( (esc_tag = meta_escape(m.artist, 0)) )
 			{
 				m.artist = esc_tag;
-				free_flags |= FLAG_ARTIST;
 			}
 		}
 	}
 	if( song.album && *song.album )
 	{
 		m.album = trim(song.album);
-		if( (esc_tag = escape_tag(m.album, 0)) )
+		if( (esc_tag = meta_escape(m.album, 0)) )
 		{
-			free_flags |= FLAG_ALBUM;
 			m.album = esc_tag;
 		}
 	}
 	if( song.genre && *song.genre )
 	{
 		m.genre = trim(song.genre);
-		if( (esc_tag = escape_tag(m.genre, 0)) )
+		if( (esc_tag = meta_escape(m.genre, 0)) )
 		{
-			free_flags |= FLAG_GENRE;
 			m.genre = esc_tag;
 		}
 	}
 	if( song.comment && *song.comment )
 	{
 		m.comment = trim(song.comment);
-		if( (esc_tag = escape_tag(m.comment, 0)) )
+		if( (esc_tag = meta_escape(m.comment, 0)) )
 		{
-			free_flags |= FLAG_COMMENT;
 			m.comment = esc_tag;
 		}
 	}
@@ -524,73 +826,74 @@ GetAudioMetadata(const char *path, char *name)
 	if( ends_with(path, ".ra") )
 	{
 		strcpy(type, "ra");
-		m.mime = strdup("audio/x-pn-realaudio");
+		m.mime = meta_strdup("audio/x-pn-realaudio");
 	}
 	else if( ends_with(path, ".ram") )
 	{
 		strcpy(type, "ra");
-		m.mime = strdup("audio/x-pn-realaudio");
+		m.mime = meta_strdup("audio/x-pn-realaudio");
 	}
 	else if( ends_with(path, ".aac+") )
 	{
 		strcpy(type, "aac+");
-		m.mime = strdup("audio/aacp");
+		m.mime = meta_strdup("audio/aacp");
 	}
 	else if( ends_with(path, ".eaac+") )
 	{
 		strcpy(type, "eaac+");
-		m.mime = strdup("audio/eaacp");
+		m.mime = meta_strdup("audio/eaacp");
 	}
 	else if( ends_with(path, ".amr") )
 	{
 		strcpy(type, "amr");
-		m.mime = strdup("audio/amr");
+		m.mime = meta_strdup("audio/amr");
 	}
 	else if( ends_with(path, ".mid") )
 	{
 		strcpy(type, "mid");
-		m.mime = strdup("audio/mid");
+		m.mime = meta_strdup("audio/mid");
 	}
 	else if( ends_with(path, ".midi") )
 	{
 		strcpy(type, "midi");
-		m.mime = strdup("audio/mid");
+		m.mime = meta_strdup("audio/mid");
 	}
 	else if( ends_with(path, ".mp2") )
 	{
 		strcpy(type, "mp2");
-		m.mime = strdup("audio/mp2");
+		m.mime = meta_strdup("audio/mp2");
 	}
 	else if( ends_with(path, ".aif") )
 	{
 		strcpy(type, "aif");
-		m.mime = strdup("audio/aiff");
+		m.mime = meta_strdup("audio/aiff");
 	}
 	else if( ends_with(path, ".mpega"))
 	{
 		strcpy(type, "mpega");
-		m.mime = strdup("audio/x-mpeg");
+		m.mime = meta_strdup("audio/x-mpeg");
 	}
 	else if( ends_with(path, ".wav") )
 	{
 		strcpy(type, "wav");
-		m.mime = strdup("audio/x-wav");
+		m.mime = meta_strdup("audio/x-wav");
 	}
 	else if( ends_with(path, ".ogg" ))
 	{
 		strcpy(type, "ogg");
-		m.mime = strdup("audio/ogg");
+		m.mime = meta_strdup("audio/ogg");
 	}
 	else
 		{
 			DPRINTF(E_WARN, L_GENERAL, "Unhandled file extension on %s\n", path);
+			meta_reset();
 			return 0;
 		}
 	if( readtags((char *)path, &song, &file, lang, type) != 0 )
 		{
 			DPRINTF(E_WARN, L_GENERAL, "Cannot extract tags from %s!\n", path);
 	        	freetags(&song);
-			free_metadata(&m, free_flags);
+			meta_reset();
 			return 0;
 		}
 	ret = sql_exec(db, "INSERT into DETAILS"
@@ -610,9 +913,10 @@ GetAudioMetadata(const char *path, char *name)
 	else
 	{
 		ret = sqlite3_last_insert_rowid(db);
+		meta_cache_store(ret, &file, song.image_size > 0);
 	}
         freetags(&song);
-	free_metadata(&m, free_flags);
+	meta_reset();
 
 	return ret;
 }
@@ -634,122 +938,70 @@ GetImageMetadata(const char *path, char *name)
 	char full_name[64];
 	snprintf(full_name,sizeof(full_name),"%s",name);
 #endif
-	ExifData *ed;
-	ExifEntry *e = NULL;
-	ExifLoader *l;
+	struct image_header hdr;
 	struct jpeg_decompress_struct cinfo;
 	struct jpeg_error_mgr jerr;
 	FILE *infile;
 	int width=0, height=0, thumb=0;
-	char make[32], model[64] = {'\0'};
-	char b[1024];
+	char model[100];
 	struct stat file;
 	int64_t ret;
-	image_s *imsrc;
 	metadata_t m;
-	uint32_t free_flags = 0xFFFFFFFF;
 	memset(&m, '\0', sizeof(metadata_t));
 	//DEBUG DPRINTF(E_DEBUG, L_METADATA, "Parsing %s...\n", path);
 	if ( stat(path, &file) != 0 )
 		return 0;
 	strip_ext(name);
+	if( meta_cache_check(path, &file) == 1 &&
+	    (ret = meta_cache_fetch(path, &file, 0)) )
+		return ret;
 	//DEBUG DPRINTF(E_DEBUG, L_METADATA, " * size: %jd\n", file.st_size);
 
 	/* MIME hard-coded to JPEG for now, until we add PNG support */
 #ifdef BAIDU_DMS_OPT
 	if( ends_with(path, ".jpg")){
 #endif
-	m.mime = strdup("image/jpeg");
+	m.mime = meta_strdup("image/jpeg");
 
-	l = exif_loader_new();
-	exif_loader_write_file(l, path);
-	ed = exif_loader_get_data(l);
-	exif_loader_unref(l);
-	if( !ed )
-		goto no_exifdata;
+	/* One pass over the headers yields the resolution along with the
+	 * EXIF (or XMP) date, camera, orientation and thumbnail. */
+	image_probe_header(path, &hdr);
+	width = hdr.width;
+	height = hdr.height;
 
-	e = exif_content_get_entry (ed->ifd[EXIF_IFD_EXIF], EXIF_TAG_DATE_TIME_ORIGINAL);
-	if( e || (e = exif_content_get_entry(ed->ifd[EXIF_IFD_EXIF], EXIF_TAG_DATE_TIME_DIGITIZED)) )
+	if( hdr.date[0] && strlen(hdr.date) > 10 )
 	{
-		m.date = strdup(exif_entry_get_value(e, b, sizeof(b)));
-		if( strlen(m.date) > 10 )
-		{
-			m.date[4] = '-';
-			m.date[7] = '-';
-			m.date[10] = 'T';
-		}
-		else {
-			free(m.date);
-			m.date = NULL;
-		}
-	}
-	else {
-		/* One last effort to get the date from XMP */
-		image_get_jpeg_date_xmp(path, &m.date);
+		m.date = meta_strdup(hdr.date);
+		m.date[4] = '-';
+		m.date[7] = '-';
+		m.date[10] = 'T';
 	}
 	//DEBUG DPRINTF(E_DEBUG, L_METADATA, " * date: %s\n", m.date);
 
-	e = exif_content_get_entry(ed->ifd[EXIF_IFD_0], EXIF_TAG_MAKE);
-	if( e )
+	if( hdr.make[0] && hdr.model[0] )
 	{
-		strncpyt(make, exif_entry_get_value(e, b, sizeof(b)), sizeof(make));
-		e = exif_content_get_entry(ed->ifd[EXIF_IFD_0], EXIF_TAG_MODEL);
-		if( e )
-		{
-			strncpyt(model, exif_entry_get_value(e, b, sizeof(b)), sizeof(model));
-			if( !strcasestr(model, make) )
-				snprintf(model, sizeof(model), "%s %s", make, exif_entry_get_value(e, b, sizeof(b)));
-			m.creator = escape_tag(trim(model), 1);
-		}
+		if( !strcasestr(hdr.model, hdr.make) )
+			snprintf(model, sizeof(model), "%s %s", hdr.make, hdr.model);
+		else
+			strncpyt(model, hdr.model, sizeof(model));
+		m.creator = meta_escape(trim(model), 1);
 	}
 	//DEBUG DPRINTF(E_DEBUG, L_METADATA, " * model: %s\n", model);
 
-	e = exif_content_get_entry(ed->ifd[EXIF_IFD_0], EXIF_TAG_ORIENTATION);
-	if( e )
-	{
-		int rotate;
-		switch( exif_get_short(e->data, exif_data_get_byte_order(ed)) )
-		{
-		case 3:
-			rotate = 180;
-			break;
-		case 6:
-			rotate = 90;
-			break;
-		case 8:
-			rotate = 270;
-			break;
-		default:
-			rotate = 0;
-			break;
-		}
-		if( rotate )
-			xasprintf(&m.rotation, "%d", rotate);
-	}
+	if( hdr.rotate )
+		m.rotation = meta_asprintf("%d", hdr.rotate);
 
-	if( ed->size )
+	/* We might need to verify that the thumbnail is 160x160 or smaller */
+	if( hdr.thumb_size )
 	{
-		/* We might need to verify that the thumbnail is 160x160 or smaller */
-		if( ed->size > 12000 )
-		{
-			imsrc = image_new_from_jpeg(NULL, 0, (char *)ed->data, ed->size, 1, ROTATE_NONE);
-			if( imsrc )
-			{
- 				if( (imsrc->width <= 160) && (imsrc->height <= 160) )
-					thumb = 1;
-				image_free(imsrc);
-			}
-		}
-		else
+		if( hdr.thumb_size <= 12000 ||
+		    (hdr.thumb_width && hdr.thumb_width <= 160 && hdr.thumb_height <= 160) )
 			thumb = 1;
 	}
 	//DEBUG DPRINTF(E_DEBUG, L_METADATA, " * thumbnail: %d\n", thumb);
 
-	exif_data_unref(ed);
-
-no_exifdata:
 	/* If SOF parsing fails, then fall through to reading the JPEG data with libjpeg to get the resolution */
-	if( image_get_jpeg_resolution(path, &width, &height) != 0 || !width || !height )
+	if( !width || !height )
 	{
 		infile = fopen(path, "r");
 		if( infile )
@@ -773,16 +1025,16 @@ no_exifdata:
 
 	if( !width || !height )
 	{
-		free_metadata(&m, free_flags);
+		meta_reset();
 		return 0;
 	}
 	if( width <= 640 && height <= 480 )
-		m.dlna_pn = strdup("JPEG_SM");
+		m.dlna_pn = meta_strdup("JPEG_SM");
 	else if( width <= 1024 && height <= 768 )
-		m.dlna_pn = strdup("JPEG_MED");
+		m.dlna_pn = meta_strdup("JPEG_MED");
 	else if( (width <= 4096 && height <= 4096) || !GETFLAG(DLNA_STRICT_MASK) )
-		m.dlna_pn = strdup("JPEG_LRG");
-	xasprintf(&m.resolution, "%dx%d", width, height);
+		m.dlna_pn = meta_strdup("JPEG_LRG");
+	m.resolution = meta_asprintf("%dx%d", width, height);
 #ifdef BAIDU_DMS_OPT
 	ret = sql_exec(db, "INSERT into DETAILS"
 	                   " (PATH, TITLE, SIZE,TIMESTAMP, DATE, RESOLUTION,"
@@ -806,113 +1058,126 @@ no_exifdata:
 	{
 		if(ends_with(path, ".png") )
 		 {
-			m.mime = strdup("image/png");
+			m.mime = meta_strdup("image/png");
 
 		  }
 		else if(ends_with(path, ".gif"))
 		{
-			m.mime = strdup("image/gif");
+			m.mime = meta_strdup("image/gif");
 
 		}
 		else if(ends_with(path, ".jpeg"))
 		{
-			m.mime = strdup("image/jpg");
+			m.mime = meta_strdup("image/jpg");
 
 		}
 		else if(ends_with(path, ".tif"))
 		{
-			m.mime = strdup("image/tiff");
+			m.mime = meta_strdup("image/tiff");
 
 		}
 		else if(ends_with(path, ".tiff"))
 					{
-						m.mime = strdup("image/tiff");
+						m.mime = meta_strdup("image/tiff");
 
 					}
 		else if(ends_with(path, ".ico"))
 				{
-					m.mime = strdup("image/x-icon");
+					m.mime = meta_strdup("image/x-icon");
 
 				}
 		else if(ends_with(path, ".ief"))
 				{
-					m.mime = strdup("image/ief");
+					m.mime = meta_strdup("image/ief");
 
 				}
 		else if(ends_with(path, ".ifm"))
 				{
-					m.mime = strdup("image/gif");
+					m.mime = meta_strdup("image/gif");
 
 				}
 		else if(ends_with(path, ".ifs"))
 				{
-					m.mime = strdup("image/ifs");
+					m.mime = meta_strdup("image/ifs");
 
 				}
 		else if(ends_with(path, ".qti"))
 				{
-					m.mime = strdup("image/x-quicktime");
+					m.mime = meta_strdup("image/x-quicktime");
 
 				}
 		else if(ends_with(path, ".qtif"))
 				{
-					m.mime = strdup("image/x-quicktime");
+					m.mime = meta_strdup("image/x-quicktime");
 
 				}
 		else if(ends_with(path, ".pnm"))
 				{
-					m.mime = strdup("image/x-portable-anymap");
+					m.mime = meta_strdup("image/x-portable-anymap");
 
 				}
 		else if(ends_with(path, ".ppm"))
 				{
-					m.mime = strdup("image/x-portable-pixmap");
+					m.mime = meta_strdup("image/x-portable-pixmap");
 
 				}
 		else if(ends_with(path, ".bmp"))
 				{
-					m.mime = strdup("image/bmp");
+					m.mime = meta_strdup("image/bmp");
 
 				}
 		else if(ends_with(path, ".cur"))
 				{
-					m.mime = strdup("application/octet-stream");
+					m.mime = meta_strdup("application/octet-stream");
 
 				}
 		else if(ends_with(path, ".jpe"))
 				{
-					m.mime = strdup("image/jpeg");
+					m.mime = meta_strdup("image/jpeg");
 
 				}
 		else if(ends_with(path, ".psd"))
 				{
-					m.mime = strdup("application/octet-stream ");
+					m.mime = meta_strdup("application/octet-stream ");
 
 				}
 		else if(ends_with(path, ".svg"))
 				{
-					m.mime = strdup("image/image/svg-xml");
+					m.mime = meta_strdup("image/image/svg-xml");
 
 				}
 		else if(ends_with(path, ".svgz"))
 				{
-					m.mime = strdup("image/svg+xml");
+					m.mime = meta_strdup("image/svg+xml");
 
 				}
+		else if(ends_with(path, ".heic") || ends_with(path, ".heif"))
+		{
+			m.mime = meta_strdup("image/heif");
+		}
 		else
 		{
 			DPRINTF(E_WARN, L_GENERAL, "Unhandled file extension on %s\n", path);
+			meta_reset();
 			return 0;
 		}
 
 
+		/* JPEG, PNG and HEIF headers give the real size and orientation */
+		if( image_probe_header(path, &hdr) == 0 )
+		{
+			m.resolution = meta_asprintf("%dx%d", hdr.width, hdr.height);
+			if( hdr.rotate )
+				m.rotation = meta_asprintf("%d", hdr.rotate);
+		}
 		ret = sql_exec(db, "INSERT into DETAILS"
 		                   " (PATH, TITLE, SIZE, TIMESTAMP, DATE, RESOLUTION,"
 		                    " ROTATION, THUMBNAIL, CREATOR, DLNA_PN, MIME) "
 		                   "VALUES"
 		                   " (%Q, '%q', %lld, %ld, %Q, %Q, %Q, %d, %Q, %Q, %Q);",
-		                   path, full_name, (long long)file.st_size, file.st_mtime ,NULL, "10x10",
-		                   NULL, 0, NULL,NULL, m.mime);
+		                   path, full_name, (long long)file.st_size, file.st_mtime ,NULL,
+		                   m.resolution ? m.resolution : "10x10",
+		                   m.rotation, 0, NULL,NULL, m.mime);
 	}
 #endif
  
@@ -924,8 +1189,9 @@ no_exifdata:
 	else
 	{
 		ret = sqlite3_last_insert_rowid(db);
+		meta_cache_store(ret, &file, 0);
 	}
-	free_metadata(&m, free_flags);
+	meta_reset();
 
 	return ret;
 }
@@ -950,7 +1216,6 @@ GetVideoMetadata(const char *path, char *name)
 	char nfo[MAXPATHLEN], *ext;
 	struct song_metadata video;
 	metadata_t m;
-	uint32_t free_flags = 0xFFFFFFFF;
 	char *path_cpy, *basepath;
 	memset(&m, '\0', sizeof(m));
 	memset(&video, '\0', sizeof(video));
@@ -959,6 +1224,12 @@ GetVideoMetadata(const char *path, char *name)
 	if ( stat(path, &file) != 0 )
 		return 0;
 	strip_ext(name);
+	if( meta_cache_check(path, &file) == 1 &&
+	    (ret = meta_cache_fetch(path, &file, find_album_art(path, NULL, 0))) )
+	{
+		check_for_captions(path, ret);
+		return ret;
+	}
 	//DEBUG DPRINTF(E_DEBUG, L_METADATA, " * size: %jd\n", file.st_size);
 
 	ret = lav_open(&ctx, path);
@@ -1080,13 +1351,13 @@ GetVideoMetadata(const char *path, char *name)
 					DPRINTF(E_DEBUG, L_METADATA, "Unhandled audio codec [0x%X]\n", ac->codec_id);
 				break;
 		}
-		xasprintf(&m.frequency, "%u", ac->sample_rate);
+		m.frequency = meta_asprintf("%u", ac->sample_rate);
 		#if LIBAVCODEC_VERSION_INT < (52<<16)
-		xasprintf(&m.bps, "%u", ac->bits_per_sample);
+		m.bps = meta_asprintf("%u", ac->bits_per_sample);
 		#else
-		xasprintf(&m.bps, "%u", ac->bits_per_coded_sample);
+		m.bps = meta_asprintf("%u", ac->bits_per_coded_sample);
 		#endif
-		xasprintf(&m.channels, "%u", ac->channels);
+		m.channels = meta_asprintf("%u", ac->channels);
 	}
 	if( vc )
 	{
@@ -1094,23 +1365,23 @@ GetVideoMetadata(const char *path, char *name)
 		int duration, hours, min, sec, ms;
 		ts_timestamp_t ts_timestamp = NONE;
 		DPRINTF(E_DEBUG, L_METADATA, "Container: '%s' [%s]\n", ctx->iformat->name, basepath);
-		xasprintf(&m.resolution, "%dx%d", vc->width, vc->height);
+		m.resolution = meta_asprintf("%dx%d", vc->width, vc->height);
 		if( ctx->bit_rate > 8 )
-			xasprintf(&m.bitrate, "%u", ctx->bit_rate / 8);
+			m.bitrate = meta_asprintf("%u", ctx->bit_rate / 8);
 		if( ctx->duration > 0 ) {
 			duration = (int)(ctx->duration / AV_TIME_BASE);
 			hours = (int)(duration / 3600);
 			min = (int)(duration / 60 % 60);
 			sec = (int)(duration % 60);
 			ms = (int)(ctx->duration / (AV_TIME_BASE/1000) % 1000);
-			xasprintf(&m.duration, "%d:%02d:%02d.%03d", hours, min, sec, ms);
+			m.duration = meta_asprintf("%d:%02d:%02d.%03d", hours, min, sec, ms);
 		}
 
 		/* NOTE: The DLNA spec only provides for ASF (WMV), TS, PS, and MP4 containers.
 		 * Skip DLNA parsing for everything else. */
 		if( strcmp(ctx->iformat->name, "avi") == 0 )
 		{
-			xasprintf(&m.mime, "video/x-msvideo");
+			m.mime = meta_asprintf("video/x-msvideo");
 			if( vc->codec_id == CODEC_ID_MPEG4 )
 			{
         			fourcc[0] = vc->codec_tag     & 0xff;
@@ -1120,50 +1391,50 @@ GetVideoMetadata(const char *path, char *name)
 				if( memcmp(fourcc, "XVID", 4) == 0 ||
 				    memcmp(fourcc, "DX50", 4) == 0 ||
 				    memcmp(fourcc, "DIVX", 4) == 0 )
-					xasprintf(&m.creator, "DiVX");
+					m.creator = meta_asprintf("DiVX");
 			}
 		}
 		else if( strcmp(ctx->iformat->name, "mov,mp4,m4a,3gp,3g2,mj2") == 0 &&
 		         ends_with(path, ".mov") )
-			xasprintf(&m.mime, "video/quicktime");
+			m.mime = meta_asprintf("video/quicktime");
 		else if( strncmp(ctx->iformat->name, "matroska", 8) == 0 )
-			xasprintf(&m.mime, "video/x-matroska");
+			m.mime = meta_asprintf("video/x-matroska");
 		else if( strcmp(ctx->iformat->name, "flv") == 0 )
-			xasprintf(&m.mime, "video/x-flv");
+			m.mime = meta_asprintf("video/x-flv");
 #ifdef BAIDU_DMS_OPT
                 else if( strcmp(ctx->iformat->name, "rm") == 0 )
-                        xasprintf(&m.mime, "video/x-pn-realvideo");
+                        m.mime = meta_asprintf("video/x-pn-realvideo");
                 else if(ends_with(path, ".swf") )
 				 {
-					m.mime = strdup("application/x-shockwave-flash");
+					m.mime = meta_strdup("application/x-shockwave-flash");
 
 				  }
                 else if( strcmp(ctx->iformat->name, "mpeg4") == 0 )
-                        xasprintf(&m.mime, "video/mpeg4");
+                        m.mime = meta_asprintf("video/mpeg4");
                 else if( strcmp(ctx->iformat->name, ".wmx") == 0 )
-                        xasprintf(&m.mime, "video/x-ms-wmx");
+                        m.mime = meta_asprintf("video/x-ms-wmx");
                 else if( strcmp(ctx->iformat->name, "rmvb") == 0 )
-                        xasprintf(&m.mime, "application/vnd.rn-realmedia-vbr");
+                        m.mime = meta_asprintf("application/vnd.rn-realmedia-vbr");
                 else if( strcmp(ctx->iformat->name, ".wm") == 0 )
-                        xasprintf(&m.mime, "video/x-ms-wm");
+                        m.mime = meta_asprintf("video/x-ms-wm");
                 else if( strcmp(ctx->iformat->name, ".mpeg") == 0 )
-                        xasprintf(&m.mime, "video/mpg");
+                        m.mime = meta_asprintf("video/mpg");
                 else if( strcmp(ctx->iformat->name, ".mpeg2") == 0 )
-                        xasprintf(&m.mime, "video/mpg");
+                        m.mime = meta_asprintf("video/mpg");
                 else if( strcmp(ctx->iformat->name, ".mpga") == 0 )
-                        xasprintf(&m.mime, "audio/rn-mpeg");
+                        m.mime = meta_asprintf("audio/rn-mpeg");
                 else if( strcmp(ctx->iformat->name, ".qt") == 0 )
-                        xasprintf(&m.mime, "video/quicktime");
+                        m.mime = meta_asprintf("video/quicktime");
                 else if( strcmp(ctx->iformat->name, ".wmz") == 0 )
-                        xasprintf(&m.mime, "application/x-ms-wmz");
+                        m.mime = meta_asprintf("application/x-ms-wmz");
                 else if( strcmp(ctx->iformat->name, ".wmd") == 0 )
-                        xasprintf(&m.mime, "application/x-ms-wmd");
+                        m.mime = meta_asprintf("application/x-ms-wmd");
                 else if( strcmp(ctx->iformat->name, ".f4v") == 0 )
-                        xasprintf(&m.mime, "video/mp4");
+                        m.mime = meta_asprintf("video/mp4");
                 else if( strcmp(ctx->iformat->name, ".ts") == 0 )
-                        xasprintf(&m.mime, "application/x-troll-ts");
+                        m.mime = meta_asprintf("application/x-troll-ts");
                 else if( strcmp(ctx->iformat->name, ".wvx") == 0 )
-                        xasprintf(&m.mime, "video/x-ms-wvx");
+                        m.mime = meta_asprintf("video/x-ms-wvx");
 #endif
 		if( m.mime )
 			goto video_no_dlna;
@@ -1176,13 +1447,13 @@ GetVideoMetadata(const char *path, char *name)
 					if( (vc->width  == 352) &&
 					    (vc->height <= 288) )
 					{
-						m.dlna_pn = strdup("MPEG1");
+						m.dlna_pn = meta_strdup("MPEG1");
 					}
-					xasprintf(&m.mime, "video/mpeg");
+					m.mime = meta_asprintf("video/mpeg");
 				}
 				break;
 			case CODEC_ID_MPEG2VIDEO:
-				m.dlna_pn = malloc(64);
+				m.dlna_pn = meta_alloc(64);
 				off = sprintf(m.dlna_pn, "MPEG_");
 				if( strcmp(ctx->iformat->name, "mpegts") == 0 )
 				{
@@ -1216,20 +1487,19 @@ GetVideoMetadata(const char *path, char *name)
 					{
 						DPRINTF(E_DEBUG, L_METADATA, "Unsupported DLNA TS packet size [%d] (%s)\n",
 							raw_packet_size, basepath);
-						free(m.dlna_pn);
 						m.dlna_pn = NULL;
 					}
 					switch( ts_timestamp )
 					{
 						case NONE:
-							xasprintf(&m.mime, "video/mpeg");
+							m.mime = meta_asprintf("video/mpeg");
 							if( m.dlna_pn )
 								off += sprintf(m.dlna_pn+off, "_ISO");
 							break;
 						case VALID:
 							off += sprintf(m.dlna_pn+off, "_T");
 						case EMPTY:
-							xasprintf(&m.mime, "video/vnd.dlna.mpeg-tts");
+							m.mime = meta_asprintf("video/vnd.dlna.mpeg-tts");
 						default:
 							break;
 					}
@@ -1244,18 +1514,17 @@ GetVideoMetadata(const char *path, char *name)
 						off += sprintf(m.dlna_pn+off, "PAL");
 					else
 						off += sprintf(m.dlna_pn+off, "NTSC");
-					xasprintf(&m.mime, "video/mpeg");
+					m.mime = meta_asprintf("video/mpeg");
 				}
 				else
 				{
 					DPRINTF(E_DEBUG, L_METADATA, "Stream %d of %s [%s] is %s non-DLNA MPEG2\n",
 						video_stream, basepath, ctx->iformat->name, m.resolution);
-					free(m.dlna_pn);
 					m.dlna_pn = NULL;
 				}
 				break;
 			case CODEC_ID_H264:
-				m.dlna_pn = malloc(128);
+				m.dlna_pn = meta_alloc(128);
 				off = sprintf(m.dlna_pn, "AVC_");
 
 				if( strcmp(ctx->iformat->name, "mpegts") == 0 )
@@ -1349,7 +1618,6 @@ GetVideoMetadata(const char *path, char *name)
 							{
 								DPRINTF(E_DEBUG, L_METADATA, "Unsupported h.264 video profile! [%s, %dx%d, %dbps : %s]\n",
 									m.dlna_pn, vc->width, vc->height, vc->bit_rate, basepath);
-								free(m.dlna_pn);
 								m.dlna_pn = NULL;
 							}
 							break;
@@ -1366,7 +1634,6 @@ GetVideoMetadata(const char *path, char *name)
 							{
 								DPRINTF(E_DEBUG, L_METADATA, "Unsupported h.264 HP video profile! [%dbps, %d audio : %s]\n",
 									vc->bit_rate, audio_profile, basepath);
-								free(m.dlna_pn);
 								m.dlna_pn = NULL;
 							}
 							break;
@@ -1390,7 +1657,6 @@ GetVideoMetadata(const char *path, char *name)
 						default:
 							DPRINTF(E_DEBUG, L_METADATA, "No DLNA profile found for %s file [%s]\n",
 								m.dlna_pn, basepath);
-							free(m.dlna_pn);
 							m.dlna_pn = NULL;
 							break;
 					}
@@ -1408,7 +1674,6 @@ GetVideoMetadata(const char *path, char *name)
 					{
 						DPRINTF(E_DEBUG, L_METADATA, "Unsupported DLNA TS packet size [%d] (%s)\n",
 							raw_packet_size, basepath);
-						free(m.dlna_pn);
 						m.dlna_pn = NULL;
 					}
 					switch( ts_timestamp )
@@ -1420,7 +1685,7 @@ GetVideoMetadata(const char *path, char *name)
 						case VALID:
 							off += sprintf(m.dlna_pn+off, "_T");
 						case EMPTY:
-							xasprintf(&m.mime, "video/vnd.dlna.mpeg-tts");
+							m.mime = meta_asprintf("video/vnd.dlna.mpeg-tts");
 						default:
 							break;
 					}
@@ -1537,7 +1802,6 @@ GetVideoMetadata(const char *path, char *name)
 						{
 							DPRINTF(E_DEBUG, L_METADATA, "No DLNA profile found for %s file %s\n",
 								m.dlna_pn, basepath);
-							free(m.dlna_pn);
 							m.dlna_pn = NULL;
 						}
 						break;
@@ -1553,14 +1817,12 @@ GetVideoMetadata(const char *path, char *name)
 					default:
 						DPRINTF(E_DEBUG, L_METADATA, "AVC profile [%d] not recognized for file %s\n",
 							vc->profile, basepath);
-						free(m.dlna_pn);
 						m.dlna_pn = NULL;
 						break;
 					}
 				}
 				else
 				{
-					free(m.dlna_pn);
 					m.dlna_pn = NULL;
 				}
 				DPRINTF(E_DEBUG, L_METADATA, "Stream %d of %s is h.264\n", video_stream, basepath);
@@ -1580,12 +1842,12 @@ GetVideoMetadata(const char *path, char *name)
 
 				if( strcmp(ctx->iformat->name, "mov,mp4,m4a,3gp,3g2,mj2") == 0 )
 				{
-					m.dlna_pn = malloc(128);
+					m.dlna_pn = meta_alloc(128);
 					off = sprintf(m.dlna_pn, "MPEG4_P2_");
 
 					if( ends_with(path, ".3gp") )
 					{
-						xasprintf(&m.mime, "video/3gpp");
+						m.mime = meta_asprintf("video/3gpp");
 						switch( audio_profile )
 						{
 							case PROFILE_AUDIO_AAC:
@@ -1597,7 +1859,6 @@ GetVideoMetadata(const char *path, char *name)
 							default:
 								DPRINTF(E_DEBUG, L_METADATA, "No DLNA profile found for MPEG4-P2 3GP/0x%X file %s\n",
 								        ac->codec_id, basepath);
-								free(m.dlna_pn);
 								m.dlna_pn = NULL;
 								break;
 						}
@@ -1622,7 +1883,6 @@ GetVideoMetadata(const char *path, char *name)
 								vc->width,
 								vc->height,
 								ctx->bit_rate);
-							free(m.dlna_pn);
 							m.dlna_pn = NULL;
 						}
 					}
@@ -1643,10 +1903,10 @@ GetVideoMetadata(const char *path, char *name)
 					DPRINTF(E_DEBUG, L_METADATA, "Skipping DLNA parsing for non-ASF VC1 file %s\n", path);
 					break;
 				}
-				m.dlna_pn = malloc(64);
+				m.dlna_pn = meta_alloc(64);
 				off = sprintf(m.dlna_pn, "WMV");
 				DPRINTF(E_DEBUG, L_METADATA, "Stream %d of %s is VC1\n", video_stream, basepath);
-				xasprintf(&m.mime, "video/x-ms-wmv");
+				m.mime = meta_asprintf("video/x-ms-wmv");
 				if( (vc->width  <= 176) &&
 				    (vc->height <= 144) &&
 				    (vc->level == 0) )
@@ -1663,7 +1923,6 @@ GetVideoMetadata(const char *path, char *name)
 						default:
 							DPRINTF(E_DEBUG, L_METADATA, "No DLNA profile found for WMVSPLL/0x%X file %s\n",
 								audio_profile, basepath);
-							free(m.dlna_pn);
 							m.dlna_pn = NULL;
 							break;
 					}
@@ -1685,7 +1944,6 @@ GetVideoMetadata(const char *path, char *name)
 						default:
 							DPRINTF(E_DEBUG, L_METADATA, "No DLNA profile found for WMVSPML/0x%X file %s\n",
 								audio_profile, basepath);
-							free(m.dlna_pn);
 							m.dlna_pn = NULL;
 							break;
 					}
@@ -1709,7 +1967,6 @@ GetVideoMetadata(const char *path, char *name)
 						default:
 							DPRINTF(E_DEBUG, L_METADATA, "No DLNA profile found for WMVMED/0x%X file %s\n",
 								audio_profile, basepath);
-							free(m.dlna_pn);
 							m.dlna_pn = NULL;
 							break;
 					}
@@ -1730,14 +1987,13 @@ GetVideoMetadata(const char *path, char *name)
 						default:
 							DPRINTF(E_DEBUG, L_METADATA, "No DLNA profile found for WMVHIGH/0x%X file %s\n",
 								audio_profile, basepath);
-							free(m.dlna_pn);
 							m.dlna_pn = NULL;
 							break;
 					}
 				}
 				break;
 			case CODEC_ID_MSMPEG4V3:
-				xasprintf(&m.mime, "video/x-msvideo");
+				m.mime = meta_asprintf("video/x-msvideo");
 			default:
 				DPRINTF(E_DEBUG, L_METADATA, "Stream %d of %s is %s [type %d]\n",
 					video_stream, basepath, m.resolution, vc->codec_id);
@@ -1751,24 +2007,23 @@ GetVideoMetadata(const char *path, char *name)
 		{
 			if( video.title && *video.title )
 			{
-				m.title = escape_tag(trim(video.title), 1);
+				m.title = meta_escape(trim(video.title), 1);
 			}
 			if( video.genre && *video.genre )
 			{
-				m.genre = escape_tag(trim(video.genre), 1);
+				m.genre = meta_escape(trim(video.genre), 1);
 			}
 			if( video.contributor[ROLE_TRACKARTIST] && *video.contributor[ROLE_TRACKARTIST] )
 			{
-				m.artist = escape_tag(trim(video.contributor[ROLE_TRACKARTIST]), 1);
+				m.artist = meta_escape(trim(video.contributor[ROLE_TRACKARTIST]), 1);
 			}
 			if( video.contributor[ROLE_ALBUMARTIST] && *video.contributor[ROLE_ALBUMARTIST] )
 			{
-				m.creator = escape_tag(trim(video.contributor[ROLE_ALBUMARTIST]), 1);
+				m.creator = meta_escape(trim(video.contributor[ROLE_ALBUMARTIST]), 1);
 			}
 			else
 			{
 				m.creator = m.artist;
-				free_flags &= ~FLAG_CREATOR;
 			}
 		}
 	}
@@ -1785,13 +2040,13 @@ GetVideoMetadata(const char *path, char *name)
 			{
 				//DEBUG DPRINTF(E_DEBUG, L_METADATA, "  %-16s: %s\n", tag->key, tag->value);
 				if( strcmp(tag->key, "title") == 0 )
-					m.title = escape_tag(trim(tag->value), 1);
+					m.title = meta_escape(trim(tag->value), 1);
 				else if( strcmp(tag->key, "genre") == 0 )
-					m.genre = escape_tag(trim(tag->value), 1);
+					m.genre = meta_escape(trim(tag->value), 1);
 				else if( strcmp(tag->key, "artist") == 0 )
-					m.artist = escape_tag(trim(tag->value), 1);
+					m.artist = meta_escape(trim(tag->value), 1);
 				else if( strcmp(tag->key, "comment") == 0 )
-					m.comment = escape_tag(trim(tag->value), 1);
+					m.comment = meta_escape(trim(tag->value), 1);
 			}
 		}
 	}
@@ -1804,11 +2059,9 @@ video_no_dlna:
 	{
 		if( m.dlna_pn )
 		{
-			free(m.dlna_pn);
 			m.dlna_pn = NULL;
 		}
-		m.mime = realloc(m.mime, 21);
-		strcpy(m.mime, "video/x-tivo-mpeg");
+		m.mime = meta_strdup("video/x-tivo-mpeg");
 	}
 #endif
 
@@ -1826,49 +2079,49 @@ video_no_dlna:
 	if( !m.mime )
 	{
 		if( strcmp(ctx->iformat->name, "avi") == 0 )
-			xasprintf(&m.mime, "video/x-msvideo");
+			m.mime = meta_asprintf("video/x-msvideo");
 		else if( strncmp(ctx->iformat->name, "mpeg", 4) == 0 )
-			xasprintf(&m.mime, "video/mpeg");
+			m.mime = meta_asprintf("video/mpeg");
 		else if( strcmp(ctx->iformat->name, "asf") == 0 )
-			xasprintf(&m.mime, "video/x-ms-wmv");
+			m.mime = meta_asprintf("video/x-ms-wmv");
 		else if( strcmp(ctx->iformat->name, "mov,mp4,m4a,3gp,3g2,mj2") == 0 )
 			if( ends_with(path, ".mov") )
-				xasprintf(&m.mime, "video/quicktime");
+				m.mime = meta_asprintf("video/quicktime");
 			else
-				xasprintf(&m.mime, "video/mp4");
+				m.mime = meta_asprintf("video/mp4");
 		else if( strncmp(ctx->iformat->name, "matroska", 8) == 0 )
-			xasprintf(&m.mime, "video/x-matroska");
+			m.mime = meta_asprintf("video/x-matroska");
 		else if( strcmp(ctx->iformat->name, "flv") == 0 )
-			xasprintf(&m.mime, "video/x-flv");
+			m.mime = meta_asprintf("video/x-flv");
 #ifdef BAIDU_DMS_OPT
                 else if( strcmp(ctx->iformat->name, "rm") == 0 )
-                        xasprintf(&m.mime, "video/x-pn-realvideo");
+                        m.mime = meta_asprintf("video/x-pn-realvideo");
                 else if( strcmp(ctx->iformat->name, "mpeg4") == 0 )
-                        xasprintf(&m.mime, "video/mpeg4");
+                        m.mime = meta_asprintf("video/mpeg4");
                 else if( strcmp(ctx->iformat->name, ".wmx") == 0 )
-                        xasprintf(&m.mime, "video/x-ms-wmx");
+                        m.mime = meta_asprintf("video/x-ms-wmx");
                 else if( strcmp(ctx->iformat->name, "rmvb") == 0 )
-                        xasprintf(&m.mime, "application/vnd.rn-realmedia-vbr");
+                        m.mime = meta_asprintf("application/vnd.rn-realmedia-vbr");
                 else if( strcmp(ctx->iformat->name, ".wm") == 0 )
-                        xasprintf(&m.mime, "video/x-ms-wm");
+                        m.mime = meta_asprintf("video/x-ms-wm");
                 else if( strcmp(ctx->iformat->name, ".mpeg") == 0 )
-                        xasprintf(&m.mime, "video/mpg");
+                        m.mime = meta_asprintf("video/mpg");
                 else if( strcmp(ctx->iformat->name, ".mpeg2") == 0 )
-                        xasprintf(&m.mime, "video/mpg");
+                        m.mime = meta_asprintf("video/mpg");
                 else if( strcmp(ctx->iformat->name, ".mpga") == 0 )
-                        xasprintf(&m.mime, "audio/rn-mpeg");
+                        m.mime = meta_asprintf("audio/rn-mpeg");
                 else if( strcmp(ctx->iformat->name, ".qt") == 0 )
-                        xasprintf(&m.mime, "video/quicktime");
+                        m.mime = meta_asprintf("video/quicktime");
                 else if( strcmp(ctx->iformat->name, ".wmz") == 0 )
-                        xasprintf(&m.mime, "application/x-ms-wmz");
+                        m.mime = meta_asprintf("application/x-ms-wmz");
                 else if( strcmp(ctx->iformat->name, ".wmd") == 0 )
-                        xasprintf(&m.mime, "application/x-ms-wmd");
+                        m.mime = meta_asprintf("application/x-ms-wmd");
                 else if( strcmp(ctx->iformat->name, ".f4v") == 0 )
-                        xasprintf(&m.mime, "video/mp4");
+                        m.mime = meta_asprintf("video/mp4");
                 else if( strcmp(ctx->iformat->name, ".ts") == 0 )
-                        xasprintf(&m.mime, "application/x-troll-ts");
+                        m.mime = meta_asprintf("application/x-troll-ts");
                 else if( strcmp(ctx->iformat->name, ".wvx") == 0 )
-                        xasprintf(&m.mime, "video/x-ms-wvx");
+                        m.mime = meta_asprintf("video/x-ms-wvx");
 #endif
 		else
 			DPRINTF(E_WARN, L_METADATA, "%s: Unhandled format: %s\n", path, ctx->iformat->name);
@@ -1877,13 +2130,13 @@ video_no_dlna:
 
 	if( !m.date )
 	{
-		m.date = malloc(20);
+		m.date = meta_alloc(20);
 		modtime = localtime(&file.st_mtime);
 		strftime(m.date, 20, "%FT%T", modtime);
 	}
 
 	if( !m.title )
-		m.title = strdup(name);
+		m.title = meta_strdup(name);
 
 	album_art = find_album_art(path, video.image, video.image_size);
 	freetags(&video);
@@ -1916,9 +2169,10 @@ video_no_dlna:
 	else
 	{
 		ret = sqlite3_last_insert_rowid(db);
+		meta_cache_store(ret, &file, video.image_size > 0);
 		check_for_captions(path, ret);
 	}
-	free_metadata(&m, free_flags);
+	meta_reset();
 	free(path_cpy);
 
 	return ret;
@@ -1936,7 +2190,6 @@ video_no_dlna:
 	char nfo[MAXPATHLEN], *ext;
 	struct song_metadata video;
 	metadata_t m;
-	uint32_t free_flags = 0xFFFFFFFF;
 	char *path_cpy, *basepath;
 	memset(&m, '\0', sizeof(m));
 	memset(&video, '\0', sizeof(video));
@@ -1948,116 +2201,117 @@ video_no_dlna:
 	if( ends_with(path, ".avi") )
 	{
 		strcpy(type, "avi");
-		m.mime = strdup("video/x-msvideo");
+		m.mime = meta_strdup("video/x-msvideo");
 	}
     else if(ends_with(path, ".swf") )
 	 {
-		m.mime = strdup("application/x-shockwave-flash");
+		m.mime = meta_strdup("application/x-shockwave-flash");
 
 	  }
 	else if( ends_with(path, ".mpeg") )
 	{
 		strcpy(type, "mpeg");
-		m.mime = strdup("video/mpeg");
+		m.mime = meta_strdup("video/mpeg");
 	}
 	else if( ends_with(path, ".asf") )
 	{
 		strcpy(type, "asf");
-		m.mime = strdup("video/x-ms-wmv");
+		m.mime = meta_strdup("video/x-ms-wmv");
 	}
 
 	else if(  ends_with(path, ".mp4") ||
 		         ends_with(path, ".m4a") || ends_with(path, ".3gp") ||
 		         ends_with(path, ".3g2") || ends_with(path, ".mj2"))
 	{
-		m.mime = strdup("video/mp4");
+		m.mime = meta_strdup("video/mp4");
 	}
 	else if(ends_with(path, ".mov"))
 	{
-		m.mime = strdup("video/quicktime");
+		m.mime = meta_strdup("video/quicktime");
 
 	}
 	else if(ends_with(path, ".matroska"))
 	{
-		m.mime = strdup("video/x-matroska");
+		m.mime = meta_strdup("video/x-matroska");
 
 	}
 	else if(ends_with(path, ".flv"))
 	{
-		m.mime = strdup("video/x-flv");
+		m.mime = meta_strdup("video/x-flv");
 
 	}
 	else if(ends_with(path, ".rm") )
 	{
-		m.mime = strdup("video/x-pn-realvideo");
+		m.mime = meta_strdup("video/x-pn-realvideo");
 	}
     else if(ends_with(path, ".mpeg4") )
     {
-        m.mime = strdup("video/mpeg4");
+        m.mime = meta_strdup("video/mpeg4");
     }
     else if( ends_with(path, ".wmx") )
     {
-        m.mime = strdup("video/x-ms-wmx");
+        m.mime = meta_strdup("video/x-ms-wmx");
     }
     else if( ends_with(path, ".rmvb") )
     {
-        m.mime = strdup("application/vnd.rn-realmedia-vbr");
+        m.mime = meta_strdup("application/vnd.rn-realmedia-vbr");
     }
     else if( ends_with(path, ".wm") )
     {
-        m.mime = strdup("video/x-ms-wm");
+        m.mime = meta_strdup("video/x-ms-wm");
     }
     else if( ends_with(path, ".mpeg2") )
     {
-        m.mime = strdup("video/mpg");
+        m.mime = meta_strdup("video/mpg");
     }
     else if( ends_with(path, ".mpga") )
     {
-        m.mime = strdup("audio/rn-mpeg");
+        m.mime = meta_strdup("audio/rn-mpeg");
     }
     else if( ends_with(path, ".qt") )
     {
-        m.mime = strdup("video/quicktime");
+        m.mime = meta_strdup("video/quicktime");
     }
     else if( ends_with(path, ".wmz") )
     {
-        m.mime = strdup("application/x-ms-wmz");
+        m.mime = meta_strdup("application/x-ms-wmz");
     }
     else if( ends_with(path, ".wmd") )
     {
-        m.mime = strdup("application/x-ms-wmd");
+        m.mime = meta_strdup("application/x-ms-wmd");
     }
     else if( ends_with(path, ".f4v") )
     {
-        m.mime = strdup("video/mp4");
+        m.mime = meta_strdup("video/mp4");
     }
     else if( ends_with(path, ".ts") )
     {
-        m.mime = strdup("application/x-troll-ts");
+        m.mime = meta_strdup("application/x-troll-ts");
     }
     else if( ends_with(path, ".wvx") )
     {
-        m.mime = strdup("video/x-ms-wvx");
+        m.mime = meta_strdup("video/x-ms-wvx");
     }
     else if( ends_with(path, ".mkv") )
     {
-        m.mime = strdup("video/x-ms-wvx");
+        m.mime = meta_strdup("video/x-ms-wvx");
     }
     else if( ends_with(path, ".mpg") )
     {
-        m.mime = strdup("video/mpeg");
+        m.mime = meta_strdup("video/mpeg");
     }
     else if( ends_with(path, ".m4v") )
     {
-        m.mime = strdup("video/x-m4v");
+        m.mime = meta_strdup("video/x-m4v");
     }
     else if( ends_with(path, ".wmv") )
     {
-        m.mime = strdup("audio/x-ms-wmv");
+        m.mime = meta_strdup("audio/x-ms-wmv");
     }
 	else
 	{
 		DPRINTF(E_WARN, L_GENERAL, "Unhandled file extension on %s\n", path);
+		meta_reset();
 		return 0;
 	}
 	path_cpy = strdup(path);
@@ -2093,7 +2347,7 @@ video_no_dlna:
 		ret = sqlite3_last_insert_rowid(db);
 		check_for_captions(path, ret);
 	}
-	free_metadata(&m, free_flags);
+	meta_reset();
 	free(path_cpy);
 
 	return ret;
@@ -2107,6 +2361,7 @@ GetAllFile(const char *path, const char *name, OPTION option, NAS_DIR dir)
 	struct stat file;
 	int64_t	  ret;
 	int dir_count=0,num=0;
+	int ext_class;
 	char file_type[16];
 	char full_dir[64];
 	snprintf(full_dir,sizeof(full_dir),"%s",path);
@@ -2135,23 +2390,24 @@ GetAllFile(const char *path, const char *name, OPTION option, NAS_DIR dir)
 	}
 	*/
 	nas_timestamp++;
-	if(is_video(name))
+	ext_class = media_ext_class(name);
+	if(ext_class & EXT_VIDEO)
 	{
 		snprintf(file_type,sizeof(file_type),"%s","vedio");
 	}
-	else if(is_audio(name))
+	else if(ext_class & EXT_AUDIO)
 	{
 		snprintf(file_type,sizeof(file_type),"%s","audio");
 	}
-	else if(is_image(name))
+	else if(ext_class & EXT_IMAGE)
 	{
 		snprintf(file_type,sizeof(file_type),"%s","image");
 	}
-	else if(is_text(name))
+	else if(ext_class & EXT_TEXT)
 	{
 		snprintf(file_type,sizeof(file_type),"%s","text");
 	}
-	else if(is_application(name))
+	else if(ext_class & EXT_APP)
 	{
 		snprintf(file_type,sizeof(file_type),"%s","app");
 	}
@@ -97,6 +97,12 @@ ends_with(const char *haystack, const char *needle);
 void
 check_for_captions(const char *path, int64_t detailID);
 
+void
+open_meta_cache(sqlite3 *handle);
+
+void
+prune_meta_cache(void);
+
 int64_t
 GetFolderMetadata(const char *name, const char *path, const char *artist, const char *genre, int64_t album_art);
 
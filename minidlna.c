@@ -287,7 +287,7 @@ getfriendlyname(char *buf, int len)
 #endif
 }
 
-static int
+int
 open_db(sqlite3 **sq3)
 {
 	char path[PATH_MAX];
@@ -302,11 +302,12 @@ open_db(sqlite3 **sq3)
 		DPRINTF(E_FATAL, L_GENERAL, "ERROR: Failed to open sqlite database!  Exiting...\n");
 	if (sq3)
 		*sq3 = db;
-	sqlite3_busy_timeout(db, 5000);
-	sql_exec(db, "pragma page_size = 4096");
-	sql_exec(db, "pragma journal_mode = OFF");
-	sql_exec(db, "pragma synchronous = OFF;");
-	sql_exec(db, "pragma default_cache_size = 8192;");
+	if (!sql_set_pragmas(db, GETFLAG(DB_WAL_MASK)) && GETFLAG(DB_WAL_MASK))
+	{
+		DPRINTF(E_WARN, L_DB_SQL, "SQLite has no WAL support; disabling db_wal\n");
+		CLEARFLAG(DB_WAL_MASK);
+	}
+	open_meta_cache(db);
 
 	return new_db;
 }
@@ -428,7 +429,7 @@ rescan:
 		open_db(&db);
 		if (*scanner_pid == 0) /* child (scanner) process */
 		{
-			start_scanner();
+			start_scanner(1);
 			sqlite3_close(db);
 			log_close();
 			freeoptions();
@@ -436,10 +437,10 @@ rescan:
 		}
 		else if (*scanner_pid < 0)
 		{
-			start_scanner();
+			start_scanner(0);
 		}
 #else
-		start_scanner();
+		start_scanner(0);
 #endif
 	}
 }
@@ -815,6 +816,14 @@ init(int argc, char **argv)
 			if ((strcmp(ary_options[i].value, "yes") == 0) || atoi(ary_options[i].value))
 				SETFLAG(DLNA_STRICT_MASK);
 			break;
+		case SCAN_SORT:
+			if ((strcmp(ary_options[i].value, "yes") != 0) && !atoi(ary_options[i].value))
+				SETFLAG(NO_SCAN_SORT_MASK);
+			break;
+		case DB_WAL:
+			if ((strcmp(ary_options[i].value, "yes") == 0) || atoi(ary_options[i].value))
+				SETFLAG(DB_WAL_MASK);
+			break;
 		case ROOT_CONTAINER:
 			switch (ary_options[i].value[0]) {
 			case '.':
@@ -1252,6 +1261,7 @@ main(int argc, char **argv)
 	time_t lastupdatetime = 0;
 	int max_fd = -1;
 	int last_changecnt = 0;
+	int last_dataver, dataver;
 #ifdef NAS
 	char nas_scan_path[PATH_MAX];
 	int nasret;
@@ -1323,6 +1333,8 @@ main(int argc, char **argv)
 			DPRINTF(E_FATAL, L_GENERAL, "ERROR: Failed to create sqlite database!  Exiting...\n");
 	}
 #endif
+	process_init_activity();
+	init_media_exts();
 	ret = open_db(NULL);
 	if (ret == 0)
 	{
@@ -1331,6 +1343,10 @@ main(int argc, char **argv)
 			ret = -1;
 	}
 	check_db(db, ret, &scanner_pid);
+	/* data_version is per connection, so seed it once check_db() has
+	 * opened the handle the main loop polls */
+	last_dataver = sql_get_int_field(db, "pragma data_version");
+	upnp_event_container_reset();
 
 #ifdef HAVE_INOTIFY
 	if( GETFLAG(INOTIFY_MASK) )
@@ -1338,7 +1354,7 @@ main(int argc, char **argv)
 		if (!sqlite3_threadsafe() || sqlite3_libversion_number() < 3005001)
 			DPRINTF(E_ERROR, L_GENERAL, "SQLite library is not threadsafe!  "
 			                            "Inotify will be disabled.\n");
-		else if (pthread_create(&inotify_thread, NULL, start_inotify, NULL) != 0)
+		else if (pthread_create(&inotify_thread, NULL, start_inotify, db) != 0)
 			DPRINTF(E_FATAL, L_GENERAL, "ERROR: pthread_create() failed for start_inotify. EXITING\n");
 	}
 #endif
@@ -1445,14 +1461,18 @@ main(int argc, char **argv)
 					timeout.tv_sec = lastbeacontime.tv_sec + beacon_interval - timeofday.tv_sec;
 			}
 #endif
+			SSDPDelayedTimeout(&timeofday, &timeout);
 		}
 
 		if (scanning)
 		{
 			if (!scanner_pid || kill(scanner_pid, 0) != 0)
 			{
+				reset_object_ids();
+				media_cache_flush();
 				scanning = 0;
 				updateID++;
+				upnp_event_container_reset();
 			}
 		}
 
@@ -1520,6 +1540,7 @@ main(int argc, char **argv)
 			/*DPRINTF(E_DEBUG, L_GENERAL, "Received SSDP Packet\n");*/
 			ProcessSSDPRequest(sssdp, (unsigned short)runtime_vars.port);
 		}
+		SendSSDPDelayedResponses();
 #ifdef TIVO_SUPPORT
 		if (sbeacon >= 0 && FD_ISSET(sbeacon, &readset))
 		{
@@ -1535,10 +1556,16 @@ main(int argc, char **argv)
 		 * and if there is an active HTTP connection, at most once every 2 seconds */
 		if (i && (timeofday.tv_sec >= (lastupdatetime + 2)))
 		{
-			if (scanning || sqlite3_total_changes(db) != last_changecnt)
+			/* total_changes() only counts this connection; in WAL mode the
+			 * inotify thread commits through its own, which bumps data_version */
+			dataver = sql_get_int_field(db, "pragma data_version");
+			if (scanning || sqlite3_total_changes(db) != last_changecnt ||
+			    dataver != last_dataver)
 			{
 				updateID++;
 				last_changecnt = sqlite3_total_changes(db);
+				last_dataver = dataver;
+				upnp_event_container_commit();
 				upnp_event_var_change_notify(EContentDirectory);
 				lastupdatetime = timeofday.tv_sec;
 			}
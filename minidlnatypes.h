@@ -65,6 +65,15 @@ typedef uint8_t media_types;
 #define TYPE_VIDEO   0x02
 #define TYPE_IMAGES  0x04
 #define ALL_MEDIA    TYPE_AUDIO|TYPE_VIDEO|TYPE_IMAGES
+
+/* media_ext_class() bits; the media ones match the types above, and the
+ * rest stay clear of every media_types bit (TYPE_OTHER included) */
+#define EXT_AUDIO    TYPE_AUDIO
+#define EXT_VIDEO    TYPE_VIDEO
+#define EXT_IMAGE    TYPE_IMAGES
+#define EXT_PLAYLIST 0x100
+#define EXT_TEXT     0x200
+#define EXT_APP      0x400
 #ifdef NAS
 #define TYPE_TEXT   0x01
 #define TYPE_APP	0x02
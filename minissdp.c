@@ -36,7 +36,9 @@
 #include <string.h>
 #include <ctype.h>
 #include <unistd.h>
+#include <sys/time.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -207,6 +209,36 @@ static const char * const known_service_types[] =
 	0
 };
 
+#define SSDP_SERVICE_TYPES (sizeof(known_service_types)/sizeof(known_service_types[0]) - 1)
+#define SSDP_PACKET_SIZE 512
+#define SSDP_MAX_DELAYED 32
+
+/* Apart from the DATE header of M-SEARCH responses, every packet we send
+ * only depends on the interface address, port and lifetime, so they are
+ * formatted once per interface and reused. */
+static struct ssdp_template {
+	char host[16];
+	unsigned short port;
+	unsigned int lifetime;
+	int notify_len[SSDP_SERVICE_TYPES];
+	char notify[SSDP_SERVICE_TYPES][SSDP_PACKET_SIZE];
+	int resp_head_len;
+	char resp_head[64];
+	int resp_tail_len[SSDP_SERVICE_TYPES];
+	char resp_tail[SSDP_SERVICE_TYPES][SSDP_PACKET_SIZE];
+} ssdp_templates[MAX_LAN_ADDR];
+
+/* M-SEARCH responses waiting for their random MX delay to expire */
+static struct ssdp_delayed {
+	struct timeval due;
+	struct sockaddr_in dest;
+	int s;
+	char host[16];
+	unsigned short port;
+	unsigned int st_mask;
+} ssdp_delayed[SSDP_MAX_DELAYED];
+static int n_ssdp_delayed = 0;
+
 static void
 _usleep(long usecs)
 {
@@ -217,17 +249,38 @@ _usleep(long usecs)
 	nanosleep(&sleep_time, NULL);
 }
 
-/* not really an SSDP "announce" as it is the response
- * to a SSDP "M-SEARCH" */
-static void
-SendSSDPResponse(int s, struct sockaddr_in sockname, int st_no,
-                  const char *host, unsigned short port)
+static int
+ssdp_template_len(int l, const char *func)
 {
-	int l, n;
-	char buf[512];
-	char tmstr[30];
-	time_t tm = time(NULL);
+	if (l >= SSDP_PACKET_SIZE)
+	{
+		DPRINTF(E_WARN, L_SSDP, "%s(): truncated output\n", func);
+		l = SSDP_PACKET_SIZE - 1;
+	}
+	return l;
+}
 
+static struct ssdp_template *
+get_ssdp_template(const char *host, unsigned short port, unsigned int lifetime)
+{
+	static int next_slot = 0;
+	struct ssdp_template *t;
+	int i, l;
+
+	for (i = 0; i < MAX_LAN_ADDR; i++)
+	{
+		t = &ssdp_templates[i];
+		if (t->port == port && t->lifetime == lifetime && strcmp(t->host, host) == 0)
+			return t;
+	}
+
+	t = &ssdp_templates[next_slot];
+	next_slot = (next_slot + 1) % MAX_LAN_ADDR;
+	DPRINTF(E_DEBUG, L_SSDP, "Building SSDP packet templates for %s:%u\n", host, port);
+
+	strncpyt(t->host, host, sizeof(t->host));
+	t->port = port;
+	t->lifetime = lifetime;
 	/*
 	 * follow guideline from document "UPnP Device Architecture 1.0"
 	 * uppercase is recommended.
@@ -235,88 +288,252 @@ SendSSDPResponse(int s, struct sockaddr_in sockname, int st_no,
 	 * SERVER: OS/ver UPnP/1.0 minidlna/1.0
 	 * - check what to put in the 'Cache-Control' header 
 	 * */
-	strftime(tmstr, sizeof(tmstr), "%a, %d %b %Y %H:%M:%S GMT", gmtime(&tm));
-	l = snprintf(buf, sizeof(buf), "HTTP/1.1 200 OK\r\n"
+	t->resp_head_len = snprintf(t->resp_head, sizeof(t->resp_head),
+		"HTTP/1.1 200 OK\r\n"
 		"CACHE-CONTROL: max-age=%u\r\n"
-		"DATE: %s\r\n"
-		"ST: %s%s\r\n"
-		"USN: %s%s%s%s\r\n"
-		"EXT:\r\n"
-		"SERVER: " MINIDLNA_SERVER_STRING "\r\n"
-		"LOCATION: http://%s:%u" ROOTDESC_PATH "\r\n"
-		"Content-Length: 0\r\n"
-		"\r\n",
-		(runtime_vars.notify_interval<<1)+10,
-		tmstr,
-		known_service_types[st_no],
-		(st_no>1?"1":""),
-		uuidvalue,
-		(st_no > 0 ? "::" : ""),
-		(st_no > 0 ? known_service_types[st_no] : ""),
-		(st_no > 1 ? "1" : ""),
-		host, (unsigned int)port);
-	DPRINTF(E_DEBUG, L_SSDP, "Sending M-SEARCH response to %s:%d ST: %s\n",
-		inet_ntoa(sockname.sin_addr), ntohs(sockname.sin_port),
-		known_service_types[st_no]);
-	n = sendto(s, buf, l, 0,
-	           (struct sockaddr *)&sockname, sizeof(struct sockaddr_in) );
-	if (n < 0)
+		"DATE: ", lifetime);
+	for (i = 0; known_service_types[i]; i++)
+	{
+		l = snprintf(t->notify[i], SSDP_PACKET_SIZE,
+			"NOTIFY * HTTP/1.1\r\n"
+			"HOST:%s:%d\r\n"
+			"CACHE-CONTROL:max-age=%u\r\n"
+			"LOCATION:http://%s:%d" ROOTDESC_PATH"\r\n"
+			"SERVER: " MINIDLNA_SERVER_STRING "\r\n"
+			"NT:%s%s\r\n"
+			"USN:%s%s%s%s\r\n"
+			"NTS:ssdp:alive\r\n"
+			"\r\n",
+			SSDP_MCAST_ADDR, SSDP_PORT,
+			lifetime,
+			host, port,
+			known_service_types[i],
+			(i > 1 ? "1" : ""),
+			uuidvalue,
+			(i > 0 ? "::" : ""),
+			(i > 0 ? known_service_types[i] : ""),
+			(i > 1 ? "1" : ""));
+		t->notify_len[i] = ssdp_template_len(l, "SendSSDPNotifies");
+		l = snprintf(t->resp_tail[i], SSDP_PACKET_SIZE,
+			"\r\n"
+			"ST: %s%s\r\n"
+			"USN: %s%s%s%s\r\n"
+			"EXT:\r\n"
+			"SERVER: " MINIDLNA_SERVER_STRING "\r\n"
+			"LOCATION: http://%s:%u" ROOTDESC_PATH "\r\n"
+			"Content-Length: 0\r\n"
+			"\r\n",
+			known_service_types[i],
+			(i > 1 ? "1" : ""),
+			uuidvalue,
+			(i > 0 ? "::" : ""),
+			(i > 0 ? known_service_types[i] : ""),
+			(i > 1 ? "1" : ""),
+			host, (unsigned int)port);
+		t->resp_tail_len[i] = ssdp_template_len(l, "SendSSDPResponse");
+	}
+
+	return t;
+}
+
+/* Send a batch of datagrams, with a single syscall where possible */
+static int
+send_ssdp_packets(int s, struct msghdr *msgs, int count)
+{
+	int i, n;
+#ifdef HAVE_SENDMMSG
+	struct mmsghdr mmsgs[SSDP_SERVICE_TYPES];
+
+	for (i = 0; i < count; i++)
+	{
+		mmsgs[i].msg_hdr = msgs[i];
+		mmsgs[i].msg_len = 0;
+	}
+	for (i = 0; i < count; i += n)
+	{
+		n = sendmmsg(s, mmsgs + i, count - i, 0);
+		if (n <= 0)
+			return -1;
+	}
+#else
+	for (i = 0; i < count; i++)
+	{
+		n = sendmsg(s, &msgs[i], 0);
+		if (n < 0)
+			return -1;
+	}
+#endif
+	return count;
+}
+
+/* not really an SSDP "announce" as it is the response
+ * to a SSDP "M-SEARCH" */
+static void
+SendSSDPResponses(int s, struct sockaddr_in *sockname, unsigned int st_mask,
+                  const char *host, unsigned short port)
+{
+	struct ssdp_template *t;
+	struct msghdr msgs[SSDP_SERVICE_TYPES];
+	struct iovec iov[SSDP_SERVICE_TYPES][3];
+	char tmstr[30];
+	time_t tm = time(NULL);
+	int i, l, n = 0;
+
+	t = get_ssdp_template(host, port, (runtime_vars.notify_interval<<1)+10);
+	l = strftime(tmstr, sizeof(tmstr), "%a, %d %b %Y %H:%M:%S GMT", gmtime(&tm));
+	memset(msgs, 0, sizeof(msgs));
+	for (i = 0; known_service_types[i]; i++)
+	{
+		if (!(st_mask & (1 << i)))
+			continue;
+		DPRINTF(E_DEBUG, L_SSDP, "Sending M-SEARCH response to %s:%d ST: %s\n",
+			inet_ntoa(sockname->sin_addr), ntohs(sockname->sin_port),
+			known_service_types[i]);
+		iov[n][0].iov_base = t->resp_head;
+		iov[n][0].iov_len = t->resp_head_len;
+		iov[n][1].iov_base = tmstr;
+		iov[n][1].iov_len = l;
+		iov[n][2].iov_base = t->resp_tail[i];
+		iov[n][2].iov_len = t->resp_tail_len[i];
+		msgs[n].msg_name = sockname;
+		msgs[n].msg_namelen = sizeof(struct sockaddr_in);
+		msgs[n].msg_iov = iov[n];
+		msgs[n].msg_iovlen = 3;
+		n++;
+	}
+	if (n && send_ssdp_packets(s, msgs, n) < 0)
 		DPRINTF(E_ERROR, L_SSDP, "sendto(udp): %s\n", strerror(errno));
 }
 
+/* Schedule the response at a random point within the MX window, as
+ * recommended by the UDA, instead of answering from inside the request. */
+static void
+QueueSSDPResponse(int s, struct sockaddr_in *sockname, unsigned int st_mask,
+                  const char *host, unsigned short port, int mx)
+{
+	struct ssdp_delayed *d;
+	struct timeval now;
+	long delay;
+	int i;
+
+	/* UDA 1.1: MX values greater than 5 should be treated as 5 */
+	if (mx > 5)
+		mx = 5;
+	if (mx <= 0 || gettimeofday(&now, NULL) < 0)
+	{
+		SendSSDPResponses(s, sockname, st_mask, host, port);
+		return;
+	}
+	/* Control points usually repeat their searches; answer them once */
+	for (i = 0; i < n_ssdp_delayed; i++)
+	{
+		d = &ssdp_delayed[i];
+		if (d->s == s &&
+		    d->dest.sin_addr.s_addr == sockname->sin_addr.s_addr &&
+		    d->dest.sin_port == sockname->sin_port)
+		{
+			d->st_mask |= st_mask;
+			return;
+		}
+	}
+	if (n_ssdp_delayed >= SSDP_MAX_DELAYED)
+	{
+		SendSSDPResponses(s, sockname, st_mask, host, port);
+		return;
+	}
+
+	d = &ssdp_delayed[n_ssdp_delayed++];
+	delay = random() % (mx * 1000000L);
+	d->due.tv_sec = now.tv_sec + delay / 1000000;
+	d->due.tv_usec = now.tv_usec + delay % 1000000;
+	if (d->due.tv_usec >= 1000000)
+	{
+		d->due.tv_sec++;
+		d->due.tv_usec -= 1000000;
+	}
+	memcpy(&d->dest, sockname, sizeof(struct sockaddr_in));
+	d->s = s;
+	strncpyt(d->host, host, sizeof(d->host));
+	d->port = port;
+	d->st_mask = st_mask;
+}
+
+/* Shorten the select() timeout so that delayed responses go out on time */
+void
+SSDPDelayedTimeout(const struct timeval *now, struct timeval *timeout)
+{
+	struct timeval left;
+	int i;
+
+	for (i = 0; i < n_ssdp_delayed; i++)
+	{
+		if (!timercmp(&ssdp_delayed[i].due, now, >))
+		{
+			timerclear(timeout);
+			return;
+		}
+		timersub(&ssdp_delayed[i].due, now, &left);
+		if (timercmp(&left, timeout, <))
+			*timeout = left;
+	}
+}
+
+void
+SendSSDPDelayedResponses(void)
+{
+	struct ssdp_delayed *d;
+	struct timeval now;
+	int i = 0;
+
+	if (!n_ssdp_delayed || gettimeofday(&now, NULL) < 0)
+		return;
+	while (i < n_ssdp_delayed)
+	{
+		d = &ssdp_delayed[i];
+		if (timercmp(&d->due, &now, >))
+		{
+			i++;
+			continue;
+		}
+		SendSSDPResponses(d->s, &d->dest, d->st_mask, d->host, d->port);
+		memcpy(d, &ssdp_delayed[--n_ssdp_delayed], sizeof(struct ssdp_delayed));
+	}
+}
+
 void
 SendSSDPNotifies(int s, const char *host, unsigned short port,
                  unsigned int interval)
 {
 	struct sockaddr_in sockname;
-	int l, n, dup, i=0;
-	unsigned int lifetime;
-	char bufr[512];
+	struct ssdp_template *t;
+	struct msghdr msgs[SSDP_SERVICE_TYPES];
+	struct iovec iov[SSDP_SERVICE_TYPES];
+	int dup, i;
 
 	memset(&sockname, 0, sizeof(struct sockaddr_in));
 	sockname.sin_family = AF_INET;
 	sockname.sin_port = htons(SSDP_PORT);
 	sockname.sin_addr.s_addr = inet_addr(SSDP_MCAST_ADDR);
-	lifetime = (interval << 1) + 10;
+
+	t = get_ssdp_template(host, port, (interval << 1) + 10);
+	memset(msgs, 0, sizeof(msgs));
+	for (i = 0; known_service_types[i]; i++)
+	{
+		iov[i].iov_base = t->notify[i];
+		iov[i].iov_len = t->notify_len[i];
+		msgs[i].msg_name = &sockname;
+		msgs[i].msg_namelen = sizeof(struct sockaddr_in);
+		msgs[i].msg_iov = &iov[i];
+		msgs[i].msg_iovlen = 1;
+	}
 
 	for (dup = 0; dup < 2; dup++)
 	{
 		if (dup)
 			_usleep(200000);
-		i = 0;
-		while (known_service_types[i])
-		{
-			l = snprintf(bufr, sizeof(bufr), 
-					"NOTIFY * HTTP/1.1\r\n"
-					"HOST:%s:%d\r\n"
-					"CACHE-CONTROL:max-age=%u\r\n"
-					"LOCATION:http://%s:%d" ROOTDESC_PATH"\r\n"
-					"SERVER: " MINIDLNA_SERVER_STRING "\r\n"
-					"NT:%s%s\r\n"
-					"USN:%s%s%s%s\r\n"
-					"NTS:ssdp:alive\r\n"
-					"\r\n",
-					SSDP_MCAST_ADDR, SSDP_PORT,
-					lifetime,
-					host, port,
-					known_service_types[i],
-					(i > 1 ? "1" : ""),
-					uuidvalue,
-					(i > 0 ? "::" : ""),
-					(i > 0 ? known_service_types[i] : ""),
-					(i > 1 ? "1" : ""));
-			if (l >= sizeof(bufr))
-			{
-				DPRINTF(E_WARN, L_SSDP, "SendSSDPNotifies(): truncated output\n");
-				l = sizeof(bufr);
-			}
-			DPRINTF(E_MAXDEBUG, L_SSDP, "Sending ssdp:alive [%d]\n", s);
-			n = sendto(s, bufr, l, 0,
-				(struct sockaddr *)&sockname, sizeof(struct sockaddr_in));
-			if (n < 0)
-				DPRINTF(E_ERROR, L_SSDP, "sendto(udp_notify=%d, %s): %s\n", s, host, strerror(errno));
-			i++;
-		}
+		DPRINTF(E_MAXDEBUG, L_SSDP, "Sending ssdp:alive [%d]\n", s);
+		if (send_ssdp_packets(s, msgs, i) < 0)
+			DPRINTF(E_ERROR, L_SSDP, "sendto(udp_notify=%d, %s): %s\n", s, host, strerror(errno));
 	}
 }
 
@@ -686,21 +903,16 @@ ProcessSSDPRequest(int s, unsigned short port)
 					if (l != st_len)
 						break;
 				}
-				_usleep(random()>>20);
-				SendSSDPResponse(s, sendername, i,
-						lan_addr[iface].str, port);
+				QueueSSDPResponse(s, &sendername, 1 << i,
+						lan_addr[iface].str, port, mx_val);
 				return;
 			}
 			/* Responds to request with ST: ssdp:all */
 			/* strlen("ssdp:all") == 8 */
 			if ((st_len == 8) && (memcmp(st, "ssdp:all", 8) == 0))
 			{
-				for (i=0; known_service_types[i]; i++)
-				{
-					l = strlen(known_service_types[i]);
-					SendSSDPResponse(s, sendername, i,
-							lan_addr[iface].str, port);
-				}
+				QueueSSDPResponse(s, &sendername, (1 << SSDP_SERVICE_TYPES) - 1,
+						lan_addr[iface].str, port, mx_val);
 			}
 		}
 		else
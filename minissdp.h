@@ -37,6 +37,10 @@ void SendSSDPNotifies(int s, const char *host, unsigned short port, unsigned int
 
 void ProcessSSDPRequest(int s, unsigned short port);
 
+void SSDPDelayedTimeout(const struct timeval *now, struct timeval *timeout);
+
+void SendSSDPDelayedResponses(void);
+
 int SendSSDPGoodbyes(int s);
 
 int SubmitServicesToMiniSSDPD(const char *host, unsigned short port);
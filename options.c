@@ -63,6 +63,8 @@ static const struct {
 	{ ROOT_CONTAINER, "root_container" },
 	{ USER_ACCOUNT, "user" },
 	{ FORCE_SORT_CRITERIA, "force_sort_criteria" },
+	{ SCAN_SORT, "scan_sort" },
+	{ DB_WAL, "db_wal" },
 #ifdef NAS
 	{ NAS_SCANDIR, "nas_scan_dir" },
 #endif
@@ -57,6 +57,8 @@ enum upnpconfigoptions {
 	ROOT_CONTAINER,			/* root ObjectID (instead of "0") */
 	USER_ACCOUNT,			/* user account to run as */
 	FORCE_SORT_CRITERIA,		/* force sorting by a given sort criteria */
+	SCAN_SORT,			/* sort directory entries by name while scanning */
+	DB_WAL,				/* keep the database in write-ahead-log mode */
 #ifdef NAS
 	NAS_SCANDIR,			/*the dir for nas.db,eg:/mnt/sda1/newifi*/
 #endif
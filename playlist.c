@@ -115,7 +115,8 @@ fill_playlists()
 	char **result;
 	char *plpath, *plname, *fname, *last_dir;
 	unsigned int hash, last_hash = 0;
-	char class[] = "playlistContainer";
+	char class[] = "container.playlistContainer";
+	char objectID[64];
 	struct song_metadata plist;
 	struct stat file;
 	char type[4];
@@ -148,11 +149,8 @@ fill_playlists()
 		                          " and NAME = '%q'", plname) <= 0 )
 		{
 			detailID = GetFolderMetadata(plname, NULL, NULL, NULL, 0);
-			sql_exec(db, "INSERT into OBJECTS"
-			             " (OBJECT_ID, PARENT_ID, DETAIL_ID, CLASS, NAME) "
-			             "VALUES"
-			             " ('%s$%llX', '%s', %lld, 'container.%s', '%q')",
-			             MUSIC_PLIST_ID, plID, MUSIC_PLIST_ID, detailID, class, plname);
+			snprintf(objectID, sizeof(objectID), "%s$%llX", MUSIC_PLIST_ID, (long long)plID);
+			sql_insert_object(db, objectID, MUSIC_PLIST_ID, NULL, class, detailID, plname);
 		}
 
 		plpath = dirname(plpath);
@@ -211,10 +209,11 @@ retry:
 found:
 				DPRINTF(E_DEBUG, L_SCANNER, "+ %s found in db\n", fname);
 				sql_exec(db, "INSERT into OBJECTS"
-				             " (OBJECT_ID, PARENT_ID, CLASS, DETAIL_ID, NAME, REF_ID) "
+				             " (OBJECT_ID, PARENT_ID, CLASS, DETAIL_ID, NAME, REF_ID, SORT_TITLE, SORT_TRACK) "
 				             "SELECT"
-				             " '%s$%llX$%d', '%s$%llX', CLASS, DETAIL_ID, NAME, OBJECT_ID from OBJECTS"
-				             " where DETAIL_ID = %lld and OBJECT_ID glob '" BROWSEDIR_ID "$*'",
+				             " '%s$%llX$%d', '%s$%llX', CLASS, DETAIL_ID, NAME, OBJECT_ID, SORT_TITLE, SORT_TRACK from OBJECTS"
+				             " where DETAIL_ID = %lld and OBJECT_ID > '" BROWSEDIR_ID "$'"
+				             " and OBJECT_ID < '" BROWSEDIR_ID "%%'",
 				             MUSIC_PLIST_ID, plID, plist.track,
 				             MUSIC_PLIST_ID, plID,
 				             detailID);
@@ -37,6 +37,7 @@
 #include <string.h>
 #include <signal.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
 
 #include "upnpglobalvars.h"
 #include "process.h"
@@ -44,6 +45,7 @@
 #include "log.h"
 
 static int number_of_children = 0;
+struct io_activity *io_activity = NULL;
 
 pid_t
 process_fork(void)
@@ -79,6 +81,8 @@ process_handle_child_termination(int signal)
 		else if (pid == 0)
 			break;
 		--number_of_children;
+		/* a child killed mid-stream never gets to uncount itself */
+		process_stream_end(pid);
 	}
 }
 
@@ -159,3 +163,56 @@ process_check_if_running(const char *fname)
 
 	return 0;
 }
+
+void
+process_init_activity(void)
+{
+	void *p;
+
+	p = mmap(NULL, sizeof(struct io_activity), PROT_READ|PROT_WRITE,
+	         MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+	{
+		DPRINTF(E_WARN, L_GENERAL, "Failed to map shared I/O activity: %s\n",
+			strerror(errno));
+		return;
+	}
+	memset(p, 0, sizeof(struct io_activity));
+	io_activity = p;
+}
+
+void
+process_stream_begin(void)
+{
+	pid_t pid = getpid();
+	int i;
+
+	if (!io_activity)
+		return;
+	for (i = 0; i < IO_STREAM_SLOTS; i++)
+	{
+		if (__sync_bool_compare_and_swap(&io_activity->streamers[i], 0, pid))
+		{
+			__sync_fetch_and_add(&io_activity->streams, 1);
+			return;
+		}
+	}
+}
+
+/* Also called from the SIGCHLD handler, so only atomics in here */
+void
+process_stream_end(pid_t pid)
+{
+	int i;
+
+	if (!io_activity)
+		return;
+	for (i = 0; i < IO_STREAM_SLOTS; i++)
+	{
+		if (__sync_bool_compare_and_swap(&io_activity->streamers[i], pid, 0))
+		{
+			__sync_fetch_and_sub(&io_activity->streams, 1);
+			return;
+		}
+	}
+}
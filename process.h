@@ -63,4 +63,29 @@ int process_daemonize(void);
  */
 int process_check_if_running(const char *fname);
 
+/**
+ * I/O activity shared between the main process, its streaming children and
+ * the scanner, so the scanner can get out of the way of playback.
+ */
+#define IO_STREAM_SLOTS 64
+struct io_activity {
+	volatile pid_t streamers[IO_STREAM_SLOTS];	/* pids in send_file(), 0 if free */
+	volatile int streams;		/* send_file() calls in progress */
+	volatile unsigned int stalls;	/* sends that starved a waiting client */
+};
+extern struct io_activity *io_activity;
+
+/**
+ * Map the shared activity block. Must be called before forking the scanner
+ * or any streaming child; io_activity stays NULL if the mapping fails.
+ */
+void process_init_activity(void);
+
+/**
+ * Count the calling process as streaming until process_stream_end() is
+ * called for it, either by itself or by the SIGCHLD handler once it exits.
+ */
+void process_stream_begin(void);
+void process_stream_end(pid_t pid);
+
 #endif // __PROCESS_H__
@@ -27,6 +27,9 @@
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <pthread.h>
 
 #include "config.h"
 
@@ -44,28 +47,52 @@
 #include "sql.h"
 #include "scanner.h"
 #include "albumart.h"
+#include "upnpevents.h"
+#include "process.h"
 #include "log.h"
 
-#if SCANDIR_CONST
-typedef const struct dirent scan_filter;
-#else
-typedef struct dirent scan_filter;
-#endif
 #ifndef AV_LOG_PANIC
 #define AV_LOG_PANIC AV_LOG_FATAL
 #endif
 
 int valid_cache = 0;
-
-struct virtual_item
+struct scan_stats scan_stats;
+
+/* Object IDs are "<parent>$<hex>", the suffix counting up per parent.
+ * The next free suffix of a parent is read from the database once and then
+ * handed out from memory, so allocating an ID costs no query.  Reserved
+ * IDs that end up unused are just gaps, so nothing needs to be persisted:
+ * after a restart the counters are reloaded from the highest stored IDs.
+ * The HTTP handler and the inotify thread both allocate, hence the lock.
+ * A scanner child allocates from its own copy of the table, so while it
+ * runs the two processes take suffixes from disjoint ranges: the child
+ * stays below ID_SIDE_BASE (up to 7 hex digits) and the parent hands out
+ * ID_SIDE_BASE and up.  The table is dropped whenever the range changes,
+ * and the parent drops it again once the child has finished.  A scan run
+ * in process shares the one table, so it keeps the full range. */
+struct id_slot
 {
-	int64_t objectID;
-	char parentID[64];
-	char name[256];
+	struct id_slot *next;
+	uint32_t hash;
+	int64_t next_id;
+	char parent[];
 };
 
-int64_t
-get_next_available_id(const char *table, const char *parentID)
+#define ID_SIDE_BASE	0x10000000LL
+enum id_range { ID_RANGE_ALL, ID_RANGE_SCANNER, ID_RANGE_SIDE };
+
+static struct {
+	struct id_slot **buckets;
+	unsigned int mask;
+	unsigned int count;
+	enum id_range range;
+} id_table;
+static enum id_range id_scanner_range = ID_RANGE_ALL;
+static int id_scan_local;
+static pthread_mutex_t id_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int64_t
+next_id_from_db(const char *table, const char *parentID)
 {
 		char *ret, *base;
 		int64_t objectID = 0;
@@ -83,9 +110,172 @@ get_next_available_id(const char *table, const char *parentID)
 
 		return objectID;
 }
+
+/* Like next_id_from_db() on OBJECTS, but only counting the suffixes of one
+ * range; the length test tells 8+ hex digit suffixes from shorter ones. */
+static int64_t
+next_id_in_range(const char *parentID, enum id_range range)
+{
+	char *ret, *base;
+	int64_t objectID = 0;
+
+	if( range == ID_RANGE_ALL )
+		return next_id_from_db("OBJECTS", parentID);
+	ret = sql_get_text_field(db, "SELECT OBJECT_ID from OBJECTS where ID = "
+	                             "(SELECT max(ID) from OBJECTS where PARENT_ID = '%s'"
+	                             " and length(OBJECT_ID) %s length(PARENT_ID) + 8)",
+	                             parentID, range == ID_RANGE_SIDE ? ">" : "<=");
+	if( ret )
+	{
+		base = strrchr(ret, '$');
+		if( base )
+			objectID = strtoll(base+1, NULL, 16) + 1;
+		sqlite3_free(ret);
+	}
+	if( range == ID_RANGE_SIDE && objectID < ID_SIDE_BASE )
+		objectID = ID_SIDE_BASE;
+
+	return objectID;
+}
+
+static int
+id_table_grow(void)
+{
+	struct id_slot **buckets, *slot, *next;
+	unsigned int size, i;
+
+	size = id_table.buckets ? (id_table.mask + 1) * 2 : 64;
+	buckets = calloc(size, sizeof(*buckets));
+	if( !buckets )
+		return -1;
+	if( id_table.buckets )
+	{
+		for( i = 0; i <= id_table.mask; i++ )
+		{
+			for( slot = id_table.buckets[i]; slot; slot = next )
+			{
+				next = slot->next;
+				slot->next = buckets[slot->hash & (size - 1)];
+				buckets[slot->hash & (size - 1)] = slot;
+			}
+		}
+		free(id_table.buckets);
+	}
+	id_table.buckets = buckets;
+	id_table.mask = size - 1;
+	return 0;
+}
+
+/* caller holds id_lock */
+static void
+id_table_clear(void)
+{
+	struct id_slot *slot, *next;
+	unsigned int i;
+
+	if( id_table.buckets )
+	{
+		for( i = 0; i <= id_table.mask; i++ )
+		{
+			for( slot = id_table.buckets[i]; slot; slot = next )
+			{
+				next = slot->next;
+				free(slot);
+			}
+		}
+		free(id_table.buckets);
+	}
+	memset(&id_table, 0, sizeof(id_table));
+}
+
+/* Reserve count consecutive child IDs of parentID and return the first. */
+int64_t
+reserve_object_ids(const char *parentID, int count)
+{
+	struct id_slot *slot = NULL;
+	uint32_t h = 2166136261U;
+	const char *p;
+	int64_t ret;
+	size_t len;
+	enum id_range range;
+
+	for( p = parentID; *p; p++ )
+		h = (h ^ (unsigned char)*p) * 16777619U;
+
+	pthread_mutex_lock(&id_lock);
+	range = id_scanner_range;
+#if USE_FORK
+	if( range == ID_RANGE_ALL && scanning && !id_scan_local )
+		range = ID_RANGE_SIDE;
+#endif
+	if( id_table.range != range )
+	{
+		id_table_clear();
+		id_table.range = range;
+	}
+	if( id_table.buckets )
+	{
+		for( slot = id_table.buckets[h & id_table.mask]; slot; slot = slot->next )
+		{
+			if( slot->hash == h && strcmp(slot->parent, parentID) == 0 )
+				break;
+		}
+	}
+	if( !slot )
+	{
+		ret = next_id_in_range(parentID, range);
+		len = strlen(parentID) + 1;
+		if( (id_table.count < id_table.mask || id_table_grow() == 0) &&
+		    (slot = malloc(sizeof(*slot) + len)) )
+		{
+			slot->hash = h;
+			slot->next_id = ret;
+			memcpy(slot->parent, parentID, len);
+			slot->next = id_table.buckets[h & id_table.mask];
+			id_table.buckets[h & id_table.mask] = slot;
+			id_table.count++;
+		}
+	}
+	if( slot )
+	{
+		ret = slot->next_id;
+		slot->next_id += count;
+	}
+	pthread_mutex_unlock(&id_lock);
+
+	return ret;
+}
+
+void
+reset_object_ids(void)
+{
+	pthread_mutex_lock(&id_lock);
+	id_table_clear();
+	pthread_mutex_unlock(&id_lock);
+}
+
+static void
+set_scanner_id_range(enum id_range range, int local)
+{
+	pthread_mutex_lock(&id_lock);
+	id_scanner_range = range;
+	id_scan_local = local;
+	id_table_clear();
+	pthread_mutex_unlock(&id_lock);
+}
+
+int64_t
+get_next_available_id(const char *table, const char *parentID)
+{
+	if( strcmp(table, "OBJECTS") != 0 )
+		return next_id_from_db(table, parentID);
+
+	return reserve_object_ids(parentID, 1);
+}
+
 int
 insert_container(const char *item, const char *rootParent, const char *refID, const char *class,
-                 const char *artist, const char *genre, const char *album_art, int64_t *objectID, int64_t *parentID)
+                 const char *artist, const char *genre, const char *album_art, int64_t *parentID)
 {
 	char *result;
 	char *base;
@@ -105,12 +295,11 @@ insert_container(const char *item, const char *rootParent, const char *refID, co
 			*parentID = strtoll(base+1, NULL, 16);
 		else
 			*parentID = 0;
-		*objectID = get_next_available_id("OBJECTS", result);
 	}
 	else
 	{
 		int64_t detailID = 0;
-		*objectID = 0;
+		char objectID[64], container[64];
 		*parentID = get_next_available_id("OBJECTS", rootParent);
 		if( refID )
 		{
@@ -122,18 +311,204 @@ insert_container(const char *item, const char *rootParent, const char *refID, co
 		{
 			detailID = GetFolderMetadata(item, NULL, artist, genre, (album_art ? strtoll(album_art, NULL, 10) : 0));
 		}
-		ret = sql_exec(db, "INSERT into OBJECTS"
-		                   " (OBJECT_ID, PARENT_ID, REF_ID, DETAIL_ID, CLASS, NAME) "
-		                   "VALUES"
-		                   " ('%s$%llX', '%s', %Q, %lld, 'container.%s', '%q')",
-		                   rootParent, (long long)*parentID, rootParent,
-		                   refID, (long long)detailID, class, item);
+		snprintf(objectID, sizeof(objectID), "%s$%llX", rootParent, (long long)*parentID);
+		snprintf(container, sizeof(container), "container.%s", class);
+		ret = sql_insert_object(db, objectID, rootParent, refID, container, detailID, item);
+		upnp_event_container_changed(rootParent);
 	}
 	sqlite3_free(result);
 
 	return ret;
 }
 
+/* Virtual containers (dates, cameras, albums, artists, genres) resolved
+ * during a scan are kept in a hash map keyed the way insert_container()
+ * matches them in SQL: parent, class, name and artist, with the ASCII case
+ * folding of LIKE.  Out-of-order files then find their containers without
+ * a query.  Removals that may delete containers clear valid_cache, which
+ * flushes the map on the next insert. */
+struct container
+{
+	struct container *next;
+	uint32_t hash;
+	const char *class;
+	char *artist;
+	char *name;
+	char parent[64];
+	char id[64];
+};
+
+static struct {
+	struct container **buckets;
+	unsigned int mask;
+	unsigned int count;
+} containers;
+
+/* The most recent container of each kind.  Consecutive files with the
+ * same name reuse it directly, as the single-entry cache always did. */
+static struct {
+	struct container *date, *cam, *camdate;
+	struct container *album, *artist, *artistAlbum, *artistAlbumAll;
+	struct container *genre, *genreArtist, *genreArtistAll;
+} last;
+
+static uint32_t
+container_hash(uint32_t h, const char *s)
+{
+	for( ; *s; s++ )
+		h = (h ^ (unsigned char)((*s >= 'A' && *s <= 'Z') ? *s + 32 : *s)) * 16777619U;
+	return (h ^ 0xff) * 16777619U;
+}
+
+static int
+container_name_eq(const char *a, const char *b)
+{
+	unsigned char ca, cb;
+
+	do {
+		ca = *a++;
+		cb = *b++;
+		if( ca >= 'A' && ca <= 'Z' )
+			ca += 32;
+		if( cb >= 'A' && cb <= 'Z' )
+			cb += 32;
+	} while( ca && ca == cb );
+
+	return ca == cb;
+}
+
+static void
+containers_flush(void)
+{
+	struct container *c, *next;
+	unsigned int i;
+
+	if( containers.buckets )
+	{
+		for( i = 0; i <= containers.mask; i++ )
+		{
+			for( c = containers.buckets[i]; c; c = next )
+			{
+				next = c->next;
+				free(c);
+			}
+		}
+		free(containers.buckets);
+	}
+	memset(&containers, 0, sizeof(containers));
+	memset(&last, 0, sizeof(last));
+}
+
+static int
+containers_grow(void)
+{
+	struct container **buckets, *c, *next;
+	unsigned int size, i;
+
+	size = containers.buckets ? (containers.mask + 1) * 2 : 256;
+	buckets = calloc(size, sizeof(*buckets));
+	if( !buckets )
+		return -1;
+	if( containers.buckets )
+	{
+		for( i = 0; i <= containers.mask; i++ )
+		{
+			for( c = containers.buckets[i]; c; c = next )
+			{
+				next = c->next;
+				c->next = buckets[c->hash & (size - 1)];
+				buckets[c->hash & (size - 1)] = c;
+			}
+		}
+		free(containers.buckets);
+	}
+	containers.buckets = buckets;
+	containers.mask = size - 1;
+	return 0;
+}
+
+static struct container *
+get_container(struct container **lastp, const char *item, const char *rootParent, const char *refID,
+              const char *class, const char *artist, const char *genre, const char *album_art)
+{
+	static struct container scratch[8];
+	static unsigned int scratch_next;
+	struct container *c;
+	int64_t parentID;
+	size_t name_len, artist_len;
+	uint32_t h;
+
+	c = *lastp;
+	if( valid_cache && c && strcmp(c->name, item) == 0 && strcmp(c->parent, rootParent) == 0 )
+		return c;
+
+	h = container_hash(2166136261U, rootParent);
+	h = container_hash(h, class);
+	h = container_hash(h, item);
+	if( artist )
+		h = container_hash(h, artist);
+	if( containers.buckets )
+	{
+		for( c = containers.buckets[h & containers.mask]; c; c = c->next )
+		{
+			if( c->hash != h || strcmp(c->class, class) != 0 ||
+			    strcmp(c->parent, rootParent) != 0 || !container_name_eq(c->name, item) )
+				continue;
+			if( artist ? (!c->artist || !container_name_eq(c->artist, artist)) : (c->artist != NULL) )
+				continue;
+			scan_stats.container_hits++;
+			*lastp = c;
+			return c;
+		}
+	}
+
+	scan_stats.container_misses++;
+	insert_container(item, rootParent, refID, class, artist, genre, album_art, &parentID);
+
+	name_len = strlen(item) + 1;
+	artist_len = artist ? strlen(artist) + 1 : 0;
+	if( (containers.count >= containers.mask || !containers.buckets) && containers_grow() != 0 )
+		c = NULL;
+	else
+		c = malloc(sizeof(*c) + name_len + artist_len);
+	if( !c )
+	{
+		/* Not cached; the next file for it goes back to SQL */
+		c = &scratch[scratch_next++ % 8];
+		c->name = "";
+		c->artist = NULL;
+		c->class = class;
+		c->parent[0] = '\0';
+	}
+	else
+	{
+		c->name = (char *)(c + 1);
+		memcpy(c->name, item, name_len);
+		c->artist = artist ? c->name + name_len : NULL;
+		if( artist )
+			memcpy(c->artist, artist, artist_len);
+		c->class = class;
+		c->hash = h;
+		strncpyt(c->parent, rootParent, sizeof(c->parent));
+		c->next = containers.buckets[h & containers.mask];
+		containers.buckets[h & containers.mask] = c;
+		containers.count++;
+	}
+	snprintf(c->id, sizeof(c->id), "%s$%llX", rootParent, (long long)parentID);
+	*lastp = c;
+
+	return c;
+}
+
+static void
+insert_child(const char *parentID, const char *refID, const char *class, int64_t detailID, const char *name)
+{
+	char objectID[64];
+
+	snprintf(objectID, sizeof(objectID), "%s$%llX", parentID, (long long)get_next_available_id("OBJECTS", parentID));
+	sql_insert_object(db, objectID, parentID, refID, class, detailID, name);
+}
+
 static void
 insert_containers(const char *name, const char *path, const char *refID, const char *class, int64_t detailID)
 {
@@ -141,15 +516,14 @@ insert_containers(const char *name, const char *path, const char *refID, const c
 	char **result;
 	int ret;
 	int cols, row;
-	int64_t objectID, parentID;
+	struct container *c;
+
+	if( !valid_cache )
+		containers_flush();
 
 	if( strstr(class, "imageItem") )
 	{
 		char *date_taken = NULL, *camera = NULL;
-		static struct virtual_item last_date;
-		static struct virtual_item last_cam;
-		static struct virtual_item last_camdate;
-		static long long last_all_objectID = 0;
 
 		snprintf(sql, sizeof(sql), "SELECT DATE, CREATOR from DETAILS where ID = %lld", (long long)detailID);
 		ret = sql_get_table(db, sql, &result, &row, &cols);
@@ -165,61 +539,14 @@ insert_containers(const char *name, const char *path, const char *refID, const c
 		if( !camera )
 			camera = _("Unknown Camera");
 
-		if( valid_cache && strcmp(last_date.name, date_taken) == 0 )
-		{
-			last_date.objectID++;
-			//DEBUG DPRINTF(E_DEBUG, L_SCANNER, "Using last date item: %s/%s/%X\n", last_date.name, last_date.parentID, last_date.objectID);
-		}
-		else
-		{
-			insert_container(date_taken, IMAGE_DATE_ID, NULL, "album.photoAlbum", NULL, NULL, NULL, &objectID, &parentID);
-			sprintf(last_date.parentID, IMAGE_DATE_ID"$%llX", (unsigned long long)parentID);
-			last_date.objectID = objectID;
-			strncpyt(last_date.name, date_taken, sizeof(last_date.name));
-			//DEBUG DPRINTF(E_DEBUG, L_SCANNER, "Creating cached date item: %s/%s/%X\n", last_date.name, last_date.parentID, last_date.objectID);
-		}
-		sql_exec(db, "INSERT into OBJECTS"
-		             " (OBJECT_ID, PARENT_ID, REF_ID, CLASS, DETAIL_ID, NAME) "
-		             "VALUES"
-		             " ('%s$%llX', '%s', '%s', '%s', %lld, %Q)",
-		             last_date.parentID, (long long)last_date.objectID, last_date.parentID, refID, class, (long long)detailID, name);
+		c = get_container(&last.date, date_taken, IMAGE_DATE_ID, NULL, "album.photoAlbum", NULL, NULL, NULL);
+		insert_child(c->id, refID, class, detailID, name);
 
-		if( !valid_cache || strcmp(camera, last_cam.name) != 0 )
-		{
-			insert_container(camera, IMAGE_CAMERA_ID, NULL, "storageFolder", NULL, NULL, NULL, &objectID, &parentID);
-			sprintf(last_cam.parentID, IMAGE_CAMERA_ID"$%llX", (long long)parentID);
-			strncpyt(last_cam.name, camera, sizeof(last_cam.name));
-			/* Invalidate last_camdate cache */
-			last_camdate.name[0] = '\0';
-		}
-		if( valid_cache && strcmp(last_camdate.name, date_taken) == 0 )
-		{
-			last_camdate.objectID++;
-			//DEBUG DPRINTF(E_DEBUG, L_SCANNER, "Using last camdate item: %s/%s/%s/%X\n", camera, last_camdate.name, last_camdate.parentID, last_camdate.objectID);
-		}
-		else
-		{
-			insert_container(date_taken, last_cam.parentID, NULL, "album.photoAlbum", NULL, NULL, NULL, &objectID, &parentID);
-			sprintf(last_camdate.parentID, "%s$%llX", last_cam.parentID, (long long)parentID);
-			last_camdate.objectID = objectID;
-			strncpyt(last_camdate.name, date_taken, sizeof(last_camdate.name));
-			//DEBUG DPRINTF(E_DEBUG, L_SCANNER, "Creating cached camdate item: %s/%s/%s/%X\n", camera, last_camdate.name, last_camdate.parentID, last_camdate.objectID);
-		}
-		sql_exec(db, "INSERT into OBJECTS"
-		             " (OBJECT_ID, PARENT_ID, REF_ID, CLASS, DETAIL_ID, NAME) "
-		             "VALUES"
-		             " ('%s$%llX', '%s', '%s', '%s', %lld, %Q)",
-		             last_camdate.parentID, last_camdate.objectID, last_camdate.parentID, refID, class, (long long)detailID, name);
+		c = get_container(&last.cam, camera, IMAGE_CAMERA_ID, NULL, "storageFolder", NULL, NULL, NULL);
+		c = get_container(&last.camdate, date_taken, c->id, NULL, "album.photoAlbum", NULL, NULL, NULL);
+		insert_child(c->id, refID, class, detailID, name);
 		/* All Images */
-		if( !last_all_objectID )
-		{
-			last_all_objectID = get_next_available_id("OBJECTS", IMAGE_ALL_ID);
-		}
-		sql_exec(db, "INSERT into OBJECTS"
-		             " (OBJECT_ID, PARENT_ID, REF_ID, CLASS, DETAIL_ID, NAME) "
-		             "VALUES"
-		             " ('"IMAGE_ALL_ID"$%llX', '"IMAGE_ALL_ID"', '%s', '%s', %lld, %Q)",
-		             last_all_objectID++, refID, class, (long long)detailID, name);
+		insert_child(IMAGE_ALL_ID, refID, class, detailID, name);
 	}
 	else if( strstr(class, "audioItem") )
 	{
@@ -234,143 +561,45 @@ insert_containers(const char *name, const char *path, const char *refID, const c
 		}
 		char *album = result[4], *artist = result[5], *genre = result[6];
 		char *album_art = result[7];
-		static struct virtual_item last_album;
-		static struct virtual_item last_artist;
-		static struct virtual_item last_artistAlbum;
-		static struct virtual_item last_artistAlbumAll;
-		static struct virtual_item last_genre;
-		static struct virtual_item last_genreArtist;
-		static struct virtual_item last_genreArtistAll;
-		static long long last_all_objectID = 0;
+		struct container *album_c = NULL, *artist_c = NULL;
 
 		if( album )
 		{
-			if( valid_cache && strcmp(album, last_album.name) == 0 )
-			{
-				last_album.objectID++;
-				//DEBUG DPRINTF(E_DEBUG, L_SCANNER, "Using last album item: %s/%s/%X\n", last_album.name, last_album.parentID, last_album.objectID);
-			}
-			else
-			{
-				strncpyt(last_album.name, album, sizeof(last_album.name));
-				insert_container(album, MUSIC_ALBUM_ID, NULL, "album.musicAlbum", artist, genre, album_art, &objectID, &parentID);
-				sprintf(last_album.parentID, MUSIC_ALBUM_ID"$%llX", (long long)parentID);
-				last_album.objectID = objectID;
-				//DEBUG DPRINTF(E_DEBUG, L_SCANNER, "Creating cached album item: %s/%s/%X\n", last_album.name, last_album.parentID, last_album.objectID);
-			}
-			sql_exec(db, "INSERT into OBJECTS"
-			             " (OBJECT_ID, PARENT_ID, REF_ID, CLASS, DETAIL_ID, NAME) "
-			             "VALUES"
-			             " ('%s$%llX', '%s', '%s', '%s', %lld, %Q)",
-			             last_album.parentID, last_album.objectID, last_album.parentID, refID, class, (long long)detailID, name);
+			album_c = get_container(&last.album, album, MUSIC_ALBUM_ID, NULL, "album.musicAlbum", artist, genre, album_art);
+			insert_child(album_c->id, refID, class, detailID, name);
 		}
 		if( artist )
 		{
-			if( !valid_cache || strcmp(artist, last_artist.name) != 0 )
-			{
-				insert_container(artist, MUSIC_ARTIST_ID, NULL, "person.musicArtist", NULL, genre, NULL, &objectID, &parentID);
-				sprintf(last_artist.parentID, MUSIC_ARTIST_ID"$%llX", (long long)parentID);
-				strncpyt(last_artist.name, artist, sizeof(last_artist.name));
-				last_artistAlbum.name[0] = '\0';
-				/* Add this file to the "- All Albums -" container as well */
-				insert_container(_("- All Albums -"), last_artist.parentID, NULL, "album", artist, genre, NULL, &objectID, &parentID);
-				sprintf(last_artistAlbumAll.parentID, "%s$%llX", last_artist.parentID, (long long)parentID);
-				last_artistAlbumAll.objectID = objectID;
-			}
-			else
-			{
-				last_artistAlbumAll.objectID++;
-			}
-			if( valid_cache && strcmp(album?album:_("Unknown Album"), last_artistAlbum.name) == 0 )
-			{
-				last_artistAlbum.objectID++;
-				//DEBUG DPRINTF(E_DEBUG, L_SCANNER, "Using last artist/album item: %s/%s/%X\n", last_artist.name, last_artist.parentID, last_artist.objectID);
-			}
-			else
-			{
-				insert_container(album?album:_("Unknown Album"), last_artist.parentID, album?last_album.parentID:NULL,
-				                 "album.musicAlbum", artist, genre, album_art, &objectID, &parentID);
-				sprintf(last_artistAlbum.parentID, "%s$%llX", last_artist.parentID, (long long)parentID);
-				last_artistAlbum.objectID = objectID;
-				strncpyt(last_artistAlbum.name, album ? album : _("Unknown Album"), sizeof(last_artistAlbum.name));
-				//DEBUG DPRINTF(E_DEBUG, L_SCANNER, "Creating cached artist/album item: %s/%s/%X\n", last_artist.name, last_artist.parentID, last_artist.objectID);
-			}
-			sql_exec(db, "INSERT into OBJECTS"
-			             " (OBJECT_ID, PARENT_ID, REF_ID, CLASS, DETAIL_ID, NAME) "
-			             "VALUES"
-			             " ('%s$%llX', '%s', '%s', '%s', %lld, %Q)",
-			             last_artistAlbum.parentID, last_artistAlbum.objectID, last_artistAlbum.parentID, refID, class, (long long)detailID, name);
-			sql_exec(db, "INSERT into OBJECTS"
-			             " (OBJECT_ID, PARENT_ID, REF_ID, CLASS, DETAIL_ID, NAME) "
-			             "VALUES"
-			             " ('%s$%llX', '%s', '%s', '%s', %lld, %Q)",
-			             last_artistAlbumAll.parentID, last_artistAlbumAll.objectID, last_artistAlbumAll.parentID, refID, class, (long long)detailID, name);
+			struct container *all_c;
+
+			artist_c = get_container(&last.artist, artist, MUSIC_ARTIST_ID, NULL, "person.musicArtist", NULL, genre, NULL);
+			/* Add this file to the "- All Albums -" container as well */
+			all_c = get_container(&last.artistAlbumAll, _("- All Albums -"), artist_c->id, NULL, "album", artist, genre, NULL);
+			c = get_container(&last.artistAlbum, album?album:_("Unknown Album"), artist_c->id, album?album_c->id:NULL,
+			                  "album.musicAlbum", artist, genre, album_art);
+			insert_child(c->id, refID, class, detailID, name);
+			insert_child(all_c->id, refID, class, detailID, name);
 		}
 		if( genre )
 		{
-			if( !valid_cache || strcmp(genre, last_genre.name) != 0 )
-			{
-				insert_container(genre, MUSIC_GENRE_ID, NULL, "genre.musicGenre", NULL, NULL, NULL, &objectID, &parentID);
-				sprintf(last_genre.parentID, MUSIC_GENRE_ID"$%llX", (long long)parentID);
-				strncpyt(last_genre.name, genre, sizeof(last_genre.name));
-				/* Add this file to the "- All Artists -" container as well */
-				insert_container(_("- All Artists -"), last_genre.parentID, NULL, "person", NULL, genre, NULL, &objectID, &parentID);
-				sprintf(last_genreArtistAll.parentID, "%s$%llX", last_genre.parentID, (long long)parentID);
-				last_genreArtistAll.objectID = objectID;
-			}
-			else
-			{
-				last_genreArtistAll.objectID++;
-			}
-			if( valid_cache && strcmp(artist?artist:_("Unknown Artist"), last_genreArtist.name) == 0 )
-			{
-				last_genreArtist.objectID++;
-			}
-			else
-			{
-				insert_container(artist?artist:_("Unknown Artist"), last_genre.parentID, artist?last_artist.parentID:NULL,
-				                 "person.musicArtist", NULL, genre, NULL, &objectID, &parentID);
-				sprintf(last_genreArtist.parentID, "%s$%llX", last_genre.parentID, (long long)parentID);
-				last_genreArtist.objectID = objectID;
-				strncpyt(last_genreArtist.name, artist ? artist : _("Unknown Artist"), sizeof(last_genreArtist.name));
-				//DEBUG DPRINTF(E_DEBUG, L_SCANNER, "Creating cached genre/artist item: %s/%s/%X\n", last_genreArtist.name, last_genreArtist.parentID, last_genreArtist.objectID);
-			}
-			sql_exec(db, "INSERT into OBJECTS"
-			             " (OBJECT_ID, PARENT_ID, REF_ID, CLASS, DETAIL_ID, NAME) "
-			             "VALUES"
-			             " ('%s$%llX', '%s', '%s', '%s', %lld, %Q)",
-			             last_genreArtist.parentID, last_genreArtist.objectID, last_genreArtist.parentID, refID, class, (long long)detailID, name);
-			sql_exec(db, "INSERT into OBJECTS"
-			             " (OBJECT_ID, PARENT_ID, REF_ID, CLASS, DETAIL_ID, NAME) "
-			             "VALUES"
-			             " ('%s$%llX', '%s', '%s', '%s', %lld, %Q)",
-			             last_genreArtistAll.parentID, last_genreArtistAll.objectID, last_genreArtistAll.parentID, refID, class, (long long)detailID, name);
+			struct container *genre_c, *all_c;
+
+			genre_c = get_container(&last.genre, genre, MUSIC_GENRE_ID, NULL, "genre.musicGenre", NULL, NULL, NULL);
+			/* Add this file to the "- All Artists -" container as well */
+			all_c = get_container(&last.genreArtistAll, _("- All Artists -"), genre_c->id, NULL, "person", NULL, genre, NULL);
+			c = get_container(&last.genreArtist, artist?artist:_("Unknown Artist"), genre_c->id, artist?artist_c->id:NULL,
+			                  "person.musicArtist", NULL, genre, NULL);
+			insert_child(c->id, refID, class, detailID, name);
+			insert_child(all_c->id, refID, class, detailID, name);
 		}
 		/* All Music */
-		if( !last_all_objectID )
-		{
-			last_all_objectID = get_next_available_id("OBJECTS", MUSIC_ALL_ID);
-		}
-		sql_exec(db, "INSERT into OBJECTS"
-		             " (OBJECT_ID, PARENT_ID, REF_ID, CLASS, DETAIL_ID, NAME) "
-		             "VALUES"
-		             " ('"MUSIC_ALL_ID"$%llX', '"MUSIC_ALL_ID"', '%s', '%s', %lld, %Q)",
-		             last_all_objectID++, refID, class, (long long)detailID, name);
+		insert_child(MUSIC_ALL_ID, refID, class, detailID, name);
 	}
 	else if( strstr(class, "videoItem") )
 	{
-		static long long last_all_objectID = 0;
 
 		/* All Videos */
-		if( !last_all_objectID )
-		{
-			last_all_objectID = get_next_available_id("OBJECTS", VIDEO_ALL_ID);
-		}
-		sql_exec(db, "INSERT into OBJECTS"
-		             " (OBJECT_ID, PARENT_ID, REF_ID, CLASS, DETAIL_ID, NAME) "
-		             "VALUES"
-		             " ('"VIDEO_ALL_ID"$%llX', '"VIDEO_ALL_ID"', '%s', '%s', %lld, %Q)",
-		             last_all_objectID++, refID, class, (long long)detailID, name);
+		insert_child(VIDEO_ALL_ID, refID, class, detailID, name);
 		return;
 	}
 	else
@@ -387,6 +616,7 @@ insert_directory(const char *name, const char *path, const char *base, const cha
 	int64_t detailID = 0;
 	char class[] = "container.storageFolder";
 	char *result, *p;
+	char parent[64], id[64];
 	static char last_found[256] = "-1";
 
 	if( strcmp(base, BROWSEDIR_ID) != 0 )
@@ -416,11 +646,8 @@ insert_directory(const char *name, const char *path, const char *base, const cha
 				detailID = strtoll(result, NULL, 10);
 				sqlite3_free(result);
 			}
-			sql_exec(db, "INSERT into OBJECTS"
-			             " (OBJECT_ID, PARENT_ID, REF_ID, DETAIL_ID, CLASS, NAME) "
-			             "VALUES"
-			             " ('%s', '%s', %Q, %lld, '%s', '%q')",
-			             id_buf, parent_buf, refID, detailID, class, strrchr(dir, '/')+1);
+			sql_insert_object(db, id_buf, parent_buf, refID, class, detailID, strrchr(dir, '/')+1);
+			upnp_event_container_changed(parent_buf);
 			if( (p = strrchr(id_buf, '$')) )
 				*p = '\0';
 			if( (p = strrchr(parent_buf, '$')) )
@@ -434,11 +661,10 @@ insert_directory(const char *name, const char *path, const char *base, const cha
 	}
 
 	detailID = GetFolderMetadata(name, path, NULL, NULL, find_album_art(path, NULL, 0));
-	sql_exec(db, "INSERT into OBJECTS"
-	             " (OBJECT_ID, PARENT_ID, DETAIL_ID, CLASS, NAME) "
-	             "VALUES"
-	             " ('%s%s$%X', '%s%s', %lld, '%s', '%q')",
-	             base, parentID, objectID, base, parentID, detailID, class, name);
+	snprintf(parent, sizeof(parent), "%s%s", base, parentID);
+	snprintf(id, sizeof(id), "%s$%X", parent, objectID);
+	sql_insert_object(db, id, parent, NULL, class, detailID, name);
+	upnp_event_container_changed(parent);
 
 	return detailID;
 }
@@ -482,7 +708,7 @@ int
 insert_file(char *name, const char *path, const char *parentID, int object)
 {
 	char class[32];
-	char objectID[64];
+	char objectID[64], parent[64], id[64];
 	int64_t detailID = 0;
 	char base[8];
 	char *typedir_parentID;
@@ -533,13 +759,9 @@ insert_file(char *name, const char *path, const char *parentID, int object)
 		return -1;
 	}
 
-	sprintf(objectID, "%s%s$%X", BROWSEDIR_ID, parentID, object);
-
-	sql_exec(db, "INSERT into OBJECTS"
-	             " (OBJECT_ID, PARENT_ID, CLASS, DETAIL_ID, NAME) "
-	             "VALUES"
-	             " ('%s', '%s%s', '%s', %lld, '%q')",
-	             objectID, BROWSEDIR_ID, parentID, class, detailID, name);
+	sprintf(parent, "%s%s", BROWSEDIR_ID, parentID);
+	sprintf(objectID, "%s$%X", parent, object);
+	sql_insert_object(db, objectID, parent, NULL, class, detailID, name);
 
 	if( *parentID )
 	{
@@ -554,16 +776,36 @@ insert_file(char *name, const char *path, const char *parentID, int object)
 		insert_directory(name, path, base, typedir_parentID, typedir_objectID);
 		free(typedir_parentID);
 	}
-	sql_exec(db, "INSERT into OBJECTS"
-	             " (OBJECT_ID, PARENT_ID, REF_ID, CLASS, DETAIL_ID, NAME) "
-	             "VALUES"
-	             " ('%s%s$%X', '%s%s', '%s', '%s', %lld, '%q')",
-	             base, parentID, object, base, parentID, objectID, class, detailID, name);
+	sprintf(parent, "%s%s", base, parentID);
+	sprintf(id, "%s$%X", parent, object);
+	sql_insert_object(db, id, parent, objectID, class, detailID, name);
 
 	insert_containers(name, path, objectID, class, detailID);
+	mark_containers_updated(detailID);
 	return 0;
 }
 
+/* Flag every container holding an object for this detail as updated,
+ * for ContainerUpdateIDs eventing.  A full scan resets them all anyway. */
+void
+mark_containers_updated(int64_t detailID)
+{
+	char sql[128];
+	char **result;
+	int rows, i;
+
+	if( scanning )
+		return;
+
+	snprintf(sql, sizeof(sql), "SELECT distinct PARENT_ID from OBJECTS where DETAIL_ID = %lld",
+	                           (long long)detailID);
+	if( sql_get_table(db, sql, &result, &rows, NULL) != SQLITE_OK )
+		return;
+	for( i = 1; i <= rows; i++ )
+		upnp_event_container_changed(result[i]);
+	sqlite3_free_table(result);
+}
+
 
 
 #ifdef NAS
@@ -651,24 +893,24 @@ CreateDatabase(void)
 	if( ret != SQLITE_OK )
 		goto sql_failed;
 	ret = sql_exec(db, "INSERT into SETTINGS values ('UPDATE_ID', '0')");
+	if( ret != SQLITE_OK )
+		goto sql_failed;
+	ret = sql_create_sort_keys(db);
 	if( ret != SQLITE_OK )
 		goto sql_failed;
 	for( i=0; containers[i]; i=i+3 )
 	{
-		ret = sql_exec(db, "INSERT into OBJECTS (OBJECT_ID, PARENT_ID, DETAIL_ID, CLASS, NAME)"
-		                   " values "
-		                   "('%s', '%s', %lld, 'container.storageFolder', '%q')",
-		                   containers[i], containers[i+1], GetFolderMetadata(containers[i+2], NULL, NULL, NULL, 0), containers[i+2]);
+		ret = sql_insert_object(db, containers[i], containers[i+1], NULL, "container.storageFolder",
+		                        GetFolderMetadata(containers[i+2], NULL, NULL, NULL, 0), containers[i+2]);
 		if( ret != SQLITE_OK )
 			goto sql_failed;
 	}
-	sql_exec(db, "create INDEX IDX_OBJECTS_OBJECT_ID ON OBJECTS(OBJECT_ID);");
-	sql_exec(db, "create INDEX IDX_OBJECTS_PARENT_ID ON OBJECTS(PARENT_ID);");
+	/* OBJECT_ID is covered by its UNIQUE constraint and PARENT_ID by the
+	 * prefix of IDX_SCANNER_OPT; the ID columns are rowids. */
 	sql_exec(db, "create INDEX IDX_OBJECTS_DETAIL_ID ON OBJECTS(DETAIL_ID);");
 	sql_exec(db, "create INDEX IDX_OBJECTS_CLASS ON OBJECTS(CLASS);");
 	sql_exec(db, "create INDEX IDX_DETAILS_PATH ON DETAILS(PATH);");
-	sql_exec(db, "create INDEX IDX_DETAILS_ID ON DETAILS(ID);");
-	sql_exec(db, "create INDEX IDX_ALBUM_ART ON ALBUM_ART(ID);");
+	sql_exec(db, "create INDEX IDX_DETAILS_MIME ON DETAILS(MIME);");
 	sql_exec(db, "create INDEX IDX_SCANNER_OPT ON OBJECTS(PARENT_ID, NAME, OBJECT_ID);");
 
 sql_failed:
@@ -677,150 +919,353 @@ sql_failed:
 	return (ret != SQLITE_OK);
 }
 
-static inline int
-filter_hidden(scan_filter *d)
+/* Directory listings are read with getdents64 into one arena shared by
+ * the whole recursive scan.  Each ScanDirectory level appends its entries
+ * and releases them when it's done; everything is addressed by offset so
+ * the arena can grow while a parent's listing is still in use. */
+struct scan_ent {
+	uint32_t key;		/* arena offset of the strxfrm collation key */
+	unsigned char type;	/* d_type from the directory */
+	char name[];
+};
+
+static struct {
+	char *buf;
+	size_t len;
+	size_t size;
+} scan_arena;
+
+#define SCAN_ENT(off)	((struct scan_ent *)(scan_arena.buf + (off)))
+#define SCAN_IDX(off)	((uint32_t *)(scan_arena.buf + (off)))
+#define SCAN_ALIGN(len)	(((len) + 7) & ~7)
+
+static int
+scan_arena_alloc(size_t len, uint32_t *off)
 {
-	return (d->d_name[0] != '.');
+	size_t size;
+	char *buf;
+
+	len = SCAN_ALIGN(len);
+	if( scan_arena.len + len > scan_arena.size )
+	{
+		size = scan_arena.size ? scan_arena.size : 65536;
+		while( scan_arena.len + len > size )
+			size *= 2;
+		if( size > UINT32_MAX || !(buf = realloc(scan_arena.buf, size)) )
+			return -1;
+		scan_arena.buf = buf;
+		scan_arena.size = size;
+	}
+	*off = scan_arena.len;
+	scan_arena.len += len;
+	return 0;
 }
 
 static int
-filter_type(scan_filter *d)
+scan_add_ent(const char *name, unsigned char type)
 {
-	return ( (d->d_type == DT_DIR) ||
-	         (d->d_type == DT_LNK) ||
-	         (d->d_type == DT_UNKNOWN)
-	       );
+	size_t len = strlen(name) + 1;
+	uint32_t off;
+
+	if( scan_arena_alloc(sizeof(struct scan_ent) + len, &off) != 0 )
+		return -1;
+	SCAN_ENT(off)->key = 0;
+	SCAN_ENT(off)->type = type;
+	memcpy(SCAN_ENT(off)->name, name, len);
+	return 0;
 }
 
+/* Hidden entries and regular files of unwanted types are dropped here;
+ * directories, links and unknown types are resolved by the caller. */
 static int
-filter_a(scan_filter *d)
+scan_want(const char *name, unsigned char type, int wanted)
 {
-	return ( filter_hidden(d) &&
-	         (filter_type(d) ||
-		  ((d->d_type == DT_REG) &&
-		   (is_audio(d->d_name) ||
-	            is_playlist(d->d_name))))
-	       );
+	if( name[0] == '.' )
+		return 0;
+	switch( type )
+	{
+		case DT_DIR:
+		case DT_LNK:
+		case DT_UNKNOWN:
+			return 1;
+		case DT_REG:
+#ifdef XIAODU_NAS
+			if( wanted & TYPE_OTHER )
+				return 1;
+#endif
+			return (media_ext_class(name) & wanted) ? 1 : 0;
+		default:
+			return 0;
+	}
 }
 
+#ifdef SYS_getdents64
+struct linux_dirent64 {
+	uint64_t	d_ino;
+	int64_t		d_off;
+	unsigned short	d_reclen;
+	unsigned char	d_type;
+	char		d_name[];
+};
+
 static int
-filter_av(scan_filter *d)
+scan_fill(int dfd, int wanted)
 {
-	return ( filter_hidden(d) &&
-	         (filter_type(d) ||
-		  ((d->d_type == DT_REG) &&
-		   (is_audio(d->d_name) ||
-		    is_video(d->d_name) ||
-	            is_playlist(d->d_name))))
-	       );
-}
+	char buf[32768];
+	struct linux_dirent64 *d;
+	int n = 0, pos, len;
 
+	while( (len = syscall(SYS_getdents64, dfd, buf, sizeof(buf))) > 0 )
+	{
+		for( pos = 0; pos < len; pos += d->d_reclen )
+		{
+			d = (struct linux_dirent64 *)(buf + pos);
+			if( !scan_want(d->d_name, d->d_type, wanted) )
+				continue;
+			if( scan_add_ent(d->d_name, d->d_type) != 0 )
+				return -1;
+			n++;
+		}
+	}
+	return (len < 0) ? -1 : n;
+}
+#else
 static int
-filter_ap(scan_filter *d)
+scan_fill(int dfd, int wanted)
 {
-	return ( filter_hidden(d) &&
-	         (filter_type(d) ||
-		  ((d->d_type == DT_REG) &&
-		   (is_audio(d->d_name) ||
-		    is_image(d->d_name) ||
-	            is_playlist(d->d_name))))
-	       );
+	struct dirent *d;
+	DIR *dh;
+	int n = 0, fd;
+
+	if( (fd = dup(dfd)) < 0 || !(dh = fdopendir(fd)) )
+		return -1;
+	while( (d = readdir(dh)) )
+	{
+		if( !scan_want(d->d_name, d->d_type, wanted) )
+			continue;
+		if( scan_add_ent(d->d_name, d->d_type) != 0 )
+		{
+			n = -1;
+			break;
+		}
+		n++;
+	}
+	closedir(dh);
+	return n;
 }
+#endif
 
 static int
-filter_v(scan_filter *d)
+scan_key_cmp(const void *a, const void *b)
 {
-	return ( filter_hidden(d) &&
-	         (filter_type(d) ||
-		  (d->d_type == DT_REG &&
-	           is_video(d->d_name)))
-	       );
+	return strcmp(scan_arena.buf + SCAN_ENT(*(const uint32_t *)a)->key,
+	              scan_arena.buf + SCAN_ENT(*(const uint32_t *)b)->key);
 }
 
+/* Reads the wanted entries of dfd into the arena and returns their count,
+ * with *index pointing at an array of entry offsets.  Unless disabled, the
+ * entries are sorted like alphasort(), but strxfrm() runs once per name
+ * instead of strcoll() on every comparison. */
 static int
-filter_vp(scan_filter *d)
+scan_read_dir(int dfd, media_types dir_types, uint32_t *index)
 {
-	return ( filter_hidden(d) &&
-	         (filter_type(d) ||
-		  ((d->d_type == DT_REG) &&
-		   (is_video(d->d_name) ||
-	            is_image(d->d_name))))
-	       );
+	uint32_t start = scan_arena.len, off, key;
+	int wanted, n, i;
+	size_t len;
+
+	wanted = dir_types & (TYPE_AUDIO|TYPE_VIDEO|TYPE_IMAGES);
+	if( dir_types & TYPE_AUDIO )
+		wanted |= EXT_PLAYLIST;
+#ifdef XIAODU_NAS
+	wanted |= dir_types & TYPE_OTHER;
+#endif
+	n = scan_fill(dfd, wanted);
+	if( n < 0 || scan_arena_alloc(n * sizeof(uint32_t), index) != 0 )
+	{
+		scan_arena.len = start;
+		return -1;
+	}
+	for( i = 0, off = start; i < n; i++ )
+	{
+		SCAN_IDX(*index)[i] = off;
+		off += SCAN_ALIGN(sizeof(struct scan_ent) + strlen(SCAN_ENT(off)->name) + 1);
+	}
+	if( n < 2 || GETFLAG(NO_SCAN_SORT_MASK) )
+		return n;
+
+	for( i = 0; i < n; i++ )
+	{
+		off = SCAN_IDX(*index)[i];
+		len = strxfrm(NULL, SCAN_ENT(off)->name, 0) + 1;
+		if( scan_arena_alloc(len, &key) != 0 )
+			return n;	/* unsorted, but complete */
+		off = SCAN_IDX(*index)[i];
+		strxfrm(scan_arena.buf + key, SCAN_ENT(off)->name, len);
+		SCAN_ENT(off)->key = key;
+	}
+	qsort(SCAN_IDX(*index), n, sizeof(uint32_t), scan_key_cmp);
+
+	return n;
 }
 
+/* resolve_unknown_type(), relative to the open directory */
 static int
-filter_p(scan_filter *d)
+scan_resolve_type(int dfd, const char *name, const char *path, media_types dir_types)
 {
-	return ( filter_hidden(d) &&
-	         (filter_type(d) ||
-		  (d->d_type == DT_REG &&
-		   is_image(d->d_name)))
-	       );
+	struct stat entry;
+	char str_buf[PATH_MAX];
+	ssize_t len;
+
+	if( fstatat(dfd, name, &entry, AT_SYMLINK_NOFOLLOW) != 0 )
+		return TYPE_UNKNOWN;
+	if( S_ISLNK(entry.st_mode) )
+	{
+		if( (len = readlinkat(dfd, name, str_buf, PATH_MAX-1)) > 0 )
+		{
+			str_buf[len] = '\0';
+			if( strncmp(path, str_buf, strlen(str_buf)) == 0 )
+			{
+				DPRINTF(E_DEBUG, L_GENERAL, "Ignoring recursive symbolic link: %s (%s)\n", path, str_buf);
+				return TYPE_UNKNOWN;
+			}
+		}
+		if( fstatat(dfd, name, &entry, 0) != 0 )
+			return TYPE_UNKNOWN;
+	}
+	if( S_ISDIR(entry.st_mode) )
+		return TYPE_DIR;
+	if( S_ISREG(entry.st_mode) &&
+	    (media_ext_class(name) & (dir_types & (TYPE_AUDIO|TYPE_VIDEO|TYPE_IMAGES))) )
+		return TYPE_FILE;
+	if( S_ISREG(entry.st_mode) && (dir_types & TYPE_AUDIO) && is_playlist(name) )
+		return TYPE_FILE;
+	return TYPE_UNKNOWN;
+}
+
+/* Scanner I/O pacing */
+#define SCAN_READAHEAD_IDLE	8		/* files prefetched ahead on an idle disk */
+#define SCAN_READAHEAD_BUSY	1		/* ... while something is streaming */
+#define SCAN_READAHEAD_BYTES	(128*1024)	/* enough for tags and container headers */
+#define SCAN_BACKOFF_MAX	512		/* ms */
+
+#define IOPRIO_CLASS_SHIFT	13
+#define IOPRIO_CLASS_BE		2
+#define IOPRIO_CLASS_IDLE	3
+#define IOPRIO_WHO_PROCESS	1
+
+static struct {
+	int idle_class;
+	int backoff;
+	unsigned int stalls;
+	unsigned long long hits, misses;
+} scan_io;
+
+static void
+scan_set_ioprio(int idle)
+{
+#ifdef __NR_ioprio_set
+	int prio;
+
+	/* Best-effort level 7 is what our nice value maps to anyway */
+	prio = idle ? (IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT) :
+	              (IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT) | 7;
+	if( syscall(__NR_ioprio_set, IOPRIO_WHO_PROCESS, 0, prio) == 0 )
+	{
+		DPRINTF(E_DEBUG, L_SCANNER, "Scanner I/O class now %s\n", idle ? "idle" : "best-effort");
+		scan_io.idle_class = idle;
+	}
+#endif
 }
 
+/* Called before each file.  While anything is streaming the scanner drops
+ * to the idle I/O class, and each stall a stream reports doubles a sleep
+ * between files, which halves again once streams run smoothly.
+ * Returns how many files ahead are worth prefetching. */
 static int
-filter_avp(scan_filter *d)
+scan_throttle(void)
 {
-	return ( filter_hidden(d) &&
-	         (filter_type(d) ||
-		  ((d->d_type == DT_REG) &&
-		   (is_audio(d->d_name) ||
-		    is_image(d->d_name) ||
-		    is_video(d->d_name) ||
-	            is_playlist(d->d_name))))
-	       );
+	unsigned int stalls;
+	int streaming;
+
+	if( !io_activity )
+		return SCAN_READAHEAD_IDLE;
+	streaming = (io_activity->streams > 0);
+	if( streaming != scan_io.idle_class )
+		scan_set_ioprio(streaming);
+
+	stalls = io_activity->stalls;
+	if( stalls != scan_io.stalls )
+	{
+		scan_io.stalls = stalls;
+		scan_io.backoff = scan_io.backoff ? MIN(scan_io.backoff * 2, SCAN_BACKOFF_MAX) : 16;
+	}
+	else
+		scan_io.backoff /= 2;
+	if( scan_io.backoff )
+	{
+		usleep(scan_io.backoff * 1000);
+		scan_stats.throttle_ms += scan_io.backoff;
+	}
+
+	return streaming ? SCAN_READAHEAD_BUSY : SCAN_READAHEAD_IDLE;
+}
+
+/* Ask the kernel to start reading the header region of the regular files
+ * in namelist up to `ahead` entries past i, so their extraction doesn't
+ * wait on one small synchronous read after another. */
+static void
+scan_readahead(int dfd, uint32_t index, int i, int n, int ahead, int *done)
+{
+#ifdef POSIX_FADV_WILLNEED
+	struct scan_ent *e;
+	int fd;
+
+	/* Nothing to gain while files keep coming out of the metadata cache */
+	if( scan_stats.meta_cache_misses != scan_io.misses )
+	{
+		scan_io.misses = scan_stats.meta_cache_misses;
+		scan_io.hits = scan_stats.meta_cache_hits;
+	}
+	else if( scan_stats.meta_cache_hits - scan_io.hits >= 4 )
+		return;
+
+	if( *done <= i )
+		*done = i + 1;
+	for( ; *done < n && *done <= i + ahead; (*done)++ )
+	{
+		e = SCAN_ENT(SCAN_IDX(index)[*done]);
+		if( e->type != DT_REG )
+			continue;
+		fd = openat(dfd, e->name, O_RDONLY);
+		if( fd < 0 )
+			continue;
+		if( posix_fadvise(fd, 0, SCAN_READAHEAD_BYTES, POSIX_FADV_WILLNEED) == 0 )
+			scan_stats.readahead_files++;
+		close(fd);
+	}
+#endif
 }
 
 static void
 ScanDirectory(const char *dir, const char *parent, media_types dir_types)
 {
-	struct dirent **namelist;
-	int i, n, startID = 0;
+	uint32_t mark = scan_arena.len, index;
+	struct scan_ent *e;
+	int i, n, dfd, startID = 0, prefetched = 0;
+	size_t dir_len, name_len;
 	char *full_path;
 	char *name = NULL;
 	static long long unsigned int fileno = 0;
 	enum file_types type;
 
 	DPRINTF(parent?E_INFO:E_WARN, L_SCANNER, _("Scanning %s\n"), dir);
-	switch( dir_types )
-	{
-
-		case ALL_MEDIA:
-			n = scandir(dir, &namelist, filter_avp, alphasort);
-			break;
-		case TYPE_AUDIO:
-			n = scandir(dir, &namelist, filter_a, alphasort);
-			break;
-		case TYPE_AUDIO|TYPE_VIDEO:
-			n = scandir(dir, &namelist, filter_av, alphasort);
-			break;
-		case TYPE_AUDIO|TYPE_IMAGES:
-			n = scandir(dir, &namelist, filter_ap, alphasort);
-			break;
-		case TYPE_VIDEO:
-			n = scandir(dir, &namelist, filter_v, alphasort);
-			break;
-		case TYPE_VIDEO|TYPE_IMAGES:
-			n = scandir(dir, &namelist, filter_vp, alphasort);
-			break;
-		case TYPE_IMAGES:
-			n = scandir(dir, &namelist, filter_p, alphasort);
-			break;
-#ifdef XIAODU_NAS
-		case TYPE_OTHER:
-			n = scandir(dir, &namelist, filter_o, alphasort);
-			break;
-		case ALL_FILE:
-			n = scandir(dir, &namelist, filter_dots, alphasort);
-			break;
-#endif
-		default:
-			n = -1;
-			break;
-	}
+	dfd = open(dir, O_RDONLY|O_DIRECTORY);
+	n = (dfd < 0) ? -1 : scan_read_dir(dfd, dir_types, &index);
 	if( n < 0 )
 	{
 		DPRINTF(E_WARN, L_SCANNER, "Error scanning %s\n", dir);
+		if( dfd >= 0 )
+			close(dfd);
 		return;
 	}
 
@@ -828,12 +1273,20 @@ ScanDirectory(const char *dir, const char *parent, media_types dir_types)
 	if (!full_path)
 	{
 		DPRINTF(E_ERROR, L_SCANNER, "Memory allocation failed scanning %s\n", dir);
+		scan_arena.len = mark;
+		close(dfd);
 		return;
 	}
+	/* Entry names are copied in after the fixed directory prefix */
+	dir_len = strlen(dir);
+	if( dir_len > PATH_MAX - 2 )
+		dir_len = PATH_MAX - 2;
+	memcpy(full_path, dir, dir_len);
+	full_path[dir_len++] = '/';
 
 	if( !parent )
 	{
-		startID = get_next_available_id("OBJECTS", BROWSEDIR_ID);
+		startID = reserve_object_ids(BROWSEDIR_ID, n);
 	}
 
 	for (i=0; i < n; i++)
@@ -842,28 +1295,37 @@ ScanDirectory(const char *dir, const char *parent, media_types dir_types)
 		if( quitting )
 			break;
 #endif
+		e = SCAN_ENT(SCAN_IDX(index)[i]);
+		if( e->type != DT_DIR )
+		{
+			scan_readahead(dfd, index, i, n, scan_throttle(), &prefetched);
+			e = SCAN_ENT(SCAN_IDX(index)[i]);
+		}
+		name_len = strlen(e->name);
+		if( dir_len + name_len >= PATH_MAX )
+			continue;
+		memcpy(full_path + dir_len, e->name, name_len + 1);
 		type = TYPE_UNKNOWN;
-		snprintf(full_path, PATH_MAX, "%s/%s", dir, namelist[i]->d_name);
-		name = escape_tag(namelist[i]->d_name, 1);
-		if( namelist[i]->d_type == DT_DIR )
+		name = escape_tag(e->name, 1);
+		if( e->type == DT_DIR )
 		{
 			type = TYPE_DIR;
 		}
-		else if( namelist[i]->d_type == DT_REG )
+		else if( e->type == DT_REG )
 		{
 			type = TYPE_FILE;
 		}
 		else
 		{
-			type = resolve_unknown_type(full_path, dir_types);
+			type = scan_resolve_type(dfd, e->name, full_path, dir_types);
 		}
 #ifdef BAIDU_DMS_OPT
 		int dir_depth = 0;
 		dir_depth = get_dir_depth(full_path);
 		DPRINTF(E_DEBUG, L_SCANNER, _("[%s]full_path depth:%d\n"),full_path,dir_depth);
-		if( (type == TYPE_DIR) && (access(full_path, R_OK|X_OK) == 0) && ((dir_depth < MAX_DIR_DEPTH) || strstr(full_path, nas_scan_dir)) )
+		if( (type == TYPE_DIR) && (faccessat(dfd, e->name, R_OK|X_OK, 0) == 0) && ((dir_depth < MAX_DIR_DEPTH) || strstr(full_path, nas_scan_dir)) )
 #else
-		if( (type == TYPE_DIR) && (access(full_path, R_OK|X_OK) == 0) )
+		if( (type == TYPE_DIR) && (faccessat(dfd, e->name, R_OK|X_OK, 0) == 0) )
 #endif
 		{
 			char *parent_id;
@@ -872,15 +1334,15 @@ ScanDirectory(const char *dir, const char *parent, media_types dir_types)
 			ScanDirectory(full_path, parent_id, dir_types);
 			free(parent_id);
 		}
-		else if( type == TYPE_FILE && (access(full_path, R_OK) == 0) )
+		else if( type == TYPE_FILE && (faccessat(dfd, e->name, R_OK, 0) == 0) )
 		{
 			if( insert_file(name, full_path, (parent ? parent:""), i+startID) == 0 )
 				fileno++;
 		}
 		free(name);
-		free(namelist[i]);
 	}
-	free(namelist);
+	scan_arena.len = mark;
+	close(dfd);
 	free(full_path);
 	if( !parent )
 	{
@@ -909,7 +1371,7 @@ _notify_stop(void)
 }
 
 void
-start_scanner()
+start_scanner(int forked)
 {
 	struct media_dir_s *media_path;
 	char path[MAXPATHLEN];
@@ -917,6 +1379,10 @@ start_scanner()
 	if (setpriority(PRIO_PROCESS, 0, 15) == -1)
 		DPRINTF(E_WARN, L_INOTIFY,  "Failed to reduce scanner thread priority\n");
 	_notify_start();
+	if( forked )
+		set_scanner_id_range(ID_RANGE_SCANNER, 0);
+	else
+		set_scanner_id_range(ID_RANGE_ALL, 1);
 
 	setlocale(LC_COLLATE, "");
 
@@ -945,6 +1411,7 @@ start_scanner()
 		sql_exec(db, "INSERT into SETTINGS values (%Q, %Q)", "media_dir", media_path->path);
 	}
 	_notify_stop();
+	prune_meta_cache();
 	/* Create this index after scanning, so it doesn't slow down the scanning process.
 	 * This index is very useful for large libraries used with an XBox360 (or any
 	 * client that uses UPnPSearch on large containers). */
@@ -960,6 +1427,22 @@ start_scanner()
 	}
 
 	DPRINTF(E_DEBUG, L_SCANNER, "Initial file scan completed\n", DB_VERSION);
+	if( scan_stats.probe_files )
+		DPRINTF(E_INFO, L_SCANNER, "Probed %llu media files (%llu escalated): %llu KB read in %llu ms\n",
+		        scan_stats.probe_files, scan_stats.probe_retries,
+		        scan_stats.probe_bytes / 1024, scan_stats.probe_usec / 1000);
+	DPRINTF(E_INFO, L_SCANNER, "Metadata cache: %llu hits, %llu misses; %llu files prefetched, %llu ms throttled\n",
+	        scan_stats.meta_cache_hits, scan_stats.meta_cache_misses,
+	        scan_stats.readahead_files, scan_stats.throttle_ms);
+	DPRINTF(E_INFO, L_SCANNER, "Metadata arena: %llu allocations, %llu bytes peak per file\n",
+	        scan_stats.meta_allocs, scan_stats.meta_arena_peak);
+	DPRINTF(E_INFO, L_SCANNER, "Embedded art: %llu images decoded, %llu repeats reused\n",
+	        scan_stats.art_decodes, scan_stats.art_lru_hits);
+	DPRINTF(E_INFO, L_SCANNER, "Containers: %llu resolved from memory, %llu from the database\n",
+	        scan_stats.container_hits, scan_stats.container_misses);
+	if( scan_io.idle_class )
+		scan_set_ioprio(0);
 	//JM: Set up a db version number, so we know if we need to rebuild due to a new structure.
 	sql_exec(db, "pragma user_version = %d;", DB_VERSION);
+	set_scanner_id_range(ID_RANGE_ALL, 0);
 }
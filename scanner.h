@@ -71,6 +71,25 @@
 #endif
 extern int valid_cache;
 
+/* Per-process scanner counters, logged when a full scan completes. */
+struct scan_stats {
+	unsigned long long probe_files;		/* lav_open() calls */
+	unsigned long long probe_retries;	/* probes escalated to a deeper tier */
+	unsigned long long probe_bytes;		/* bytes read while probing */
+	unsigned long long probe_usec;		/* time spent probing */
+	unsigned long long meta_cache_hits;	/* files served from meta_cache.db */
+	unsigned long long meta_cache_misses;
+	unsigned long long readahead_files;	/* header regions prefetched */
+	unsigned long long throttle_ms;		/* time spent backing off for streams */
+	unsigned long long meta_allocs;		/* metadata arena allocations */
+	unsigned long long meta_arena_peak;	/* largest per-file arena footprint, bytes */
+	unsigned long long art_lru_hits;	/* embedded art resolved from the recent-hash LRU */
+	unsigned long long art_decodes;		/* embedded images decoded and cached */
+	unsigned long long container_hits;	/* virtual containers found in the in-memory map */
+	unsigned long long container_misses;	/* containers looked up or created in SQL */
+};
+extern struct scan_stats scan_stats;
+
 int
 is_video(const char *file);
 
@@ -90,12 +109,21 @@ is_application(const char *file);
 int64_t
 get_next_available_id(const char *table, const char *parentID);
 
+int64_t
+reserve_object_ids(const char *parentID, int count);
+
+void
+reset_object_ids(void);
+
 int64_t
 insert_directory(const char *name, const char *path, const char *base, const char *parentID, int objectID);
 
 int
 insert_file(char *name, const char *path, const char *parentID, int object);
 
+void
+mark_containers_updated(int64_t detailID);
+
 int
 CreateDatabase(void);
 #ifdef NAS
@@ -110,6 +138,6 @@ scan_Dir(char *path);
 #endif
 
 void
-start_scanner();
+start_scanner(int forked);
 
 #endif
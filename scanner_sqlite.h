@@ -29,7 +29,9 @@ char create_objectTable_sqlite[] = "CREATE TABLE OBJECTS ("
 					"REF_ID TEXT DEFAULT NULL, "
 					"CLASS TEXT NOT NULL, "
 					"DETAIL_ID INTEGER DEFAULT NULL, "
-                                        "NAME TEXT DEFAULT NULL);";
+					"NAME TEXT DEFAULT NULL, "
+					"SORT_TITLE TEXT, "
+                                        "SORT_TRACK TEXT);";
 
 char create_detailTable_sqlite[] = "CREATE TABLE DETAILS ("
 					"ID INTEGER PRIMARY KEY AUTOINCREMENT, "
@@ -17,6 +17,7 @@
  */
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
 
 #include "sql.h"
@@ -200,6 +201,136 @@ sql_get_text_field(sqlite3 *db, const char *fmt, ...)
 	return str;
 }
 
+/* Sort keys fold ASCII case and drop a leading article from the title;
+ * SORT_KEY(title, disc, track) puts the zero-padded disc and track first.
+ * They're stored on OBJECTS so that a sorted Browse walks a
+ * (PARENT_ID, key) index instead of sorting the joined rows. */
+static void
+sort_key_func(sqlite3_context *ctx, int argc, sqlite3_value **argv)
+{
+	static const char *articles[] = { "the ", "a ", "an ", NULL };
+	const char *title;
+	char *key;
+	size_t len;
+	int i, n, off = 0;
+
+	title = (const char *)sqlite3_value_text(argv[0]);
+	if( !title )
+		title = "";
+	for( i = 0; articles[i]; i++ )
+	{
+		n = strlen(articles[i]);
+		if( strncasecmp(title, articles[i], n) == 0 && title[n] )
+		{
+			title += n;
+			break;
+		}
+	}
+	len = strlen(title);
+	key = sqlite3_malloc(len + 9);
+	if( !key )
+	{
+		sqlite3_result_error_nomem(ctx);
+		return;
+	}
+	if( argc == 3 )
+	{
+		int disc = sqlite3_value_int(argv[1]);
+		int track = sqlite3_value_int(argv[2]);
+
+		disc = (disc < 0) ? 0 : (disc > 9999) ? 9999 : disc;
+		track = (track < 0) ? 0 : (track > 9999) ? 9999 : track;
+		off = sprintf(key, "%04d%04d", disc, track);
+	}
+	for( i = 0; i < len; i++ )
+		key[off + i] = (title[i] >= 'A' && title[i] <= 'Z') ? title[i] + 32 : title[i];
+	sqlite3_result_text(ctx, key, off + len, sqlite3_free);
+}
+
+int
+sql_create_functions(sqlite3 *db)
+{
+	return sqlite3_create_function(db, "SORT_KEY", -1, SQLITE_UTF8, NULL, sort_key_func, NULL, NULL);
+}
+
+/* Per-connection setup of files.db.  Returns 1 if the database ended up in
+ * WAL mode, which needs wal set and an SQLite that supports it. */
+int
+sql_set_pragmas(sqlite3 *db, int wal)
+{
+	char *mode = NULL;
+	int ret = 0;
+
+	sqlite3_busy_timeout(db, 5000);
+	sql_create_functions(db);
+	sql_exec(db, "pragma page_size = 4096");
+	/* With a write-ahead log, readers see the last commit while the
+	 * scanner or inotify thread writes, and an interrupted writer can't
+	 * leave a torn database behind. */
+	if( wal )
+		mode = sql_get_text_field(db, "pragma journal_mode = WAL");
+	if( mode && strcasecmp(mode, "wal") == 0 )
+	{
+		sql_exec(db, "pragma synchronous = NORMAL;");
+		sql_exec(db, "pragma mmap_size = %d;", 64*1024*1024);
+		ret = 1;
+	}
+	else
+	{
+		sql_exec(db, "pragma journal_mode = OFF");
+		sql_exec(db, "pragma synchronous = OFF;");
+	}
+	sqlite3_free(mode);
+	sql_exec(db, "pragma default_cache_size = 8192;");
+
+	return ret;
+}
+
+/* Insert an OBJECTS row.  Its sort keys come from the title, disc and
+ * track of detailID (or from name) in the same statement, so filling them
+ * costs no second write. */
+int
+sql_insert_object(sqlite3 *db, const char *objectID, const char *parentID, const char *refID,
+                  const char *class, int64_t detailID, const char *name)
+{
+	return sql_exec(db, "INSERT into OBJECTS"
+	                    " (OBJECT_ID, PARENT_ID, REF_ID, CLASS, DETAIL_ID, NAME, SORT_TITLE, SORT_TRACK) "
+	                    "SELECT %Q, %Q, %Q, %Q, %lld, %Q,"
+	                    " SORT_KEY(coalesce(d.TITLE, %Q)), SORT_KEY(coalesce(d.TITLE, %Q), d.DISC, d.TRACK)"
+	                    " from (SELECT 1) left join DETAILS d on (d.ID = %lld)",
+	                    objectID, parentID, refID, class, (long long)detailID, name,
+	                    name, name, (long long)detailID);
+}
+
+/* Keep the OBJECTS sort keys current when a title, disc or track changes. */
+int
+sql_create_sort_keys(sqlite3 *db)
+{
+	int ret;
+
+	ret = sql_exec(db, "CREATE TRIGGER IF NOT EXISTS DETAILS_SORT_KEYS AFTER UPDATE OF TITLE, DISC, TRACK ON DETAILS BEGIN"
+	                   " UPDATE OBJECTS set"
+	                   " SORT_TITLE = SORT_KEY(coalesce(new.TITLE, NAME)),"
+	                   " SORT_TRACK = SORT_KEY(coalesce(new.TITLE, NAME), new.DISC, new.TRACK)"
+	                   " where DETAIL_ID = new.ID; END");
+	if( ret != SQLITE_OK )
+		return ret;
+	sql_exec(db, "CREATE INDEX IF NOT EXISTS IDX_OBJECTS_SORT_TITLE ON OBJECTS(PARENT_ID, SORT_TITLE)");
+	sql_exec(db, "CREATE INDEX IF NOT EXISTS IDX_OBJECTS_SORT_TRACK ON OBJECTS(PARENT_ID, CLASS, SORT_TRACK)");
+
+	return SQLITE_OK;
+}
+
+/* ObjectIDs are materialized paths ("64$1A$3F"), so the descendants of id
+ * are exactly the keys between "id$" and "id%" ('%' sorts right after '$').
+ * Unlike a glob this is always a range on the index, whatever characters
+ * a client-supplied id contains.  Free the result with sqlite3_free(). */
+char *
+sql_subtree(const char *column, const char *id)
+{
+	return sqlite3_mprintf("(%s > '%q$' and %s < '%q%%')", column, id, column, id);
+}
+
 int
 db_upgrade(sqlite3 *db)
 {
@@ -215,6 +346,36 @@ db_upgrade(sqlite3 *db)
 		return -1;
 	if (db_vers < 9)
 		return 9;
+	if (db_vers < 10)
+	{
+		/* Indexes duplicating a primary key, a UNIQUE constraint, or a
+		 * prefix of IDX_SCANNER_OPT */
+		sql_exec(db, "DROP INDEX IF EXISTS IDX_OBJECTS_OBJECT_ID");
+		sql_exec(db, "DROP INDEX IF EXISTS IDX_OBJECTS_PARENT_ID");
+		sql_exec(db, "DROP INDEX IF EXISTS IDX_DETAILS_ID");
+		sql_exec(db, "DROP INDEX IF EXISTS IDX_ALBUM_ART");
+	}
+	if (db_vers < 11)
+	{
+		/* The status page and TiVo filters select by MIME prefix */
+		sql_exec(db, "CREATE INDEX IF NOT EXISTS IDX_DETAILS_MIME ON DETAILS(MIME)");
+	}
+	if (db_vers < 12)
+	{
+		if (sql_exec(db, "ALTER TABLE OBJECTS ADD COLUMN SORT_TITLE TEXT") != SQLITE_OK ||
+		    sql_exec(db, "ALTER TABLE OBJECTS ADD COLUMN SORT_TRACK TEXT") != SQLITE_OK ||
+		    sql_create_sort_keys(db) != SQLITE_OK)
+			return 12;
+		sql_exec(db, "UPDATE OBJECTS set"
+		             " SORT_TITLE = SORT_KEY(coalesce((SELECT TITLE from DETAILS where ID = OBJECTS.DETAIL_ID), NAME)),"
+		             " SORT_TRACK = coalesce((SELECT SORT_KEY(coalesce(TITLE, OBJECTS.NAME), DISC, TRACK)"
+		             "                        from DETAILS where ID = OBJECTS.DETAIL_ID), SORT_KEY(NAME, 0, 0))");
+	}
+	if (db_vers < 13)
+	{
+		/* Inserts fill the sort keys themselves now */
+		sql_exec(db, "DROP TRIGGER IF EXISTS OBJECTS_SORT_KEYS");
+	}
 	sql_exec(db, "PRAGMA user_version = %d", DB_VERSION);
 
 	return 0;
@@ -24,6 +24,7 @@
 #ifndef __SQL_H__
 #define __SQL_H__
 
+#include <stdint.h>
 #include <sqlite3.h>
 
 #ifndef HAVE_SQLITE3_MALLOC
@@ -45,7 +46,27 @@ sql_get_int_field(sqlite3 *db, const char *fmt, ...);
 char *
 sql_get_text_field(sqlite3 *db, const char *fmt, ...);
 
+char *
+sql_subtree(const char *column, const char *id);
+
+int
+sql_create_functions(sqlite3 *db);
+
+int
+sql_set_pragmas(sqlite3 *db, int wal);
+
+int
+sql_insert_object(sqlite3 *db, const char *objectID, const char *parentID, const char *refID,
+                  const char *class, int64_t detailID, const char *name);
+
+int
+sql_create_sort_keys(sqlite3 *db);
+
 int
 db_upgrade(sqlite3 *db);
 
+/* Open files.db as the calling thread's db handle (minidlna.c) */
+int
+open_db(sqlite3 **sq3);
+
 #endif
@@ -21,7 +21,10 @@
 
 #include "config.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
 #ifdef HAVE_MACHINE_ENDIAN_H
 #include <machine/endian.h>
 #else
@@ -123,3 +126,155 @@ cpu_to_be32(__u32 cpu32)
 	return cpu32;
 #endif
 }
+
+/* The file is read through a TAG_BUF_SIZE window rather than mapped, so
+ * a file truncated during the scan ends in a short read instead of a
+ * SIGBUS.  The first and last TAG_PREFETCH bytes, where every supported
+ * container keeps its tags and indexes, are queued for readahead. */
+#define TAG_BUF_SIZE	(64 << 10)
+#define TAG_PREFETCH	(64 << 10)
+
+int
+tag_open(struct tag_file *tf, const char *path)
+{
+	memset(tf, 0, sizeof(*tf));
+	tf->fd = open(path, O_RDONLY);
+	if(tf->fd < 0)
+		return -1;
+	tf->size = lseek(tf->fd, 0, SEEK_END);
+	tf->buf = malloc(TAG_BUF_SIZE);
+	if(tf->size < 0 || !tf->buf)
+	{
+		free(tf->buf);
+		close(tf->fd);
+		tf->fd = -1;
+		return -1;
+	}
+	posix_fadvise(tf->fd, 0, TAG_PREFETCH, POSIX_FADV_WILLNEED);
+	if(tf->size > TAG_PREFETCH)
+		posix_fadvise(tf->fd, tf->size - TAG_PREFETCH, TAG_PREFETCH, POSIX_FADV_WILLNEED);
+
+	return 0;
+}
+
+void
+tag_close(struct tag_file *tf)
+{
+	free(tf->buf);
+	if(tf->fd >= 0)
+		close(tf->fd);
+	memset(tf, 0, sizeof(*tf));
+	tf->fd = -1;
+}
+
+/* For parsers that walk the whole file front to back (Ogg) */
+void
+tag_sequential(struct tag_file *tf)
+{
+	posix_fadvise(tf->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+}
+
+/* Pointer to len bytes at the cursor, refilling the window if needed.
+ * NULL if they don't fit in the window or the file is shorter than
+ * expected.  The cursor does not move, and the pointer is only good
+ * until the next tag_peek() or tag_read(). */
+const unsigned char *
+tag_peek(struct tag_file *tf, size_t len)
+{
+	off_t pos = tf->pos;
+	ssize_t n;
+
+	if(pos < 0 || pos > tf->size || len > tf->size - pos)
+		return NULL;
+	if(pos >= tf->buf_off && pos + len <= tf->buf_off + tf->buf_len)
+		return tf->buf + (pos - tf->buf_off);
+	if(len > TAG_BUF_SIZE)
+		return NULL;
+
+	tf->buf_len = 0;
+	n = pread(tf->fd, tf->buf, TAG_BUF_SIZE, pos);
+	if(n < 0 || (size_t)n < len)
+		return NULL;
+	tf->buf_off = pos;
+	tf->buf_len = n;
+
+	return tf->buf;
+}
+
+/* fread() replacement: copies up to len bytes and advances the cursor */
+size_t
+tag_read(struct tag_file *tf, void *buf, size_t len)
+{
+	const unsigned char *p;
+	ssize_t n;
+
+	if(tf->pos < 0 || tf->pos >= tf->size)
+		return 0;
+	if(len > tf->size - tf->pos)
+		len = tf->size - tf->pos;
+	if((p = tag_peek(tf, len)))
+	{
+		memcpy(buf, p, len);
+		tf->pos += len;
+		return len;
+	}
+	/* too big for the window, or the file shrank under us */
+	n = pread(tf->fd, buf, len, tf->pos);
+	if(n <= 0)
+		return 0;
+	tf->pos += n;
+
+	return n;
+}
+
+/* fseek() replacement; seeking past either end is allowed, reads there fail */
+int
+tag_seek(struct tag_file *tf, off_t off, int whence)
+{
+	switch(whence)
+	{
+	case SEEK_SET:
+		tf->pos = off;
+		break;
+	case SEEK_CUR:
+		tf->pos += off;
+		break;
+	case SEEK_END:
+		tf->pos = tf->size + off;
+		break;
+	default:
+		return -1;
+	}
+
+	return 0;
+}
+
+__u8
+tag_get_byte(struct tag_file *tf)
+{
+	__u8 d;
+
+	if(!tag_read(tf, &d, sizeof(d)))
+		return 0;
+	return d;
+}
+
+__u16
+tag_get_le16(struct tag_file *tf)
+{
+	__u16 d;
+
+	if(tag_read(tf, &d, sizeof(d)) != sizeof(d))
+		return 0;
+	return le16_to_cpu(d);
+}
+
+__u32
+tag_get_le32(struct tag_file *tf)
+{
+	__u32 d;
+
+	if(tag_read(tf, &d, sizeof(d)) != sizeof(d))
+		return 0;
+	return le32_to_cpu(d);
+}
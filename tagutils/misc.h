@@ -48,4 +48,28 @@ inline __u32 cpu_to_be32(__u32 cpu32);
 
 extern char * sha1_hex(char *key);
 
+/* Read-only view of a media file shared by the tag and fileinfo passes.
+ * Reads are served from one window that is refilled with a bounded
+ * pread() whenever the cursor leaves it. */
+struct tag_file {
+	int fd;
+	off_t size;
+	off_t pos;
+	unsigned char *buf;		/* bytes [buf_off, buf_off + buf_len) */
+	off_t buf_off;
+	size_t buf_len;
+};
+
+extern int tag_open(struct tag_file *tf, const char *path);
+extern void tag_close(struct tag_file *tf);
+extern void tag_sequential(struct tag_file *tf);
+extern size_t tag_read(struct tag_file *tf, void *buf, size_t len);
+extern const unsigned char *tag_peek(struct tag_file *tf, size_t len);
+extern int tag_seek(struct tag_file *tf, off_t off, int whence);
+#define tag_tell(tf)	((tf)->pos)
+#define tag_size(tf)	((tf)->size)
+extern __u8 tag_get_byte(struct tag_file *tf);
+extern __u16 tag_get_le16(struct tag_file *tf);
+extern __u32 tag_get_le32(struct tag_file *tf);
+
 #endif
@@ -27,7 +27,7 @@
 
 // _aac_findatom:
 static long
-_aac_findatom(FILE *fin, long max_offset, char *which_atom, int *atom_size)
+_aac_findatom(struct tag_file *tf, long max_offset, char *which_atom, int *atom_size)
 {
 	long current_offset = 0;
 	int size;
@@ -35,7 +35,7 @@ _aac_findatom(FILE *fin, long max_offset, char *which_atom, int *atom_size)
 
 	while(current_offset < max_offset)
 	{
-		if(fread((void*)&size, 1, sizeof(int), fin) != sizeof(int))
+		if(tag_read(tf, (void*)&size, sizeof(int)) != sizeof(int))
 			return -1;
 
 		size = ntohl(size);
@@ -43,7 +43,7 @@ _aac_findatom(FILE *fin, long max_offset, char *which_atom, int *atom_size)
 		if(size <= 7)
 			return -1;
 
-		if(fread(atom, 1, 4, fin) != 4)
+		if(tag_read(tf, atom, 4) != 4)
 			return -1;
 
 		if(strncasecmp(atom, which_atom, 4) == 0)
@@ -52,7 +52,7 @@ _aac_findatom(FILE *fin, long max_offset, char *which_atom, int *atom_size)
 			return current_offset;
 		}
 
-		fseek(fin, size - 8, SEEK_CUR);
+		tag_seek(tf, size - 8, SEEK_CUR);
 		current_offset += size;
 	}
 
@@ -61,33 +61,29 @@ _aac_findatom(FILE *fin, long max_offset, char *which_atom, int *atom_size)
 
 // _get_aactags
 static int
-_get_aactags(char *file, struct song_metadata *psong)
+_get_aactags(char *file, struct tag_file *tf, struct song_metadata *psong)
 {
-	FILE *fin;
 	long atom_offset;
 	unsigned int atom_length;
 
 	long current_offset = 0;
 	int current_size;
 	char current_atom[4];
+	const unsigned char *mapped;
 	char *current_data = NULL;
+	char *buf = NULL;
+	int buf_size = 0;
 	int genre;
 	int len;
 
-	if(!(fin = fopen(file, "rb")))
-	{
-		DPRINTF(E_ERROR, L_SCANNER, "Cannot open file %s for reading\n", file);
-		return -1;
-	}
+	tag_seek(tf, 0, SEEK_SET);
 
-	fseek(fin, 0, SEEK_SET);
-
-	atom_offset = _aac_lookforatom(fin, "moov:udta:meta:ilst", &atom_length);
+	atom_offset = _aac_lookforatom(tf, "moov:udta:meta:ilst", &atom_length);
 	if(atom_offset != -1)
 	{
 		while(current_offset < atom_length)
 		{
-			if(fread((void*)&current_size, 1, sizeof(int), fin) != sizeof(int))
+			if(tag_read(tf, (void*)&current_size, sizeof(int)) != sizeof(int))
 				break;
 
 			current_size = ntohl(current_size);
@@ -95,18 +91,34 @@ _get_aactags(char *file, struct song_metadata *psong)
 			if(current_size <= 7 || current_size > 1<<24)  // something not right
 				break;
 
-			if(fread(current_atom, 1, 4, fin) != 4)
+			if(tag_read(tf, current_atom, 4) != 4)
 				break;
 
-			len = current_size - 7; // too short
-			if(len < 22)
-				len = 22;
-
-			current_data = (char*)malloc(len); // extra byte
-			memset(current_data, 0x00, len);
-
-			if(fread(current_data, 1, current_size - 8, fin) != current_size - 8)
-				break;
+			/* Text atoms are NUL-terminated by the 4 spare bytes and the
+			 * integer ones need 22, so only short atoms and ones that
+			 * don't fit the reader's window are copied. */
+			len = current_size - 8;
+			mapped = tag_peek(tf, len + 1);
+			if(mapped && len >= 22 && memchr(mapped + 16, '\0', len - 16 + 1))
+			{
+				current_data = (char*)mapped;
+				tag_seek(tf, len, SEEK_CUR);
+			}
+			else
+			{
+				if(buf_size < len + 1 || buf_size < 22)
+				{
+					buf_size = len + 1 < 22 ? 22 : len + 1;
+					free(buf);
+					buf = malloc(buf_size);
+					if(!buf)
+						break;
+				}
+				memset(buf, 0x00, buf_size);
+				if(tag_read(tf, buf, len) != len)
+					break;
+				current_data = buf;
+			}
 
 			if(!memcmp(current_atom, "\xA9" "nam", 4))
 				psong->title = strdup((char*)&current_data[16]);
@@ -159,13 +171,10 @@ _get_aactags(char *file, struct song_metadata *psong)
 					DPRINTF(E_ERROR, L_SCANNER, "Out of memory [%s]\n", file);
 			}
 
-			free(current_data);
-			current_data = NULL;
 			current_offset += current_size;
 		}
 	}
-	fclose(fin);
-	free(current_data);
+	free(buf);
 
 	if(atom_offset == -1)
 		return -1;
@@ -175,16 +184,15 @@ _get_aactags(char *file, struct song_metadata *psong)
 
 // aac_lookforatom
 static off_t
-_aac_lookforatom(FILE *aac_fp, char *atom_path, unsigned int *atom_length)
+_aac_lookforatom(struct tag_file *tf, char *atom_path, unsigned int *atom_length)
 {
 	long atom_offset;
 	off_t file_size;
 	char *cur_p, *end_p;
 	char atom_name[5];
 
-	fseek(aac_fp, 0, SEEK_END);
-	file_size = ftell(aac_fp);
-	rewind(aac_fp);
+	file_size = tag_size(tf);
+	tag_seek(tf, 0, SEEK_SET);
 
 	end_p = atom_path;
 	while(*end_p != '\0')
@@ -201,7 +209,7 @@ _aac_lookforatom(FILE *aac_fp, char *atom_path, unsigned int *atom_length)
 			return -1;
 		}
 		strncpy(atom_name, cur_p, 4);
-		atom_offset = _aac_findatom(aac_fp, file_size, atom_name, (int*)atom_length);
+		atom_offset = _aac_findatom(tf, file_size, atom_name, (int*)atom_length);
 		if(atom_offset == -1)
 		{
 			return -1;
@@ -213,30 +221,30 @@ _aac_lookforatom(FILE *aac_fp, char *atom_path, unsigned int *atom_length)
 
 			if(!strcmp(atom_name, "meta"))
 			{
-				fseek(aac_fp, 4, SEEK_CUR);
+				tag_seek(tf, 4, SEEK_CUR);
 			}
 			else if(!strcmp(atom_name, "stsd"))
 			{
-				fseek(aac_fp, 8, SEEK_CUR);
+				tag_seek(tf, 8, SEEK_CUR);
 			}
 			else if(!strcmp(atom_name, "mp4a"))
 			{
-				fseek(aac_fp, 28, SEEK_CUR);
+				tag_seek(tf, 28, SEEK_CUR);
 			}
 		}
 	}
 
 	// return position of 'size:atom'
-	return ftell(aac_fp) - 8;
+	return tag_tell(tf) - 8;
 }
 
-int
-_aac_check_extended_descriptor(FILE *infile)
+static int
+_aac_check_extended_descriptor(struct tag_file *tf)
 {
 	short int i;
 	unsigned char buf[3];
 
-	if( !fread((void *)&buf, 3, 1, infile) )
+	if( tag_read(tf, (void *)&buf, 3) != 3 )
 		return -1;
 	for( i=0; i<3; i++ )
 	{
@@ -244,7 +252,7 @@ _aac_check_extended_descriptor(FILE *infile)
 		    (buf[i] != 0x81) &&
 		    (buf[i] != 0xFE) )
 		{
-			fseek(infile, -3, SEEK_CUR);
+			tag_seek(tf, -3, SEEK_CUR);
 			return 0;
 		}
 	}
@@ -254,9 +262,8 @@ _aac_check_extended_descriptor(FILE *infile)
 
 // _get_aacfileinfo
 int
-_get_aacfileinfo(char *file, struct song_metadata *psong)
+_get_aacfileinfo(char *file, struct tag_file *tf, struct song_metadata *psong)
 {
-	FILE *infile;
 	long atom_offset;
 	int atom_length;
 	int sample_size;
@@ -270,26 +277,16 @@ _get_aacfileinfo(char *file, struct song_metadata *psong)
 	psong->vbr_scale = -1;
 	psong->channels = 2; // A "normal" default in case we can't find this information
 
-	infile = fopen(file, "rb");
-	if(!infile)
-	{
-		DPRINTF(E_ERROR, L_SCANNER, "Could not open %s for reading\n", file);
-		return -1;
-	}
-
-	fseek(infile, 0, SEEK_END);
-	file_size = ftell(infile);
-	fseek(infile, 0, SEEK_SET);
+	file_size = tag_size(tf);
 
 	// move to 'mvhd' atom
-	atom_offset = _aac_lookforatom(infile, "moov:mvhd", (unsigned int*)&atom_length);
+	atom_offset = _aac_lookforatom(tf, "moov:mvhd", (unsigned int*)&atom_length);
 	if(atom_offset != -1)
 	{
-		fseek(infile, 12, SEEK_CUR);
-		if(!fread((void*)&sample_size, 1, sizeof(int), infile) ||
-		   !fread((void*)&samples, 1, sizeof(int), infile))
+		tag_seek(tf, 12, SEEK_CUR);
+		if(tag_read(tf, (void*)&sample_size, sizeof(int)) != sizeof(int) ||
+		   tag_read(tf, (void*)&samples, sizeof(int)) != sizeof(int))
 		{
-			fclose(infile);
 			return -1;
 		}
 
@@ -311,44 +308,44 @@ _get_aacfileinfo(char *file, struct song_metadata *psong)
 	psong->bitrate = 0;
 
 	// see if it is aac or alac
-	atom_offset = _aac_lookforatom(infile, "moov:trak:mdia:minf:stbl:stsd:alac", (unsigned int*)&atom_length);
+	atom_offset = _aac_lookforatom(tf, "moov:trak:mdia:minf:stbl:stsd:alac", (unsigned int*)&atom_length);
 	if(atom_offset != -1) {
-		fseek(infile, atom_offset + 32, SEEK_SET);
-		if (fread(buffer, sizeof(unsigned char), 2, infile) == 2)
+		tag_seek(tf, atom_offset + 32, SEEK_SET);
+		if (tag_read(tf, buffer, 2) == 2)
 			psong->samplerate = (buffer[0] << 8) | (buffer[1]);
 		goto bad_esds;
 	}
 
 	// get samplerate from 'mp4a' (not from 'mdhd')
-	atom_offset = _aac_lookforatom(infile, "moov:trak:mdia:minf:stbl:stsd:mp4a", (unsigned int*)&atom_length);
+	atom_offset = _aac_lookforatom(tf, "moov:trak:mdia:minf:stbl:stsd:mp4a", (unsigned int*)&atom_length);
 	if(atom_offset != -1)
 	{
-		fseek(infile, atom_offset + 32, SEEK_SET);
-		if(fread(buffer, sizeof(unsigned char), 2, infile) == 2)
+		tag_seek(tf, atom_offset + 32, SEEK_SET);
+		if(tag_read(tf, buffer, 2) == 2)
 			psong->samplerate = (buffer[0] << 8) | (buffer[1]);
 
-		fseek(infile, 2, SEEK_CUR);
+		tag_seek(tf, 2, SEEK_CUR);
 
 		// get bitrate from 'esds'
-		atom_offset = _aac_findatom(infile, atom_length - (ftell(infile) - atom_offset), "esds", &atom_length);
+		atom_offset = _aac_findatom(tf, atom_length - (tag_tell(tf) - atom_offset), "esds", &atom_length);
 
 		if(atom_offset != -1)
 		{
 			// skip the version number
-			fseek(infile, atom_offset + 4, SEEK_CUR);
+			tag_seek(tf, atom_offset + 4, SEEK_CUR);
 			// should be 0x03, to signify the descriptor type (section)
-			if( !fread((void *)&buffer, 1, 1, infile) || (buffer[0] != 0x03) || (_aac_check_extended_descriptor(infile) != 0) )
+			if( !tag_read(tf, (void *)&buffer, 1) || (buffer[0] != 0x03) || (_aac_check_extended_descriptor(tf) != 0) )
 				goto bad_esds;
-			fseek(infile, 4, SEEK_CUR);
-			if( !fread((void *)&buffer, 1, 1, infile) || (buffer[0] != 0x04) || (_aac_check_extended_descriptor(infile) != 0) )
+			tag_seek(tf, 4, SEEK_CUR);
+			if( !tag_read(tf, (void *)&buffer, 1) || (buffer[0] != 0x04) || (_aac_check_extended_descriptor(tf) != 0) )
 				goto bad_esds;
-			fseek(infile, 10, SEEK_CUR); // 10 bytes into section 4 should be average bitrate.  max bitrate is 6 bytes in.
-			if(fread((void *)&bitrate, sizeof(unsigned int), 1, infile))
+			tag_seek(tf, 10, SEEK_CUR); // 10 bytes into section 4 should be average bitrate.  max bitrate is 6 bytes in.
+			if(tag_read(tf, (void *)&bitrate, sizeof(unsigned int)) == sizeof(unsigned int))
 				psong->bitrate = ntohl(bitrate);
-			if( !fread((void *)&buffer, 1, 1, infile) || (buffer[0] != 0x05) || (_aac_check_extended_descriptor(infile) != 0) )
+			if( !tag_read(tf, (void *)&buffer, 1) || (buffer[0] != 0x05) || (_aac_check_extended_descriptor(tf) != 0) )
 				goto bad_esds;
-			fseek(infile, 1, SEEK_CUR); // 1 bytes into section 5 should be the setup data
-			if(fread((void *)&buffer, 2, 1, infile))
+			tag_seek(tf, 1, SEEK_CUR); // 1 bytes into section 5 should be the setup data
+			if(tag_read(tf, (void *)&buffer, 2) == 2)
 			{
 				profile_id = (buffer[0] >> 3); // first 5 bits of setup data is the Audo Profile ID
 				/* Frequency index: (((buffer[0] & 0x7) << 1) | (buffer[1] >> 7))) */
@@ -359,7 +356,7 @@ _get_aacfileinfo(char *file, struct song_metadata *psong)
 	}
 bad_esds:
 
-	atom_offset = _aac_lookforatom(infile, "mdat", (unsigned int*)&atom_length);
+	atom_offset = _aac_lookforatom(tf, "mdat", (unsigned int*)&atom_length);
 	psong->audio_size = atom_length - 8;
 	psong->audio_offset = atom_offset;
 
@@ -405,6 +402,5 @@ bad_esds:
 			break;
 	}
 
-	fclose(infile);
 	return 0;
 }
@@ -21,7 +21,7 @@
  */
 
 static int
-_asf_read_file_properties(FILE *fp, asf_file_properties_t *p, __u32 size)
+_asf_read_file_properties(struct tag_file *tf, asf_file_properties_t *p, __u32 size)
 {
 	int len;
 
@@ -33,7 +33,7 @@ _asf_read_file_properties(FILE *fp, asf_file_properties_t *p, __u32 size)
 	p->ID = ASF_FileProperties;
 	p->Size = size;
 
-	if(len != fread(&p->FileID, 1, len, fp))
+	if(len != tag_read(tf, &p->FileID, len))
 		return -1;
 
 	return 0;
@@ -63,7 +63,7 @@ _pick_dlna_profile(struct song_metadata *psong, uint16_t format)
 }
 
 static int
-_asf_read_audio_stream(FILE *fp, struct song_metadata *psong, int size)
+_asf_read_audio_stream(struct tag_file *tf, struct song_metadata *psong, int size)
 {
 	asf_audio_stream_t s;
 	int len;
@@ -72,7 +72,7 @@ _asf_read_audio_stream(FILE *fp, struct song_metadata *psong, int size)
 	if(len > size)
 		len = size;
 
-	if(len != fread(&s.wfx, 1, len, fp))
+	if(len != tag_read(tf, &s.wfx, len))
 		return -1;
 
 	psong->channels = le16_to_cpu(s.wfx.nChannels);
@@ -86,7 +86,7 @@ _asf_read_audio_stream(FILE *fp, struct song_metadata *psong, int size)
 }
 
 static int
-_asf_read_media_stream(FILE *fp, struct song_metadata *psong, __u32 size)
+_asf_read_media_stream(struct tag_file *tf, struct song_metadata *psong, __u32 size)
 {
 	asf_media_stream_t s;
 	avi_audio_format_t wfx;
@@ -96,14 +96,14 @@ _asf_read_media_stream(FILE *fp, struct song_metadata *psong, __u32 size)
 	if(len > size)
 		len = size;
 
-	if(len != fread(&s.MajorType, 1, len, fp))
+	if(len != tag_read(tf, &s.MajorType, len))
 		return -1;
 
 	if(IsEqualGUID(&s.MajorType, &ASF_MediaTypeAudio) &&
 	   IsEqualGUID(&s.FormatType, &ASF_FormatTypeWave) && s.FormatSize >= sizeof(wfx))
 	{
 
-		if(sizeof(wfx) != fread(&wfx, 1, sizeof(wfx), fp))
+		if(sizeof(wfx) != tag_read(tf, &wfx, sizeof(wfx)))
 			return -1;
 
 		psong->channels = le16_to_cpu(wfx.nChannels);
@@ -118,7 +118,7 @@ _asf_read_media_stream(FILE *fp, struct song_metadata *psong, __u32 size)
 }
 
 static int
-_asf_read_stream_object(FILE *fp, struct song_metadata *psong, __u32 size)
+_asf_read_stream_object(struct tag_file *tf, struct song_metadata *psong, __u32 size)
 {
 	asf_stream_object_t s;
 	int len;
@@ -127,13 +127,13 @@ _asf_read_stream_object(FILE *fp, struct song_metadata *psong, __u32 size)
 	if(size < len)
 		return -1;
 
-	if(len != fread(&s.StreamType, 1, len, fp))
+	if(len != tag_read(tf, &s.StreamType, len))
 		return -1;
 
 	if(IsEqualGUID(&s.StreamType, &ASF_AudioStream))
-		_asf_read_audio_stream(fp, psong, s.TypeSpecificSize);
+		_asf_read_audio_stream(tf, psong, s.TypeSpecificSize);
 	else if(IsEqualGUID(&s.StreamType, &ASF_StreamBufferStream))
-		_asf_read_media_stream(fp, psong, s.TypeSpecificSize);
+		_asf_read_media_stream(tf, psong, s.TypeSpecificSize);
 	else if(!IsEqualGUID(&s.StreamType, &ASF_VideoStream))
 	{
 		DPRINTF(E_ERROR, L_SCANNER, "Unknown asf stream type.\n");
@@ -143,7 +143,7 @@ _asf_read_stream_object(FILE *fp, struct song_metadata *psong, __u32 size)
 }
 
 static int
-_asf_read_extended_stream_object(FILE *fp, struct song_metadata *psong, __u32 size)
+_asf_read_extended_stream_object(struct tag_file *tf, struct song_metadata *psong, __u32 size)
 {
 	int i, len;
 	long off;
@@ -156,7 +156,7 @@ _asf_read_extended_stream_object(FILE *fp, struct song_metadata *psong, __u32 si
 		return -1;
 
 	len = sizeof(xs) - offsetof(asf_extended_stream_object_t, StartTime);
-	if(len != fread(&xs.StartTime, 1, len, fp))
+	if(len != tag_read(tf, &xs.StartTime, len))
 		return -1;
 	off = sizeof(xs);
 
@@ -164,13 +164,13 @@ _asf_read_extended_stream_object(FILE *fp, struct song_metadata *psong, __u32 si
 	{
 		if(off + sizeof(nm) > size)
 			return -1;
-		if(sizeof(nm) != fread(&nm, 1, sizeof(nm), fp))
+		if(sizeof(nm) != tag_read(tf, &nm, sizeof(nm)))
 			return -1;
 		off += sizeof(nm);
 		if(off + nm.Length > sizeof(asf_extended_stream_object_t))
 			return -1;
 		if(nm.Length > 0)
-			fseek(fp, nm.Length, SEEK_CUR);
+			tag_seek(tf, nm.Length, SEEK_CUR);
 		off += nm.Length;
 	}
 
@@ -178,27 +178,27 @@ _asf_read_extended_stream_object(FILE *fp, struct song_metadata *psong, __u32 si
 	{
 		if(off + sizeof(pe) > size)
 			return -1;
-		if(sizeof(pe) != fread(&pe, 1, sizeof(pe), fp))
+		if(sizeof(pe) != tag_read(tf, &pe, sizeof(pe)))
 			return -1;
 		off += sizeof(pe);
 		if(pe.InfoLength > 0)
-			fseek(fp, pe.InfoLength, SEEK_CUR);
+			tag_seek(tf, pe.InfoLength, SEEK_CUR);
 		off += pe.InfoLength;
 	}
 
 	if(off < size)
 	{
-		if(sizeof(tmp) != fread(&tmp, 1, sizeof(tmp), fp))
+		if(sizeof(tmp) != tag_read(tf, &tmp, sizeof(tmp)))
 			return -1;
 		if(IsEqualGUID(&tmp.ID, &ASF_StreamHeader))
-			_asf_read_stream_object(fp, psong, tmp.Size);
+			_asf_read_stream_object(tf, psong, tmp.Size);
 	}
 
 	return 0;
 }
 
 static int
-_asf_read_header_extension(FILE *fp, struct song_metadata *psong, __u32 size)
+_asf_read_header_extension(struct tag_file *tf, struct song_metadata *psong, __u32 size)
 {
 	off_t pos;
 	long off;
@@ -208,33 +208,33 @@ _asf_read_header_extension(FILE *fp, struct song_metadata *psong, __u32 size)
 	if(size < sizeof(asf_header_extension_t))
 		return -1;
 
-	if(sizeof(ext.Reserved1) != fread(&ext.Reserved1, 1, sizeof(ext.Reserved1), fp))
+	if(sizeof(ext.Reserved1) != tag_read(tf, &ext.Reserved1, sizeof(ext.Reserved1)))
 		return -1;
-	ext.Reserved2 = fget_le16(fp);
-	ext.DataSize = fget_le32(fp);
+	ext.Reserved2 = tag_get_le16(tf);
+	ext.DataSize = tag_get_le32(tf);
 
-	pos = ftell(fp);
+	pos = tag_tell(tf);
 	off = 0;
 	while(off < ext.DataSize)
 	{
 		if(sizeof(asf_header_extension_t) + off > size)
 			break;
-		if(sizeof(tmp) != fread(&tmp, 1, sizeof(tmp), fp))
+		if(sizeof(tmp) != tag_read(tf, &tmp, sizeof(tmp)))
 			break;
 		if(off + tmp.Size > ext.DataSize)
 			break;
 		if(IsEqualGUID(&tmp.ID, &ASF_ExtendedStreamPropertiesObject))
-			_asf_read_extended_stream_object(fp, psong, tmp.Size);
+			_asf_read_extended_stream_object(tf, psong, tmp.Size);
 
 		off += tmp.Size;
-		fseek(fp, pos + off, SEEK_SET);
+		tag_seek(tf, pos + off, SEEK_SET);
 	}
 
 	return 0;
 }
 
 static int
-_asf_load_string(FILE *fp, int type, int size, char *buf, int len)
+_asf_load_string(struct tag_file *tf, int type, int size, char *buf, int len)
 {
 	unsigned char data[2048];
 	__u16 wc;
@@ -244,7 +244,7 @@ _asf_load_string(FILE *fp, int type, int size, char *buf, int len)
 	__s16 *wd16;
 
 	i = 0;
-	if(size && (size <= sizeof(data)) && (size == fread(data, 1, size, fp)))
+	if(size && (size <= sizeof(data)) && (size == tag_read(tf, data, size)))
 	{
 
 		switch(type)
@@ -295,14 +295,14 @@ _asf_load_string(FILE *fp, int type, int size, char *buf, int len)
 
 		size = 0;
 	}
-	else fseek(fp, size, SEEK_CUR);
+	else tag_seek(tf, size, SEEK_CUR);
 
 	buf[i] = 0;
 	return i;
 }
 
 static void *
-_asf_load_picture(FILE *fp, int size, void *bm, int *bm_size)
+_asf_load_picture(struct tag_file *tf, int size, void *bm, int *bm_size)
 {
 	int i;
 	char buf[256];
@@ -317,22 +317,22 @@ _asf_load_picture(FILE *fp, int size, void *bm, int *bm_size)
 	char pic_type;
 	long pic_size;
 
-	pic_type = fget_byte(fp); size -= 1;
-	pic_size = fget_le32(fp); size -= 4;
+	pic_type = tag_get_byte(tf); size -= 1;
+	pic_size = tag_get_le32(tf); size -= 4;
 #else
-	fseek(fp, 5, SEEK_CUR);
+	tag_seek(tf, 5, SEEK_CUR);
 	size -= 5;
 #endif
 	for(i = 0; i < sizeof(buf) - 1; i++)
 	{
-		buf[i] = fget_le16(fp); size -= 2;
+		buf[i] = tag_get_le16(tf); size -= 2;
 		if(!buf[i])
 			break;
 	}
 	buf[i] = '\0';
 	if(i == sizeof(buf) - 1)
 	{
-		while(fget_le16(fp))
+		while(tag_get_le16(tf))
 			size -= 2;
 	}
 
@@ -341,7 +341,7 @@ _asf_load_picture(FILE *fp, int size, void *bm, int *bm_size)
 	   !strcasecmp(buf, "image/peg"))
 	{
 
-		while(0 != fget_le16(fp))
+		while(0 != tag_get_le16(tf))
 			size -= 2;
 
 		if(size > 0)
@@ -353,7 +353,7 @@ _asf_load_picture(FILE *fp, int size, void *bm, int *bm_size)
 			else
 			{
 				*bm_size = size;
-				if(size > *bm_size || fread(bm, 1, size, fp) != size)
+				if(size > *bm_size || tag_read(tf, bm, size) != size)
 				{
 					DPRINTF(E_ERROR, L_SCANNER, "Overrun %d bytes required\n", size);
 					free(bm);
@@ -378,9 +378,8 @@ _asf_load_picture(FILE *fp, int size, void *bm, int *bm_size)
 }
 
 static int
-_get_asffileinfo(char *file, struct song_metadata *psong)
+_get_asffileinfo(char *file, struct tag_file *tf, struct song_metadata *psong)
 {
-	FILE *fp;
 	asf_object_t hdr;
 	asf_object_t tmp;
 	unsigned long NumObjects;
@@ -399,16 +398,10 @@ _get_asffileinfo(char *file, struct song_metadata *psong)
 
 	psong->vbr_scale = -1;
 
-	if(!(fp = fopen(file, "rb")))
-	{
-		DPRINTF(E_ERROR, L_SCANNER, "Could not open %s for reading\n", file);
-		return -1;
-	}
-
-	if(sizeof(hdr) != fread(&hdr, 1, sizeof(hdr), fp))
+	tag_seek(tf, 0, SEEK_SET);
+	if(sizeof(hdr) != tag_read(tf, &hdr, sizeof(hdr)))
 	{
 		DPRINTF(E_ERROR, L_SCANNER, "Error reading %s\n", file);
-		fclose(fp);
 		return -1;
 	}
 	hdr.Size = le64_to_cpu(hdr.Size);
@@ -416,16 +409,15 @@ _get_asffileinfo(char *file, struct song_metadata *psong)
 	if(!IsEqualGUID(&hdr.ID, &ASF_HeaderObject))
 	{
 		DPRINTF(E_ERROR, L_SCANNER, "Not a valid header\n");
-		fclose(fp);
 		return -1;
 	}
-	NumObjects = fget_le32(fp);
-	fseek(fp, 2, SEEK_CUR); // Reserved le16
+	NumObjects = tag_get_le32(tf);
+	tag_seek(tf, 2, SEEK_CUR); // Reserved le16
 
-	pos = ftell(fp);
+	pos = tag_tell(tf);
 	while(NumObjects > 0)
 	{
-		if(sizeof(tmp) != fread(&tmp, 1, sizeof(tmp), fp))
+		if(sizeof(tmp) != tag_read(tf, &tmp, sizeof(tmp)))
 			break;
 		tmp.Size = le64_to_cpu(tmp.Size);
 
@@ -437,55 +429,55 @@ _get_asffileinfo(char *file, struct song_metadata *psong)
 
 		if(IsEqualGUID(&tmp.ID, &ASF_FileProperties))
 		{
-			_asf_read_file_properties(fp, &FileProperties, tmp.Size);
+			_asf_read_file_properties(tf, &FileProperties, tmp.Size);
 			psong->song_length = le64_to_cpu(FileProperties.PlayDuration) / 10000;
 			psong->bitrate = le64_to_cpu(FileProperties.MaxBitrate);
 			psong->max_bitrate = psong->bitrate;
 		}
 		else if(IsEqualGUID(&tmp.ID, &ASF_ContentDescription))
 		{
-			TitleLength = fget_le16(fp);
-			AuthorLength = fget_le16(fp);
-			CopyrightLength = fget_le16(fp);
-			DescriptionLength = fget_le16(fp);
-			RatingLength = fget_le16(fp);
+			TitleLength = tag_get_le16(tf);
+			AuthorLength = tag_get_le16(tf);
+			CopyrightLength = tag_get_le16(tf);
+			DescriptionLength = tag_get_le16(tf);
+			RatingLength = tag_get_le16(tf);
 
-			if(_asf_load_string(fp, ASF_VT_UNICODE, TitleLength, buf, sizeof(buf)))
+			if(_asf_load_string(tf, ASF_VT_UNICODE, TitleLength, buf, sizeof(buf)))
 			{
 				if(buf[0])
 					psong->title = strdup(buf);
 			}
-			if(_asf_load_string(fp, ASF_VT_UNICODE, AuthorLength, buf, sizeof(buf)))
+			if(_asf_load_string(tf, ASF_VT_UNICODE, AuthorLength, buf, sizeof(buf)))
 			{
 				if(buf[0])
 					psong->contributor[ROLE_TRACKARTIST] = strdup(buf);
 			}
 			if(CopyrightLength)
-				fseek(fp, CopyrightLength, SEEK_CUR);
+				tag_seek(tf, CopyrightLength, SEEK_CUR);
 			if(DescriptionLength)
-				fseek(fp, DescriptionLength, SEEK_CUR);
+				tag_seek(tf, DescriptionLength, SEEK_CUR);
 			if(RatingLength)
-				fseek(fp, RatingLength, SEEK_CUR);
+				tag_seek(tf, RatingLength, SEEK_CUR);
 		}
 		else if(IsEqualGUID(&tmp.ID, &ASF_ExtendedContentDescription))
 		{
-			NumEntries = fget_le16(fp);
+			NumEntries = tag_get_le16(tf);
 			while(NumEntries > 0)
 			{
-				NameLength = fget_le16(fp);
-				_asf_load_string(fp, ASF_VT_UNICODE, NameLength, buf, sizeof(buf));
-				ValueType = fget_le16(fp);
-				ValueLength = fget_le16(fp);
+				NameLength = tag_get_le16(tf);
+				_asf_load_string(tf, ASF_VT_UNICODE, NameLength, buf, sizeof(buf));
+				ValueType = tag_get_le16(tf);
+				ValueLength = tag_get_le16(tf);
 
 				if(!strcasecmp(buf, "AlbumTitle") || !strcasecmp(buf, "WM/AlbumTitle"))
 				{
-					if(_asf_load_string(fp, ValueType, ValueLength, buf, sizeof(buf)))
+					if(_asf_load_string(tf, ValueType, ValueLength, buf, sizeof(buf)))
 						if(buf[0])
 							psong->album = strdup(buf);
 				}
 				else if(!strcasecmp(buf, "AlbumArtist") || !strcasecmp(buf, "WM/AlbumArtist"))
 				{
-					if(_asf_load_string(fp, ValueType, ValueLength, buf, sizeof(buf)))
+					if(_asf_load_string(tf, ValueType, ValueLength, buf, sizeof(buf)))
 					{
 						if(buf[0])
 							psong->contributor[ROLE_ALBUMARTIST] = strdup(buf);
@@ -493,71 +485,71 @@ _get_asffileinfo(char *file, struct song_metadata *psong)
 				}
 				else if(!strcasecmp(buf, "Description") || !strcasecmp(buf, "WM/Track"))
 				{
-					if(_asf_load_string(fp, ValueType, ValueLength, buf, sizeof(buf)))
+					if(_asf_load_string(tf, ValueType, ValueLength, buf, sizeof(buf)))
 						if(buf[0])
 							psong->track = atoi(buf);
 				}
 				else if(!strcasecmp(buf, "Genre") || !strcasecmp(buf, "WM/Genre"))
 				{
-					if(_asf_load_string(fp, ValueType, ValueLength, buf, sizeof(buf)))
+					if(_asf_load_string(tf, ValueType, ValueLength, buf, sizeof(buf)))
 						if(buf[0])
 							psong->genre = strdup(buf);
 				}
 				else if(!strcasecmp(buf, "Year") || !strcasecmp(buf, "WM/Year"))
 				{
-					if(_asf_load_string(fp, ValueType, ValueLength, buf, sizeof(buf)))
+					if(_asf_load_string(tf, ValueType, ValueLength, buf, sizeof(buf)))
 						if(buf[0])
 							psong->year = atoi(buf);
 				}
 				else if(!strcasecmp(buf, "WM/Director"))
 				{
-					if(_asf_load_string(fp, ValueType, ValueLength, buf, sizeof(buf)))
+					if(_asf_load_string(tf, ValueType, ValueLength, buf, sizeof(buf)))
 						if(buf[0])
 							psong->contributor[ROLE_CONDUCTOR] = strdup(buf);
 				}
 				else if(!strcasecmp(buf, "WM/Composer"))
 				{
-					if(_asf_load_string(fp, ValueType, ValueLength, buf, sizeof(buf)))
+					if(_asf_load_string(tf, ValueType, ValueLength, buf, sizeof(buf)))
 						if(buf[0])
 							psong->contributor[ROLE_COMPOSER] = strdup(buf);
 				}
 				else if(!strcasecmp(buf, "WM/Picture") && (ValueType == ASF_VT_BYTEARRAY))
 				{
-					psong->image = _asf_load_picture(fp, ValueLength, psong->image, &psong->image_size);
+					psong->image = _asf_load_picture(tf, ValueLength, psong->image, &psong->image_size);
 				}
 				else if(!strcasecmp(buf, "TrackNumber") || !strcasecmp(buf, "WM/TrackNumber"))
 				{
-					if(_asf_load_string(fp, ValueType, ValueLength, buf, sizeof(buf)))
+					if(_asf_load_string(tf, ValueType, ValueLength, buf, sizeof(buf)))
 						if(buf[0])
 							psong->track = atoi(buf);
 				}
 				else if(!strcasecmp(buf, "isVBR"))
 				{
-					fseek(fp, ValueLength, SEEK_CUR);
+					tag_seek(tf, ValueLength, SEEK_CUR);
 					psong->vbr_scale = 0;
 				}
 				else if(ValueLength)
 				{
-					fseek(fp, ValueLength, SEEK_CUR);
+					tag_seek(tf, ValueLength, SEEK_CUR);
 				}
 				NumEntries--;
 			}
 		}
 		else if(IsEqualGUID(&tmp.ID, &ASF_StreamHeader))
 		{
-			_asf_read_stream_object(fp, psong, tmp.Size);
+			_asf_read_stream_object(tf, psong, tmp.Size);
 		}
 		else if(IsEqualGUID(&tmp.ID, &ASF_HeaderExtension))
 		{
-			_asf_read_header_extension(fp, psong, tmp.Size);
+			_asf_read_header_extension(tf, psong, tmp.Size);
 		}
 		pos += tmp.Size;
-		fseek(fp, pos, SEEK_SET);
+		tag_seek(tf, pos, SEEK_SET);
 		NumObjects--;
 	}
 
 #if 0
-	if(sizeof(hdr) == fread(&hdr, 1, sizeof(hdr), fp) && IsEqualGUID(&hdr.ID, &ASF_DataObject))
+	if(sizeof(hdr) == tag_read(tf, &hdr, sizeof(hdr)) && IsEqualGUID(&hdr.ID, &ASF_DataObject))
 	{
 		if(psong->song_length)
 		{
@@ -566,6 +558,5 @@ _get_asffileinfo(char *file, struct song_metadata *psong)
 	}
 #endif
 
-	fclose(fp);
 	return 0;
 }
@@ -25,7 +25,7 @@
  */
 
 static int
-_get_mp3tags(char *file, struct song_metadata *psong)
+_get_mp3tags(char *file, struct tag_file *tf, struct song_metadata *psong)
 {
 	struct id3_file *pid3file;
 	struct id3_tag *pid3tag;
@@ -397,7 +397,7 @@ _decode_mp3_frame(unsigned char *frame, struct mp3_frameinfo *pfi)
 
 // _mp3_get_average_bitrate
 //    read from midle of file, and estimate
-static void _mp3_get_average_bitrate(FILE *infile, struct mp3_frameinfo *pfi, const char *fname)
+static void _mp3_get_average_bitrate(struct tag_file *tf, struct mp3_frameinfo *pfi, const char *fname)
 {
 	off_t file_size;
 	unsigned char frame_buffer[2900];
@@ -409,14 +409,13 @@ static void _mp3_get_average_bitrate(FILE *infile, struct mp3_frameinfo *pfi, co
 	int frame_count = 0;
 	int bitrate_total = 0;
 
-	fseek(infile, 0, SEEK_END);
-	file_size = ftell(infile);
+	file_size = tag_size(tf);
 
 	pos = file_size >> 1;
 
 	/* now, find the first frame */
-	fseek(infile, pos, SEEK_SET);
-	if(fread(frame_buffer, 1, sizeof(frame_buffer), infile) != sizeof(frame_buffer))
+	tag_seek(tf, pos, SEEK_SET);
+	if(tag_read(tf, frame_buffer, sizeof(frame_buffer)) != sizeof(frame_buffer))
 		return;
 
 	while(!found)
@@ -433,8 +432,8 @@ static void _mp3_get_average_bitrate(FILE *infile, struct mp3_frameinfo *pfi, co
 		if(!_decode_mp3_frame(&frame_buffer[index], &fi))
 		{
 			/* see if next frame is valid */
-			fseek(infile, pos + index + fi.frame_length, SEEK_SET);
-			if(fread(header, 1, sizeof(header), infile) != sizeof(header))
+			tag_seek(tf, pos + index + fi.frame_length, SEEK_SET);
+			if(tag_read(tf, header, sizeof(header)) != sizeof(header))
 			{
 				DPRINTF(E_DEBUG, L_SCANNER, "Could not read frame header for %s\n", basename((char *)fname));
 				return;
@@ -453,8 +452,8 @@ static void _mp3_get_average_bitrate(FILE *infile, struct mp3_frameinfo *pfi, co
 	// got first frame
 	while(frame_count < 10)
 	{
-		fseek(infile, pos, SEEK_SET);
-		if(fread(header, 1, sizeof(header), infile) != sizeof(header))
+		tag_seek(tf, pos, SEEK_SET);
+		if(tag_read(tf, header, sizeof(header)) != sizeof(header))
 		{
 			DPRINTF(E_DEBUG, L_SCANNER, "Could not read frame header for %s\n", basename((char *)fname));
 			return;
@@ -478,7 +477,7 @@ static void _mp3_get_average_bitrate(FILE *infile, struct mp3_frameinfo *pfi, co
 // _mp3_get_frame_count
 //   do brute scan
 static void __attribute__((unused))
-_mp3_get_frame_count(FILE *infile, struct mp3_frameinfo *pfi)
+_mp3_get_frame_count(struct tag_file *tf, struct mp3_frameinfo *pfi)
 {
 	int pos;
 	int frames = 0;
@@ -489,8 +488,7 @@ _mp3_get_frame_count(FILE *infile, struct mp3_frameinfo *pfi)
 	int cbr = 1;
 	int last_bitrate = 0;
 
-	fseek(infile, 0, SEEK_END);
-	file_size = ftell(infile);
+	file_size = tag_size(tf);
 
 	pos = pfi->frame_offset;
 
@@ -498,8 +496,8 @@ _mp3_get_frame_count(FILE *infile, struct mp3_frameinfo *pfi)
 	{
 		err = 1;
 
-		fseek(infile, pos, SEEK_SET);
-		if(fread(frame_buffer, 1, sizeof(frame_buffer), infile) == sizeof(frame_buffer))
+		tag_seek(tf, pos, SEEK_SET);
+		if(tag_read(tf, frame_buffer, sizeof(frame_buffer)) == sizeof(frame_buffer))
 		{
 			// valid frame?
 			if(!_decode_mp3_frame(frame_buffer, &fi))
@@ -540,9 +538,8 @@ _mp3_get_frame_count(FILE *infile, struct mp3_frameinfo *pfi)
 
 // _get_mp3fileinfo
 static int
-_get_mp3fileinfo(char *file, struct song_metadata *psong)
+_get_mp3fileinfo(char *file, struct tag_file *tf, struct song_metadata *psong)
 {
-	FILE *infile;
 	struct id3header *pid3;
 	struct mp3_frameinfo fi;
 	unsigned int size = 0;
@@ -560,21 +557,14 @@ _get_mp3fileinfo(char *file, struct song_metadata *psong)
 
 	char id3v1taghdr[4];
 
-	if(!(infile = fopen(file, "rb")))
-	{
-		DPRINTF(E_ERROR, L_SCANNER, "Could not open %s for reading\n", file);
-		return -1;
-	}
-
 	memset((void*)&fi, 0, sizeof(fi));
 
-	fseek(infile, 0, SEEK_END);
-	file_size = ftell(infile);
-	fseek(infile, 0, SEEK_SET);
+	file_size = tag_size(tf);
+	tag_seek(tf, 0, SEEK_SET);
 
-	if(fread(buffer, 1, sizeof(buffer), infile) != sizeof(buffer))
+	if(tag_read(tf, buffer, sizeof(buffer)) != sizeof(buffer))
 	{
-		if(ferror(infile))
+		if(tag_size(tf) >= sizeof(buffer))
 		{
 			DPRINTF(E_ERROR, L_SCANNER, "Error reading: %s [%s]\n", strerror(errno), file);
 		}
@@ -582,7 +572,6 @@ _get_mp3fileinfo(char *file, struct song_metadata *psong)
 		{
 			DPRINTF(E_WARN, L_SCANNER, "File too small. Probably corrupted. [%s]\n", file);
 		}
-		fclose(infile);
 		return -1;
 	}
 
@@ -614,10 +603,9 @@ _get_mp3fileinfo(char *file, struct song_metadata *psong)
 
 	while(!found)
 	{
-		fseek(infile, fp_size, SEEK_SET);
-		if((n_read = fread(buffer, 1, sizeof(buffer), infile)) < 4)   // at least mp3 frame header size (i.e. 4 bytes)
+		tag_seek(tf, fp_size, SEEK_SET);
+		if((n_read = tag_read(tf, buffer, sizeof(buffer))) < 4)   // at least mp3 frame header size (i.e. 4 bytes)
 		{
-			fclose(infile);
 			return 0;
 		}
 
@@ -633,7 +621,6 @@ _get_mp3fileinfo(char *file, struct song_metadata *psong)
 				first_check = 0;
 				if(n_read < sizeof(buffer))
 				{
-					fclose(infile);
 					return 0;
 				}
 				break;
@@ -644,7 +631,6 @@ _get_mp3fileinfo(char *file, struct song_metadata *psong)
 				fp_size += index;
 				if(n_read < sizeof(buffer))
 				{
-					fclose(infile);
 					return 0;
 				}
 				break;
@@ -662,8 +648,8 @@ _get_mp3fileinfo(char *file, struct song_metadata *psong)
 				else
 				{
 					/* No Xing... check for next frame to validate current fram is correct */
-					fseek(infile, fp_size + index + fi.frame_length, SEEK_SET);
-					if(fread(frame_buffer, 1, sizeof(frame_buffer), infile) == sizeof(frame_buffer))
+					tag_seek(tf, fp_size + index + fi.frame_length, SEEK_SET);
+					if(tag_read(tf, frame_buffer, sizeof(frame_buffer)) == sizeof(frame_buffer))
 					{
 						if(!_decode_mp3_frame((unsigned char*)frame_buffer, &fi))
 						{
@@ -674,7 +660,6 @@ _get_mp3fileinfo(char *file, struct song_metadata *psong)
 					else
 					{
 						DPRINTF(E_ERROR, L_SCANNER, "Could not read frame header: %s\n", file);
-						fclose(infile);
 						return 0;
 					}
 
@@ -706,8 +691,8 @@ _get_mp3fileinfo(char *file, struct song_metadata *psong)
 	psong->audio_offset = fp_size;
 	psong->audio_size = file_size - fp_size;
 	// check if last 128 bytes is ID3v1.0 ID3v1.1 tag
-	fseek(infile, file_size - 128, SEEK_SET);
-	if(fread(id3v1taghdr, 1, 4, infile) == 4)
+	tag_seek(tf, file_size - 128, SEEK_SET);
+	if(tag_read(tf, id3v1taghdr, 4) == 4)
 	{
 		if(id3v1taghdr[0] == 'T' && id3v1taghdr[1] == 'A' && id3v1taghdr[2] == 'G')
 		{
@@ -717,7 +702,6 @@ _get_mp3fileinfo(char *file, struct song_metadata *psong)
 
 	if(_decode_mp3_frame(&buffer[index], &fi))
 	{
-		fclose(infile);
 		DPRINTF(E_ERROR, L_SCANNER, "Could not find sync frame: %s\n", file);
 		return 0;
 	}
@@ -744,7 +728,7 @@ _get_mp3fileinfo(char *file, struct song_metadata *psong)
 
 	if((fi.number_of_frames == 0) && (!psong->song_length))
 	{
-		_mp3_get_average_bitrate(infile, &fi, file);
+		_mp3_get_average_bitrate(tf, &fi, file);
 	}
 
 	psong->bitrate = fi.bitrate * 1000;
@@ -766,7 +750,6 @@ _get_mp3fileinfo(char *file, struct song_metadata *psong)
 	}
 	psong->channels = fi.stereo ? 2 : 1;
 
-	fclose(infile);
 	//DEBUG DPRINTF(E_INFO, L_SCANNER, "Got fileinfo successfully for file=%s song_length=%d\n", file, psong->song_length);
 
 	psong->blockalignment = 1;
@@ -392,7 +392,7 @@ _ogg_find_stream_processor(ogg_stream_set *set, ogg_page *page)
 }
 
 static int
-_ogg_get_next_page(FILE *f, ogg_sync_state *sync, ogg_page *page,
+_ogg_get_next_page(struct tag_file *tf, ogg_sync_state *sync, ogg_page *page,
 		   ogg_int64_t *written)
 {
 	int ret;
@@ -405,7 +405,7 @@ _ogg_get_next_page(FILE *f, ogg_sync_state *sync, ogg_page *page,
 			DPRINTF(E_WARN, L_SCANNER, "Hole in data found at approximate offset %lld bytes. Corrupted ogg.\n", *written);
 
 		buffer = ogg_sync_buffer(sync, 4500); // chunk=4500
-		bytes = fread(buffer, 1, 4500, f);
+		bytes = tag_read(tf, buffer, 4500);
 		if(bytes <= 0)
 		{
 			ogg_sync_wrote(sync, 0);
@@ -420,28 +420,21 @@ _ogg_get_next_page(FILE *f, ogg_sync_state *sync, ogg_page *page,
 
 
 static int
-_get_oggfileinfo(char *filename, struct song_metadata *psong)
+_get_oggfileinfo(char *filename, struct tag_file *tf, struct song_metadata *psong)
 {
-	FILE *file = fopen(filename, "rb");
 	ogg_sync_state sync;
 	ogg_page page;
 	ogg_stream_set *processors = _ogg_create_stream_set();
 	int gotpage = 0;
 	ogg_int64_t written = 0;
 
-	if(!file)
-	{
-		DPRINTF(E_FATAL, L_SCANNER,
-			"Error opening input file \"%s\": %s\n", filename,  strerror(errno));
-		_ogg_free_stream_set(processors);
-		return -1;
-	}
-
 	DPRINTF(E_MAXDEBUG, L_SCANNER, "Processing file \"%s\"...\n\n", filename);
 
 	ogg_sync_init(&sync);
+	tag_seek(tf, 0, SEEK_SET);
+	tag_sequential(tf);
 
-	while(_ogg_get_next_page(file, &sync, &page, &written))
+	while(_ogg_get_next_page(tf, &sync, &page, &written))
 	{
 		ogg_stream_processor *p = _ogg_find_stream_processor(processors, &page);
 		gotpage = 1;
@@ -450,7 +443,7 @@ _get_oggfileinfo(char *filename, struct song_metadata *psong)
 		{
 			DPRINTF(E_FATAL, L_SCANNER, "Could not find a processor for stream, bailing\n");
 			_ogg_free_stream_set(processors);
-			fclose(file);
+			ogg_sync_clear(&sync);
 			return -1;
 		}
 
@@ -525,8 +518,6 @@ _get_oggfileinfo(char *filename, struct song_metadata *psong)
 
 	ogg_sync_clear(&sync);
 
-	fclose(file);
-
 	if(!gotpage)
 	{
 		DPRINTF(E_ERROR, L_SCANNER, "No ogg data found in file \"%s\".\n", filename);
@@ -30,9 +30,8 @@
 			  (((uint8_t)((p)[0]))))
 
 static int
-_get_wavtags(char *filename, struct song_metadata *psong)
+_get_wavtags(char *filename, struct tag_file *tf, struct song_metadata *psong)
 {
-	int fd;
 	uint32_t len;
 	unsigned char hdr[12];
 	unsigned char fmt[16];
@@ -51,17 +50,11 @@ _get_wavtags(char *filename, struct song_metadata *psong)
 
 	//DEBUG DPRINTF(E_DEBUG,L_SCANNER,"Getting WAV file info\n");
 
-	if(!(fd = open(filename, O_RDONLY)))
-	{
-		DPRINTF(E_WARN, L_SCANNER, "Could not create file handle\n");
-		return -1;
-	}
-
+	tag_seek(tf, 0, SEEK_SET);
 	len = 12;
-	if(!(len = read(fd, hdr, len)) || (len != 12))
+	if(!(len = tag_read(tf, hdr, len)) || (len != 12))
 	{
 		DPRINTF(E_WARN, L_SCANNER, "Could not read wav header from %s\n", filename);
-		close(fd);
 		return -1;
 	}
 
@@ -71,7 +64,6 @@ _get_wavtags(char *filename, struct song_metadata *psong)
 	   strncmp((char*)hdr + 8, "WAVE", 4))
 	{
 		DPRINTF(E_WARN, L_SCANNER, "Invalid wav header in %s\n", filename);
-		close(fd);
 		return -1;
 	}
 
@@ -82,9 +74,8 @@ _get_wavtags(char *filename, struct song_metadata *psong)
 	while(current_offset + 8 < psong->file_size)
 	{
 		len = 8;
-		if(!(len = read(fd, hdr, len)) || (len != 8))
+		if(!(len = tag_read(tf, hdr, len)) || (len != 8))
 		{
-			close(fd);
 			DPRINTF(E_WARN, L_SCANNER, "Error reading block: %s\n", filename);
 			return -1;
 		}
@@ -102,7 +93,6 @@ _get_wavtags(char *filename, struct song_metadata *psong)
 
 		if(block_len < 0)
 		{
-			close(fd);
 			DPRINTF(E_WARN, L_SCANNER, "Bad block len: %s\n", filename);
 			return -1;
 		}
@@ -111,9 +101,8 @@ _get_wavtags(char *filename, struct song_metadata *psong)
 		{
 			//DEBUG DPRINTF(E_DEBUG,L_SCANNER,"Found 'fmt ' header\n");
 			len = 16;
-			if(!read(fd, fmt, len) || (len != 16))
+			if(tag_read(tf, fmt, len) != 16)
 			{
-				close(fd);
 				DPRINTF(E_WARN, L_SCANNER, "Bad .wav file: can't read fmt: %s\n",
 					filename);
 				return -1;
@@ -152,7 +141,7 @@ _get_wavtags(char *filename, struct song_metadata *psong)
 			if(!tags)
 				goto next_block;
 
-			if(read(fd, tags, len) < len ||
+			if(tag_read(tf, tags, len) < len ||
 			   strncmp(tags, "INFO", 4) != 0)
 			{
 				free(tags);
@@ -212,10 +201,9 @@ _get_wavtags(char *filename, struct song_metadata *psong)
 			free(tags);
 		}
 next_block:
-		lseek(fd, current_offset + block_len, SEEK_SET);
+		tag_seek(tf, current_offset + block_len, SEEK_SET);
 		current_offset += block_len;
 	}
-	close(fd);
 
 	if(((format_data_length != 16) && (format_data_length != 18)) ||
 	   (compression_code != 1) ||
@@ -247,7 +235,7 @@ next_block:
 }
 
 static int
-_get_wavfileinfo(char *filename, struct song_metadata *psong)
+_get_wavfileinfo(char *filename, struct tag_file *tf, struct song_metadata *psong)
 {
 	psong->lossless = 1;
 	/* Upon further review, WAV files should be little-endian, and DLNA requires the LPCM profile to be big-endian.
@@ -111,8 +111,8 @@ char *winamp_genre[] = {
 #include "tagutils-wav.h"
 #include "tagutils-pcm.h"
 
-static int _get_tags(char *file, struct song_metadata *psong);
-static int _get_fileinfo(char *file, struct song_metadata *psong);
+static int _get_tags(char *file, struct tag_file *tf, struct song_metadata *psong);
+static int _get_fileinfo(char *file, struct tag_file *tf, struct song_metadata *psong);
 
 
 /*
@@ -121,8 +121,8 @@ static int _get_fileinfo(char *file, struct song_metadata *psong);
 
 typedef struct {
 	char* type;
-	int (*get_tags)(char* file, struct song_metadata* psong);
-	int (*get_fileinfo)(char* file, struct song_metadata* psong);
+	int (*get_tags)(char* file, struct tag_file* tf, struct song_metadata* psong);
+	int (*get_fileinfo)(char* file, struct tag_file* tf, struct song_metadata* psong);
 } taghandler;
 
 static taghandler taghandlers[] = {
@@ -180,7 +180,7 @@ freetags(struct song_metadata *psong)
 
 // _get_fileinfo
 static int
-_get_fileinfo(char *file, struct song_metadata *psong)
+_get_fileinfo(char *file, struct tag_file *tf, struct song_metadata *psong)
 {
 	taghandler *hdl;
 
@@ -190,7 +190,7 @@ _get_fileinfo(char *file, struct song_metadata *psong)
 			break;
 
 	if(hdl->get_fileinfo)
-		return hdl->get_fileinfo(file, psong);
+		return hdl->get_fileinfo(file, tf, psong);
 
 	return 0;
 }
@@ -242,7 +242,7 @@ _make_composite_tags(struct song_metadata *psong)
 /*****************************************************************************/
 // _get_tags
 static int
-_get_tags(char *file, struct song_metadata *psong)
+_get_tags(char *file, struct tag_file *tf, struct song_metadata *psong)
 {
 	taghandler *hdl;
 
@@ -253,7 +253,7 @@ _get_tags(char *file, struct song_metadata *psong)
 
 	if(hdl->get_tags)
 	{
-		return hdl->get_tags(file, psong);
+		return hdl->get_tags(file, tf, psong);
 	}
 
 	return 0;
@@ -265,6 +265,8 @@ int
 readtags(char *path, struct song_metadata *psong, struct stat *stat, char *lang, char *type)
 {
 	char *fname;
+	struct tag_file tf;
+	int ret;
 
 	if(lang_index == -1)
 		lang_index = _lang2cp(lang);
@@ -283,12 +285,22 @@ readtags(char *path, struct song_metadata *psong, struct stat *stat, char *lang,
 		psong->file_size = stat->st_size;
 	}
 
+	// both passes share one mapping of the file
+	if(tag_open(&tf, path) != 0)
+	{
+		DPRINTF(E_ERROR, L_SCANNER, "Cannot open file %s for reading\n", path);
+		return -1;
+	}
+
 	// get tag
-	if( _get_tags(path, psong) == 0 )
+	if( _get_tags(path, &tf, psong) == 0 )
 	{
 		_make_composite_tags(psong);
 	}
 	
 	// get fileinfo
-	return _get_fileinfo(path, psong);
+	ret = _get_fileinfo(path, &tf, psong);
+	tag_close(&tf);
+
+	return ret;
 }
@@ -0,0 +1,185 @@
+/* MiniDLNA media server
+ *
+ * This file is part of MiniDLNA.
+ *
+ * MiniDLNA is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * MiniDLNA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MiniDLNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "config.h"
+#include "sql.h"
+#include "scanner_sqlite.h"
+#include "testutils.h"
+
+/* Browse latency while a scanner commits in another connection, with the
+ * open_db() setup with and without db_wal.  Only torn or failed reads
+ * fail the test; the latencies are reported, not compared. */
+#define BROWSE_ITEMS	2000
+#define SCAN_BATCHES	100
+#define SCAN_BATCH	200
+#define BROWSE_MAX	100000
+
+static char db_file[64];
+static volatile int scan_done;
+
+/* Set up like open_db(), with or without db_wal */
+static sqlite3 *
+open_test_db(int wal)
+{
+	sqlite3 *sq3;
+
+	if( sqlite3_open(db_file, &sq3) != SQLITE_OK )
+		return NULL;
+	if( sql_set_pragmas(sq3, wal) != wal )
+	{
+		fprintf(stderr, "could not set up %s\n", db_file);
+		sqlite3_close(sq3);
+		return NULL;
+	}
+	return sq3;
+}
+
+static int
+insert_item(sqlite3 *sq3, const char *parent, int n)
+{
+	char id[32], name[32];
+
+	if( sql_exec(sq3, "INSERT into DETAILS (PATH, SIZE, TITLE, TRACK, MIME)"
+	                  " values ('/media/%s/%d.mp3', %d, 'Track %d', %d, 'audio/mpeg')",
+	                  parent, n, n * 1000, n, n % 20) != SQLITE_OK )
+		return -1;
+	snprintf(id, sizeof(id), "%s$%X", parent, n);
+	snprintf(name, sizeof(name), "Track %d", n);
+	return sql_insert_object(sq3, id, parent, NULL, "item.audioItem.musicTrack",
+	                         sqlite3_last_insert_rowid(sq3), name);
+}
+
+static void *
+scanner(void *arg)
+{
+	sqlite3 *sq3 = open_test_db(*(int *)arg);
+	int i, j;
+
+	for( i = 0; sq3 && i < SCAN_BATCHES; i++ )
+	{
+		sql_exec(sq3, "BEGIN");
+		for( j = 0; j < SCAN_BATCH; j++ )
+			insert_item(sq3, "64$1", i * SCAN_BATCH + j);
+		sql_exec(sq3, "COMMIT");
+	}
+	sqlite3_close(sq3);
+	scan_done = 1;
+	return NULL;
+}
+
+static int
+cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+static int
+run(int wal, double *lat)
+{
+	pthread_t thread;
+	sqlite3 *sq3;
+	int i, n, rows, cols, count, bad = 0;
+	char **result;
+	double t;
+
+	unlink(db_file);
+	sq3 = open_test_db(wal);
+	if( !test_check(sq3 &&
+	                sql_exec(sq3, create_objectTable_sqlite) == SQLITE_OK &&
+	                sql_exec(sq3, create_detailTable_sqlite) == SQLITE_OK &&
+	                sql_create_sort_keys(sq3) == SQLITE_OK,
+	                "could not create %s", db_file) )
+		return -1;
+	sql_exec(sq3, "create INDEX IDX_SCANNER_OPT ON OBJECTS(PARENT_ID, NAME, OBJECT_ID);");
+	sql_exec(sq3, "BEGIN");
+	for( i = 0; i < BROWSE_ITEMS; i++ )
+		insert_item(sq3, "64$0", i);
+	sql_exec(sq3, "COMMIT");
+
+	scan_done = 0;
+	if( !test_check(pthread_create(&thread, NULL, scanner, &wal) == 0, "pthread_create failed") )
+		return -1;
+	for( n = 0; !scan_done && n < BROWSE_MAX; n++ )
+	{
+		t = test_now();
+		if( sql_get_table(sq3, "SELECT o.OBJECT_ID, d.TITLE, d.SIZE, d.MIME from OBJECTS o"
+		                       " left join DETAILS d on (d.ID = o.DETAIL_ID)"
+		                       " where PARENT_ID = '64$0' order by SORT_TITLE limit 50 offset 100",
+		                       &result, &rows, &cols) != SQLITE_OK || rows != 50 )
+			bad++;
+		else
+			sqlite3_free_table(result);
+		/* A reader must only ever see whole scanner transactions */
+		count = sql_get_int_field(sq3, "SELECT count(*) from OBJECTS where PARENT_ID = '64$1'");
+		if( count < 0 || count % SCAN_BATCH )
+			bad++;
+		lat[n] = (test_now() - t) * 1e6;
+		usleep(200);
+	}
+	pthread_join(thread, NULL);
+	count = sql_get_int_field(sq3, "SELECT count(*) from OBJECTS where PARENT_ID = '64$1'");
+	if( count != SCAN_BATCHES * SCAN_BATCH )
+		bad++;
+	sqlite3_close(sq3);
+
+	if( !test_check(!bad && n, "%s: %d failed or torn reads in %d",
+	                wal ? "WAL" : "journal off", bad, n) )
+		return -1;
+	qsort(lat, n, sizeof(*lat), cmp_double);
+	printf("%-12s %6d browses during scan: p50 %8.0f us, p99 %8.0f us, max %8.0f us\n",
+	       wal ? "WAL" : "journal off", n, lat[n / 2], lat[n * 99 / 100], lat[n - 1]);
+	return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+	double *lat;
+	int fd;
+
+	strcpy(db_file, "testbrowselat.XXXXXX");
+	fd = mkstemp(db_file);
+	if( fd < 0 )
+	{
+		perror("mkstemp");
+		return 1;
+	}
+	close(fd);
+	lat = malloc(BROWSE_MAX * sizeof(*lat));
+	if( !lat )
+		return 1;
+
+	if( run(0, lat) == 0 )
+		run(1, lat);
+
+	unlink(db_file);
+	strcat(db_file, "-wal");
+	unlink(db_file);
+	db_file[strlen(db_file) - 4] = '\0';
+	strcat(db_file, "-shm");
+	unlink(db_file);
+	free(lat);
+
+	return test_status();
+}
@@ -0,0 +1,265 @@
+/* MiniDLNA media server
+ *
+ * This file is part of MiniDLNA.
+ *
+ * MiniDLNA is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * MiniDLNA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MiniDLNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "config.h"
+#include "upnpglobalvars.h"
+#include "upnphttp.h"
+#include "upnpsoap.h"
+#include "upnpevents.h"
+#include "scanner.h"
+#include "getifaddr.h"
+#include "sql.h"
+#include "scanner_sqlite.h"
+#include "testutils.h"
+
+/* DIDL-Lite serialization of Browse results: checks the elements each
+ * filter emits and reports result rows per second. */
+#define TRACKS		500
+#define BENCH_ROWS	200000
+
+/* The HTTP side of a SOAP response, kept in memory */
+void
+BuildHeader_upnphttp(struct upnphttp *h, int respcode, const char *respmsg, int bodylen)
+{
+	h->res_buf_alloclen = bodylen + 1;
+	h->res_buf = realloc(h->res_buf, h->res_buf_alloclen);
+	h->res_buflen = 0;
+}
+
+void
+BuildResp2_upnphttp(struct upnphttp *h, int respcode, const char *respmsg, const char *body, int bodylen)
+{
+	test_check(0, "SOAP error %d", respcode);
+}
+
+void
+Send400(struct upnphttp *h)
+{
+	test_check(0, "HTTP 400");
+}
+
+void
+Send500(struct upnphttp *h)
+{
+	test_check(0, "HTTP 500");
+}
+
+void
+SendResp_upnphttp(struct upnphttp *h)
+{
+	h->res_buf[h->res_buflen] = '\0';
+}
+
+void
+CloseSocket_upnphttp(struct upnphttp *h)
+{
+}
+
+int
+get_remote_mac(struct in_addr ip_addr, unsigned char *mac)
+{
+	return -1;
+}
+
+int64_t
+get_next_available_id(const char *table, const char *parentID)
+{
+	return 0;
+}
+
+uint32_t
+upnp_event_container_update_id(const char *id)
+{
+	return 0;
+}
+
+static const char *
+browse(struct upnphttp *h, const char *id, const char *filter, int count)
+{
+	static char body[1024];
+
+	h->req_contentlen = snprintf(body, sizeof(body),
+		"<?xml version=\"1.0\" encoding=\"utf-8\"?>"
+		"<s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\" "
+		"s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\"><s:Body>"
+		"<u:Browse xmlns:u=\"urn:schemas-upnp-org:service:ContentDirectory:1\">"
+		"<ObjectID>%s</ObjectID><BrowseFlag>BrowseDirectChildren</BrowseFlag>"
+		"<Filter>%s</Filter><StartingIndex>0</StartingIndex>"
+		"<RequestedCount>%d</RequestedCount><SortCriteria></SortCriteria>"
+		"</u:Browse></s:Body></s:Envelope>", id, filter, count);
+	h->req_buf = body;
+	h->req_contentoff = 0;
+	h->res_buflen = 0;
+	ExecuteSoapAction(h, "\"urn:schemas-upnp-org:service:ContentDirectory:1#Browse\"",
+	                  strlen("\"urn:schemas-upnp-org:service:ContentDirectory:1#Browse\""));
+	return h->res_buf ? h->res_buf : "";
+}
+
+static int
+count_str(const char *s, const char *sub)
+{
+	int n = 0;
+
+	while( (s = strstr(s, sub)) )
+	{
+		n++;
+		s += strlen(sub);
+	}
+	return n;
+}
+
+static void
+expect(const char *what, const char *resp, const char *sub, int n)
+{
+	int got = count_str(resp, sub);
+
+	test_check(got == n, "%s: %d x \"%s\", expected %d", what, got, sub, n);
+}
+
+static int
+create_library(void)
+{
+	char comment[512], id[32], name[32];
+	int t, ret = SQLITE_OK;
+
+	if( sqlite3_open(":memory:", &db) != SQLITE_OK ||
+	    sql_create_functions(db) != SQLITE_OK ||
+	    sql_exec(db, create_objectTable_sqlite) != SQLITE_OK ||
+	    sql_exec(db, create_detailTable_sqlite) != SQLITE_OK ||
+	    sql_exec(db, create_bookmarkTable_sqlite) != SQLITE_OK ||
+	    sql_exec(db, create_captionTable_sqlite) != SQLITE_OK ||
+	    sql_create_sort_keys(db) != SQLITE_OK )
+		return -1;
+	sql_exec(db, "create INDEX IDX_SCANNER_OPT ON OBJECTS(PARENT_ID, NAME, OBJECT_ID);");
+	/* Longer than the 384 bytes dc:description keeps */
+	memset(comment, 'c', sizeof(comment) - 1);
+	comment[sizeof(comment) - 1] = '\0';
+
+	/* Titles keep the file extension, as BAIDU_DMS_OPT builds take the
+	 * /MediaItems/ suffix from the title rather than the MIME type */
+	sql_exec(db, "BEGIN");
+	for( t = 0; t < TRACKS && ret == SQLITE_OK; t++ )
+	{
+		ret = sql_exec(db, "INSERT into DETAILS (PATH, SIZE, TITLE, DURATION, BITRATE, SAMPLERATE,"
+		                   " CHANNELS, ARTIST, ALBUM, GENRE, COMMENT, CREATOR, TRACK, DATE, MIME)"
+		                   " values ('/media/music/%d.mp3', 4000000, 'Track %d.mp3', '0:03:20.000', 16000, 44100,"
+		                   " 2, 'Artist %d', 'Album', 'Rock', %Q, 'Composer', %d, '2010-01-01', 'audio/mpeg')",
+		                   t, t, t % 7, (t % 10) ? NULL : comment, t);
+		if( ret != SQLITE_OK )
+			break;
+		snprintf(id, sizeof(id), MUSIC_ALL_ID "$%X", t);
+		snprintf(name, sizeof(name), "Track %d.mp3", t);
+		ret = sql_insert_object(db, id, MUSIC_ALL_ID, NULL, "item.audioItem.musicTrack",
+		                        sqlite3_last_insert_rowid(db), name);
+	}
+	if( ret == SQLITE_OK )
+		ret = sql_exec(db, "INSERT into DETAILS (PATH, SIZE, TITLE, ARTIST, MIME)"
+		                   " values ('/media/video/v.avi', 70000000, 'Video.avi', 'Actor', 'video/avi')");
+	if( ret == SQLITE_OK )
+		ret = sql_insert_object(db, VIDEO_ALL_ID "$0", VIDEO_ALL_ID, NULL, "item.videoItem",
+		                        sqlite3_last_insert_rowid(db), "Video.avi");
+	sql_exec(db, "COMMIT");
+
+	return (ret == SQLITE_OK) ? 0 : -1;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct upnphttp h;
+	const char *resp;
+	double t, secs;
+	int rows;
+
+	strcpy(lan_addr[0].str, "192.168.0.10");
+	n_lan_addr = 1;
+	runtime_vars.port = 8200;
+	if( !test_check(create_library() == 0, "could not build the test library") )
+		return 1;
+	memset(&h, 0, sizeof(h));
+
+	/* Everything */
+	resp = browse(&h, MUSIC_ALL_ID, "*", 0);
+	expect("filter *", resp, "&lt;item ", TRACKS);
+	expect("filter *", resp, "&lt;dc:title&gt;Track 3.mp3&lt;/dc:title&gt;", 1);
+	expect("filter *", resp, "&lt;upnp:artist&gt;Artist 3&lt;/upnp:artist&gt;", TRACKS / 7);
+	expect("filter *", resp, "&lt;upnp:album&gt;Album&lt;/upnp:album&gt;", TRACKS);
+	expect("filter *", resp, "&lt;upnp:genre&gt;Rock&lt;/upnp:genre&gt;", TRACKS);
+	expect("filter *", resp, "&lt;dc:creator&gt;Composer&lt;/dc:creator&gt;", TRACKS);
+	expect("filter *", resp, "&lt;dc:date&gt;2010-01-01&lt;/dc:date&gt;", TRACKS);
+	expect("filter *", resp, "&lt;upnp:originalTrackNumber&gt;7&lt;/upnp:originalTrackNumber&gt;", 1);
+	/* Track 0 has no track number to show */
+	expect("filter *", resp, "&lt;upnp:originalTrackNumber&gt;", TRACKS - 1);
+	expect("filter *", resp, "&lt;upnp:actor&gt;", 0);
+	expect("filter *", resp, "ccc&lt;/dc:description&gt;", TRACKS / 10);
+	/* A whole item, in the element order callback() always used */
+	expect("filter *", resp,
+	       "&lt;item id=\"1$4$1\" parentID=\"1$4\" restricted=\"1\"&gt;"
+	       "&lt;dc:title&gt;Track 1.mp3&lt;/dc:title&gt;"
+	       "&lt;upnp:class&gt;object.item.audioItem.musicTrack&lt;/upnp:class&gt;"
+	       "&lt;dc:creator&gt;Composer&lt;/dc:creator&gt;&lt;dc:date&gt;2010-01-01&lt;/dc:date&gt;"
+	       "&lt;upnp:artist&gt;Artist 1&lt;/upnp:artist&gt;&lt;upnp:album&gt;Album&lt;/upnp:album&gt;"
+	       "&lt;upnp:genre&gt;Rock&lt;/upnp:genre&gt;"
+	       "&lt;upnp:originalTrackNumber&gt;1&lt;/upnp:originalTrackNumber&gt;"
+	       "&lt;res size=\"4000000\" duration=\"0:03:20.000\" bitrate=\"16000\" sampleFrequency=\"44100\""
+	       " nrAudioChannels=\"2\" protocolInfo=\"http-get:*:audio/mpeg:*\"&gt;"
+	       "http://192.168.0.10:8200/MediaItems/2.mp3&lt;/res&gt;&lt;/item&gt;", 1);
+	expect("description cap", resp, "&lt;dc:description&gt;", TRACKS / 10);
+	test_check(strstr(resp, "&lt;dc:description&gt;") &&
+	           strspn(strstr(resp, "&lt;dc:description&gt;") + strlen("&lt;dc:description&gt;"), "c") == 384,
+	           "dc:description is not cut at 384 bytes");
+	expect("filter *", resp, "&lt;res ", TRACKS);
+	expect("filter *", resp, "http://192.168.0.10:8200/MediaItems/", TRACKS);
+	expect("filter *", resp, "<NumberReturned>500</NumberReturned>", 1);
+
+	/* Only what was asked for */
+	resp = browse(&h, MUSIC_ALL_ID, "dc:title,upnp:album", 0);
+	expect("filter title,album", resp, "&lt;item ", TRACKS);
+	expect("filter title,album", resp, "&lt;upnp:album&gt;", TRACKS);
+	expect("filter title,album", resp, "&lt;upnp:artist&gt;", 0);
+	expect("filter title,album", resp, "&lt;dc:date&gt;", 0);
+	expect("filter title,album", resp, "&lt;dc:description&gt;", 0);
+	expect("filter title,album", resp, "&lt;res ", 0);
+
+	/* upnp:actor only on video items */
+	resp = browse(&h, VIDEO_ALL_ID, "*", 0);
+	expect("video", resp, "&lt;upnp:actor&gt;Actor&lt;/upnp:actor&gt;", 1);
+	expect("video", resp, "&lt;upnp:artist&gt;Actor&lt;/upnp:artist&gt;", 1);
+
+	if( test_status() )
+		return 1;
+
+	t = test_now();
+	for( rows = 0; rows < BENCH_ROWS; rows += TRACKS )
+		browse(&h, MUSIC_ALL_ID, "*", 0);
+	secs = test_now() - t;
+	printf("DIDL serialization, filter *: %.0f rows/s\n", rows / secs);
+
+	t = test_now();
+	for( rows = 0; rows < BENCH_ROWS; rows += TRACKS )
+		browse(&h, MUSIC_ALL_ID, "dc:title,upnp:artist,upnp:album,res", 0);
+	secs = test_now() - t;
+	printf("DIDL serialization, title/artist/album/res: %.0f rows/s\n", rows / secs);
+
+	free(h.res_buf);
+	sqlite3_close(db);
+
+	return 0;
+}
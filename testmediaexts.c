@@ -0,0 +1,155 @@
+/* MiniDLNA media server
+ *
+ * This file is part of MiniDLNA.
+ *
+ * MiniDLNA is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * MiniDLNA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MiniDLNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "config.h"
+#include "minidlnatypes.h"
+#include "utils.h"
+#include "testutils.h"
+
+/* Reference classification: the ends_with() chains media_ext_class() replaced */
+static const struct {
+	const char *ext;
+	int class;
+} ref_exts[] = {
+	{ ".mpg", EXT_VIDEO }, { ".mpeg", EXT_VIDEO }, { ".avi", EXT_VIDEO },
+	{ ".divx", EXT_VIDEO }, { ".wmv", EXT_VIDEO }, { ".m4v", EXT_VIDEO },
+	{ ".mts", EXT_VIDEO }, { ".m2ts", EXT_VIDEO }, { ".m2t", EXT_VIDEO },
+	{ ".mkv", EXT_VIDEO }, { ".vob", EXT_VIDEO }, { ".ts", EXT_VIDEO },
+	{ ".flv", EXT_VIDEO }, { ".xvid", EXT_VIDEO }, { ".mov", EXT_VIDEO },
+	{ ".asf", EXT_VIDEO|EXT_AUDIO }, { ".mp4", EXT_VIDEO|EXT_AUDIO },
+	{ ".3gp", EXT_VIDEO|EXT_AUDIO },
+#ifdef BAIDU_DMS_OPT
+	{ ".rmvb", EXT_VIDEO }, { ".webm", EXT_VIDEO }, { ".3gpp", EXT_VIDEO },
+	{ ".mka", EXT_AUDIO }, { ".aac+", EXT_AUDIO }, { ".ape", EXT_AUDIO },
+	{ ".png", EXT_IMAGE }, { ".tiff", EXT_IMAGE }, { ".heic", EXT_IMAGE },
+#endif
+#ifdef TIVO_SUPPORT
+	{ ".tivo", EXT_VIDEO },
+#endif
+	{ ".mp3", EXT_AUDIO }, { ".flac", EXT_AUDIO }, { ".wma", EXT_AUDIO },
+	{ ".fla", EXT_AUDIO }, { ".flc", EXT_AUDIO }, { ".m4a", EXT_AUDIO },
+	{ ".aac", EXT_AUDIO }, { ".m4p", EXT_AUDIO }, { ".pcm", EXT_AUDIO },
+	{ ".wav", EXT_AUDIO }, { ".ogg", EXT_AUDIO },
+	{ ".jpg", EXT_IMAGE }, { ".jpeg", EXT_IMAGE },
+	{ ".m3u", EXT_PLAYLIST }, { ".pls", EXT_PLAYLIST },
+#ifdef NAS
+	{ ".txt", EXT_TEXT }, { ".pdf", EXT_TEXT }, { ".docx", EXT_TEXT },
+	{ ".apk", EXT_APP }, { ".exe", EXT_APP },
+#endif
+	/* never classified */
+	{ ".nfo", 0 }, { ".srt", 0 }, { ".part", 0 }, { ".db", 0 },
+	{ ".mp3x", 0 }, { ".jpgs", 0 }, { ".averylongext", 0 },
+};
+#define N_REF_EXTS	(sizeof(ref_exts)/sizeof(ref_exts[0]))
+
+static const char * const stems[] = {
+	"track", "/media/Music/Artist/Album (2009)/01 - Song Name",
+	"/media/Video/Some.Show.S01E02.720p", "/mnt/sda1/photos/2019.08.14/IMG_0001",
+	"a", "/v.mp3/file",
+};
+#define N_STEMS	(sizeof(stems)/sizeof(stems[0]))
+
+static int
+ref_class(const char *name)
+{
+	int i;
+
+	for( i = 0; i < N_REF_EXTS; i++ )
+	{
+		if( ends_with(name, ref_exts[i].ext) )
+			return ref_exts[i].class;
+	}
+	return 0;
+}
+
+static void
+make_name(char *buf, size_t size, int stem, int ext, int variant)
+{
+	char *p;
+
+	p = buf + snprintf(buf, size, "%s", stems[stem]);
+	snprintf(p, size - (p - buf), "%s", ref_exts[ext].ext);
+	for( ; *p; p++ )
+	{
+		if( variant == 1 || (variant == 2 && ((p - buf) & 1)) )
+			*p = toupper((unsigned char)*p);
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	char name[256];
+	static char names[N_STEMS * N_REF_EXTS][128];
+	int iters = argc > 1 ? atoi(argv[1]) : 2000;
+	int i, j, s, e, v, got, want, n = 0;
+	volatile int sink = 0;
+	double t, ref_ns, new_ns;
+
+	init_media_exts();
+	for( s = 0; s < N_STEMS; s++ )
+	{
+		for( e = 0; e < N_REF_EXTS; e++ )
+		{
+			for( v = 0; v < 3; v++ )
+			{
+				make_name(name, sizeof(name), s, e, v);
+				want = ref_class(name);
+				got = media_ext_class(name);
+				test_check(got == want, "%s: class %#x, expected %#x", name, got, want);
+				n++;
+			}
+		}
+	}
+	/* names without a usable extension */
+	test_check(!media_ext_class("noext") && !media_ext_class("/dir.mp3/noext") &&
+	           !media_ext_class("trailingdot.") && media_ext_class(".mp3") == EXT_AUDIO,
+	           "extensionless names misclassified");
+	test_check(strcmp(mime_to_ext("audio/mpeg"), "mp3") == 0 &&
+	           strcmp(mime_to_ext("audio/L16;rate=44100;channels=2"), "pcm") == 0 &&
+	           strcmp(mime_to_ext("application/x-unknown"), "dat") == 0,
+	           "mime_to_ext() mismatch");
+	if( test_status() )
+		return 1;
+	printf("%d names classified identically\n", n);
+
+	n = 0;
+	for( s = 0; s < N_STEMS; s++ )
+		for( e = 0; e < N_REF_EXTS; e++ )
+			make_name(names[n++], sizeof(names[0]), s, e, 0);
+
+	t = test_now();
+	for( i = 0; i < iters; i++ )
+		for( j = 0; j < n; j++ )
+			sink += ref_class(names[j]);
+	ref_ns = (test_now() - t) * 1e9 / ((double)iters * n);
+
+	t = test_now();
+	for( i = 0; i < iters; i++ )
+		for( j = 0; j < n; j++ )
+			sink += media_ext_class(names[j]);
+	new_ns = (test_now() - t) * 1e9 / ((double)iters * n);
+
+	printf("ends_with() chain:  %7.1f ns/name\n", ref_ns);
+	printf("media_ext_class():  %7.1f ns/name (%.1fx)\n", new_ns, ref_ns / new_ns);
+
+	return 0;
+}
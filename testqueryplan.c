@@ -0,0 +1,270 @@
+/* MiniDLNA media server
+ *
+ * This file is part of MiniDLNA.
+ *
+ * MiniDLNA is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * MiniDLNA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MiniDLNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "config.h"
+#include "sql.h"
+#include "scanner_sqlite.h"
+#include "testutils.h"
+
+/* Query plans of the SQL issued by upnpsoap.c, upnphttp.c and
+ * tivo_commands.c, checked against a generated library with the schema
+ * and indexes CreateDatabase() and start_scanner() build. */
+#define ARTISTS		50
+#define ALBUMS		200
+#define TRACKS		15
+
+#define COLS "o.OBJECT_ID, o.PARENT_ID, o.REF_ID, o.DETAIL_ID, o.CLASS, d.SIZE, d.TITLE," \
+             " d.MIME, d.DISC, d.TRACK, o.SORT_TITLE, o.SORT_TRACK "
+#define JOIN "from OBJECTS o left join DETAILS d on (d.ID = o.DETAIL_ID)"
+#define TIVO_MIME "(MIME in ('image/jpeg', 'audio/mpeg', 'video/mpeg', 'video/x-tivo-mpeg', " \
+                  "'video/x-tivo-mpeg-ts') or CLASS glob 'container*')"
+
+struct plan_check {
+	const char *name;
+	const char *sql;
+	const char *index;	/* must appear in the plan, if set */
+	int temp_sort;		/* a temp B-tree is expected */
+};
+
+static const struct plan_check checks[] = {
+	/* upnpsoap.c Browse */
+	{ "Browse metadata",
+	  "SELECT " COLS JOIN " where OBJECT_ID = '64$1'",
+	  "sqlite_autoindex_OBJECTS_1", 0 },
+	{ "Browse child count",
+	  "SELECT count(*) from OBJECTS where PARENT_ID = '64$1'",
+	  NULL, 0 },
+	{ "Browse children",
+	  "SELECT " COLS JOIN " where PARENT_ID = '64$1'  limit 0, 50",
+	  NULL, 0 },
+	{ "Browse +dc:title",
+	  "SELECT " COLS JOIN " where PARENT_ID = '64$1' order by o.SORT_TITLE limit 0, 50",
+	  "IDX_OBJECTS_SORT_TITLE", 0 },
+	{ "Browse forced sort",
+	  "SELECT " COLS JOIN " where PARENT_ID = '64$1' order by o.CLASS, o.SORT_TRACK limit 0, 50",
+	  "IDX_OBJECTS_SORT_TRACK", 0 },
+	{ "Browse -dc:title",
+	  "SELECT " COLS JOIN " where PARENT_ID = '64$1' order by o.SORT_TITLE DESC limit 0, 50",
+	  "IDX_OBJECTS_SORT_TITLE", 0 },
+	{ "Browse +upnp:originalTrackNumber",
+	  "SELECT " COLS JOIN " where PARENT_ID = '64$1' order by o.SORT_TRACK limit 0, 50",
+	  NULL, 1 },
+	{ "Browse +upnp:class,+dc:title",
+	  "SELECT " COLS JOIN " where PARENT_ID = '64$1' order by o.CLASS, o.SORT_TITLE limit 0, 50",
+	  NULL, 1 },
+	{ "Browse +dc:date",
+	  "SELECT " COLS JOIN " where PARENT_ID = '64$1' order by d.DATE, o.SORT_TITLE ASC limit 0, 50",
+	  NULL, 1 },
+	{ "Browse +upnp:album",
+	  "SELECT " COLS JOIN " where PARENT_ID = '64$1' order by d.ALBUM, o.SORT_TITLE ASC limit 0, 50",
+	  NULL, 1 },
+	{ "Browse playlist",
+	  "SELECT " COLS JOIN " where PARENT_ID = '1$F$3' order by length(OBJECT_ID), OBJECT_ID limit 0, 50",
+	  NULL, 1 },
+	{ "Browse MS PFS id",
+	  "SELECT OBJECT_ID from OBJECTS where OBJECT_ID in ('1$3', '2$3', '3$3')",
+	  "sqlite_autoindex_OBJECTS_1", 0 },
+	{ "Browse object exists",
+	  "SELECT count(*) from OBJECTS where OBJECT_ID = '64$1'",
+	  "sqlite_autoindex_OBJECTS_1", 0 },
+	/* upnpsoap.c Search */
+	{ "Search count",
+	  "SELECT (select count(distinct DETAIL_ID) from OBJECTS o left join DETAILS d on (o.DETAIL_ID = d.ID)"
+	  " where (OBJECT_ID > '1$' and OBJECT_ID < '1%') and (o.CLASS glob 'object.item.audioItem*'))"
+	  " + (select count(*) from OBJECTS o left join DETAILS d on (o.DETAIL_ID = d.ID)"
+	  " where (OBJECT_ID = '1') and (o.CLASS glob 'object.item.audioItem*'))",
+	  "IDX_SEARCH_OPT", 1 },
+	{ "Search page",
+	  "SELECT " COLS JOIN " where (OBJECT_ID > '1$' and OBJECT_ID < '1%') and (d.ARTIST like 'Artist 1%')"
+	  " group by DETAIL_ID UNION ALL SELECT " COLS JOIN
+	  " where OBJECT_ID = '1' and (d.ARTIST like 'Artist 1%')  order by SORT_TITLE limit 0, 50",
+	  NULL, 1 },
+	/* upnpsoap.c object and container paths */
+	{ "Container path",
+	  "select PATH from DETAILS where ID = (select DETAIL_ID from OBJECTS where OBJECT_ID = '64$1')",
+	  "sqlite_autoindex_OBJECTS_1", 0 },
+	{ "Detail by path",
+	  "select ID from DETAILS where PATH = '/media/music/a1/t1.mp3'",
+	  "IDX_DETAILS_PATH", 0 },
+	{ "Bookmark",
+	  "SELECT SEC from BOOKMARKS where ID = '5'",
+	  NULL, 0 },
+	/* upnphttp.c */
+	{ "Status MIME count",
+	  "SELECT count(*) from DETAILS where MIME glob 'a*'",
+	  "IDX_DETAILS_MIME", 0 },
+	{ "Folder path",
+	  "select PATH from DETAILS where ID = (select DETAIL_ID from OBJECTS"
+	  " where (OBJECT_ID = '64$1' and CLASS = 'container.storageFolder'))",
+	  "sqlite_autoindex_OBJECTS_1", 0 },
+	{ "dlnaurl lookup",
+	  "SELECT ID, MIME from DETAILS where (PATH = '/media/music/a1/t1.mp3') limit 1",
+	  "IDX_DETAILS_PATH", 0 },
+	{ "Object class by detail",
+	  "SELECT CLASS from OBJECTS where DETAIL_ID = '5'",
+	  "IDX_OBJECTS_DETAIL_ID", 0 },
+	{ "MediaItems",
+	  "SELECT PATH, MIME, DLNA_PN from DETAILS where ID = '5'",
+	  NULL, 0 },
+	{ "Resized image",
+	  "SELECT PATH, RESOLUTION, ROTATION from DETAILS where ID = '5'",
+	  NULL, 0 },
+	{ "Album art",
+	  "SELECT PATH from ALBUM_ART where ID = '5'",
+	  NULL, 0 },
+	{ "Caption",
+	  "SELECT PATH from CAPTIONS where ID = 5",
+	  NULL, 0 },
+	/* tivo_commands.c */
+	{ "TiVo child count",
+	  "SELECT count(*) " JOIN " where PARENT_ID = '64$1' and " TIVO_MIME,
+	  NULL, 0 },
+	{ "TiVo item details",
+	  "SELECT " COLS JOIN " where o.DETAIL_ID = 5 group by o.DETAIL_ID",
+	  "IDX_OBJECTS_DETAIL_ID", 0 },
+	{ "TiVo container name",
+	  "SELECT NAME from OBJECTS where OBJECT_ID = '64$1'",
+	  "sqlite_autoindex_OBJECTS_1", 0 },
+	{ "TiVo recursive count",
+	  "SELECT count(distinct DETAIL_ID) from OBJECTS o left join DETAILS d on (o.DETAIL_ID = d.ID)"
+	  " where (OBJECT_ID > '64$' and OBJECT_ID < '64%') and " TIVO_MIME,
+	  NULL, 1 },
+	{ "TiVo page",
+	  "SELECT " COLS JOIN " where PARENT_ID = '64$1' and " TIVO_MIME
+	  " order by CLASS, NAME, DETAIL_ID limit 0, 50",
+	  NULL, 1 },
+	{ NULL }
+};
+
+static int
+create_library(sqlite3 *sq3)
+{
+	char id[32], parent[32], ref[32], name[32];
+	int64_t detailID;
+	int a, t, ret;
+
+	if( sql_create_functions(sq3) != SQLITE_OK ||
+	    sql_exec(sq3, create_objectTable_sqlite) != SQLITE_OK ||
+	    sql_exec(sq3, create_detailTable_sqlite) != SQLITE_OK ||
+	    sql_exec(sq3, create_albumArtTable_sqlite) != SQLITE_OK ||
+	    sql_exec(sq3, create_captionTable_sqlite) != SQLITE_OK ||
+	    sql_exec(sq3, create_bookmarkTable_sqlite) != SQLITE_OK ||
+	    sql_exec(sq3, create_playlistTable_sqlite) != SQLITE_OK ||
+	    sql_create_sort_keys(sq3) != SQLITE_OK )
+		return -1;
+	sql_exec(sq3, "create INDEX IDX_OBJECTS_DETAIL_ID ON OBJECTS(DETAIL_ID);");
+	sql_exec(sq3, "create INDEX IDX_OBJECTS_CLASS ON OBJECTS(CLASS);");
+	sql_exec(sq3, "create INDEX IDX_DETAILS_PATH ON DETAILS(PATH);");
+	sql_exec(sq3, "create INDEX IDX_DETAILS_MIME ON DETAILS(MIME);");
+	sql_exec(sq3, "create INDEX IDX_SCANNER_OPT ON OBJECTS(PARENT_ID, NAME, OBJECT_ID);");
+
+	/* Each track in a folder, and again under the music Artist view */
+	sql_exec(sq3, "BEGIN");
+	for( a = 0; a < ALBUMS; a++ )
+	{
+		for( t = 0, ret = 0; t < TRACKS && ret == SQLITE_OK; t++ )
+		{
+			ret = sql_exec(sq3, "INSERT into DETAILS (PATH, SIZE, TITLE, ARTIST, ALBUM, GENRE, DISC, TRACK, DATE, MIME)"
+			                    " values ('/media/music/a%d/t%d.mp3', %d, 'Track %d', 'Artist %d', 'Album %d',"
+			                    " 'Genre %d', 1, %d, '2010-01-01', 'audio/mpeg')",
+			                    a, t, 4000000 + t, t, a % ARTISTS, a, a % 10, t + 1);
+			if( ret != SQLITE_OK )
+				break;
+			detailID = sqlite3_last_insert_rowid(sq3);
+			snprintf(id, sizeof(id), "64$%X$%X", a, t);
+			snprintf(parent, sizeof(parent), "64$%X", a);
+			snprintf(name, sizeof(name), "Track %d", t);
+			ret = sql_insert_object(sq3, id, parent, NULL, "item.audioItem.musicTrack", detailID, name);
+			if( ret != SQLITE_OK )
+				break;
+			snprintf(ref, sizeof(ref), "1$6$%X$%X", a, t);
+			snprintf(parent, sizeof(parent), "1$6$%X", a);
+			ret = sql_insert_object(sq3, ref, parent, id, "item.audioItem.musicTrack", detailID, name);
+		}
+		if( ret != SQLITE_OK )
+			return -1;
+	}
+	sql_exec(sq3, "COMMIT");
+	/* Created after the scan, as in start_scanner() */
+	sql_exec(sq3, "create INDEX IDX_SEARCH_OPT ON OBJECTS(OBJECT_ID, CLASS, DETAIL_ID);");
+
+	return 0;
+}
+
+static void
+check_plan(sqlite3 *sq3, const struct plan_check *c)
+{
+	sqlite3_stmt *stmt;
+	char *sql;
+	const char *detail;
+	int has_index = 0, temp_sort = 0, full_scan = 0, ret;
+
+	sql = sqlite3_mprintf("EXPLAIN QUERY PLAN %s", c->sql);
+	ret = sqlite3_prepare_v2(sq3, sql, -1, &stmt, NULL);
+	sqlite3_free(sql);
+	if( !test_check(ret == SQLITE_OK, "%s: %s", c->name, sqlite3_errmsg(sq3)) )
+		return;
+	while( sqlite3_step(stmt) == SQLITE_ROW )
+	{
+		detail = (const char *)sqlite3_column_text(stmt, 3);
+		if( !detail )
+			continue;
+		if( c->index && strstr(detail, c->index) )
+			has_index = 1;
+		if( strstr(detail, "TEMP B-TREE") )
+			temp_sort = 1;
+		/* "SCAN o" or "SCAN TABLE OBJECTS AS o", without an index */
+		else if( strncmp(detail, "SCAN ", 5) == 0 && !strstr(detail, " USING ") &&
+		         !strstr(detail, "CONSTANT ROW") && !strstr(detail, "SUBQUERY") )
+			full_scan = 1;
+	}
+	sqlite3_finalize(stmt);
+
+	test_check(!full_scan && (!c->index || has_index) && temp_sort == c->temp_sort,
+	           "%s:%s%s%s", c->name,
+	           full_scan ? " full table scan" : "",
+	           (c->index && !has_index) ? " does not use " : "",
+	           (c->index && !has_index) ? c->index :
+	           temp_sort != c->temp_sort ? (temp_sort ? " temp sort" : " no longer sorts (update the check)") : "");
+}
+
+int
+main(int argc, char **argv)
+{
+	sqlite3 *sq3;
+	char *key;
+	int i;
+
+	if( !test_check(sqlite3_open(":memory:", &sq3) == SQLITE_OK && create_library(sq3) == 0,
+	                "could not build the test library") )
+		return 1;
+	/* Inserts fill the sort keys from DETAILS themselves */
+	key = sql_get_text_field(sq3, "SELECT SORT_TRACK from OBJECTS where OBJECT_ID = '1$6$0$2'");
+	test_check(key && strcmp(key, "00010003track 2") == 0 &&
+	           sql_get_int_field(sq3, "SELECT count(*) from OBJECTS where SORT_TITLE is NULL or SORT_TRACK is NULL") == 0,
+	           "sort keys: %s", key ? key : "(null)");
+	sqlite3_free(key);
+	for( i = 0; checks[i].name; i++ )
+		check_plan(sq3, &checks[i]);
+	printf("%d query plans checked\n", i);
+	sqlite3_close(sq3);
+
+	return test_status();
+}
@@ -0,0 +1,162 @@
+/* MiniDLNA media server
+ *
+ * This file is part of MiniDLNA.
+ *
+ * MiniDLNA is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * MiniDLNA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MiniDLNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "config.h"
+#include "upnpreplyparse.h"
+#include "testutils.h"
+
+/* Browse and Search bodies as sent by common control points */
+static const char * const envelopes[] = {
+	/* Windows Media Player */
+	"<?xml version=\"1.0\"?><SOAP-ENV:Envelope xmlns:SOAP-ENV=\"http://schemas.xmlsoap.org/soap/envelope/\" "
+	"SOAP-ENV:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\"><SOAP-ENV:Body>"
+	"<m:Browse xmlns:m=\"urn:schemas-upnp-org:service:ContentDirectory:1\">"
+	"<ObjectID xmlns:dt=\"urn:schemas-microsoft-com:datatypes\" dt:dt=\"string\">0</ObjectID>"
+	"<BrowseFlag xmlns:dt=\"urn:schemas-microsoft-com:datatypes\" dt:dt=\"string\">BrowseDirectChildren</BrowseFlag>"
+	"<Filter xmlns:dt=\"urn:schemas-microsoft-com:datatypes\" dt:dt=\"string\">*</Filter>"
+	"<StartingIndex xmlns:dt=\"urn:schemas-microsoft-com:datatypes\" dt:dt=\"ui4\">0</StartingIndex>"
+	"<RequestedCount xmlns:dt=\"urn:schemas-microsoft-com:datatypes\" dt:dt=\"ui4\">50</RequestedCount>"
+	"<SortCriteria xmlns:dt=\"urn:schemas-microsoft-com:datatypes\" dt:dt=\"string\"></SortCriteria>"
+	"</m:Browse></SOAP-ENV:Body></SOAP-ENV:Envelope>",
+	/* Samsung TV */
+	"<?xml version=\"1.0\" encoding=\"utf-8\"?>\r\n"
+	"<s:Envelope s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\" "
+	"xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\">\r\n<s:Body>\r\n"
+	"<u:Browse xmlns:u=\"urn:schemas-upnp-org:service:ContentDirectory:1\">\r\n"
+	"<ObjectID>64$0$1</ObjectID>\r\n<BrowseFlag>BrowseMetadata</BrowseFlag>\r\n"
+	"<Filter>dc:title,res,res@duration,upnp:album,upnp:artist,sec:CaptionInfoEx</Filter>\r\n"
+	"<StartingIndex>0</StartingIndex>\r\n<RequestedCount>0</RequestedCount>\r\n"
+	"<SortCriteria>+dc:title</SortCriteria>\r\n</u:Browse>\r\n</s:Body>\r\n</s:Envelope>\r\n",
+	/* Xbox 360 */
+	"<?xml version=\"1.0\" encoding=\"utf-8\"?><s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\" "
+	"s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\"><s:Body>"
+	"<u:Search xmlns:u=\"urn:schemas-upnp-org:service:ContentDirectory:1\">"
+	"<ContainerID>7</ContainerID>"
+	"<SearchCriteria>(upnp:class = &quot;object.container.album.musicAlbum&quot; and @refID exists false)</SearchCriteria>"
+	"<Filter>dc:title,upnp:artist</Filter><StartingIndex>0</StartingIndex>"
+	"<RequestedCount>1000</RequestedCount><SortCriteria>+dc:title</SortCriteria>"
+	"</u:Search></s:Body></s:Envelope>",
+	/* BubbleUPnP */
+	"<?xml version=\"1.0\" encoding=\"utf-8\" standalone=\"yes\"?><s:Envelope "
+	"s:encodingStyle=\"http://schemas.xmlsoap.org/soap/encoding/\" xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\">"
+	"<s:Body><u:Search xmlns:u=\"urn:schemas-upnp-org:service:ContentDirectory:1\">"
+	"<ContainerID>0</ContainerID>"
+	"<SearchCriteria>(upnp:class derivedfrom \"object.item.audioItem\" and dc:title contains \"rock &amp; roll\")</SearchCriteria>"
+	"<Filter>*</Filter><StartingIndex>32</StartingIndex><RequestedCount>16</RequestedCount>"
+	"<SortCriteria>+upnp:artist,+upnp:album,+upnp:originalTrackNumber,+dc:title</SortCriteria>"
+	"</u:Search></s:Body></s:Envelope>",
+	/* Sony Bravia: escaped quotes, repeated element */
+	"<?xml version=\"1.0\"?><s:Envelope xmlns:s=\"http://schemas.xmlsoap.org/soap/envelope/\"><s:Body>"
+	"<u:Search xmlns:u=\"urn:schemas-upnp-org:service:ContentDirectory:1\">"
+	"<ContainerID>1$4</ContainerID><SearchCriteria>dc:title contains \\&quot;x\\&quot;</SearchCriteria>"
+	"<Filter></Filter><Filter>res@size</Filter><StartingIndex>0</StartingIndex>"
+	"<RequestedCount>10</RequestedCount></u:Search></s:Body></s:Envelope>",
+	/* truncated body */
+	"<s:Envelope><s:Body><u:Browse><ObjectID>0</ObjectID><BrowseFlag>Browse",
+	NULL
+};
+
+static const char *
+field_name[] = {
+	"ObjectID", "ContainerID", "BrowseFlag", "Filter", "SearchCriteria",
+	"SortCriteria", "StartingIndex", "RequestedCount"
+};
+
+static char *
+arg_field(struct ContentDirectoryArgs *args, int i)
+{
+	char *f[] = { args->ObjectID, args->ContainerID, args->BrowseFlag, args->Filter,
+	              args->SearchCriteria, args->SortCriteria, args->StartingIndex,
+	              args->RequestedCount };
+	return f[i];
+}
+
+static void
+check_envelope(int n, const char *env)
+{
+	struct NameValueParserData data;
+	struct ContentDirectoryArgs args;
+	int len = strlen(env);
+	char *buf = strdup(env);
+	char *want, *got;
+	int i;
+
+	ParseNameValue(env, len, &data, 0);
+	ParseContentDirectoryArgs(buf, len, &args);
+	for (i = 0; i < sizeof(field_name)/sizeof(field_name[0]); i++)
+	{
+		want = GetValueFromNameValueList(&data, field_name[i]);
+		got = arg_field(&args, i);
+		if (want && !*want)
+			want = NULL;
+		test_check((want == NULL) == (got == NULL) && (!want || strcmp(want, got) == 0),
+		           "envelope %d %s: expected \"%s\", got \"%s\"", n, field_name[i],
+		           want ? want : "(null)", got ? got : "(null)");
+	}
+	ClearNameValueList(&data);
+	free(buf);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct NameValueParserData data;
+	struct ContentDirectoryArgs args;
+	char buf[2048];
+	int iters = argc > 1 ? atoi(argv[1]) : 200000;
+	int i, j, n, len;
+	double t, old_rate, new_rate;
+
+	for (n = 0; envelopes[n]; n++)
+		check_envelope(n, envelopes[n]);
+	if (test_status())
+		return 1;
+	printf("%d envelopes parse identically\n", n);
+
+	/* Both parsers run on a fresh copy, since the in-place one writes into it */
+	t = test_now();
+	for (i = 0; i < iters; i++)
+	{
+		j = i % n;
+		len = strlen(envelopes[j]);
+		memcpy(buf, envelopes[j], len + 1);
+		ParseNameValue(buf, len, &data, 0);
+		GetValueFromNameValueList(&data, "ObjectID");
+		GetValueFromNameValueList(&data, "SortCriteria");
+		ClearNameValueList(&data);
+	}
+	old_rate = iters / (test_now() - t);
+
+	t = test_now();
+	for (i = 0; i < iters; i++)
+	{
+		j = i % n;
+		len = strlen(envelopes[j]);
+		memcpy(buf, envelopes[j], len + 1);
+		ParseContentDirectoryArgs(buf, len, &args);
+	}
+	new_rate = iters / (test_now() - t);
+
+	printf("ParseNameValue:            %10.0f envelopes/s\n", old_rate);
+	printf("ParseContentDirectoryArgs: %10.0f envelopes/s (%.1fx)\n",
+	       new_rate, new_rate / old_rate);
+
+	return 0;
+}
@@ -0,0 +1,204 @@
+/* MiniDLNA media server
+ *
+ * This file is part of MiniDLNA.
+ *
+ * MiniDLNA is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * MiniDLNA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MiniDLNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include "config.h"
+#include "tagutils/misc.h"
+#include "tagutils/tagutils.h"
+#include "testutils.h"
+
+/* Checks the tag_file reader against the bytes it should return, then,
+ * given a directory (argument or TAGREAD_DIR), times readtags() over
+ * every audio file below it. */
+
+#define TEST_SIZE	(1 << 20)
+
+static unsigned char *expect;
+static int corpus_files, corpus_errors;
+
+static unsigned char
+pattern(off_t off)
+{
+	return (off * 2654435761u) >> 13;
+}
+
+static void
+check_reader(const char *path)
+{
+	struct tag_file tf;
+	unsigned char *buf;
+	const unsigned char *p;
+	off_t pos;
+	size_t len, n;
+	int i;
+
+	if( !test_check(tag_open(&tf, path) == 0 && tag_size(&tf) == TEST_SIZE, "tag_open failed") )
+		return;
+	buf = malloc(TEST_SIZE);
+	srand(1);
+	for( i = 0; i < 20000 && !test_failures; i++ )
+	{
+		/* mostly small reads near the cursor, some long jumps and big reads */
+		switch( rand() % 4 )
+		{
+		case 0:
+			tag_seek(&tf, rand() % (TEST_SIZE + 64), SEEK_SET);
+			break;
+		case 1:
+			tag_seek(&tf, -(rand() % 4096), SEEK_END);
+			break;
+		default:
+			tag_seek(&tf, rand() % 512 - 128, SEEK_CUR);
+			break;
+		}
+		pos = tag_tell(&tf);
+		len = (rand() % 16) ? rand() % 256 : rand() % (256 << 10);
+		if( rand() % 3 == 0 )
+		{
+			p = tag_peek(&tf, len);
+			test_check(!p || (pos >= 0 && pos + len <= TEST_SIZE && memcmp(p, expect + pos, len) == 0),
+			           "tag_peek(%zu) at %lld returned wrong bytes", len, (long long)pos);
+			test_check(p || pos < 0 || pos + len > TEST_SIZE || len > 4096,
+			           "tag_peek(%zu) at %lld failed", len, (long long)pos);
+			continue;
+		}
+		n = tag_read(&tf, buf, len);
+		if( pos < 0 || pos >= TEST_SIZE )
+			len = 0;
+		else if( len > TEST_SIZE - pos )
+			len = TEST_SIZE - pos;
+		test_check(n == len && memcmp(buf, expect + pos, n) == 0 && tag_tell(&tf) == pos + (off_t)n,
+		           "tag_read(%zu) at %lld returned %zu bytes, expected %zu",
+		           len, (long long)pos, n, len);
+	}
+
+	/* A file cut short while it is being read must not bring us down */
+	tag_seek(&tf, 0, SEEK_SET);
+	tag_read(&tf, buf, 16);
+	if( !test_failures && truncate(path, TEST_SIZE / 2) == 0 )
+	{
+		tag_seek(&tf, TEST_SIZE - 100, SEEK_SET);
+		test_check(tag_read(&tf, buf, 50) == 0 && tag_peek(&tf, 50) == NULL,
+		           "read past a truncated end succeeded");
+	}
+	tag_close(&tf);
+	free(buf);
+}
+
+static const char *
+tag_type(const char *path)
+{
+	static const struct { const char *ext, *type; } types[] = {
+		{ ".mp3", "mp3" }, { ".m4a", "aac" }, { ".mp4", "aac" }, { ".aac", "aac" },
+		{ ".m4p", "aac" }, { ".3gp", "aac" }, { ".wma", "asf" }, { ".asf", "asf" },
+		{ ".flac", "flc" }, { ".fla", "flc" }, { ".flc", "flc" }, { ".pcm", "pcm" },
+		{ ".wav", "wav" }, { ".ogg", "ogg" },
+	};
+	size_t len = strlen(path);
+	int i;
+
+	for( i = 0; i < sizeof(types)/sizeof(types[0]); i++ )
+	{
+		size_t n = strlen(types[i].ext);
+		if( len > n && strcasecmp(path + len - n, types[i].ext) == 0 )
+			return types[i].type;
+	}
+	return NULL;
+}
+
+static void
+read_dir(const char *dir)
+{
+	struct song_metadata song;
+	struct dirent *e;
+	struct stat st;
+	char path[PATH_MAX];
+	const char *type;
+	DIR *d;
+
+	if( !(d = opendir(dir)) )
+		return;
+	while( (e = readdir(d)) )
+	{
+		if( e->d_name[0] == '.' )
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+		if( lstat(path, &st) != 0 )
+			continue;
+		if( S_ISDIR(st.st_mode) )
+		{
+			read_dir(path);
+			continue;
+		}
+		if( !S_ISREG(st.st_mode) || !(type = tag_type(path)) )
+			continue;
+		if( readtags(path, &song, &st, NULL, (char *)type) != 0 )
+			corpus_errors++;
+		freetags(&song);
+		corpus_files++;
+	}
+	closedir(d);
+}
+
+int
+main(int argc, char **argv)
+{
+	char path[] = "testtagread.XXXXXX";
+	const char *corpus = argc > 1 ? argv[1] : getenv("TAGREAD_DIR");
+	double t;
+	int fd, i;
+
+	expect = malloc(TEST_SIZE);
+	for( i = 0; i < TEST_SIZE; i++ )
+		expect[i] = pattern(i);
+	fd = mkstemp(path);
+	if( fd < 0 || write(fd, expect, TEST_SIZE) != TEST_SIZE )
+	{
+		perror("testtagread");
+		return 1;
+	}
+	close(fd);
+	check_reader(path);
+	unlink(path);
+	free(expect);
+	if( test_status() )
+		return 1;
+	printf("tag_file reader matches pread()\n");
+
+	if( !corpus || !*corpus )
+	{
+		printf("no corpus given (TAGREAD_DIR), skipping the readtags() benchmark\n");
+		return 0;
+	}
+	/* one cold pass to fill the page cache, then a timed one */
+	read_dir(corpus);
+	corpus_files = corpus_errors = 0;
+	t = test_now();
+	read_dir(corpus);
+	t = test_now() - t;
+	printf("readtags(): %d files (%d unreadable) in %.2f s, %.0f files/s\n",
+	       corpus_files, corpus_errors, t, corpus_files / t);
+
+	return 0;
+}
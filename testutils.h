@@ -0,0 +1,38 @@
+/* MiniDLNA media server
+ *
+ * This file is part of MiniDLNA.
+ *
+ * MiniDLNA is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * MiniDLNA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MiniDLNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __TESTUTILS_H__
+#define __TESTUTILS_H__
+
+/* Shared by the programs "make check" runs.  Each one checks the code it
+ * covers against a reference, and only times it once every check held. */
+
+/* Checks failed so far */
+extern int test_failures;
+
+/* Counts a failed check and prints why; returns cond */
+int
+test_check(int cond, const char *fmt, ...);
+
+/* Reports the failures, if any; returns the exit status */
+int
+test_status(void);
+
+/* Monotonic time in seconds, for timing benchmark loops */
+double
+test_now(void);
+
+#endif
@@ -0,0 +1,188 @@
+/* MiniDLNA media server
+ *
+ * This file is part of MiniDLNA.
+ *
+ * MiniDLNA is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * MiniDLNA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with MiniDLNA. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "config.h"
+#include "minidlnatypes.h"
+#include "utils.h"
+#include "testutils.h"
+
+#define MAX_LEN	80
+
+/* Reference: the modifyString() chain escape_tag() replaced */
+static char *
+ref_escape_tag(const char *tag, int force_alloc, int twice)
+{
+	char *esc_tag = NULL;
+
+	if( strchr(tag, '&') || strchr(tag, '<') || strchr(tag, '>') || strchr(tag, '"') )
+	{
+		esc_tag = strdup(tag);
+		esc_tag = modifyString(esc_tag, "&", twice ? "&amp;amp;" : "&amp;");
+		esc_tag = modifyString(esc_tag, "<", twice ? "&amp;lt;" : "&lt;");
+		esc_tag = modifyString(esc_tag, ">", twice ? "&amp;gt;" : "&gt;");
+		esc_tag = modifyString(esc_tag, "\"", twice ? "&amp;quot;" : "&quot;");
+	}
+	else if( force_alloc )
+		esc_tag = strdup(tag);
+
+	return esc_tag;
+}
+
+/* Reference: one byte at a time, no vector scan */
+static char *
+scalar_escape(char *dst, const char *src, size_t len, int twice)
+{
+	const char *prefix = twice ? "&amp;" : "&";
+	size_t i;
+
+	for( i = 0; i < len; i++ )
+	{
+		switch( src[i] )
+		{
+		case '&':
+			dst += sprintf(dst, "%samp;", prefix);
+			break;
+		case '<':
+			dst += sprintf(dst, "%slt;", prefix);
+			break;
+		case '>':
+			dst += sprintf(dst, "%sgt;", prefix);
+			break;
+		case '"':
+			dst += sprintf(dst, "%squot;", prefix);
+			break;
+		default:
+			*dst++ = src[i];
+		}
+	}
+	*dst = '\0';
+
+	return dst;
+}
+
+/* Compare every path on one string */
+static void
+check(const char *src)
+{
+	char want[MAX_LEN * 10 + 1], got[MAX_LEN * 10 + 1];
+	char *ref, *esc, *end;
+	size_t len = strlen(src);
+	int twice, force;
+
+	for( twice = 0; twice < 2; twice++ )
+	{
+		scalar_escape(want, src, len, twice);
+		end = xml_escape(got, src, len, twice);
+		test_check(strcmp(want, got) == 0 && end == got + strlen(got) &&
+		           xml_escaped_len(src, len, twice) == strlen(want),
+		           "xml_escape(\"%s\", %d): \"%s\", expected \"%s\"", src, twice, got, want);
+		ref = ref_escape_tag(src, 1, twice);
+		test_check(strcmp(ref, want) == 0,
+		           "modifyString(\"%s\", %d): \"%s\", expected \"%s\"", src, twice, ref, want);
+		free(ref);
+	}
+
+	for( force = 0; force < 2; force++ )
+	{
+		ref = ref_escape_tag(src, force, 1);
+		esc = escape_tag(src, force);
+		test_check((ref == NULL) == (esc == NULL) && (!ref || strcmp(ref, esc) == 0),
+		           "escape_tag(\"%s\", %d): \"%s\", expected \"%s\"",
+		           src, force, esc ? esc : "(null)", ref ? ref : "(null)");
+		free(ref);
+		free(esc);
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	static const char specials[] = "&<>\"";
+	static const char alphabet[] = "abc XYZ&<>\"';\xc3\xa9\xff";
+	static const char * const tags[] = {
+		"The Dark Side of the Moon", "Simon & Garfunkel",
+		"Bohemian Rhapsody (Remastered 2011)",
+		"/media/music/Artist Name/Album <Deluxe>/01 - Track \"Title\".flac",
+	};
+	char buf[MAX_LEN + 1];
+	int iters = argc > 1 ? atoi(argv[1]) : 1000000;
+	int i, len, pos, c, n = 0;
+	volatile size_t sink = 0;
+	double t, ref_ns, new_ns;
+	char *esc;
+
+	/* One special byte at every offset, on both sides of each 16-byte block,
+	 * with high-bit bytes around it */
+	for( len = 1; len <= 48; len++ )
+	{
+		for( pos = 0; pos < len; pos++ )
+		{
+			for( c = 0; c < 4; c++ )
+			{
+				for( i = 0; i < len; i++ )
+					buf[i] = (i & 1) ? '\xe9' : 'a' + i % 26;
+				buf[len] = '\0';
+				buf[pos] = specials[c];
+				check(buf);
+				buf[len - 1 - (len - 1 - pos) / 2] = specials[3 - c];
+				check(buf);
+				n += 2;
+			}
+		}
+	}
+
+	srand(1);
+	for( i = 0; i < 200000; i++ )
+	{
+		len = rand() % (MAX_LEN + 1);
+		for( pos = 0; pos < len; pos++ )
+			buf[pos] = (rand() % 4) ? 'a' + rand() % 26 : alphabet[rand() % (sizeof(alphabet) - 1)];
+		buf[len] = '\0';
+		check(buf);
+		n++;
+	}
+	check("");
+	if( test_status() )
+		return 1;
+	printf("%d strings escaped identically\n", n);
+
+	t = test_now();
+	for( i = 0; i < iters; i++ )
+	{
+		esc = ref_escape_tag(tags[i & 3], 1, 1);
+		sink += strlen(esc);
+		free(esc);
+	}
+	ref_ns = (test_now() - t) * 1e9 / iters;
+
+	t = test_now();
+	for( i = 0; i < iters; i++ )
+	{
+		esc = escape_tag(tags[i & 3], 1);
+		sink += strlen(esc);
+		free(esc);
+	}
+	new_ns = (test_now() - t) * 1e9 / iters;
+
+	printf("modifyString() chain: %7.1f ns/tag\n", ref_ns);
+	printf("escape_tag():         %7.1f ns/tag (%.1fx)\n", new_ns, ref_ns / new_ns);
+
+	return 0;
+}
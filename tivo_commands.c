@@ -406,7 +406,7 @@ SendContainer(struct upnphttp *h, const char *objectID, int itemStart, int itemC
 
 	if( recurse )
 	{
-		which = sqlite3_mprintf("OBJECT_ID glob '%q$*'", objectID);
+		which = sql_subtree("OBJECT_ID", objectID);
 		strcpy(groupBy, "group by DETAIL_ID");
 	}
 	else
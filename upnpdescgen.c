@@ -385,6 +385,7 @@ static const struct stateVar ContentDirectoryVars[] =
 #ifdef XIAODU_NAS
 	{"A_ARG_TYPE_TagValueList", 0, 0},
 #endif
+	{"ContainerUpdateIDs", 0|EVENTED, 0, 0, 255},
 	{0, 0}
 };
 
@@ -627,6 +628,30 @@ genRootDescSamsung(int * len)
 	return str;
 }
 
+/* genRootDescXbox() :
+ * Xbox 360's only recognize us with a model number of 1 and a
+ * friendly name containing a colon, so temporarily fake both. */
+char *
+genRootDescXbox(int * len)
+{
+	char * str;
+	char model_sav[2];
+	int i = 0;
+
+	memcpy(model_sav, modelnumber, 2);
+	strcpy(modelnumber, "1");
+	if( !strchr(friendly_name, ':') )
+	{
+		i = strlen(friendly_name);
+		snprintf(friendly_name+i, FRIENDLYNAME_MAX_LEN-i, ": 1");
+	}
+	str = genRootDesc(len);
+	if( i )
+		friendly_name[i] = '\0';
+	memcpy(modelnumber, model_sav, 2);
+	return str;
+}
+
 /* genServiceDesc() :
  * Generate service description with allowed methods and 
  * related variables. */
@@ -784,6 +809,10 @@ genEventVars(int * len, const struct serviceDesc * s, const char * servns)
 					snprintf(buf, sizeof(buf), "%d", updateID);
 					str = strcat_str(str, len, &tmplen, buf);
 				}
+				else if( strcmp(v->name, "ContainerUpdateIDs") == 0 && containerUpdateIDs )
+				{
+					str = strcat_str(str, len, &tmplen, containerUpdateIDs);
+				}
 				break;
 			default:
 				str = strcat_str(str, len, &tmplen, upnpallowedvalues[v->ieventvalue]);
@@ -78,6 +78,9 @@ genRootDesc(int * len);
 char *
 genRootDescSamsung(int * len);
 
+char *
+genRootDescXbox(int * len);
+
 /* for the two following functions */
 char *
 genContentDirectory(int * len);
@@ -54,6 +54,8 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <time.h>
+#include <sys/time.h>
+#include <sys/uio.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/param.h>
@@ -61,14 +63,22 @@
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "upnpevents.h"
 #include "minidlnapath.h"
 #include "upnpglobalvars.h"
 #include "upnpdescgen.h"
+#include "utils.h"
 #include "uuid.h"
 #include "log.h"
 
+/* at most this many NOTIFY connections are in flight at once; the rest
+ * stay pending on their subscriber until a slot frees up */
+#define MAX_EVENT_CONNECTIONS	8
+/* give up on a subscriber that has not answered within this many seconds */
+#define EVENT_NOTIFY_TIMEOUT	30
+
 /* stuctures definitions */
 struct subscriber {
 	LIST_ENTRY(subscriber) entries;
@@ -76,10 +86,24 @@ struct subscriber {
 	time_t timeout;
 	uint32_t seq;
 	enum subscriber_service_enum service;
+	int s;			/* idle kept-alive connection, or -1 */
+	int pending;		/* a change is waiting to be sent */
+	unsigned int delivered;
+	unsigned int failures;
+	unsigned int last_latency;	/* milliseconds */
+	unsigned int max_latency;
 	char uuid[42];
 	char callback[];
 };
 
+/* property-set body shared by every NOTIFY for one state change */
+struct event_body {
+	int refcount;
+	uint32_t updateid;
+	int len;
+	char xml[];
+};
+
 struct upnp_event_notify {
 	LIST_ENTRY(upnp_event_notify) entries;
     int s;  /* socket */
@@ -92,8 +116,11 @@ struct upnp_event_notify {
     struct subscriber * sub;
     char * buffer;
     int buffersize;
+	struct event_body * body;
 	int tosend;
     int sent;
+	int reused;
+	struct timeval start;
 	const char * path;
 	char addrstr[16];
 	char portstr[8];
@@ -108,6 +135,74 @@ LIST_HEAD(listhead, subscriber) subscriberlist = { NULL };
 
 /* notify list */
 LIST_HEAD(listheadnotif, upnp_event_notify) notifylist = { NULL };
+static int n_notify = 0;
+
+/* rendered bodies, indexed by subscriber_service_enum */
+static struct event_body * event_bodies[EMSMediaReceiverRegistrar+1];
+
+static void
+upnp_event_body_release(struct event_body * body)
+{
+	if(body && --body->refcount == 0)
+		free(body);
+}
+
+/* returns a reference to the current property-set for a service,
+ * rendering it only if the state changed since it was last built */
+static struct event_body *
+upnp_event_body_get(enum subscriber_service_enum service)
+{
+	struct event_body * body = event_bodies[service];
+	char * xml;
+	int l;
+
+	if(body && body->updateid == updateID)
+	{
+		body->refcount++;
+		return body;
+	}
+	upnp_event_body_release(body);
+	event_bodies[service] = NULL;
+
+	switch(service) {
+	case EContentDirectory:
+		xml = getVarsContentDirectory(&l);
+		break;
+	case EConnectionManager:
+		xml = getVarsConnectionManager(&l);
+		break;
+	case EMSMediaReceiverRegistrar:
+		xml = getVarsX_MS_MediaReceiverRegistrar(&l);
+		break;
+	default:
+		xml = NULL;
+		l = 0;
+	}
+	body = malloc(sizeof(struct event_body) + l + 3);
+	if(!body) {
+		free(xml);
+		return NULL;
+	}
+	body->refcount = 2;	/* cache + caller */
+	body->updateid = updateID;
+	body->len = l + 2;
+	if(xml)
+		memcpy(body->xml, xml, l);
+	memcpy(body->xml + l, "\r\n", 3);
+	free(xml);
+	event_bodies[service] = body;
+
+	return body;
+}
+
+static void
+upnp_event_close_idle(struct subscriber * sub)
+{
+	if(sub->s >= 0) {
+		close(sub->s);
+		sub->s = -1;
+	}
+}
 
 /* create a new subscriber */
 static struct subscriber *
@@ -117,6 +212,8 @@ newSubscriber(const char * eventurl, const char * callback, int callbacklen)
 	if(!eventurl || !callback || !callbacklen)
 		return NULL;
 	tmp = calloc(1, sizeof(struct subscriber)+callbacklen+1);
+	if(!tmp)
+		return NULL;
 	if(strcmp(eventurl, CONTENTDIRECTORY_EVENTURL)==0)
 		tmp->service = EContentDirectory;
 	else if(strcmp(eventurl, CONNECTIONMGR_EVENTURL)==0)
@@ -127,6 +224,7 @@ newSubscriber(const char * eventurl, const char * callback, int callbacklen)
 		free(tmp);
 		return NULL;
 	}
+	tmp->s = -1;
 	memcpy(tmp->callback, callback, callbacklen);
 	tmp->callback[callbacklen] = '\0';
 	/* make a dummy uuid */
@@ -140,6 +238,19 @@ newSubscriber(const char * eventurl, const char * callback, int callbacklen)
 	return tmp;
 }
 
+/* start a notify for the subscriber now if a connection slot is free,
+ * otherwise remember that it has to be sent later */
+static void
+upnp_event_schedule(struct subscriber * sub)
+{
+	if(sub->notify || n_notify >= MAX_EVENT_CONNECTIONS)
+		sub->pending = 1;
+	else {
+		sub->pending = 0;
+		upnp_event_create_notify(sub);
+	}
+}
+
 /* creates a new subscriber and adds it to the subscriber list
  * also initiate 1st notify */
 const char *
@@ -156,7 +267,7 @@ upnpevents_addSubscriber(const char * eventurl,
 	if(timeout)
 		tmp->timeout = time(NULL) + timeout;
 	LIST_INSERT_HEAD(&subscriberlist, tmp, entries);
-	upnp_event_create_notify(tmp);
+	upnp_event_schedule(tmp);
 	return tmp->uuid;
 }
 
@@ -187,6 +298,7 @@ upnpevents_removeSubscriber(const char * sid, int sidlen)
 			if(sub->notify) {
 				sub->notify->sub = NULL;
 			}
+			upnp_event_close_idle(sub);
 			LIST_REMOVE(sub, entries);
 			free(sub);
 			return 0;
@@ -199,23 +311,93 @@ void
 upnpevents_removeSubscribers(void)
 {
 	struct subscriber * sub;
+	int i;
 
 	for(sub = subscriberlist.lh_first; sub != NULL; sub = subscriberlist.lh_first) {
 		upnpevents_removeSubscriber(sub->uuid, sizeof(sub->uuid));
 	}
+	for(i = 0; i <= EMSMediaReceiverRegistrar; i++) {
+		upnp_event_body_release(event_bodies[i]);
+		event_bodies[i] = NULL;
+	}
 }
 
-/* notifies all subscribers of a SystemUpdateID change */
+/* notifies all subscribers of a SystemUpdateID change.
+ * Subscribers with a notify still in flight only get flagged, so they
+ * receive the latest state once the current one completes. */
 void
 upnp_event_var_change_notify(enum subscriber_service_enum service)
 {
 	struct subscriber * sub;
+
+	upnp_event_body_release(event_bodies[service]);
+	event_bodies[service] = NULL;
 	for(sub = subscriberlist.lh_first; sub != NULL; sub = sub->entries.le_next) {
-		if(sub->service == service && sub->notify == NULL)
-			upnp_event_create_notify(sub);
+		if(sub->service == service)
+			upnp_event_schedule(sub);
 	}
 }
 
+/* split the callback URL into address, port and path */
+static int
+upnp_event_parse_callback(struct upnp_event_notify * obj, unsigned short * port)
+{
+	int i = 0;
+	const char * p;
+
+	p = obj->sub->callback;
+	p += 7;	/* http:// */
+	while(*p != '/' && *p != ':' && i < (sizeof(obj->addrstr)-1))
+		obj->addrstr[i++] = *(p++);
+	obj->addrstr[i] = '\0';
+	if(*p == ':') {
+		obj->portstr[0] = *p;
+		i = 1;
+		p++;
+		*port = (unsigned short)atoi(p);
+		while(*p != '/' && *p != '\0') {
+			if(i<7) obj->portstr[i++] = *p;
+			p++;
+		}
+		obj->portstr[i] = 0;
+	} else {
+		*port = 80;
+		obj->portstr[0] = '\0';
+	}
+	if( *p )
+		obj->path = p;
+	else
+		obj->path = "/";
+
+	return 0;
+}
+
+/* hand over the subscriber's idle connection if the peer still has it open */
+static int
+upnp_event_reuse_connection(struct upnp_event_notify * obj)
+{
+	struct subscriber * sub = obj->sub;
+	unsigned short port;
+	char c;
+	int n;
+
+	if(sub->s < 0)
+		return 0;
+	n = recv(sub->s, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+	if(n >= 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+		/* closed by the peer, or unsolicited data: start over */
+		upnp_event_close_idle(sub);
+		return 0;
+	}
+	obj->s = sub->s;
+	sub->s = -1;
+	obj->reused = 1;
+	upnp_event_parse_callback(obj, &port);
+	obj->state = EConnecting;
+
+	return 1;
+}
+
 /* create and add the notify object to the list */
 static void
 upnp_event_create_notify(struct subscriber * sub)
@@ -229,6 +411,9 @@ upnp_event_create_notify(struct subscriber * sub)
 	}
 	obj->sub = sub;
 	obj->state = ECreated;
+	gettimeofday(&obj->start, NULL);
+	if(sub && upnp_event_reuse_connection(obj))
+		goto out;
 	obj->s = socket(PF_INET, SOCK_STREAM, 0);
 	if(obj->s<0) {
 		DPRINTF(E_ERROR, L_HTTP, "%s: socket(): %s\n", "upnp_event_create_notify", strerror(errno));
@@ -244,9 +429,11 @@ upnp_event_create_notify(struct subscriber * sub)
 		       "upnp_event_create_notify", strerror(errno));
 		goto error;
 	}
+out:
 	if(sub)
 		sub->notify = obj;
 	LIST_INSERT_HEAD(&notifylist, obj, entries);
+	n_notify++;
 	return;
 error:
 	if(obj->s >= 0)
@@ -257,41 +444,16 @@ error:
 static void
 upnp_event_notify_connect(struct upnp_event_notify * obj)
 {
-	int i;
-	const char * p;
 	unsigned short port;
 	struct sockaddr_in addr;
 	if(!obj)
 		return;
 	memset(&addr, 0, sizeof(addr));
-	i = 0;
 	if(obj->sub == NULL) {
 		obj->state = EError;
 		return;
 	}
-	p = obj->sub->callback;
-	p += 7;	/* http:// */
-	while(*p != '/' && *p != ':' && i < (sizeof(obj->addrstr)-1))
-		obj->addrstr[i++] = *(p++);
-	obj->addrstr[i] = '\0';
-	if(*p == ':') {
-		obj->portstr[0] = *p;
-		i = 1;
-		p++;
-		port = (unsigned short)atoi(p);
-		while(*p != '/' && *p != '\0') {
-			if(i<7) obj->portstr[i++] = *p;
-			p++;
-		}
-		obj->portstr[i] = 0;
-	} else {
-		port = 80;
-		obj->portstr[0] = '\0';
-	}
-	if( *p )
-		obj->path = p;
-	else
-		obj->path = "/";
+	upnp_event_parse_callback(obj, &port);
 	addr.sin_family = AF_INET;
 	inet_aton(obj->addrstr, &addr.sin_addr);
 	addr.sin_port = htons(port);
@@ -306,6 +468,7 @@ upnp_event_notify_connect(struct upnp_event_notify * obj)
 	}
 }
 
+/* only the headers are formatted per subscriber; the body is shared */
 static void upnp_event_prepare(struct upnp_event_notify * obj)
 {
 	static const char notifymsg[] = 
@@ -317,47 +480,51 @@ static void upnp_event_prepare(struct upnp_event_notify * obj)
 		"NTS: upnp:propchange\r\n"
 		"SID: %s\r\n"
 		"SEQ: %u\r\n"
-		"Connection: close\r\n"
 		"Cache-Control: no-cache\r\n"
-		"\r\n"
-		"%.*s\r\n";
-	char * xml;
+		"\r\n";
 	int l;
 	if(obj->sub == NULL) {
 		obj->state = EError;
 		return;
 	}
-	switch(obj->sub->service) {
-	case EContentDirectory:
-		xml = getVarsContentDirectory(&l);
-		break;
-	case EConnectionManager:
-		xml = getVarsConnectionManager(&l);
-		break;
-	case EMSMediaReceiverRegistrar:
-		xml = getVarsX_MS_MediaReceiverRegistrar(&l);
-		break;
-	default:
-		xml = NULL;
-		l = 0;
+	obj->body = upnp_event_body_get(obj->sub->service);
+	if(!obj->body) {
+		obj->state = EError;
+		return;
 	}
-	obj->tosend = asprintf(&(obj->buffer), notifymsg,
-	                       obj->path, obj->addrstr, obj->portstr, l+2,
-	                       obj->sub->uuid, obj->sub->seq,
-	                       l, xml);
-	obj->buffersize = obj->tosend;
-	free(xml);
-	DPRINTF(E_DEBUG, L_HTTP, "Sending UPnP Event response:\n%s\n", obj->buffer);
+	l = asprintf(&(obj->buffer), notifymsg,
+	             obj->path, obj->addrstr, obj->portstr, obj->body->len,
+	             obj->sub->uuid, obj->sub->seq);
+	if(l < 0) {
+		obj->buffer = NULL;
+		obj->state = EError;
+		return;
+	}
+	obj->buffersize = l;
+	obj->tosend = l + obj->body->len;
+	DPRINTF(E_DEBUG, L_HTTP, "Sending UPnP Event response:\n%s%s\n", obj->buffer, obj->body->xml);
 	obj->state = ESending;
 }
 
 static void upnp_event_send(struct upnp_event_notify * obj)
 {
+	struct iovec iov[2];
+	int hlen = obj->buffersize;
 	int i;
 	//DEBUG DPRINTF(E_DEBUG, L_HTTP, "Sending UPnP Event:\n%s", obj->buffer+obj->sent);
 	while( obj->sent < obj->tosend ) {
-		i = send(obj->s, obj->buffer + obj->sent, obj->tosend - obj->sent, 0);
+		if(obj->sent < hlen) {
+			iov[0].iov_base = obj->buffer + obj->sent;
+			iov[0].iov_len = hlen - obj->sent;
+			iov[1].iov_base = obj->body->xml;
+			iov[1].iov_len = obj->body->len;
+			i = writev(obj->s, iov, 2);
+		}
+		else
+			i = send(obj->s, obj->body->xml + (obj->sent - hlen), obj->tosend - obj->sent, 0);
 		if(i<0) {
+			if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+				return;
 			DPRINTF(E_WARN, L_HTTP, "%s: send(): %s\n", "upnp_event_send", strerror(errno));
 			obj->state = EError;
 			return;
@@ -368,23 +535,61 @@ static void upnp_event_send(struct upnp_event_notify * obj)
 		obj->state = EWaitingForResponse;
 }
 
+/* a complete response without "Connection: close" lets us keep the socket */
+static int
+upnp_event_can_keepalive(const char * buf, int n)
+{
+	const char * hdrend;
+	const char * p;
+
+	if(n < 12 || strncmp(buf, "HTTP/1.1 2", 10) != 0)
+		return 0;
+	hdrend = strstr(buf, "\r\n\r\n");
+	if(!hdrend)
+		return 0;
+	p = strcasestr(buf, "\r\nConnection:");
+	if(p && p < hdrend && strcasestrc(p + 13, "close", '\r'))
+		return 0;
+	p = strcasestr(buf, "\r\nContent-Length:");
+	if(!p || p > hdrend)
+		return 0;
+
+	return (atoi(p + 17) == n - (hdrend + 4 - buf));
+}
+
 static void upnp_event_recv(struct upnp_event_notify * obj)
 {
+	char buf[512];
+	struct timeval now;
+	unsigned int latency;
 	int n;
-	n = recv(obj->s, obj->buffer, obj->buffersize, 0);
+	n = recv(obj->s, buf, sizeof(buf)-1, 0);
 	if(n<0) {
 		DPRINTF(E_ERROR, L_HTTP, "%s: recv(): %s\n", "upnp_event_recv", strerror(errno));
 		obj->state = EError;
 		return;
 	}
+	buf[n] = '\0';
 	DPRINTF(E_DEBUG, L_HTTP, "%s: (%dbytes) %.*s\n", "upnp_event_recv",
-	       n, n, obj->buffer);
+	       n, n, buf);
 	obj->state = EFinished;
 	if(obj->sub)
 	{
 		obj->sub->seq++;
 		if (!obj->sub->seq)
 			obj->sub->seq++;
+		gettimeofday(&now, NULL);
+		latency = (now.tv_sec - obj->start.tv_sec) * 1000 +
+		          (now.tv_usec - obj->start.tv_usec) / 1000;
+		obj->sub->delivered++;
+		obj->sub->last_latency = latency;
+		if(latency > obj->sub->max_latency)
+			obj->sub->max_latency = latency;
+		if(upnp_event_can_keepalive(buf, n) && obj->sub->s < 0)
+		{
+			obj->sub->s = obj->s;
+			obj->s = -1;
+		}
 	}
 }
 
@@ -395,7 +600,8 @@ upnp_event_process_notify(struct upnp_event_notify * obj)
 	case EConnecting:
 		/* now connected or failed to connect */
 		upnp_event_prepare(obj);
-		upnp_event_send(obj);
+		if(obj->state == ESending)
+			upnp_event_send(obj);
 		break;
 	case ESending:
 		upnp_event_send(obj);
@@ -458,15 +664,29 @@ void upnpevents_processfds(fd_set *readset, fd_set *writeset)
 				upnp_event_process_notify(obj);
 		}
 	}
+	curtime = time(NULL);
 	obj = notifylist.lh_first;
 	while(obj != NULL) {
 		next = obj->entries.le_next;
+		if(obj->state != EFinished && obj->state != EError &&
+		   curtime - obj->start.tv_sec > EVENT_NOTIFY_TIMEOUT) {
+			DPRINTF(E_WARN, L_HTTP, "Event notify to %s%s timed out\n",
+			        obj->addrstr, obj->portstr);
+			obj->state = EError;
+		}
 		if(obj->state == EError || obj->state == EFinished) {
 			if(obj->s >= 0) {
 				close(obj->s);
 			}
-			if(obj->sub)
+			if(obj->sub) {
 				obj->sub->notify = NULL;
+				if(obj->state == EError) {
+					obj->sub->failures++;
+					/* a stale kept-alive socket gets one fresh retry */
+					if(obj->reused)
+						obj->sub->pending = 1;
+				}
+			}
 #if 0 /* Just let it time out instead of explicitly removing the subscriber */
 			/* remove also the subscriber from the list if there was an error */
 			if(obj->state == EError && obj->sub) {
@@ -474,21 +694,208 @@ void upnpevents_processfds(fd_set *readset, fd_set *writeset)
 				free(obj->sub);
 			}
 #endif
+			upnp_event_body_release(obj->body);
 			free(obj->buffer);
 			LIST_REMOVE(obj, entries);
 			free(obj);
+			n_notify--;
 		}
 		obj = next;
 	}
-	/* remove timeouted subscribers */
-	curtime = time(NULL);
+	/* remove timeouted subscribers, and start the notifies that were
+	 * waiting on a busy subscriber or a free connection slot */
 	for(sub = subscriberlist.lh_first; sub != NULL; ) {
 		subnext = sub->entries.le_next;
 		if(sub->timeout && curtime > sub->timeout && sub->notify == NULL) {
+			upnp_event_close_idle(sub);
 			LIST_REMOVE(sub, entries);
 			free(sub);
 		}
+		else if(sub->pending && sub->notify == NULL && n_notify < MAX_EVENT_CONNECTIONS) {
+			sub->pending = 0;
+			upnp_event_create_notify(sub);
+		}
 		sub = subnext;
 	}
 }
 
+/* ContainerUpdateIDs tracking.
+ * Containers touched by inotify are staged here (from the inotify thread)
+ * and stamped with the new SystemUpdateID by the main loop, which also
+ * renders the evented "id,updateID,..." list.  Containers not in the table
+ * report the update ID of the last full scan or restart. */
+#define CONTAINER_PENDING_MAX	64
+#define CONTAINER_UPDATE_SLOTS	256
+
+struct container_update {
+	char * id;
+	uint32_t update_id;
+};
+
+static pthread_mutex_t container_lock = PTHREAD_MUTEX_INITIALIZER;
+static char * container_pending[CONTAINER_PENDING_MAX];
+static int n_container_pending = 0;
+static int container_pending_overflow = 0;
+
+static struct container_update container_updates[CONTAINER_UPDATE_SLOTS];
+static int n_container_updates = 0;
+static uint32_t container_base_id = 0;
+
+void
+upnp_event_container_changed(const char * id)
+{
+	int i;
+
+	if(scanning || !id)
+		return;
+	pthread_mutex_lock(&container_lock);
+	for(i = 0; i < n_container_pending; i++) {
+		if(strcmp(container_pending[i], id) == 0)
+			break;
+	}
+	if(i == n_container_pending) {
+		if(n_container_pending < CONTAINER_PENDING_MAX &&
+		   (container_pending[i] = strdup(id)))
+			n_container_pending++;
+		else
+			container_pending_overflow = 1;
+	}
+	pthread_mutex_unlock(&container_lock);
+}
+
+static struct container_update *
+container_update_slot(const char * id)
+{
+	int i;
+
+	i = DJBHash(id, strlen(id)) % CONTAINER_UPDATE_SLOTS;
+	while(container_updates[i].id && strcmp(container_updates[i].id, id) != 0)
+		i = (i + 1) % CONTAINER_UPDATE_SLOTS;
+
+	return &container_updates[i];
+}
+
+/* forget every per-container ID; everything now reads as changed at updateID */
+void
+upnp_event_container_reset(void)
+{
+	int i;
+
+	for(i = 0; i < CONTAINER_UPDATE_SLOTS; i++) {
+		free(container_updates[i].id);
+		container_updates[i].id = NULL;
+	}
+	n_container_updates = 0;
+	container_base_id = updateID;
+	free(containerUpdateIDs);
+	containerUpdateIDs = NULL;
+}
+
+uint32_t
+upnp_event_container_update_id(const char * id)
+{
+	struct container_update * c;
+
+	if(scanning)
+		return updateID;
+	if(!n_container_updates)
+		return container_base_id;
+	c = container_update_slot(id);
+
+	return c->id ? c->update_id : container_base_id;
+}
+
+/* stamp the staged containers with the current updateID and rebuild the
+ * ContainerUpdateIDs value; called by the main loop right after a bump */
+void
+upnp_event_container_commit(void)
+{
+	struct container_update * c;
+	struct string_s str;
+	char * pending[CONTAINER_PENDING_MAX];
+	int n, overflow, i;
+
+	pthread_mutex_lock(&container_lock);
+	n = n_container_pending;
+	overflow = container_pending_overflow;
+	memcpy(pending, container_pending, n * sizeof(char *));
+	n_container_pending = 0;
+	container_pending_overflow = 0;
+	pthread_mutex_unlock(&container_lock);
+
+	free(containerUpdateIDs);
+	containerUpdateIDs = NULL;
+	/* too much changed to name individual containers (or the table is
+	 * full): fall back to SystemUpdateID alone */
+	if(overflow || n_container_updates + n > CONTAINER_UPDATE_SLOTS * 3 / 4) {
+		upnp_event_container_reset();
+		for(i = 0; i < n; i++)
+			free(pending[i]);
+		return;
+	}
+	if(!n)
+		return;
+
+	str.size = n * 32;
+	str.off = 0;
+	str.data = malloc(str.size);
+	for(i = 0; i < n; i++) {
+		c = container_update_slot(pending[i]);
+		if(c->id)
+			free(pending[i]);
+		else {
+			c->id = pending[i];
+			n_container_updates++;
+		}
+		c->update_id = updateID;
+		if(!str.data)
+			continue;
+		if(str.size - str.off < strlen(c->id) + 16) {
+			char * tmp;
+			str.size = str.size * 2 + strlen(c->id) + 16;
+			tmp = realloc(str.data, str.size);
+			if(!tmp) {
+				free(str.data);
+				str.data = NULL;
+				continue;
+			}
+			str.data = tmp;
+		}
+		strcatf(&str, "%s%s,%u", i ? "," : "", c->id, c->update_id);
+	}
+	containerUpdateIDs = str.data;
+}
+
+/* appends the subscriber delivery statistics to the /status page */
+void
+upnpevents_status(struct string_s *str)
+{
+	struct subscriber * sub;
+	static const char * const names[] = { "", "ContentDirectory",
+		"ConnectionManager", "X_MS_MediaReceiverRegistrar" };
+	char * callback;
+	size_t len;
+
+	strcatf(str,
+		"<h3>Event subscribers</h3>"
+		"<table border=1 cellpadding=10>"
+		"<tr><td>Service</td><td>Callback</td><td>SEQ</td><td>Delivered</td>"
+		"<td>Failed</td><td>Last latency (ms)</td><td>Max latency (ms)</td>"
+		"<td>Pending</td></tr>");
+	for(sub = subscriberlist.lh_first; sub != NULL; sub = sub->entries.le_next) {
+		/* The callback is whatever the subscriber sent; never let it
+		 * inject markup into the page. */
+		len = strlen(sub->callback);
+		callback = malloc(xml_escaped_len(sub->callback, len, 0) + 1);
+		if(!callback)
+			continue;
+		xml_escape(callback, sub->callback, len, 0);
+		strcatf(str, "<tr><td>%s</td><td>%s</td><td>%u</td><td>%u</td>"
+			"<td>%u</td><td>%u</td><td>%u</td><td>%s</td></tr>",
+			names[sub->service], callback, sub->seq, sub->delivered,
+			sub->failures, sub->last_latency, sub->max_latency,
+			(sub->pending || sub->notify) ? "yes" : "no");
+		free(callback);
+	}
+	strcatf(str, "</table>");
+}
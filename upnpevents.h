@@ -69,6 +69,14 @@ int renewSubscription(const char * sid, int sidlen, int timeout);
 void upnpevents_selectfds(fd_set *readset, fd_set *writeset, int * max_fd);
 void upnpevents_processfds(fd_set *readset, fd_set *writeset);
 
+struct string_s;
+void upnpevents_status(struct string_s *str);
+
+void upnp_event_container_changed(const char * id);
+void upnp_event_container_commit(void);
+void upnp_event_container_reset(void);
+uint32_t upnp_event_container_update_id(const char * id);
+
 #ifdef USE_MINIUPNPDCTL
 void write_events_details(int s);
 #endif
@@ -84,7 +84,9 @@ int sssdp = -1;
 const char * minissdpdsocketpath = "/var/run/minissdpd.sock";
 
 /* UPnP-A/V [DLNA] */
-sqlite3 *db,*db2,*add_db,*rm_db,*update_db;
+/* Per thread: the inotify thread opens its own writer in WAL mode */
+__thread sqlite3 *db;
+sqlite3 *db2,*add_db,*rm_db,*update_db;
 char friendly_name[FRIENDLYNAME_MAX_LEN];
 char db_path[PATH_MAX] = {'\0'};
 char log_path[PATH_MAX] = {'\0'};
@@ -96,5 +98,6 @@ struct album_art_name_s * album_art_names = NULL;
 short int scanning = 0;
 volatile short int quitting = 0;
 volatile uint32_t updateID = 0;
+char *containerUpdateIDs = NULL;
 const char *force_sort_criteria = NULL;
 
@@ -67,7 +67,7 @@
 #endif
 
 #define USE_FORK 1
-#define DB_VERSION 9
+#define DB_VERSION 13
 
 #ifdef ENABLE_NLS
 #define _(string) gettext(string)
@@ -211,6 +211,8 @@ extern uint32_t runtime_flags;
 #define DLNA_STRICT_MASK      0x0004
 #define NO_PLAYLIST_MASK      0x0008
 #define SYSTEMD_MASK          0x0010
+#define NO_SCAN_SORT_MASK     0x0020
+#define DB_WAL_MASK           0x0040
 
 #define SETFLAG(mask)	runtime_flags |= mask
 #define GETFLAG(mask)	(runtime_flags & mask)
@@ -244,7 +246,8 @@ extern int sssdp;
 extern const char *minissdpdsocketpath;
 
 /* UPnP-A/V [DLNA] */
-extern sqlite3 *db,*db2,*add_db,*rm_db,*update_db;
+extern __thread sqlite3 *db;
+extern sqlite3 *db2,*add_db,*rm_db,*update_db;
 #define FRIENDLYNAME_MAX_LEN 64
 extern char friendly_name[];
 extern char db_path[];
@@ -257,6 +260,7 @@ extern struct album_art_name_s *album_art_names;
 extern short int scanning;
 extern volatile short int quitting;
 extern volatile uint32_t updateID;
+extern char *containerUpdateIDs;
 extern const char *force_sort_criteria;
 
 #endif
@@ -54,6 +54,7 @@
 #include <sys/socket.h>
 #include <sys/param.h>
 #include <ctype.h>
+#include <limits.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
@@ -61,6 +62,11 @@
 #include <arpa/inet.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <linux/sockios.h>
+#endif
 
 #include "config.h"
 #include "upnpglobalvars.h"
@@ -85,6 +91,8 @@
 //#define MAX_BUFFER_SIZE 4194304 // 4MB -- Too much?
 #define MAX_BUFFER_SIZE 2147483647 // 2GB -- Too much?
 #define MIN_BUFFER_SIZE 65536
+/* While the scanner may be watching, send in chunks small enough to sample */
+#define STREAM_SAMPLE_SIZE 1048576
 
 #include "icons.c"
 
@@ -94,6 +102,34 @@ enum event_type {
 	E_RENEW
 };
 
+enum desc_type {
+	EDescRoot,
+	EDescRootSamsung,
+	EDescRootXbox,
+	EDescContentDirectory,
+	EDescConnectionManager,
+	EDescMSMediaReceiverRegistrar,
+	EDescMax
+};
+
+/* The descriptions only depend on settings fixed at startup (friendly name,
+ * uuid, model), so each client variant is rendered once and kept around
+ * together with its ETag. */
+static struct desc_cache_s {
+	char * body;
+	int len;
+	char etag[24];
+} desc_cache[EDescMax];
+
+static char * (* const desc_generators[EDescMax])(int *) = {
+	genRootDesc,
+	genRootDescSamsung,
+	genRootDescXbox,
+	genContentDirectory,
+	genConnectionManager,
+	genX_MS_MediaReceiverRegistrar
+};
+
 struct upnphttp * 
 New_upnphttp(int s)
 {
@@ -289,6 +325,19 @@ ParseHttpHeaders(struct upnphttp * h)
 					h->req_SIDLen = n;
 				}
 			}
+			else if(strncasecmp(line, "If-None-Match", 13)==0)
+			{
+				p = colon + 1;
+				while(isspace(*p))
+					p++;
+				n = 0;
+				while(p[n] >= ' ')
+					n++;
+				while(n > 0 && isspace(p[n-1]))
+					n--;
+				h->req_IfNoneMatch = p;
+				h->req_IfNoneMatchLen = n;
+			}
 			else if(strncasecmp(line, "NT", 2)==0)
 			{
 				p = colon + 1;
@@ -637,23 +686,88 @@ findendheaders(const char * s, int len)
 	return NULL;
 }
 
-/* Sends the description generated by the parameter */
+/* Sends the cached description of the given type, rendering it first if
+ * needed.  Clients revalidating with a matching If-None-Match get a 304. */
 static void
-sendXMLdesc(struct upnphttp * h, char * (f)(int *))
+sendXMLdesc(struct upnphttp * h, enum desc_type type)
 {
-	char * desc;
-	int len;
-	desc = f(&len);
-	if(!desc)
+	struct desc_cache_s * d = &desc_cache[type];
+	struct iovec iov[2];
+	char header[512];
+	char date[30];
+	time_t curtime = time(NULL);
+	int notmodified, ret, i;
+	ssize_t n;
+
+	if(!d->body)
 	{
-		DPRINTF(E_ERROR, L_HTTP, "Failed to generate XML description\n");
-		Send500(h);
-		return;
+		d->body = desc_generators[type](&d->len);
+		if(!d->body)
+		{
+			DPRINTF(E_ERROR, L_HTTP, "Failed to generate XML description\n");
+			Send500(h);
+			return;
+		}
+		snprintf(d->etag, sizeof(d->etag), "\"%08x-%x\"",
+		         DJBHash(d->body, d->len), d->len);
+	}
+	notmodified = (h->req_IfNoneMatch &&
+	               (strstrc(h->req_IfNoneMatch, d->etag, '\r') ||
+	                (h->req_IfNoneMatchLen == 1 && *h->req_IfNoneMatch == '*')));
+
+	strftime(date, 30,"%a, %d %b %Y %H:%M:%S GMT" , gmtime(&curtime));
+	if(notmodified)
+		ret = snprintf(header, sizeof(header), "HTTP/1.1 304 Not Modified\r\n"
+		                                       "ETag: %s\r\n"
+		                                       "Connection: close\r\n"
+		                                       "Date: %s\r\n"
+		                                       "Server: " MINIDLNA_SERVER_STRING "\r\n\r\n",
+		                                       d->etag, date);
+	else
+		ret = snprintf(header, sizeof(header), "HTTP/1.1 200 OK\r\n"
+		                                       "Content-Type: text/xml; charset=\"utf-8\"\r\n"
+		                                       "Connection: close\r\n"
+		                                       "Content-Length: %d\r\n"
+		                                       "ETag: %s\r\n"
+		                                       "Server: " MINIDLNA_SERVER_STRING "\r\n"
+		                                       "%s"
+		                                       "Date: %s\r\n"
+		                                       "EXT:\r\n\r\n",
+		                                       d->len, d->etag,
+		                                       (h->reqflags & FLAG_LANGUAGE) ? "Content-Language: en\r\n" : "",
+		                                       date);
+
+	iov[0].iov_base = header;
+	iov[0].iov_len = ret;
+	iov[1].iov_base = d->body;
+	iov[1].iov_len = (notmodified || h->req_command == EHead) ? 0 : d->len;
+	/* The socket blocks, but writev() may still return short; resume
+	 * from wherever it stopped. */
+	i = 0;
+	while(i < 2)
+	{
+		if(iov[i].iov_len == 0)
+		{
+			i++;
+			continue;
+		}
+		n = writev(h->socket, iov + i, 2 - i);
+		if(n < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			DPRINTF(E_ERROR, L_HTTP, "writev(desc): %s\n", strerror(errno));
+			break;
+		}
+		for(; i < 2 && n >= (ssize_t)iov[i].iov_len; i++)
+			n -= iov[i].iov_len;
+		if(i < 2)
+		{
+			iov[i].iov_base = (char *)iov[i].iov_base + n;
+			iov[i].iov_len -= n;
+		}
 	}
-	BuildResp_upnphttp(h, desc, len);
-	SendResp_upnphttp(h);
 	CloseSocket_upnphttp(h);
-	free(desc);
 }
 
 #ifdef READYNAS
@@ -677,7 +791,7 @@ static void
 SendResp_presentation(struct upnphttp * h)
 {
 	struct string_s str;
-	char body[4096];
+	char body[8192];
 	int a, v, p, i;
 
 	str.data = body;
@@ -715,7 +829,10 @@ SendResp_presentation(struct upnphttp * h)
 				clients[i].mac[0], clients[i].mac[1], clients[i].mac[2],
 				clients[i].mac[3], clients[i].mac[4], clients[i].mac[5]);
 	}
-	strcatf(&str, "</table></BODY></HTML>\r\n");
+	strcatf(&str, "</table>");
+
+	upnpevents_status(&str);
+	strcatf(&str, "</BODY></HTML>\r\n");
 
 	BuildResp_upnphttp(h, str.data, str.off);
 	SendResp_upnphttp(h);
@@ -1441,40 +1558,28 @@ ProcessHttpQuery_upnphttp(struct upnphttp * h)
 			/* If it's a Xbox360, we might need a special friendly_name to be recognized */
 			if( client_types[h->req_client].type == EXbox )
 			{
-				char model_sav[2];
-				i = 0;
-				memcpy(model_sav, modelnumber, 2);
-				strcpy(modelnumber, "1");
-				if( !strchr(friendly_name, ':') )
-				{
-					i = strlen(friendly_name);
-					snprintf(friendly_name+i, FRIENDLYNAME_MAX_LEN-i, ": 1");
-				}
-				sendXMLdesc(h, genRootDesc);
-				if( i )
-					friendly_name[i] = '\0';
-				memcpy(modelnumber, model_sav, 2);
+				sendXMLdesc(h, EDescRootXbox);
 			}
 			else if( client_types[h->req_client].flags & FLAG_SAMSUNG_TV )
 			{
-				sendXMLdesc(h, genRootDescSamsung);
+				sendXMLdesc(h, EDescRootSamsung);
 			}
 			else
 			{
-				sendXMLdesc(h, genRootDesc);
+				sendXMLdesc(h, EDescRoot);
 			}
 		}
 		else if(strcmp(CONTENTDIRECTORY_PATH, HttpUrl) == 0)
 		{
-			sendXMLdesc(h, genContentDirectory);
+			sendXMLdesc(h, EDescContentDirectory);
 		}
 		else if(strcmp(CONNECTIONMGR_PATH, HttpUrl) == 0)
 		{
-			sendXMLdesc(h, genConnectionManager);
+			sendXMLdesc(h, EDescConnectionManager);
 		}
 		else if(strcmp(X_MS_MEDIARECEIVERREGISTRAR_PATH, HttpUrl) == 0)
 		{
-			sendXMLdesc(h, genX_MS_MediaReceiverRegistrar);
+			sendXMLdesc(h, EDescMSMediaReceiverRegistrar);
 		}
 		else if(strncmp(HttpUrl, "/MediaItems/", 12) == 0)
 		{
@@ -1800,6 +1905,34 @@ send_data(struct upnphttp * h, char * header, size_t size, int flags)
 	return 1;
 }
 
+/* A chunk that took well over the running average, with nothing left in
+ * the socket queue when it started, kept the client waiting on our reads
+ * rather than the other way around.  Count it so the scanner backs off. */
+static void
+send_file_sample(const struct timeval *start, int drained, long *avg_usec)
+{
+	struct timeval end;
+	long usec;
+
+	gettimeofday(&end, NULL);
+	usec = (end.tv_sec - start->tv_sec) * 1000000L + (end.tv_usec - start->tv_usec);
+	if( *avg_usec && drained && usec > 2 * *avg_usec && usec > 20000 )
+		__sync_fetch_and_add(&io_activity->stalls, 1);
+	*avg_usec = *avg_usec ? (*avg_usec * 7 + usec) / 8 : usec;
+}
+
+static int
+send_queue_drained(int sock)
+{
+#ifdef SIOCOUTQ
+	int queued;
+
+	if( ioctl(sock, SIOCOUTQ, &queued) == 0 )
+		return (queued == 0);
+#endif
+	return 0;
+}
+
 void
 send_file(struct upnphttp * h, int sendfd, off_t offset, off_t end_offset)
 {
@@ -1808,14 +1941,24 @@ send_file(struct upnphttp * h, int sendfd, off_t offset, off_t end_offset)
 	char *buf = NULL;
 #if HAVE_SENDFILE
 	int try_sendfile = 1;
+	off_t max_size = io_activity ? STREAM_SAMPLE_SIZE : MAX_BUFFER_SIZE;
+	struct timeval start;
+	long avg_usec = 0;
+	int drained = 0;
 #endif
 
+	process_stream_begin();
 	while( offset < end_offset )
 	{
 #if HAVE_SENDFILE
 		if( try_sendfile )
 		{
-			send_size = ( ((end_offset - offset) < MAX_BUFFER_SIZE) ? (end_offset - offset + 1) : MAX_BUFFER_SIZE);
+			send_size = ( ((end_offset - offset) < max_size) ? (end_offset - offset + 1) : max_size);
+			if( io_activity )
+			{
+				drained = send_queue_drained(h->socket);
+				gettimeofday(&start, NULL);
+			}
 			ret = sys_sendfile(h->socket, sendfd, &offset, send_size);
 			if( ret == -1 )
 			{
@@ -1829,6 +1972,8 @@ send_file(struct upnphttp * h, int sendfd, off_t offset, off_t end_offset)
 			else
 			{
 				//DPRINTF(E_DEBUG, L_HTTP, "sent %lld bytes to %d. offset is now %lld.\n", ret, h->socket, offset);
+				if( io_activity && ret == send_size )
+					send_file_sample(&start, drained, &avg_usec);
 				continue;
 			}
 		}
@@ -1853,6 +1998,7 @@ send_file(struct upnphttp * h, int sendfd, off_t offset, off_t end_offset)
 		offset+=ret;
 	}
 	free(buf);
+	process_stream_end(getpid());
 }
 
 void
@@ -2332,6 +2478,117 @@ resized_error:
 #endif
 }
 
+/* Resolved /MediaItems/ entries, keyed by DETAILS.ID, so a seeking
+ * renderer's range requests don't each go back to SQLite.  Lookups and
+ * inserts only happen in the main loop, before the fork; other threads
+ * only clear keys, so an entry is never read while it is being filled.
+ * Keys are 32 bits so they can be stored and cleared atomically on 32-bit
+ * targets too; larger IDs are just not cached. */
+#define MEDIA_CACHE_SIZE	1024	/* power of two */
+#define MEDIA_CACHE_PROBE	4
+#define MEDIA_CACHE_KEY(id)	((id) > 0 && (id) <= UINT_MAX)
+
+struct media_entry_s {
+	volatile unsigned int id;
+	char *path;
+	const char *mime;
+	const char *dlna_pn;
+};
+
+static struct media_entry_s media_cache[MEDIA_CACHE_SIZE];
+static volatile unsigned int media_cache_gen;
+static unsigned int media_cache_hand;
+
+static struct media_entry_s *
+media_cache_get(int64_t id)
+{
+	struct media_entry_s *e;
+	int i;
+
+	if( !MEDIA_CACHE_KEY(id) )
+		return NULL;
+	for( i = 0; i < MEDIA_CACHE_PROBE; i++ )
+	{
+		e = &media_cache[(id + i) & (MEDIA_CACHE_SIZE - 1)];
+		if( e->id == id )
+			return e;
+	}
+	return NULL;
+}
+
+static void
+media_cache_put(int64_t id, unsigned int gen, const char *path, const char *mime, const char *dlna_pn)
+{
+	struct media_entry_s *e = NULL;
+	char *dup;
+	int i;
+
+	if( !MEDIA_CACHE_KEY(id) )
+		return;
+	/* Entries share the interned copies of the MIME type and profile */
+	mime = intern_str(intern_id(mime));
+	if( !mime )
+		return;
+	if( dlna_pn && !(dlna_pn = intern_str(intern_id(dlna_pn))) )
+		return;
+	dup = strdup(path);
+	if( !dup )
+		return;
+	for( i = 0; i < MEDIA_CACHE_PROBE && !e; i++ )
+	{
+		if( media_cache[(id + i) & (MEDIA_CACHE_SIZE - 1)].id == 0 )
+			e = &media_cache[(id + i) & (MEDIA_CACHE_SIZE - 1)];
+	}
+	if( !e )
+		e = &media_cache[(id + (media_cache_hand++ % MEDIA_CACHE_PROBE)) & (MEDIA_CACHE_SIZE - 1)];
+
+	e->id = 0;
+	free(e->path);
+	e->path = dup;
+	e->mime = mime;
+	e->dlna_pn = dlna_pn;
+	__sync_synchronize();
+	/* Don't publish a row that was invalidated while we looked it up.  An
+	 * invalidation can also land between that check and the publish, so
+	 * check again afterwards: either we see its generation bump and take
+	 * the entry back, or its clear runs after our publish and does. */
+	if( gen != media_cache_gen )
+		return;
+	e->id = (unsigned int)id;
+	__sync_synchronize();
+	if( gen != media_cache_gen )
+		__sync_bool_compare_and_swap(&e->id, (unsigned int)id, 0);
+}
+
+/* Called after a DETAILS row is deleted or changed; safe from any thread. */
+void
+media_cache_invalidate(int64_t id)
+{
+	int i;
+
+	__sync_fetch_and_add(&media_cache_gen, 1);
+	if( !MEDIA_CACHE_KEY(id) )
+		return;
+	for( i = 0; i < MEDIA_CACHE_PROBE; i++ )
+		__sync_bool_compare_and_swap(&media_cache[(id + i) & (MEDIA_CACHE_SIZE - 1)].id,
+		                             (unsigned int)id, 0);
+}
+
+void
+media_cache_flush(void)
+{
+	unsigned int id;
+	int i;
+
+	__sync_fetch_and_add(&media_cache_gen, 1);
+	for( i = 0; i < MEDIA_CACHE_SIZE; i++ )
+	{
+		id = media_cache[i].id;
+		if( id )
+			__sync_bool_compare_and_swap(&media_cache[i].id, id, 0);
+	}
+}
+
 void
 SendResp_dlnafile(struct upnphttp *h, char *object)
 {
@@ -2347,12 +2604,12 @@ SendResp_dlnafile(struct upnphttp *h, char *object)
 	int sendfh;
 	uint32_t dlna_flags = DLNA_FLAG_DLNA_V1_5|DLNA_FLAG_HTTP_STALLING|DLNA_FLAG_TM_B;
 	uint32_t cflags = client_types[h->req_client].flags;
-	static struct { int64_t id;
-	                enum client_types client;
-	                char path[PATH_MAX];
-	                char mime[32];
-	                char dlna[96];
-	              } last_file = { 0, 0 };
+	struct media_entry_s *entry;
+	unsigned int gen;
+	struct { char path[PATH_MAX];
+	         char mime[32];
+	         char dlna[96];
+	       } last_file;
 #if USE_FORK
 	pid_t newpid = 0;
 #endif
@@ -2369,8 +2626,19 @@ SendResp_dlnafile(struct upnphttp *h, char *object)
 			return;
 		}
 	}
-	if( id != last_file.id || h->req_client != last_file.client )
+	entry = media_cache_get(id);
+	if( entry )
 	{
+		strncpyt(last_file.path, entry->path, sizeof(last_file.path));
+		strncpyt(last_file.mime, entry->mime, sizeof(last_file.mime));
+		if( entry->dlna_pn )
+			snprintf(last_file.dlna, sizeof(last_file.dlna), "DLNA.ORG_PN=%s;", entry->dlna_pn);
+		else
+			last_file.dlna[0] = '\0';
+	}
+	else
+	{
+		gen = media_cache_gen;
 		snprintf(buf, sizeof(buf), "SELECT PATH, MIME, DLNA_PN from DETAILS where ID = '%lld'", (long long)id);
 		ret = sql_get_table(db, buf, &result, &rows, NULL);
 		if( (ret != SQLITE_OK) )
@@ -2387,38 +2655,35 @@ SendResp_dlnafile(struct upnphttp *h, char *object)
 			return;
 		}
 		/* Cache the result */
-		last_file.id = id;
-		last_file.client = h->req_client;
-		strncpy(last_file.path, result[3], sizeof(last_file.path)-1);
-		if( result[4] )
-		{
-			strncpy(last_file.mime, result[4], sizeof(last_file.mime)-1);
-			/* From what I read, Samsung TV's expect a [wrong] MIME type of x-mkv. */
-			if( cflags & FLAG_SAMSUNG )
-			{
-				if( strcmp(last_file.mime+6, "x-matroska") == 0 )
-					strcpy(last_file.mime+8, "mkv");
-				/* Samsung TV's such as the A750 can natively support many
-				   Xvid/DivX AVI's however, the DLNA server needs the 
-				   mime type to say video/mpeg */
-				else if( h->req_client == ESamsungSeriesA &&
-				         strcmp(last_file.mime+6, "x-msvideo") == 0 )
-					strcpy(last_file.mime+6, "mpeg");
-			}
-			/* ... and Sony BDP-S370 won't play MKV unless we pretend it's a DiVX file */
-			else if( h->req_client == ESonyBDP )
-			{
-				if( strcmp(last_file.mime+6, "x-matroska") == 0 ||
-				    strcmp(last_file.mime+6, "mpeg") == 0 )
-					strcpy(last_file.mime+6, "divx");
-			}
-		}
+		media_cache_put(id, gen, result[3], result[4], result[5]);
+		strncpyt(last_file.path, result[3], sizeof(last_file.path));
+		strncpyt(last_file.mime, result[4], sizeof(last_file.mime));
 		if( result[5] )
 			snprintf(last_file.dlna, sizeof(last_file.dlna), "DLNA.ORG_PN=%s;", result[5]);
 		else
 			last_file.dlna[0] = '\0';
 		sqlite3_free_table(result);
 	}
+	/* The cache keeps the stored type; client quirks are applied per request.
+	 * From what I read, Samsung TV's expect a [wrong] MIME type of x-mkv. */
+	if( cflags & FLAG_SAMSUNG )
+	{
+		if( strcmp(last_file.mime+6, "x-matroska") == 0 )
+			strcpy(last_file.mime+8, "mkv");
+		/* Samsung TV's such as the A750 can natively support many
+		   Xvid/DivX AVI's however, the DLNA server needs the 
+		   mime type to say video/mpeg */
+		else if( h->req_client == ESamsungSeriesA &&
+		         strcmp(last_file.mime+6, "x-msvideo") == 0 )
+			strcpy(last_file.mime+6, "mpeg");
+	}
+	/* ... and Sony BDP-S370 won't play MKV unless we pretend it's a DiVX file */
+	else if( h->req_client == ESonyBDP )
+	{
+		if( strcmp(last_file.mime+6, "x-matroska") == 0 ||
+		    strcmp(last_file.mime+6, "mpeg") == 0 )
+			strcpy(last_file.mime+6, "divx");
+	}
 #if USE_FORK
 	newpid = process_fork();
 	if( newpid > 0 )
@@ -101,6 +101,8 @@ struct upnphttp {
 	int req_Timeout;
 	const char * req_SID;		/* For UNSUBSCRIBE */
 	int req_SIDLen;
+	const char * req_IfNoneMatch;	/* For conditional GET */
+	int req_IfNoneMatchLen;
 	off_t req_RangeStart;
 	off_t req_RangeEnd;
 	long int req_chunklen;
@@ -223,5 +225,11 @@ SendResp_thumbnail(struct upnphttp *, char * url);
  * send the actual file data for a UPnP-A/V or DLNA request. */
 void
 SendResp_dlnafile(struct upnphttp *, char * url);
+
+/* Drop cached /MediaItems/ lookups after DETAILS rows change. */
+void
+media_cache_invalidate(int64_t id);
+void
+media_cache_flush(void);
 #endif
 
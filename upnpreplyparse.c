@@ -27,6 +27,7 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdio.h>
 
@@ -87,6 +88,98 @@ ParseNameValue(const char * buffer, int bufsize,
     parsexml(&parser);
 }
 
+static const struct {
+    const char * name;
+    int len;
+    size_t offset;
+} ContentDirectoryArgNames[] = {
+#define CDARG(n) { #n, sizeof(#n)-1, offsetof(struct ContentDirectoryArgs, n) }
+    CDARG(ObjectID),
+    CDARG(ContainerID),
+    CDARG(BrowseFlag),
+    CDARG(Filter),
+    CDARG(SearchCriteria),
+    CDARG(SortCriteria),
+    CDARG(StartingIndex),
+    CDARG(RequestedCount),
+#undef CDARG
+    { NULL, 0, 0 }
+};
+
+/* Same element/value rules as ParseNameValue() without XML_STORE_EMPTY_FL
+ * (namespace prefixes ignored, entities left as-is, the last occurrence
+ * wins), but nothing is copied or allocated. */
+void
+ParseContentDirectoryArgs(char * buffer, int bufsize,
+                          struct ContentDirectoryArgs * args)
+{
+    char * p = buffer;
+    char * end = buffer + bufsize;
+    char * name;
+    char * value;
+    char quote;
+    int len, i;
+
+    memset(args, 0, sizeof(*args));
+    while(p < end - 1)
+    {
+        if(p[0] != '<' || p[1] == '?' || p[1] == '/')
+        {
+            p++;
+            continue;
+        }
+        name = ++p;
+        len = 0;
+        while(p < end && !IS_WHITE_SPACE(*p) && *p != '>' && *p != '/')
+        {
+            if(*p == ':')
+            {
+                name = p + 1;
+                len = 0;
+            }
+            else
+                len++;
+            p++;
+        }
+        /* skip attributes */
+        quote = 0;
+        while(p < end && (quote || *p != '>'))
+        {
+            if(quote && *p == quote)
+                quote = 0;
+            else if(!quote && (*p == '"' || *p == '\''))
+                quote = *p;
+            p++;
+        }
+        if(p >= end)
+            return;
+        if(p[-1] == '/')
+            continue;
+        p++;
+        while(p < end && IS_WHITE_SPACE(*p))
+            p++;
+        value = p;
+        while(p < end && *p != '<')
+            p++;
+        if(p >= end)
+            return;
+        if(p == value)
+            continue;
+        for(i = 0; ContentDirectoryArgNames[i].name; i++)
+        {
+            if(ContentDirectoryArgNames[i].len == len &&
+               memcmp(ContentDirectoryArgNames[i].name, name, len) == 0)
+            {
+                *(char **)((char *)args + ContentDirectoryArgNames[i].offset) = value;
+                /* the '<' being overwritten opens this element's end tag,
+                 * which the loop would skip anyway */
+                *p++ = '\0';
+                break;
+            }
+        }
+    }
+}
+
 void
 ClearNameValueList(struct NameValueParserData * pdata)
 {
@@ -49,11 +49,30 @@ struct NameValueParserData {
 
 #define XML_STORE_EMPTY_FL  0x01
 
+/* Arguments of the ContentDirectory Browse and Search actions.
+ * Each one points into the request buffer, or is NULL if absent/empty. */
+struct ContentDirectoryArgs {
+    char * ObjectID;
+    char * ContainerID;
+    char * BrowseFlag;
+    char * Filter;
+    char * SearchCriteria;
+    char * SortCriteria;
+    char * StartingIndex;
+    char * RequestedCount;
+};
+
 /* ParseNameValue() */
 void
 ParseNameValue(const char * buffer, int bufsize,
                struct NameValueParserData * data, uint32_t flags);
 
+/* ParseContentDirectoryArgs()
+ * single pass, in place: values are NUL-terminated inside buffer */
+void
+ParseContentDirectoryArgs(char * buffer, int bufsize,
+                          struct ContentDirectoryArgs * args);
+
 /* ClearNameValueList() */
 void
 ClearNameValueList(struct NameValueParserData * pdata);
@@ -66,6 +66,7 @@
 #include "upnphttp.h"
 #include "upnpsoap.h"
 #include "upnpreplyparse.h"
+#include "upnpevents.h"
 #include "getifaddr.h"
 #include "scanner.h"
 #include "sql.h"
@@ -336,6 +337,7 @@ GetCurrentConnectionInfo(struct upnphttp * h, const char * action)
 #define FILTER_UPNP_ORIGINALTRACKNUMBER          0x00100000
 #define FILTER_UPNP_SEARCHCLASS                  0x00200000
 #define FILTER_UPNP_STORAGEUSED                  0x00400000
+#define FILTER_UPNP_CONTAINERUPDATEID            0x00800000
 /* Vendor-specific filter flags */
 #define FILTER_SEC_CAPTION_INFO_EX               0x01000000
 #define FILTER_SEC_DCM_INFO                      0x02000000
@@ -435,6 +437,10 @@ set_filter_flags(char *filter, struct upnphttp *h)
 		{
 			flags |= FILTER_UPNP_STORAGEUSED;
 		}
+		else if( strcmp(item, "upnp:containerUpdateID") == 0 )
+		{
+			flags |= FILTER_UPNP_CONTAINERUPDATEID;
+		}
 		else if( strcmp(item, "res") == 0 )
 		{
 			flags |= FILTER_RES;
@@ -554,7 +560,7 @@ parse_sort_criteria(char *sortCriteria, int *error)
 		}
 		else if( strcasecmp(item, "dc:title") == 0 )
 		{
-			strcatf(&str, "d.TITLE");
+			strcatf(&str, "o.SORT_TITLE");
 			title_sorted = 1;
 		}
 		else if( strcasecmp(item, "dc:date") == 0 )
@@ -563,7 +569,9 @@ parse_sort_criteria(char *sortCriteria, int *error)
 		}
 		else if( strcasecmp(item, "upnp:originalTrackNumber") == 0 )
 		{
-			strcatf(&str, "d.DISC, d.TRACK");
+			/* The track key ends with the title key */
+			strcatf(&str, "o.SORT_TRACK");
+			title_sorted = 1;
 		}
 		else if( strcasecmp(item, "upnp:album") == 0 )
 		{
@@ -597,7 +605,7 @@ parse_sort_criteria(char *sortCriteria, int *error)
 	}
 	/* Add a "tiebreaker" sort order */
 	if( !title_sorted )
-		strcatf(&str, ", TITLE ASC");
+		strcatf(&str, ", o.SORT_TITLE ASC");
 
 	if( force_sort_criteria )
 		free(sortCriteria);
@@ -605,6 +613,33 @@ parse_sort_criteria(char *sortCriteria, int *error)
 	return order;
 }
 
+#ifdef __sparc__
+/* Sorting takes too long on slow processors with very large containers,
+ * unless the order is a walk of an OBJECTS sort-key index. */
+static char *
+limit_sort(char *orderBy, int totalMatches, int indexed)
+{
+	static const char * const walks[] = {
+		"order by o.SORT_TITLE",
+		"order by o.SORT_TITLE DESC",
+		NULL
+	};
+	int i;
+
+	if( !orderBy || totalMatches < 10000 )
+		return orderBy;
+	for( i = 0; indexed && walks[i]; i++ )
+	{
+		if( strcmp(orderBy, walks[i]) == 0 )
+			return orderBy;
+	}
+	free(orderBy);
+	return NULL;
+}
+#else
+#define limit_sort(orderBy, totalMatches, indexed) (orderBy)
+#endif
+
 inline static void
 add_resized_res(int srcw, int srch, int reqw, int reqh, char *dlna_pn,
                 char *detailID, struct Response *args)
@@ -637,7 +672,7 @@ add_resized_res(int srcw, int srch, int reqw, int reqh, char *dlna_pn,
 
 inline static void
 add_res(char *size, char *duration, char *bitrate, char *sampleFrequency,
-        char *nrAudioChannels, char *resolution, char *dlna_pn, char *mime,
+        char *nrAudioChannels, char *resolution, const char *dlna_pn, const char *mime,
         char *detailID, const char *ext, struct Response *args)
 {
 	strcatf(args->str, "&lt;res ");
@@ -680,19 +715,310 @@ add_res(char *size, char *duration, char *bitrate, char *sampleFrequency,
 	                          runtime_vars.port, detailID, ext);
 }
 
+/* Client flags that change how an item's MIME type and DLNA profile are presented */
+#define RES_PROFILE_FLAGS (FLAG_DLNA|FLAG_MIME_AVI_DIVX|FLAG_MIME_AVI_AVI|FLAG_SAMSUNG| \
+                           FLAG_MIME_FLAC_FLAC|FLAG_MIME_WAV_WAV)
+#define RES_PROFILE_SLOTS 256
+
+/* The protocolInfo of an item, for one client type and stored MIME/DLNA_PN
+ * pair.  A result page only holds a few distinct pairs, so each one is
+ * worked out once and reused for every later row. */
+struct res_profile_s {
+	enum client_types client;
+	uint32_t flags;
+	int mime_id;
+	int pn_id;
+	int creator;
+	char mime[64];
+	char dlna[128];
+	const char *ext;
+};
+
+static struct res_profile_s res_profiles[RES_PROFILE_SLOTS];
+
+static void
+build_res_profile(struct res_profile_s *p, const struct Response *args,
+                  const char *stored_mime, const char *dlna_pn, int creator)
+{
+	uint32_t dlna_flags = DLNA_FLAG_DLNA_V1_5|DLNA_FLAG_HTTP_STALLING|DLNA_FLAG_TM_B;
+	char *mime = p->mime;
+
+	strncpyt(mime, stored_mime, sizeof(p->mime));
+	/* We may need special handling for certain MIME types */
+	if( *mime == 'v' )
+	{
+		dlna_flags |= DLNA_FLAG_TM_S;
+		if( args->flags & FLAG_MIME_AVI_DIVX )
+		{
+			if( strcmp(mime, "video/x-msvideo") == 0 )
+			{
+				if( creator )
+					strcpy(mime+6, "divx");
+				else
+					strcpy(mime+6, "avi");
+			}
+		}
+		else if( args->flags & FLAG_MIME_AVI_AVI )
+		{
+			if( strcmp(mime, "video/x-msvideo") == 0 )
+			{
+				strcpy(mime+6, "avi");
+			}
+		}
+		else if( args->client == EFreeBox && dlna_pn )
+		{
+			if( strncmp(dlna_pn, "AVC_TS", 6) == 0 ||
+			    strncmp(dlna_pn, "MPEG_TS", 7) == 0 )
+			{
+				strcpy(mime+6, "mp2t");
+			}
+		}
+		if( !(args->flags & FLAG_DLNA) )
+		{
+			if( strcmp(mime+6, "vnd.dlna.mpeg-tts") == 0 )
+			{
+				strcpy(mime+6, "mpeg");
+			}
+		}
+		/* From what I read, Samsung TV's expect a [wrong] MIME type of x-mkv. */
+		if( args->flags & FLAG_SAMSUNG )
+		{
+			if( strcmp(mime+6, "x-matroska") == 0 )
+			{
+				strcpy(mime+8, "mkv");
+			}
+		}
+	}
+	else if( *mime == 'a' )
+	{
+		dlna_flags |= DLNA_FLAG_TM_S;
+		if( strcmp(mime+6, "x-flac") == 0 )
+		{
+			if( args->flags & FLAG_MIME_FLAC_FLAC )
+			{
+				strcpy(mime+6, "flac");
+			}
+		}
+		else if( strcmp(mime+6, "x-wav") == 0 )
+		{
+			if( args->flags & FLAG_MIME_WAV_WAV )
+			{
+				strcpy(mime+6, "wav");
+			}
+		}
+	}
+	else
+		dlna_flags |= DLNA_FLAG_TM_I;
+
+	if( dlna_pn )
+		snprintf(p->dlna, sizeof(p->dlna), "DLNA.ORG_PN=%s;"
+		                                   "DLNA.ORG_OP=01;"
+		                                   "DLNA.ORG_CI=0;"
+		                                   "DLNA.ORG_FLAGS=%08X%024X",
+		                                   dlna_pn, dlna_flags, 0);
+	else if( args->flags & FLAG_DLNA )
+		snprintf(p->dlna, sizeof(p->dlna), "DLNA.ORG_OP=01;"
+		                                   "DLNA.ORG_CI=0;"
+		                                   "DLNA.ORG_FLAGS=%08X%024X",
+		                                   dlna_flags, 0);
+	else
+		strcpy(p->dlna, "*");
+	p->ext = mime_to_ext(mime);
+}
+
+static const struct res_profile_s *
+get_res_profile(const struct Response *args, const char *mime, const char *dlna_pn, const char *creator)
+{
+	static struct res_profile_s scratch;
+	struct res_profile_s *p = NULL;
+	uint32_t flags = args->flags & RES_PROFILE_FLAGS;
+	int mime_id, pn_id = -1, has_creator;
+	unsigned int h, i;
+
+	/* Only the DivX rewrite looks at the creator */
+	has_creator = (creator && (flags & FLAG_MIME_AVI_DIVX)) ? 1 : 0;
+	mime_id = intern_id(mime);
+	if( dlna_pn )
+		pn_id = intern_id(dlna_pn);
+	if( mime_id < 0 || (dlna_pn && pn_id < 0) )
+	{
+		build_res_profile(&scratch, args, mime, dlna_pn, has_creator);
+		return &scratch;
+	}
+
+	h = (((unsigned int)mime_id * 31 + pn_id + 1) * 31 + args->client) * 2 + has_creator;
+	for( i = 0; i < 8; i++ )
+	{
+		p = &res_profiles[(h + i) % RES_PROFILE_SLOTS];
+		if( !p->ext )
+			break;
+		if( p->mime_id == mime_id && p->pn_id == pn_id && p->client == args->client &&
+		    p->flags == flags && p->creator == has_creator )
+			return p;
+	}
+	/* Fill the empty slot, or replace the last one probed */
+	p->client = args->client;
+	p->flags = flags;
+	p->mime_id = mime_id;
+	p->pn_id = pn_id;
+	p->creator = has_creator;
+	build_res_profile(p, args, mime, dlna_pn, has_creator);
+
+	return p;
+}
+
+/* Result columns of SELECT_COLUMNS that the output plan copies */
+enum didl_col {
+	COL_OBJECT_ID = 0,
+	COL_TITLE = 6,
+	COL_ARTIST = 10,
+	COL_ALBUM = 11,
+	COL_GENRE = 12,
+	COL_COMMENT = 13,
+	COL_TRACK = 15,
+	COL_DATE = 16,
+	COL_CREATOR = 19,
+	COL_MIME = 21
+};
+
+enum didl_op_type {
+	DIDL_TEXT,	/* column between two literal tags */
+	DIDL_ACTOR,	/* the artist again, on video items only */
+	DIDL_TRACK,	/* non-zero track, or the position in a playlist */
+	DIDL_DCM_INFO	/* Samsung bookmark, looked up per row */
+};
+
+struct didl_op_s {
+	enum didl_op_type type;
+	enum didl_col col;
+	int max;
+	const char *open;
+	const char *close;
+	int open_len;
+	int close_len;
+};
+
+#define DIDL_MAX_OPS 12
+
+/* The optional metadata elements of a result row only depend on the
+ * filter, so which ones to emit is decided once per request.  Each row
+ * then just copies literal tags around its column values. */
+struct didl_plan_s {
+	struct didl_op_s item[DIDL_MAX_OPS];
+	int item_ops;
+	struct didl_op_s container[DIDL_MAX_OPS];
+	int container_ops;
+};
+
+#define DIDL_TAG(name) "&lt;" name "&gt;", "&lt;/" name "&gt;"
+#define strcatl(str, lit) strcatn(str, lit, sizeof(lit) - 1)
+
+static void
+add_didl_op(struct didl_op_s *ops, int *count, enum didl_op_type type,
+            enum didl_col col, int max, const char *open, const char *close)
+{
+	struct didl_op_s *op = &ops[(*count)++];
+
+	op->type = type;
+	op->col = col;
+	op->max = max;
+	op->open = open;
+	op->close = close;
+	op->open_len = strlen(open);
+	op->close_len = strlen(close);
+}
+
+static void
+build_didl_plan(struct didl_plan_s *plan, uint32_t filter)
+{
+	plan->item_ops = 0;
+	if( filter & FILTER_DC_DESCRIPTION )
+		add_didl_op(plan->item, &plan->item_ops, DIDL_TEXT, COL_COMMENT, 384, DIDL_TAG("dc:description"));
+	if( filter & FILTER_DC_CREATOR )
+		add_didl_op(plan->item, &plan->item_ops, DIDL_TEXT, COL_CREATOR, 0, DIDL_TAG("dc:creator"));
+	if( filter & FILTER_DC_DATE )
+		add_didl_op(plan->item, &plan->item_ops, DIDL_TEXT, COL_DATE, 0, DIDL_TAG("dc:date"));
+	if( filter & FILTER_SEC_DCM_INFO )
+		add_didl_op(plan->item, &plan->item_ops, DIDL_DCM_INFO, COL_TITLE, 0,
+		            "&lt;sec:dcmInfo&gt;CREATIONDATE=0,FOLDER=", "&lt;/sec:dcmInfo&gt;");
+	if( filter & FILTER_UPNP_ACTOR )
+		add_didl_op(plan->item, &plan->item_ops, DIDL_ACTOR, COL_ARTIST, 0, DIDL_TAG("upnp:actor"));
+	if( filter & FILTER_UPNP_ARTIST )
+		add_didl_op(plan->item, &plan->item_ops, DIDL_TEXT, COL_ARTIST, 0, DIDL_TAG("upnp:artist"));
+	if( filter & FILTER_UPNP_ALBUM )
+		add_didl_op(plan->item, &plan->item_ops, DIDL_TEXT, COL_ALBUM, 0, DIDL_TAG("upnp:album"));
+	if( filter & FILTER_UPNP_GENRE )
+		add_didl_op(plan->item, &plan->item_ops, DIDL_TEXT, COL_GENRE, 0, DIDL_TAG("upnp:genre"));
+	if( filter & FILTER_UPNP_ORIGINALTRACKNUMBER )
+		add_didl_op(plan->item, &plan->item_ops, DIDL_TRACK, COL_TRACK, 0, DIDL_TAG("upnp:originalTrackNumber"));
+
+	plan->container_ops = 0;
+	if( filter & FILTER_DC_CREATOR )
+		add_didl_op(plan->container, &plan->container_ops, DIDL_TEXT, COL_CREATOR, 0, DIDL_TAG("dc:creator"));
+	if( filter & FILTER_UPNP_GENRE )
+		add_didl_op(plan->container, &plan->container_ops, DIDL_TEXT, COL_GENRE, 0, DIDL_TAG("upnp:genre"));
+	if( filter & FILTER_UPNP_ARTIST )
+		add_didl_op(plan->container, &plan->container_ops, DIDL_TEXT, COL_ARTIST, 0, DIDL_TAG("upnp:artist"));
+}
+
+static void
+run_didl_plan(struct string_s *str, const struct didl_op_s *op, int count,
+              char **argv, const char *title, const char *detailID)
+{
+	const char *val;
+	int len;
+
+	for( ; count > 0; count--, op++ )
+	{
+		val = argv[op->col];
+		switch( op->type )
+		{
+		case DIDL_ACTOR:
+			if( *argv[COL_MIME] != 'v' )
+				val = NULL;
+			break;
+		case DIDL_TRACK:
+			if( strncmp(argv[COL_OBJECT_ID], MUSIC_PLIST_ID, strlen(MUSIC_PLIST_ID)) == 0 )
+				val = strrchr(argv[COL_OBJECT_ID], '$') + 1;
+			if( val && !atoi(val) )
+				val = NULL;
+			break;
+		case DIDL_DCM_INFO:
+			/* Get bookmark */
+			strcatn(str, op->open, op->open_len);
+			strcatf(str, "%s,BM=%d", title,
+			        sql_get_int_field(db, "SELECT SEC from BOOKMARKS where ID = '%s'", detailID));
+			strcatn(str, op->close, op->close_len);
+			continue;
+		default:
+			break;
+		}
+		if( !val )
+			continue;
+		len = strlen(val);
+		if( op->max && len > op->max )
+			len = op->max;
+		strcatn(str, op->open, op->open_len);
+		strcatn(str, val, len);
+		strcatn(str, op->close, op->close_len);
+	}
+}
+
 #define COLUMNS "o.REF_ID, o.DETAIL_ID, o.CLASS," \
                 " d.SIZE, d.TITLE, d.DURATION, d.BITRATE, d.SAMPLERATE, d.ARTIST," \
                 " d.ALBUM, d.GENRE, d.COMMENT, d.CHANNELS, d.TRACK, d.DATE, d.RESOLUTION," \
-                " d.THUMBNAIL, d.CREATOR, d.DLNA_PN, d.MIME, d.ALBUM_ART, d.DISC "
+                " d.THUMBNAIL, d.CREATOR, d.DLNA_PN, d.MIME, d.ALBUM_ART, d.DISC," \
+                " o.SORT_TITLE, o.SORT_TRACK "
 #define SELECT_COLUMNS "SELECT o.OBJECT_ID, o.PARENT_ID, " COLUMNS
 
 static int
 callback(void *args, int argc, char **argv, char **azColName)
 {
 	struct Response *passed_args = (struct Response *)args;
+	/* Artist, genre, comment, track and date are copied by the output plan */
 	char *id = argv[0], *parent = argv[1], *refID = argv[2], *detailID = argv[3], *class = argv[4], *size = argv[5], *title = argv[6],
-	     *duration = argv[7], *bitrate = argv[8], *sampleFrequency = argv[9], *artist = argv[10], *album = argv[11],
-	     *genre = argv[12], *comment = argv[13], *nrAudioChannels = argv[14], *track = argv[15], *date = argv[16], *resolution = argv[17],
+	     *duration = argv[7], *bitrate = argv[8], *sampleFrequency = argv[9], *album = argv[11],
+	     *nrAudioChannels = argv[14], *resolution = argv[17],
 	     *tn = argv[18], *creator = argv[19], *dlna_pn = argv[20], *mime = argv[21], *album_art = argv[22];
 	char dlna_buf[128];
 	const char *ext;
@@ -734,150 +1060,43 @@ callback(void *args, int argc, char **argv, char **azColName)
 
 	if( strncmp(class, "item", 4) == 0 )
 	{
-		uint32_t dlna_flags = DLNA_FLAG_DLNA_V1_5|DLNA_FLAG_HTTP_STALLING|DLNA_FLAG_TM_B;
+		const struct res_profile_s *res;
 		char *alt_title = NULL;
-		/* We may need special handling for certain MIME types */
-		if( *mime == 'v' )
-		{
-			dlna_flags |= DLNA_FLAG_TM_S;
-			if( passed_args->flags & FLAG_MIME_AVI_DIVX )
-			{
-				if( strcmp(mime, "video/x-msvideo") == 0 )
-				{
-					if( creator )
-						strcpy(mime+6, "divx");
-					else
-						strcpy(mime+6, "avi");
-				}
-			}
-			else if( passed_args->flags & FLAG_MIME_AVI_AVI )
-			{
-				if( strcmp(mime, "video/x-msvideo") == 0 )
-				{
-					strcpy(mime+6, "avi");
-				}
-			}
-			else if( passed_args->client == EFreeBox && dlna_pn )
-			{
-				if( strncmp(dlna_pn, "AVC_TS", 6) == 0 ||
-				    strncmp(dlna_pn, "MPEG_TS", 7) == 0 )
-				{
-					strcpy(mime+6, "mp2t");
-				}
-			}
-			if( !(passed_args->flags & FLAG_DLNA) )
-			{
-				if( strcmp(mime+6, "vnd.dlna.mpeg-tts") == 0 )
-				{
-					strcpy(mime+6, "mpeg");
-				}
-			}
-			/* From what I read, Samsung TV's expect a [wrong] MIME type of x-mkv. */
-			if( passed_args->flags & FLAG_SAMSUNG )
-			{
-				if( strcmp(mime+6, "x-matroska") == 0 )
-				{
-					strcpy(mime+8, "mkv");
-				}
-			}
-			/* LG hack: subtitles won't get used unless dc:title contains a dot. */
-			else if( passed_args->client == ELGDevice && (passed_args->filter & FILTER_RES) )
-			{
-				if( sql_get_int_field(db, "SELECT ID from CAPTIONS where ID = '%s'", detailID) > 0 )
-				{
-					ret = asprintf(&alt_title, "%s.", title);
-					if( ret > 0 )
-						title = alt_title;
-					else
-						alt_title = NULL;
-				}
-			}
-		}
-		else if( *mime == 'a' )
+
+		res = get_res_profile(passed_args, mime, dlna_pn, creator);
+		/* LG hack: subtitles won't get used unless dc:title contains a dot. */
+		if( *mime == 'v' && passed_args->client == ELGDevice &&
+		    !(passed_args->flags & FLAG_SAMSUNG) && (passed_args->filter & FILTER_RES) )
 		{
-			dlna_flags |= DLNA_FLAG_TM_S;
-			if( strcmp(mime+6, "x-flac") == 0 )
+			if( sql_get_int_field(db, "SELECT ID from CAPTIONS where ID = '%s'", detailID) > 0 )
 			{
-				if( passed_args->flags & FLAG_MIME_FLAC_FLAC )
-				{
-					strcpy(mime+6, "flac");
-				}
-			}
-			else if( strcmp(mime+6, "x-wav") == 0 )
-			{
-				if( passed_args->flags & FLAG_MIME_WAV_WAV )
-				{
-					strcpy(mime+6, "wav");
-				}
+				ret = asprintf(&alt_title, "%s.", title);
+				if( ret > 0 )
+					title = alt_title;
+				else
+					alt_title = NULL;
 			}
 		}
-		else
-			dlna_flags |= DLNA_FLAG_TM_I;
-
-		if( dlna_pn )
-			snprintf(dlna_buf, sizeof(dlna_buf), "DLNA.ORG_PN=%s;"
-			                                     "DLNA.ORG_OP=01;"
-			                                     "DLNA.ORG_CI=0;"
-			                                     "DLNA.ORG_FLAGS=%08X%024X",
-			                                     dlna_pn, dlna_flags, 0);
-		else if( passed_args->flags & FLAG_DLNA )
-			snprintf(dlna_buf, sizeof(dlna_buf), "DLNA.ORG_OP=01;"
-			                                     "DLNA.ORG_CI=0;"
-			                                     "DLNA.ORG_FLAGS=%08X%024X",
-			                                     dlna_flags, 0);
-		else
-			strcpy(dlna_buf, "*");
 
 		ret = strcatf(str, "&lt;item id=\"%s\" parentID=\"%s\" restricted=\"1\"", id, parent);
 		if( refID && (passed_args->filter & FILTER_REFID) ) {
 			ret = strcatf(str, " refID=\"%s\"", refID);
 		}
-		ret = strcatf(str, "&gt;"
-		                   "&lt;dc:title&gt;%s&lt;/dc:title&gt;"
-		                   "&lt;upnp:class&gt;object.%s&lt;/upnp:class&gt;",
-		                   title, class);
-		if( comment && (passed_args->filter & FILTER_DC_DESCRIPTION) ) {
-			ret = strcatf(str, "&lt;dc:description&gt;%.384s&lt;/dc:description&gt;", comment);
-		}
-		if( creator && (passed_args->filter & FILTER_DC_CREATOR) ) {
-			ret = strcatf(str, "&lt;dc:creator&gt;%s&lt;/dc:creator&gt;", creator);
-		}
-		if( date && (passed_args->filter & FILTER_DC_DATE) ) {
-			ret = strcatf(str, "&lt;dc:date&gt;%s&lt;/dc:date&gt;", date);
-		}
-		if( passed_args->filter & FILTER_SEC_DCM_INFO ) {
-			/* Get bookmark */
-			ret = strcatf(str, "&lt;sec:dcmInfo&gt;CREATIONDATE=0,FOLDER=%s,BM=%d&lt;/sec:dcmInfo&gt;",
-			              title, sql_get_int_field(db, "SELECT SEC from BOOKMARKS where ID = '%s'", detailID));
-		}
-		if( artist ) {
-			if( (*mime == 'v') && (passed_args->filter & FILTER_UPNP_ACTOR) ) {
-				ret = strcatf(str, "&lt;upnp:actor&gt;%s&lt;/upnp:actor&gt;", artist);
-			}
-			if( passed_args->filter & FILTER_UPNP_ARTIST ) {
-				ret = strcatf(str, "&lt;upnp:artist&gt;%s&lt;/upnp:artist&gt;", artist);
-			}
-		}
-		if( album && (passed_args->filter & FILTER_UPNP_ALBUM) ) {
-			ret = strcatf(str, "&lt;upnp:album&gt;%s&lt;/upnp:album&gt;", album);
-		}
-		if( genre && (passed_args->filter & FILTER_UPNP_GENRE) ) {
-			ret = strcatf(str, "&lt;upnp:genre&gt;%s&lt;/upnp:genre&gt;", genre);
-		}
-		if( strncmp(id, MUSIC_PLIST_ID, strlen(MUSIC_PLIST_ID)) == 0 ) {
-			track = strrchr(id, '$')+1;
-		}
-		if( track && atoi(track) && (passed_args->filter & FILTER_UPNP_ORIGINALTRACKNUMBER) ) {
-			ret = strcatf(str, "&lt;upnp:originalTrackNumber&gt;%s&lt;/upnp:originalTrackNumber&gt;", track);
-		}
+		strcatl(str, "&gt;&lt;dc:title&gt;");
+		if( title )
+			strcatn(str, title, strlen(title));
+		strcatl(str, "&lt;/dc:title&gt;&lt;upnp:class&gt;object.");
+		strcatn(str, class, strlen(class));
+		strcatl(str, "&lt;/upnp:class&gt;");
+		run_didl_plan(str, passed_args->plan->item, passed_args->plan->item_ops, argv, title, detailID);
 		if( passed_args->filter & FILTER_RES ) {
 #ifdef BAIDU_DMS_OPT
 			ext = title_to_ext(title);
 #else
-			ext = mime_to_ext(mime);
+			ext = res->ext;
 #endif
 			add_res(size, duration, bitrate, sampleFrequency, nrAudioChannels,
-			        resolution, dlna_buf, mime, detailID, ext, passed_args);
+			        resolution, res->dlna, res->mime, detailID, ext, passed_args);
 			if( *mime == 'i' ) {
 				int srcw, srch;
 				if( resolution && (sscanf(resolution, "%6dx%6d", &srcw, &srch) == 2) )
@@ -893,7 +1112,7 @@ callback(void *args, int argc, char **argv, char **azColName)
 					ret = strcatf(str, "&lt;res protocolInfo=\"http-get:*:%s:%s\"&gt;"
 					                   "http://%s:%d/Thumbnails/%s.jpg"
 					                   "&lt;/res&gt;",
-					                   mime, "DLNA.ORG_PN=JPEG_TN;DLNA.ORG_CI=1", lan_addr[passed_args->iface].str,
+					                   res->mime, "DLNA.ORG_PN=JPEG_TN;DLNA.ORG_CI=1", lan_addr[passed_args->iface].str,
 					                   runtime_vars.port, detailID);
 				}
 				else
@@ -910,7 +1129,7 @@ callback(void *args, int argc, char **argv, char **azColName)
 					{
 						sprintf(dlna_buf, "DLNA.ORG_PN=%s;DLNA.ORG_OP=01;DLNA.ORG_CI=1", "MPEG_PS_NTSC");
 						add_res(size, duration, bitrate, sampleFrequency, nrAudioChannels,
-						        resolution, dlna_buf, mime, detailID, ext, passed_args);
+						        resolution, dlna_buf, res->mime, detailID, ext, passed_args);
 					}
 					break;
 				case ESonyBDP:
@@ -922,34 +1141,33 @@ callback(void *args, int argc, char **argv, char **azColName)
 						{
 							sprintf(dlna_buf, "DLNA.ORG_PN=%s;DLNA.ORG_OP=01;DLNA.ORG_CI=1", "MPEG_TS_SD_NA");
 							add_res(size, duration, bitrate, sampleFrequency, nrAudioChannels,
-							        resolution, dlna_buf, mime, detailID, ext, passed_args);
+							        resolution, dlna_buf, res->mime, detailID, ext, passed_args);
 						}
 						if( strncmp(dlna_pn, "MPEG_TS_SD_EU", 13) != 0 )
 						{
 							sprintf(dlna_buf, "DLNA.ORG_PN=%s;DLNA.ORG_OP=01;DLNA.ORG_CI=1", "MPEG_TS_SD_EU");
 							add_res(size, duration, bitrate, sampleFrequency, nrAudioChannels,
-							        resolution, dlna_buf, mime, detailID, ext, passed_args);
+							        resolution, dlna_buf, res->mime, detailID, ext, passed_args);
 						}
 					}
 					else if( (dlna_pn &&
 					          (strncmp(dlna_pn, "AVC_MP4", 7) == 0 ||
 					           strncmp(dlna_pn, "MPEG4_P2_MP4", 12) == 0)) ||
-					         strcmp(mime+6, "x-matroska") == 0 ||
-					         strcmp(mime+6, "x-msvideo") == 0 ||
-					         strcmp(mime+6, "mpeg") == 0 )
+					         strcmp(res->mime+6, "x-matroska") == 0 ||
+					         strcmp(res->mime+6, "x-msvideo") == 0 ||
+					         strcmp(res->mime+6, "mpeg") == 0 )
 					{
-						strcpy(mime+6, "avi");
 						if( !dlna_pn || strncmp(dlna_pn, "MPEG_PS_NTSC", 12) != 0 )
 						{
 							sprintf(dlna_buf, "DLNA.ORG_PN=%s;DLNA.ORG_OP=01;DLNA.ORG_CI=1", "MPEG_PS_NTSC");
 							add_res(size, duration, bitrate, sampleFrequency, nrAudioChannels,
-						        	resolution, dlna_buf, mime, detailID, ext, passed_args);
+						        	resolution, dlna_buf, "video/avi", detailID, ext, passed_args);
 						}
 						if( !dlna_pn || strncmp(dlna_pn, "MPEG_PS_PAL", 11) != 0 )
 						{
 							sprintf(dlna_buf, "DLNA.ORG_PN=%s;DLNA.ORG_OP=01;DLNA.ORG_CI=1", "MPEG_PS_PAL");
 							add_res(size, duration, bitrate, sampleFrequency, nrAudioChannels,
-						        	resolution, dlna_buf, mime, detailID, ext, passed_args);
+						        	resolution, dlna_buf, "video/avi", detailID, ext, passed_args);
 						}
 					}
 					break;
@@ -963,7 +1181,7 @@ callback(void *args, int argc, char **argv, char **azColName)
 					{
 					        sprintf(dlna_buf, "DLNA.ORG_PN=AVC_TS_HD_50_AC3%s", dlna_pn + 16);
 						add_res(size, duration, bitrate, sampleFrequency, nrAudioChannels,
-						        resolution, dlna_buf, mime, detailID, ext, passed_args);
+						        resolution, dlna_buf, res->mime, detailID, ext, passed_args);
 					}
 					break;
 				case ELGDevice:
@@ -1047,23 +1265,21 @@ callback(void *args, int argc, char **argv, char **azColName)
 			                   "&lt;upnp:searchClass includeDerived=\"1\"&gt;object.item.imageItem&lt;/upnp:searchClass&gt;"
 			                   "&lt;upnp:searchClass includeDerived=\"1\"&gt;object.item.videoItem&lt;/upnp:searchClass");
 		}
-		ret = strcatf(str, "&gt;"
-		                   "&lt;dc:title&gt;%s&lt;/dc:title&gt;"
-		                   "&lt;upnp:class&gt;object.%s&lt;/upnp:class&gt;",
-		                   title, class);
+		strcatl(str, "&gt;&lt;dc:title&gt;");
+		if( title )
+			strcatn(str, title, strlen(title));
+		strcatl(str, "&lt;/dc:title&gt;&lt;upnp:class&gt;object.");
+		strcatn(str, class, strlen(class));
+		strcatl(str, "&lt;/upnp:class&gt;");
 		if( (passed_args->filter & FILTER_UPNP_STORAGEUSED) || strcmp(class+10, "storageFolder") == 0 ) {
 			/* TODO: Implement real folder size tracking */
 			ret = strcatf(str, "&lt;upnp:storageUsed&gt;%s&lt;/upnp:storageUsed&gt;", (size ? size : "-1"));
 		}
-		if( creator && (passed_args->filter & FILTER_DC_CREATOR) ) {
-			ret = strcatf(str, "&lt;dc:creator&gt;%s&lt;/dc:creator&gt;", creator);
-		}
-		if( genre && (passed_args->filter & FILTER_UPNP_GENRE) ) {
-			ret = strcatf(str, "&lt;upnp:genre&gt;%s&lt;/upnp:genre&gt;", genre);
-		}
-		if( artist && (passed_args->filter & FILTER_UPNP_ARTIST) ) {
-			ret = strcatf(str, "&lt;upnp:artist&gt;%s&lt;/upnp:artist&gt;", artist);
+		if( passed_args->filter & FILTER_UPNP_CONTAINERUPDATEID ) {
+			ret = strcatf(str, "&lt;upnp:containerUpdateID&gt;%u&lt;/upnp:containerUpdateID&gt;",
+			                   upnp_event_container_update_id(id));
 		}
+		run_didl_plan(str, passed_args->plan->container, passed_args->plan->container_ops, argv, title, detailID);
 		if( album_art && atoi(album_art) && (passed_args->filter & FILTER_UPNP_ALBUMARTURI) ) {
 			ret = strcatf(str, "&lt;upnp:albumArtURI ");
 			if( passed_args->filter & FILTER_UPNP_ALBUMARTURI_DLNA_PROFILEID ) {
@@ -1109,21 +1325,22 @@ BrowseContentDirectory(struct upnphttp * h, const char * action)
 	int ret;
 	char *ObjectID, *Filter, *BrowseFlag, *SortCriteria;
 	char *orderBy = NULL;
-	struct NameValueParserData data;
+	struct ContentDirectoryArgs data;
+	struct didl_plan_s plan;
 	int RequestedCount = 0;
 	int StartingIndex = 0;
 
 	memset(&args, 0, sizeof(args));
 	memset(&str, 0, sizeof(str));
 
-	ParseNameValue(h->req_buf + h->req_contentoff, h->req_contentlen, &data, 0);
+	ParseContentDirectoryArgs(h->req_buf + h->req_contentoff, h->req_contentlen, &data);
 
-	ObjectID = GetValueFromNameValueList(&data, "ObjectID");
-	Filter = GetValueFromNameValueList(&data, "Filter");
-	BrowseFlag = GetValueFromNameValueList(&data, "BrowseFlag");
-	SortCriteria = GetValueFromNameValueList(&data, "SortCriteria");
+	ObjectID = data.ObjectID;
+	Filter = data.Filter;
+	BrowseFlag = data.BrowseFlag;
+	SortCriteria = data.SortCriteria;
 
-	if( (ptr = GetValueFromNameValueList(&data, "RequestedCount")) )
+	if( (ptr = data.RequestedCount) )
 		RequestedCount = atoi(ptr);
 	if( RequestedCount < 0 )
 	{
@@ -1132,7 +1349,7 @@ BrowseContentDirectory(struct upnphttp * h, const char * action)
 	}
 	if( !RequestedCount )
 		RequestedCount = -1;
-	if( (ptr = GetValueFromNameValueList(&data, "StartingIndex")) )
+	if( (ptr = data.StartingIndex) )
 		StartingIndex = atoi(ptr);
 	if( StartingIndex < 0 )
 	{
@@ -1144,7 +1361,7 @@ BrowseContentDirectory(struct upnphttp * h, const char * action)
 		SoapError(h, 402, "Invalid Args");
 		goto browse_error;
 	}
-	if( !ObjectID && !(ObjectID = GetValueFromNameValueList(&data, "ContainerID")) )
+	if( !ObjectID && !(ObjectID = data.ContainerID) )
 	{
 		SoapError(h, 402, "Invalid Args");
 		goto browse_error;
@@ -1156,6 +1373,8 @@ BrowseContentDirectory(struct upnphttp * h, const char * action)
 	/* See if we need to include DLNA namespace reference */
 	args.iface = h->iface;
 	args.filter = set_filter_flags(Filter, h);
+	build_didl_plan(&plan, args.filter);
+	args.plan = &plan;
 	if( args.filter & FILTER_DLNA_NAMESPACE )
 		ret = strcatf(&str, DLNA_NAMESPACE);
 	if( args.filter & (FILTER_PV_SUBTITLE_FILE_TYPE|FILTER_PV_SUBTITLE_FILE_URI) )
@@ -1225,12 +1444,12 @@ BrowseContentDirectory(struct upnphttp * h, const char * action)
 		ret = sql_get_int_field(db, "SELECT count(*) from OBJECTS where PARENT_ID = '%q'", ObjectID);
 		totalMatches = (ret > 0) ? ret : 0;
 		ret = 0;
+		/* A title order, and the forced class/track order, walk an OBJECTS
+		 * sort-key index, so even very large containers sort without a
+		 * temp sort. */
 		if( SortCriteria )
 		{
-#ifdef __sparc__ /* Sorting takes too long on slow processors with very large containers */
-			if( totalMatches < 10000 )
-#endif
-			orderBy = parse_sort_criteria(SortCriteria, &ret);
+			orderBy = limit_sort(parse_sort_criteria(SortCriteria, &ret), totalMatches, 1);
 		}
 		else
 		{
@@ -1243,10 +1462,7 @@ BrowseContentDirectory(struct upnphttp * h, const char * action)
 			}
 			else if( args.flags & FLAG_FORCE_SORT )
 			{
-#ifdef __sparc__
-				if( totalMatches < 10000 )
-#endif
-				ret = asprintf(&orderBy, "order by o.CLASS, d.DISC, d.TRACK, d.TITLE");
+				ret = asprintf(&orderBy, "order by o.CLASS, o.SORT_TRACK");
 			}
 			else
 				orderBy = parse_sort_criteria(SortCriteria, &ret);
@@ -1296,7 +1512,6 @@ BrowseContentDirectory(struct upnphttp * h, const char * action)
 	                    args.returned, totalMatches, updateID);
 	BuildSendAndCloseSoapResp(h, str.data, str.off);
 browse_error:
-	ClearNameValueList(&data);
 	if( args.flags & FLAG_FREE_OBJECT_ID )
 		sqlite3_free(ObjectID);
 	free(orderBy);
@@ -1590,31 +1805,32 @@ SearchContentDirectory(struct upnphttp * h, const char * action)
 	int totalMatches;
 	int ret;
 	char *ContainerID, *Filter, *SearchCriteria, *SortCriteria;
-	char *orderBy = NULL, *where = NULL, sep[] = "$*";
+	char *orderBy = NULL, *where = NULL, *scope = NULL, sep[] = "$*";
 	char groupBy[] = "group by DETAIL_ID";
-	struct NameValueParserData data;
+	struct ContentDirectoryArgs data;
+	struct didl_plan_s plan;
 	int RequestedCount = 0;
 	int StartingIndex = 0;
 
 	memset(&args, 0, sizeof(args));
 	memset(&str, 0, sizeof(str));
 
-	ParseNameValue(h->req_buf + h->req_contentoff, h->req_contentlen, &data, 0);
+	ParseContentDirectoryArgs(h->req_buf + h->req_contentoff, h->req_contentlen, &data);
 
-	ContainerID = GetValueFromNameValueList(&data, "ContainerID");
-	Filter = GetValueFromNameValueList(&data, "Filter");
-	SearchCriteria = GetValueFromNameValueList(&data, "SearchCriteria");
-	SortCriteria = GetValueFromNameValueList(&data, "SortCriteria");
+	ContainerID = data.ContainerID;
+	Filter = data.Filter;
+	SearchCriteria = data.SearchCriteria;
+	SortCriteria = data.SortCriteria;
 
-	if( (ptr = GetValueFromNameValueList(&data, "RequestedCount")) )
+	if( (ptr = data.RequestedCount) )
 		RequestedCount = atoi(ptr);
 	if( !RequestedCount )
 		RequestedCount = -1;
-	if( (ptr = GetValueFromNameValueList(&data, "StartingIndex")) )
+	if( (ptr = data.StartingIndex) )
 		StartingIndex = atoi(ptr);
 	if( !ContainerID )
 	{
-		if( !(ContainerID = GetValueFromNameValueList(&data, "ObjectID")) )
+		if( !(ContainerID = data.ObjectID) )
 		{
 			SoapError(h, 402, "Invalid Args");
 			goto search_error;
@@ -1627,6 +1843,8 @@ SearchContentDirectory(struct upnphttp * h, const char * action)
 	/* See if we need to include DLNA namespace reference */
 	args.iface = h->iface;
 	args.filter = set_filter_flags(Filter, h);
+	build_didl_plan(&plan, args.filter);
+	args.plan = &plan;
 	if( args.filter & FILTER_DLNA_NAMESPACE )
 	{
 		ret = strcatf(&str, DLNA_NAMESPACE);
@@ -1672,14 +1890,18 @@ SearchContentDirectory(struct upnphttp * h, const char * action)
 
 	where = parse_search_criteria(SearchCriteria, sep);
 	DPRINTF(E_DEBUG, L_HTTP, "Translated SearchCriteria: %s\n", where);
+	if( *ContainerID != '*' && strcmp(sep, "$*") == 0 )
+		scope = sql_subtree("OBJECT_ID", ContainerID);
+	else
+		scope = sqlite3_mprintf("OBJECT_ID glob '%q%s'", ContainerID, sep);
 
 	totalMatches = sql_get_int_field(db, "SELECT (select count(distinct DETAIL_ID)"
 	                                     " from OBJECTS o left join DETAILS d on (o.DETAIL_ID = d.ID)"
-	                                     " where (OBJECT_ID glob '%q%s') and (%s))"
+	                                     " where %s and (%s))"
 	                                     " + "
 	                                     "(select count(*) from OBJECTS o left join DETAILS d on (o.DETAIL_ID = d.ID)"
 	                                     " where (OBJECT_ID = '%q') and (%s))",
-	                                     ContainerID, sep, where, ContainerID, where);
+	                                     scope, where, ContainerID, where);
 	if( totalMatches < 0 )
 	{
 		/* Must be invalid SQL, so most likely bad or unhandled search criteria. */
@@ -1697,11 +1919,8 @@ SearchContentDirectory(struct upnphttp * h, const char * action)
 			goto search_error;
 		}
 	}
-#ifdef __sparc__ /* Sorting takes too long on slow processors with very large containers */
-	ret = 0;
-	if( totalMatches < 10000 )
-#endif
-		orderBy = parse_sort_criteria(SortCriteria, &ret);
+	/* No index orders a subtree range */
+	orderBy = limit_sort(parse_sort_criteria(SortCriteria, &ret), totalMatches, 0);
 	/* If it's a DLNA client, return an error for bad sort criteria */
 	if( ret < 0 && ((args.flags & FLAG_DLNA) || GETFLAG(DLNA_STRICT_MASK)) )
 	{
@@ -1711,10 +1930,10 @@ SearchContentDirectory(struct upnphttp * h, const char * action)
 
 	sql = sqlite3_mprintf( SELECT_COLUMNS
 	                      "from OBJECTS o left join DETAILS d on (d.ID = o.DETAIL_ID)"
-	                      " where OBJECT_ID glob '%q%s' and (%s) %s "
+	                      " where %s and (%s) %s "
 	                      "%z %s"
 	                      " limit %d, %d",
-	                      ContainerID, sep, where, groupBy,
+	                      scope, where, groupBy,
 	                      (*ContainerID == '*') ? NULL :
 	                      sqlite3_mprintf("UNION ALL " SELECT_COLUMNS
 	                                      "from OBJECTS o left join DETAILS d on (d.ID = o.DETAIL_ID)"
@@ -1736,9 +1955,9 @@ SearchContentDirectory(struct upnphttp * h, const char * action)
 	                    args.returned, totalMatches, updateID);
 	BuildSendAndCloseSoapResp(h, str.data, str.off);
 search_error:
-	ClearNameValueList(&data);
 	if( args.flags & FLAG_FREE_OBJECT_ID )
 		sqlite3_free(ContainerID);
+	sqlite3_free(scope);
 	free(orderBy);
 	free(where);
 	free(str.data);
@@ -36,6 +36,8 @@
 #define FLAG_FREE_OBJECT_ID     0x40000000
 #define FLAG_ROOT_CONTAINER     0x80000000
 
+struct didl_plan_s;
+
 struct Response
 {
 	struct string_s *str;
@@ -46,6 +48,7 @@ struct Response
 	uint32_t filter;
 	uint32_t flags;
 	enum client_types client;
+	const struct didl_plan_s *plan;
 };
 
 /* ExecuteSoapAction():
@@ -28,6 +28,11 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <errno.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
 #include "minidlnatypes.h"
 #include "upnpglobalvars.h"
 #include "log.h"
@@ -62,6 +67,29 @@ strcatf(struct string_s *str, const char *fmt, ...)
 	return ret;
 }
 
+/* Append len bytes of src, truncating like strcatf() when full */
+void
+strcatn(struct string_s *str, const char *src, int len)
+{
+	int size;
+
+	if (str->off >= str->size)
+		return;
+
+	size = str->size - str->off;
+	if (len >= size)
+	{
+		len = size - 1;
+		memcpy(str->data + str->off, src, len);
+		str->data[str->off + len] = '\0';
+		str->off = str->size;
+		return;
+	}
+	memcpy(str->data + str->off, src, len);
+	str->off += len;
+	str->data[str->off] = '\0';
+}
+
 inline void
 strncpyt(char *dst, const char *src, size_t len)
 {
@@ -236,21 +264,120 @@ unescape_tag(const char *tag, int force_alloc)
 	return esc_tag;
 }
 
+/* Characters that need an entity in XML text and attributes */
+static const unsigned char xml_special[256] = {
+	['"'] = 1, ['&'] = 2, ['<'] = 3, ['>'] = 4
+};
+
+static const struct {
+	const char *str;
+	int len;
+} xml_entities[2][5] = {
+	{ { NULL, 0 }, { "&quot;", 6 }, { "&amp;", 5 }, { "&lt;", 4 }, { "&gt;", 4 } },
+	/* Escaped twice, for text that is itself embedded in escaped DIDL */
+	{ { NULL, 0 }, { "&amp;quot;", 10 }, { "&amp;amp;", 9 }, { "&amp;lt;", 8 }, { "&amp;gt;", 8 } }
+};
+
+/* Length of the leading run of src that can be copied unescaped */
+static size_t
+xml_clean_run(const char *src, size_t len)
+{
+	size_t i = 0;
+#if defined(__SSE2__)
+	const __m128i quot = _mm_set1_epi8('"'), amp = _mm_set1_epi8('&');
+	const __m128i lt = _mm_set1_epi8('<'), gt = _mm_set1_epi8('>');
+	__m128i v, m;
+	int bits;
+
+	for( ; i + 16 <= len; i += 16 )
+	{
+		v = _mm_loadu_si128((const __m128i *)(src + i));
+		m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quot), _mm_cmpeq_epi8(v, amp)),
+		                 _mm_or_si128(_mm_cmpeq_epi8(v, lt), _mm_cmpeq_epi8(v, gt)));
+		bits = _mm_movemask_epi8(m);
+		if( bits )
+			return i + __builtin_ctz(bits);
+	}
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	const uint8x16_t quot = vdupq_n_u8('"'), amp = vdupq_n_u8('&');
+	const uint8x16_t lt = vdupq_n_u8('<'), gt = vdupq_n_u8('>');
+	uint8x16_t v, m;
+	uint64x2_t m64;
+
+	for( ; i + 16 <= len; i += 16 )
+	{
+		v = vld1q_u8((const uint8_t *)src + i);
+		m = vorrq_u8(vorrq_u8(vceqq_u8(v, quot), vceqq_u8(v, amp)),
+		             vorrq_u8(vceqq_u8(v, lt), vceqq_u8(v, gt)));
+		m64 = vreinterpretq_u64_u8(m);
+		/* The scalar loop below finds the exact byte */
+		if( vgetq_lane_u64(m64, 0) | vgetq_lane_u64(m64, 1) )
+			break;
+	}
+#endif
+	for( ; i < len; i++ )
+	{
+		if( xml_special[(unsigned char)src[i]] )
+			break;
+	}
+
+	return i;
+}
+
+/* Size of src once escaped, not counting the terminator */
+size_t
+xml_escaped_len(const char *src, size_t len, int twice)
+{
+	size_t out = len, i = 0;
+
+	while( (i += xml_clean_run(src + i, len - i)) < len )
+	{
+		out += xml_entities[twice ? 1 : 0][xml_special[(unsigned char)src[i]]].len - 1;
+		i++;
+	}
+
+	return out;
+}
+
+/* Escape src into dst in one pass, copying clean runs in bulk.  dst must
+ * hold xml_escaped_len() + 1 bytes.  Returns the terminating NUL. */
 char *
-escape_tag(const char *tag, int force_alloc)
+xml_escape(char *dst, const char *src, size_t len, int twice)
 {
-	char *esc_tag = NULL;
+	size_t i = 0, run;
+	int e;
 
-	if( strchr(tag, '&') || strchr(tag, '<') || strchr(tag, '>') || strchr(tag, '"') )
+	for( ;; )
 	{
-		esc_tag = strdup(tag);
-		esc_tag = modifyString(esc_tag, "&", "&amp;amp;");
-		esc_tag = modifyString(esc_tag, "<", "&amp;lt;");
-		esc_tag = modifyString(esc_tag, ">", "&amp;gt;");
-		esc_tag = modifyString(esc_tag, "\"", "&amp;quot;");
+		run = xml_clean_run(src + i, len - i);
+		memcpy(dst, src + i, run);
+		dst += run;
+		i += run;
+		if( i >= len )
+			break;
+		e = xml_special[(unsigned char)src[i++]];
+		memcpy(dst, xml_entities[twice ? 1 : 0][e].str, xml_entities[twice ? 1 : 0][e].len);
+		dst += xml_entities[twice ? 1 : 0][e].len;
 	}
-	else if( force_alloc )
-		esc_tag = strdup(tag);
+	*dst = '\0';
+
+	return dst;
+}
+
+char *
+escape_tag(const char *tag, int force_alloc)
+{
+	char *esc_tag;
+	size_t len, esc_len;
+
+	len = strlen(tag);
+	if( xml_clean_run(tag, len) == len )
+		return force_alloc ? strdup(tag) : NULL;
+
+	esc_len = xml_escaped_len(tag, len, 1);
+	esc_tag = malloc(esc_len + 1);
+	if( esc_tag )
+		xml_escape(esc_tag, tag, len, 1);
 
 	return esc_tag;
 }
@@ -430,6 +557,50 @@ DJBHash(const char *str, int len)
 
 	return hash;
 }
+
+/* MIME types and DLNA profiles come from a few dozen distinct values,
+ * so they are kept once here and referred to by a small ID.
+ * The table only grows; it is used from the main loop. */
+#define INTERN_SLOTS	512
+
+static struct {
+	char *str[INTERN_SLOTS];
+	short slot[INTERN_SLOTS];	/* hash slot -> ID + 1 */
+	int count;
+} interns;
+
+int
+intern_id(const char *str)
+{
+	unsigned int h;
+	int id;
+
+	h = DJBHash(str, strlen(str));
+	for( ;; h++ )
+	{
+		id = interns.slot[h % INTERN_SLOTS] - 1;
+		if( id < 0 )
+			break;
+		if( strcmp(interns.str[id], str) == 0 )
+			return id;
+	}
+	/* Keep the table at most half full so probes stay short */
+	if( interns.count >= INTERN_SLOTS / 2 )
+		return -1;
+	id = interns.count;
+	interns.str[id] = strdup(str);
+	if( !interns.str[id] )
+		return -1;
+	interns.slot[h % INTERN_SLOTS] = ++interns.count;
+
+	return id;
+}
+
+const char *
+intern_str(int id)
+{
+	return (id >= 0 && id < interns.count) ? interns.str[id] : NULL;
+}
 #ifdef BAIDU_DMS_OPT
 char *
 title_to_ext(const char * title)
@@ -464,399 +635,340 @@ get_nas_scan_path(char *newifi_path)
 	snprintf(newifi_path, PATH_MAX, "%s/%s", path, nas_scan_dir);
 }
 #endif
+/* MIME types we serve, sorted for bsearch().  The prefix entries also
+ * match types carrying parameters, like audio/L16;rate=44100. */
+static const struct mime_ext {
+	const char *mime;
+	const char *ext;
+	int prefix;
+} mime_exts[] = {
+	{ "audio/3gpp", "3gp", 0 },
+	{ "audio/L16", "pcm", 1 },
+	{ "audio/aacp", "aac+", 0 },
+	{ "audio/aiff", "aif", 0 },
+	{ "audio/amr", "amr", 0 },
+	{ "audio/eaacp", "eaac+", 0 },
+	{ "audio/flac", "flac", 0 },
+	{ "audio/mid", "mid", 0 },
+	{ "audio/mp4", "m4a", 0 },
+	{ "audio/mpeg", "mp3", 0 },
+	{ "audio/ogg", "ogg", 0 },
+	{ "audio/x-flac", "flac", 0 },
+	{ "audio/x-mpeg", "mpega", 0 },
+	{ "audio/x-ms-wma", "wma", 0 },
+	{ "audio/x-pn-realaudio", "ra", 0 },
+	{ "audio/x-wav", "wav", 0 },
+#ifdef BAIDU_DMS_OPT
+	{ "image/gif", "gif", 0 },
+	{ "image/ico", "ico", 0 },
+#endif
+	{ "image/jpeg", "jpg", 0 },
+#ifdef BAIDU_DMS_OPT
+	{ "image/pcb", "pcb", 0 },
+#endif
+	{ "image/png", "png", 0 },
+#ifdef BAIDU_DMS_OPT
+	{ "image/pnm", "pnm", 0 },
+	{ "image/ppm", "ppm", 0 },
+	{ "image/qtf", "qtf", 0 },
+	{ "image/qti", "qti", 0 },
+	{ "image/qtif", "qtif", 0 },
+	{ "image/tif", "tif", 0 },
+	{ "image/tiff", "tiff", 0 },
+#endif
+	{ "video/3gpp", "3gp", 0 },
+	{ "video/avi", "avi", 0 },
+	{ "video/divx", "avi", 0 },
+	{ "video/mp4", "mp4", 0 },
+	{ "video/mpeg", "mpg", 0 },
+	{ "video/quicktime", "mov", 0 },
+#ifdef BAIDU_DMS_OPT
+	{ "video/swf", "swf", 0 },
+#endif
+	{ "video/vnd.dlna.mpeg-tts", "mpg", 0 },
+	{ "video/x-flv", "flv", 0 },
+	{ "video/x-matroska", "mkv", 0 },
+	{ "video/x-mkv", "mkv", 0 },
+	{ "video/x-ms-wmv", "wmv", 0 },
+	{ "video/x-msvideo", "avi", 0 },
+#ifdef BAIDU_DMS_OPT
+	{ "video/x-pn-realvideo", "rm", 0 },
+	{ "video/x-rm", "rm", 0 },
+	{ "video/x-rmvb", "rmvb", 0 },
+#endif
+	{ "video/x-tivo-mpeg", "TiVo", 1 }
+};
+
+static int
+mime_ext_cmp(const void *key, const void *entry)
+{
+	return strcmp(key, ((const struct mime_ext *)entry)->mime);
+}
+
 const char *
 mime_to_ext(const char * mime)
 {
-	switch( *mime )
+	const struct mime_ext *found;
+	const char *ext = NULL;
+	int i;
+
+	found = bsearch(mime, mime_exts, sizeof(mime_exts)/sizeof(mime_exts[0]),
+	                sizeof(mime_exts[0]), mime_ext_cmp);
+	if( found )
+		return found->ext;
+	for( i = 0; i < sizeof(mime_exts)/sizeof(mime_exts[0]); i++ )
 	{
-		/* Audio extensions */
-		case 'a':
-			if( strcmp(mime+6, "mpeg") == 0 )
-				return "mp3";
-			else if( strcmp(mime+6, "mp4") == 0 )
-				return "m4a";
-			else if( strcmp(mime+6, "x-ms-wma") == 0 )
-				return "wma";
-			else if( strcmp(mime+6, "x-flac") == 0 )
-				return "flac";
-			else if( strcmp(mime+6, "flac") == 0 )
-				return "flac";
-			else if( strcmp(mime+6, "x-wav") == 0 )
-				return "wav";
-			else if( strncmp(mime+6, "L16", 3) == 0 )
-				return "pcm";
-			else if( strcmp(mime+6, "3gpp") == 0 )
-				return "3gp";
-			else if( strcmp(mime+6, "ogg") == 0 )
-				return "ogg";
-			else if( strcmp(mime, "audio/x-pn-realaudio") == 0 )
-				return "ra";
-			else if( strcmp(mime, "audio/aacp") == 0 )
-				return "aac+";
-			else if( strcmp(mime, "audio/eaacp") == 0 )
-				return "eaac+";
-			else if( strcmp(mime, "audio/amr") == 0 )
-				return "amr";
-			else if( strcmp(mime, "audio/mid") == 0 )
-				return "mid";
-			else if( strcmp(mime, "aaudio/mp2") == 0 )
-				return "mp2";
-			else if( strcmp(mime, "audio/aiff") == 0 )
-				return "aif";
-			else if( strcmp(mime, "audio/x-mpeg") == 0 )
-				return "mpega";
-			break;
-		case 'v':
-			if( strcmp(mime+6, "avi") == 0 )
-				return "avi";
-			else if( strcmp(mime+6, "divx") == 0 )
-				return "avi";
-			else if( strcmp(mime+6, "x-msvideo") == 0 )
-				return "avi";
-			else if( strcmp(mime+6, "mpeg") == 0 )
-				return "mpg";
-			else if( strcmp(mime+6, "mp4") == 0 )
-				return "mp4";
-			else if( strcmp(mime+6, "x-ms-wmv") == 0 )
-				return "wmv";
-			else if( strcmp(mime+6, "x-matroska") == 0 )
-				return "mkv";
-			else if( strcmp(mime+6, "x-mkv") == 0 )
-				return "mkv";
-			else if( strcmp(mime+6, "x-flv") == 0 )
-				return "flv";
-#ifdef BAIDU_DMS_OPT
-                        else if( strcmp(mime+6, "x-pn-realvideo") == 0)
-                            return "rm";
-                        else if( strcmp(mime+6, "x-rm") == 0 )
-                            return "rm";
-                        else if( strcmp(mime+6, "x-rmvb") == 0 )
-                            return "rmvb";
-                       else if( strcmp(mime, "application/x-shockwave-flash") == 0 )
-                            return "swf";
-                        else if( strcmp(mime+6, "swf") == 0 )
-                            return "swf";
-                        else if( strcmp(mime+6, "video/mpeg4") == 0 )
-                            return "mpeg4";
-                        else if( strcmp(mime+6, "video/x-ms-wmx") == 0 )
-                            return "wmx";
-                        else if( strcmp(mime+6, "application/vnd.rn-realmedia-vbr") == 0 )
-                            return "rmvb";
-                        else if( strcmp(mime+6, "video/x-ms-wm") == 0 )
-                            return "wm";
-                        else if( strcmp(mime+6, "video/mpg") == 0 )
-                            return "mpeg";
-                        else if( strcmp(mime+6, "video/mpg") == 0 )
-                            return "mpeg2";
-                        else if( strcmp(mime+6, "video/quicktime") == 0 )
-                             return "qt";
-                        else if( strcmp(mime+6, "application/x-ms-wmz") == 0 )
-                             return "wmz";
-                        else if( strcmp(mime+6, "application/x-ms-wmd") == 0 )
-                             return "wmd";
-                        else if( strcmp(mime+6, "video/mp4") == 0 )
-                             return "f4v";
-                        else if( strcmp(mime+6, "application/x-troll-ts") == 0 )
-                              return "ts";
+		if( mime_exts[i].prefix &&
+		    strncmp(mime, mime_exts[i].mime, strlen(mime_exts[i].mime)) == 0 )
+			ext = mime_exts[i].ext;
+	}
+	return ext ? ext : "dat";
+}
 
+/* Every file extension we classify, with the MIME type served for the
+ * document types.  Lookups go through a collision-free hash built once
+ * from this table, so classifying a name costs one hash and one compare. */
+static const struct {
+	const char *ext;
+	int class;
+	const char *mime;
+} media_exts[] = {
+	{ "mpg", EXT_VIDEO, NULL }, { "mpeg", EXT_VIDEO, NULL }, { "avi", EXT_VIDEO, NULL },
+	{ "divx", EXT_VIDEO, NULL }, { "wmv", EXT_VIDEO, NULL }, { "m4v", EXT_VIDEO, NULL },
+	{ "mts", EXT_VIDEO, NULL }, { "m2ts", EXT_VIDEO, NULL }, { "m2t", EXT_VIDEO, NULL },
+	{ "mkv", EXT_VIDEO, NULL }, { "vob", EXT_VIDEO, NULL }, { "ts", EXT_VIDEO, NULL },
+	{ "flv", EXT_VIDEO, NULL }, { "xvid", EXT_VIDEO, NULL }, { "mov", EXT_VIDEO, NULL },
+	{ "asf", EXT_VIDEO|EXT_AUDIO, NULL }, { "mp4", EXT_VIDEO|EXT_AUDIO, NULL },
+	{ "3gp", EXT_VIDEO|EXT_AUDIO, NULL },
+#ifdef BAIDU_DMS_OPT
+	{ "rm", EXT_VIDEO, NULL }, { "rmvb", EXT_VIDEO, NULL }, { "mpeg4", EXT_VIDEO, NULL },
+	{ "swf", EXT_VIDEO, NULL }, { "wmx", EXT_VIDEO, NULL }, { "wm", EXT_VIDEO, NULL },
+	{ "xv", EXT_VIDEO, NULL }, { "mpeg2", EXT_VIDEO, NULL }, { "mpga", EXT_VIDEO, NULL },
+	{ "qt", EXT_VIDEO, NULL }, { "wmz", EXT_VIDEO, NULL }, { "wmd", EXT_VIDEO, NULL },
+	{ "f4v", EXT_VIDEO, NULL }, { "wvx", EXT_VIDEO, NULL }, { "vod", EXT_VIDEO, NULL },
+	{ "webm", EXT_VIDEO, NULL }, { "3gp2", EXT_VIDEO, NULL }, { "3gpp", EXT_VIDEO, NULL },
+	{ "3g2", EXT_VIDEO, NULL },
 #endif
-                        else if( strcmp(mime+6, "vnd.dlna.mpeg-tts") == 0 )
-				return "mpg";
-			else if( strcmp(mime+6, "quicktime") == 0 )
-				return "mov";
-			else if( strcmp(mime+6, "3gpp") == 0 )
-				return "3gp";
-			else if( strncmp(mime+6, "x-tivo-mpeg", 11) == 0 )
-				return "TiVo";
-			break;
-		case 'i':
-			if( strcmp(mime+6, "jpeg") == 0 )
-				return "jpg";
-			else if( strcmp(mime+6, "png") == 0 )
-				return "png";
+#ifdef TIVO_SUPPORT
+	{ "tivo", EXT_VIDEO, NULL },
+#endif
+	{ "mp3", EXT_AUDIO, NULL }, { "flac", EXT_AUDIO, NULL }, { "wma", EXT_AUDIO, NULL },
+	{ "fla", EXT_AUDIO, NULL }, { "flc", EXT_AUDIO, NULL }, { "m4a", EXT_AUDIO, NULL },
+	{ "aac", EXT_AUDIO, NULL }, { "m4p", EXT_AUDIO, NULL }, { "pcm", EXT_AUDIO, NULL },
+	{ "wav", EXT_AUDIO, NULL }, { "ogg", EXT_AUDIO, NULL },
 #ifdef BAIDU_DMS_OPT
-			else if( strcmp(mime+6, "gif") == 0)
-				return "gif";
-			else if( strcmp(mime+6, "png") == 0)
-				return "png";
-			else if( strcmp(mime+6, "ico") == 0)
-				return "ico";
-			else if( strcmp(mime+6, "pcb") == 0)
-				return "pcb";
-			else if( strcmp(mime+6, "pnm") == 0)
-				return "pnm";
-			else if( strcmp(mime+6, "ppm") == 0)
-				return "ppm";
-			else if( strcmp(mime+6, "qti") == 0)
-				return "qti";
-			else if( strcmp(mime+6, "qtf") == 0)
-				return "qtf";
-			else if( strcmp(mime+6, "qtif") == 0)
-				return "qtif";
-			else if( strcmp(mime+6, "tif") == 0)
-				return "tif";
-			else if( strcmp(mime+6, "tiff") == 0)
-				return "tiff";
+	{ "ra", EXT_AUDIO, NULL }, { "aac+", EXT_AUDIO, NULL }, { "eaac+", EXT_AUDIO, NULL },
+	{ "amr", EXT_AUDIO, NULL }, { "mid", EXT_AUDIO, NULL }, { "midi", EXT_AUDIO, NULL },
+	{ "mp2", EXT_AUDIO, NULL }, { "aif", EXT_AUDIO, NULL }, { "mpega", EXT_AUDIO, NULL },
+	{ "ram", EXT_AUDIO, NULL }, { "cue", EXT_AUDIO, NULL }, { "dts", EXT_AUDIO, NULL },
+	{ "ape", EXT_AUDIO, NULL }, { "mp", EXT_AUDIO, NULL }, { "mka", EXT_AUDIO, NULL },
 #endif
+	{ "jpg", EXT_IMAGE, NULL }, { "jpeg", EXT_IMAGE, NULL },
+#ifdef BAIDU_DMS_OPT
+	{ "png", EXT_IMAGE, NULL }, { "gif", EXT_IMAGE, NULL }, { "ico", EXT_IMAGE, NULL },
+	{ "ief", EXT_IMAGE, NULL }, { "ifm", EXT_IMAGE, NULL }, { "ifs", EXT_IMAGE, NULL },
+	{ "ppm", EXT_IMAGE, NULL }, { "qtif", EXT_IMAGE, NULL }, { "tif", EXT_IMAGE, NULL },
+	{ "tiff", EXT_IMAGE, NULL }, { "pcd", EXT_IMAGE, NULL }, { "qti", EXT_IMAGE, NULL },
+	{ "qtf", EXT_IMAGE, NULL }, { "pnm", EXT_IMAGE, NULL }, { "bmp", EXT_IMAGE, NULL },
+	{ "psd", EXT_IMAGE, NULL }, { "svg", EXT_IMAGE, NULL }, { "svgz", EXT_IMAGE, NULL },
+	{ "apng", EXT_IMAGE, NULL }, { "ai", EXT_IMAGE, NULL }, { "cur", EXT_IMAGE, NULL },
+	{ "jpe", EXT_IMAGE, NULL }, { "heic", EXT_IMAGE, NULL }, { "heif", EXT_IMAGE, NULL },
+#endif
+	{ "m3u", EXT_PLAYLIST, NULL }, { "pls", EXT_PLAYLIST, NULL },
+#ifdef NAS
+	{ "txt", EXT_TEXT, "text/plain" },
+	{ "pdf", EXT_TEXT, "application/pdf" },
+	{ "umd", EXT_TEXT, "application/umd" },
+	{ "epub", EXT_TEXT, "application/epub+zip" },
+	{ "doc", EXT_TEXT, "application/msword" },
+	{ "dot", EXT_TEXT, "application/msword" },
+	{ "xls", EXT_TEXT, "application/vnd.ms-excel" },
+	{ "ppt", EXT_TEXT, "application/vnd.ms-powerpoint" },
+	{ "docx", EXT_TEXT, "application/vnd.openxmlformats-officedocument.wordprocessingml.document" },
+	{ "xlsx", EXT_TEXT, "application/vnd.openxmlformats-officedocument.spreadsheetml.sheet" },
+	{ "pptx", EXT_TEXT, "application/vnd.openxmlformats-officedocument.presentationml.presentation" },
+	{ "chm", EXT_TEXT, "application/mshelp" },
+	{ "rtf", EXT_TEXT, "application/rtf" },
+	{ "html", EXT_TEXT, "text/html" }, { "dotx", EXT_TEXT, "text/html" },
+	{ "odm", EXT_TEXT, "text/html" }, { "ots", EXT_TEXT, "text/html" },
+	{ "ods", EXT_TEXT, "text/html" }, { "xlt", EXT_TEXT, "text/html" },
+	{ "csv", EXT_TEXT, "text/html" }, { "pps", EXT_TEXT, "text/html" },
+	{ "ppsx", EXT_TEXT, "text/html" }, { "potx", EXT_TEXT, "text/html" },
+	{ "vsd", EXT_TEXT, NULL }, { "htm", EXT_TEXT, NULL },
+	{ "xml", EXT_TEXT, NULL }, { "xhtml", EXT_TEXT, NULL },
+	{ "vcf", EXT_TEXT, NULL }, { "vsdx", EXT_TEXT, NULL },
+	{ "mpp", EXT_TEXT, NULL }, { "mppx", EXT_TEXT, NULL },
+	{ "mpt", EXT_TEXT, NULL }, { "accd", EXT_TEXT, NULL },
+	{ "xps", EXT_TEXT, NULL },
+	/* MIME types known for names is_text() doesn't accept */
+	{ "odt", 0, "text/html" }, { "xltx", 0, "text/html" },
+	{ "apk", EXT_APP, "application/vnd.android.package-archive" },
+	{ "exe", EXT_APP, "application/octet-stream" },
+	{ "msi", EXT_APP, "application/octet-stream" },
+	{ "deb", EXT_APP, "application/x-debian-package-archive" },
+	{ "ipa", EXT_APP, "application/iphone-package-archive" },
+	{ "px", EXT_APP, "application/x-ipix" },
+#endif
+};
+#define N_MEDIA_EXTS	(sizeof(media_exts)/sizeof(media_exts[0]))
+
+#define EXT_HASH_BITS	12
+#define EXT_HASH_SIZE	(1 << EXT_HASH_BITS)
+#define EXT_MAX_LEN	8
+static unsigned short ext_hash[EXT_HASH_SIZE];	/* media_exts index + 1 */
+static unsigned int ext_seed;
+static int ext_probe = 0;	/* only if no perfect seed was found */
+static volatile int ext_hash_ready = 0;
+
+static inline unsigned int
+ext_hash_fn(const char *ext, unsigned int seed)
+{
+	unsigned int h = 5381 + seed;
+
+	while( *ext )
+		h = ((h << 5) + h) ^ (unsigned char)*ext++;
+	h ^= h >> 15;
+	h *= 0x2c1b3c6d;
+	h ^= h >> 12;
+	return h & (EXT_HASH_SIZE-1);
+}
+
+/* Try seeds until every extension lands in its own slot.  With a table
+ * this sparse that takes a handful of attempts; linear probing is only
+ * kept as a fallback should the table ever outgrow it. */
+void
+init_media_exts(void)
+{
+	unsigned int i, h, seed;
+
+	if( ext_hash_ready )
+		return;
+	for( seed = 0; seed < 4096; seed++ )
+	{
+		memset(ext_hash, 0, sizeof(ext_hash));
+		for( i = 0; i < N_MEDIA_EXTS; i++ )
+		{
+			h = ext_hash_fn(media_exts[i].ext, seed);
+			if( ext_hash[h] )
+				break;
+			ext_hash[h] = i + 1;
+		}
+		if( i == N_MEDIA_EXTS )
 			break;
-		default:
+	}
+	if( seed == 4096 )
+	{
+		seed = 0;
+		ext_probe = 1;
+		memset(ext_hash, 0, sizeof(ext_hash));
+		for( i = 0; i < N_MEDIA_EXTS; i++ )
+		{
+			h = ext_hash_fn(media_exts[i].ext, seed);
+			while( ext_hash[h] )
+				h = (h + 1) & (EXT_HASH_SIZE-1);
+			ext_hash[h] = i + 1;
+		}
+	}
+	ext_seed = seed;
+	ext_hash_ready = 1;
+}
+
+/* Returns the media_exts index for the extension of a file name or path,
+ * matched case-insensitively like ends_with(), or -1. */
+static int
+media_ext_lookup(const char *file)
+{
+	char ext[EXT_MAX_LEN+1];
+	const char *dot;
+	unsigned int h, len;
+
+	dot = strrchr(file, '.');
+	if( !dot )
+		return -1;
+	for( len = 0; dot[len+1]; len++ )
+	{
+		if( len == EXT_MAX_LEN || dot[len+1] == '/' )
+			return -1;
+		ext[len] = tolower((unsigned char)dot[len+1]);
+	}
+	ext[len] = '\0';
+
+	if( !ext_hash_ready )
+		init_media_exts();
+	h = ext_hash_fn(ext, ext_seed);
+	while( ext_hash[h] )
+	{
+		if( strcmp(media_exts[ext_hash[h]-1].ext, ext) == 0 )
+			return ext_hash[h] - 1;
+		if( !ext_probe )
 			break;
+		h = (h + 1) & (EXT_HASH_SIZE-1);
 	}
-	return "dat";
+	return -1;
+}
+
+int
+media_ext_class(const char *file)
+{
+	int i = media_ext_lookup(file);
+
+	return (i < 0) ? 0 : media_exts[i].class;
 }
 
 int
 is_video(const char * file)
 {
-	return (ends_with(file, ".mpg") || ends_with(file, ".mpeg")  ||
-		ends_with(file, ".avi") || ends_with(file, ".divx")  ||
-		ends_with(file, ".asf") || ends_with(file, ".wmv")   ||
-		ends_with(file, ".mp4") || ends_with(file, ".m4v")   ||
-		ends_with(file, ".mts") || ends_with(file, ".m2ts")  ||
-		ends_with(file, ".m2t") || ends_with(file, ".mkv")   ||
-		ends_with(file, ".vob") || ends_with(file, ".ts")    ||
-		ends_with(file, ".flv") || ends_with(file, ".xvid")  ||
-#ifdef BAIDU_DMS_OPT
-		ends_with(file, ".rm")  || ends_with(file, ".rmvb")  ||
-		ends_with(file, ".mpeg4")  || ends_with(file, ".swf")  ||
-		ends_with(file, ".wmx")  || ends_with(file, ".wm")  ||
-		ends_with(file, ".xv")  || ends_with(file, ".mpeg2")  ||
-		ends_with(file, ".mpga")  || ends_with(file, ".qt")  ||
-		ends_with(file, ".wmz")  || ends_with(file, ".wmd")  ||
-		ends_with(file, ".wmd")  || ends_with(file, ".f4v")  ||
-		ends_with(file, ".ts")  || ends_with(file, ".wvx")  ||
-		ends_with(file, ".vod")  || ends_with(file, ".webm")  ||
-		ends_with(file, ".mts")  || ends_with(file, ".m2ts")  ||
-		ends_with(file, ".3gp2")  || ends_with(file, ".3gpp")  ||
-		ends_with(file, ".3g2")  || ends_with(file, ".divx")  ||
-#endif
-#ifdef TIVO_SUPPORT
-		ends_with(file, ".TiVo") ||
-#endif
-		ends_with(file, ".mov") || ends_with(file, ".3gp"));
+	return (media_ext_class(file) & EXT_VIDEO) ? 1 : 0;
 }
 
 int
 is_audio(const char * file)
 {
-	return (ends_with(file, ".mp3") || ends_with(file, ".flac") ||
-		ends_with(file, ".wma") || ends_with(file, ".asf")  ||
-		ends_with(file, ".fla") || ends_with(file, ".flc")  ||
-		ends_with(file, ".m4a") || ends_with(file, ".aac")  ||
-		ends_with(file, ".mp4") || ends_with(file, ".m4p")  ||
-		ends_with(file, ".pcm") || ends_with(file, ".3gp")  ||
-#ifdef BAIDU_DMS_OPT
-		ends_with(file, ".ra")  || ends_with(file, ".aac+") ||
-		ends_with(file, ".eaac+")|| ends_with(file, ".amr") ||
-		ends_with(file, ".mid") || ends_with(file, ".midi") ||
-		ends_with(file, ".mp2") || ends_with(file, ".aif")  ||
-		ends_with(file, ".mpega") || ends_with(file, ".ram")||
-		ends_with(file, ".cue") || ends_with(file, ".dts")||
-		ends_with(file, ".ape") || ends_with(file, ".mp")||
-		ends_with(file, ".mka") ||
-#endif
-		ends_with(file, ".wav") || ends_with(file, ".ogg"));
+	return (media_ext_class(file) & EXT_AUDIO) ? 1 : 0;
 }
 
 int
 is_image(const char * file)
 {
-#ifdef BAIDU_DMS_OPT
-	return (ends_with(file, ".jpg") || ends_with(file, ".jpeg") ||
-			ends_with(file, ".png") || ends_with(file,".gif")  ||
-			ends_with(file, ".ico") || ends_with(file,".ief")  ||
-			ends_with(file, ".ifm") || ends_with(file,".ifs")  ||
-			ends_with(file, ".ppm") || ends_with(file,".qtif") ||
-			ends_with(file, ".tif") || ends_with(file,".tiff") ||
-			ends_with(file, ".pcd") || ends_with(file,".qti")  ||
-			ends_with(file, ".qtf") || ends_with(file,".pnm")  ||
-			ends_with(file, ".bmp") || ends_with(file, ".psd") ||
-			ends_with(file, ".svg") || ends_with(file,".svgz") ||
-			ends_with(file, ".apng") || ends_with(file,".ai") ||
-			ends_with(file, ".cur") || ends_with(file,".jpe"));
-#else
-	return (ends_with(file, ".jpg") || ends_with(file, ".jpeg"));
-#endif
+	return (media_ext_class(file) & EXT_IMAGE) ? 1 : 0;
 }
+
 #ifdef NAS
 int
 is_text(const char * file)
 {
-
-	return (ends_with(file, ".txt") || ends_with(file, ".pdf") ||
-			ends_with(file, ".umd") || ends_with(file,".epub")  ||
-			ends_with(file, ".doc") || ends_with(file,".xls")  ||
-			ends_with(file, ".ppt") || ends_with(file,".docx")  ||
-			ends_with(file, ".xlsx") || ends_with(file,".pptx") ||
-			ends_with(file, ".dot") || ends_with(file,".dotx") ||
-			ends_with(file, ".odm") || ends_with(file,".ots") ||
-			ends_with(file, ".ods") || ends_with(file,".rtf") ||
-			ends_with(file, ".xlt") || ends_with(file,".csv") ||
-			ends_with(file, ".pps") || ends_with(file,".ppsx") ||
-			ends_with(file, ".potx") || ends_with(file,".vsd") ||
-			ends_with(file, ".htm") || ends_with(file,".xml") ||
-			ends_with(file, ".xhtml") || ends_with(file,".vcf") ||
-			ends_with(file, ".vsdx") || ends_with(file,".mpp") ||
-			ends_with(file, ".mppx") || ends_with(file,".mpt") ||
-			ends_with(file, ".accd") || ends_with(file,".xps") ||
-			ends_with(file, ".chm") || ends_with(file,".html"));
+	return (media_ext_class(file) & EXT_TEXT) ? 1 : 0;
 }
+
 int
 is_application(const char * file)
 {
-
-	return (ends_with(file, ".apk") || ends_with(file, ".exe") ||
-			ends_with(file, ".ipa") || ends_with(file, ".px") ||
-			ends_with(file, ".deb") ||ends_with(file, ".msi"));
+	return (media_ext_class(file) & EXT_APP) ? 1 : 0;
 }
-#endif
 
-#ifdef NAS
 char* getTextmime(char *name)
 {
-	char *mime;
-	if( ends_with(name, ".txt") )
-	{
-		mime = strdup("text/plain");
-	}
-	else if(ends_with(name, ".pdf") )
-	{
-		mime = strdup("application/pdf");
-	}
-	else if( ends_with(name, ".umd") )
-	{
-		mime = strdup("application/umd");
-	}
-	else if( ends_with(name, ".epub") )
-	{
-		mime = strdup("application/epub+zip");
-	}
-	else if(ends_with(name, ".doc") )
-	{
-		mime = strdup("application/msword");
-	}
-	else if( ends_with(name, ".xls") )
-	{
-		mime = strdup("application/vnd.ms-excel");
-	}
-	else if( ends_with(name, ".ppt") )
-	{
-		mime = strdup("application/vnd.ms-powerpoint");
-	}
-	else if(ends_with(name, ".docx") )
-	{
-		mime = strdup("application/vnd.openxmlformats-officedocument.wordprocessingml.document");
-	}
-	else if( ends_with(name, ".xlsx") )
-	{
-		mime = strdup("application/vnd.openxmlformats-officedocument.spreadsheetml.sheet");
-	}
-	else if( ends_with(name, ".pptx") )
-	{
-		mime = strdup("application/vnd.openxmlformats-officedocument.presentationml.presentation");
-	}
-	else if( ends_with(name, ".chm") )
-	{
-		mime = strdup("application/mshelp");
-	}
-	else if(ends_with(name, ".html") )
-	{
-		mime = strdup("text/html");
-	}
-	else if(ends_with(name, ".dot") )
-	{
-		mime = strdup("application/msword");
-	}
-	else if(ends_with(name, ".dotx") )
-	{
-		mime = strdup("text/html");
-	}
-	else if(ends_with(name, ".odm") )
-	{
-		mime = strdup("text/html");
-	}
-	else if(ends_with(name, ".ots") )
-	{
-		mime = strdup("text/html");
-	}
-	else if(ends_with(name, ".ods") )
-	{
-		mime = strdup("text/html");
-	}
-	else if(ends_with(name, ".odt") )
-	{
-		mime = strdup("text/html");
-	}
-	else if(ends_with(name, ".rtf") )
-	{
-		mime = strdup("application/rtf");
-	}
-	else if(ends_with(name, ".xlt") )
-	{
-		mime = strdup("text/html");
-	}
-	else if(ends_with(name, ".xltx") )
-	{
-		mime = strdup("text/html");
-	}
-	else if(ends_with(name, ".csv") )
-	{
-		mime = strdup("text/html");
-	}
-	else if(ends_with(name, ".pps") )
-	{
-		mime = strdup("text/html");
-	}
-	else if(ends_with(name, ".ppsx") )
-	{
-		mime = strdup("text/html");
-	}
-	else if(ends_with(name, ".potx") )
-	{
-		mime = strdup("text/html");
-	}
-	return mime;
+	int i = media_ext_lookup(name);
+
+	if( i < 0 || !media_exts[i].mime || (media_exts[i].class & EXT_APP) )
+		return strdup("other");
+	return strdup(media_exts[i].mime);
 }
 
 char* getAppmime(char *name)
 {
-	char *mime;
-	if( ends_with(name, ".apk") )
-	{
-		mime = strdup("application/vnd.android.package-archive");
-	}
-	else if(ends_with(name, ".exe") )
-	{
-		mime = strdup("application/octet-stream");
-	}
-	else if( ends_with(name, ".msi") )
-	{
-		mime = strdup("application/octet-stream");
-	}
-	else if( ends_with(name, ".deb") )
-	{
-		mime = strdup("application/x-debian-package-archive");
-	}
-	else if( ends_with(name, ".ipa") )
-	{
-		mime = strdup("application/iphone-package-archive");
-	}
-	else if( ends_with(name, ".px") )
-	{
-		mime = strdup("application/x-ipix");
-	}
-	else
-	{
-		mime = strdup("other");
-	}
-	return mime;
+	int i = media_ext_lookup(name);
+
+	if( i < 0 || !(media_exts[i].class & EXT_APP) )
+		return strdup("other");
+	return strdup(media_exts[i].mime);
 }
 #endif
 
 int
 is_playlist(const char * file)
 {
-	return (ends_with(file, ".m3u") || ends_with(file, ".pls"));
+	return (media_ext_class(file) & EXT_PLAYLIST) ? 1 : 0;
 }
 
 int
@@ -34,6 +34,7 @@ void get_local_ip(char *interface, char *result, int n_result);
 
 /* String functions */
 int strcatf(struct string_s *str, char *fmt, ...);
+void strcatn(struct string_s *str, const char *src, int len);
 void strncpyt(char *dst, const char *src, size_t len);
 inline int xasprintf(char **strp, char *fmt, ...);
 int ends_with(const char * haystack, const char * needle);
@@ -42,10 +43,16 @@ char *strstrc(const char *s, const char *p, const char t);
 char *strcasestrc(const char *s, const char *p, const char t);
 char *modifyString(char * string, const char * before, const char * after);
 char *escape_tag(const char *tag, int force_alloc);
+size_t xml_escaped_len(const char *src, size_t len, int twice);
+char *xml_escape(char *dst, const char *src, size_t len, int twice);
 char *unescape_tag(const char *tag, int force_alloc);
 void strip_ext(char * name);
+int intern_id(const char *str);
+const char *intern_str(int id);
 
 /* Metadata functions */
+void init_media_exts(void);
+int media_ext_class(const char *file);
 int is_video(const char * file);
 int is_audio(const char * file);
 int is_image(const char * file);